@@ -0,0 +1,3 @@
+#pragma once
+// code and data placement of the target, without meaning on the host
+#define IRAM_ATTR
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_NOT_FINISHED 0x10C
+#define ESP_ERR_MESH_BASE 0x4000
+#define ESP_ERR_MESH_WIFI_NOT_START (ESP_ERR_MESH_BASE + 1)
+#define ESP_ERR_MESH_NOT_INIT (ESP_ERR_MESH_BASE + 2)
+#define ESP_ERR_MESH_NOT_CONFIG (ESP_ERR_MESH_BASE + 3)
+#define ESP_ERR_MESH_NOT_START (ESP_ERR_MESH_BASE + 4)
+#define ESP_ERR_MESH_NOT_SUPPORT (ESP_ERR_MESH_BASE + 5)
+#define ESP_ERR_MESH_NOT_ALLOWED (ESP_ERR_MESH_BASE + 6)
+#define ESP_ERR_MESH_NO_MEMORY (ESP_ERR_MESH_BASE + 7)
+#define ESP_ERR_MESH_ARGUMENT (ESP_ERR_MESH_BASE + 8)
+#define ESP_ERR_MESH_EXCEED_MTU (ESP_ERR_MESH_BASE + 9)
+#define ESP_ERR_MESH_TIMEOUT (ESP_ERR_MESH_BASE + 10)
+#define ESP_ERR_MESH_DISCONNECTED (ESP_ERR_MESH_BASE + 11)
+#define ESP_ERR_MESH_QUEUE_FAIL (ESP_ERR_MESH_BASE + 12)
+#define ESP_ERR_MESH_QUEUE_FULL (ESP_ERR_MESH_BASE + 13)
+#define ESP_ERR_MESH_NO_PARENT_FOUND (ESP_ERR_MESH_BASE + 14)
+#define ESP_ERR_MESH_NO_ROUTE_FOUND (ESP_ERR_MESH_BASE + 15)
+#define ESP_ERR_MESH_OPTION_NULL (ESP_ERR_MESH_BASE + 16)
+#define ESP_ERR_MESH_OPTION_UNKNOWN (ESP_ERR_MESH_BASE + 17)
+#define ESP_ERR_MESH_XON_NO_WINDOW (ESP_ERR_MESH_BASE + 18)
+#define ESP_ERR_MESH_INTERFACE (ESP_ERR_MESH_BASE + 19)
+#define ESP_ERR_MESH_DISCARD_DUPLICATE (ESP_ERR_MESH_BASE + 20)
+#define ESP_ERR_MESH_DISCARD (ESP_ERR_MESH_BASE + 21)
+#define ESP_ERR_MESH_VOTING (ESP_ERR_MESH_BASE + 22)
+const char* esp_err_to_name(esp_err_t code);
+void _esp_error_check_failed(esp_err_t rc, const char* file, int line, const char* function, const char* expression);
+#define ESP_ERROR_CHECK(x) do { esp_err_t err_rc_ = (x); if (err_rc_ != ESP_OK) { _esp_error_check_failed(err_rc_, __FILE__, __LINE__, __func__, #x); } } while (0)
@@ -0,0 +1,120 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_wifi.h"
+#include "esp_wifi_types.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include "esp_system.h"
+
+#define MESH_ROOT_LAYER (1)
+#define MESH_MTU (1500)
+#define MESH_MPS (1472)
+#define MESH_DATA_ENC (0x01)
+#define MESH_DATA_P2P (0x02)
+#define MESH_DATA_FROMDS (0x04)
+#define MESH_DATA_TODS (0x08)
+#define MESH_DATA_NONBLOCK (0x10)
+#define MESH_DATA_DROP (0x20)
+#define MESH_DATA_GROUP (0x40)
+#define MESH_OPT_SEND_GROUP (7)
+#define MESH_OPT_RECV_DS_ADDR (8)
+#define MESH_ASSOC_FLAG_VOTE_IN_PROGRESS (0x02)
+
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+
+ESP_EVENT_DECLARE_BASE(MESH_EVENT);
+
+typedef enum {
+    MESH_EVENT_STARTED, MESH_EVENT_STOPPED, MESH_EVENT_CHANNEL_SWITCH, MESH_EVENT_CHILD_CONNECTED,
+    MESH_EVENT_CHILD_DISCONNECTED, MESH_EVENT_ROUTING_TABLE_ADD, MESH_EVENT_ROUTING_TABLE_REMOVE,
+    MESH_EVENT_PARENT_CONNECTED, MESH_EVENT_PARENT_DISCONNECTED, MESH_EVENT_NO_PARENT_FOUND,
+    MESH_EVENT_LAYER_CHANGE, MESH_EVENT_TODS_STATE, MESH_EVENT_VOTE_STARTED, MESH_EVENT_VOTE_STOPPED,
+    MESH_EVENT_ROOT_ADDRESS, MESH_EVENT_ROOT_SWITCH_REQ, MESH_EVENT_ROOT_SWITCH_ACK, MESH_EVENT_ROOT_ASKED_YIELD,
+    MESH_EVENT_ROOT_FIXED, MESH_EVENT_SCAN_DONE, MESH_EVENT_NETWORK_STATE, MESH_EVENT_STOP_RECONNECTION,
+    MESH_EVENT_FIND_NETWORK, MESH_EVENT_ROUTER_SWITCH, MESH_EVENT_PS_PARENT_DUTY, MESH_EVENT_PS_CHILD_DUTY,
+    MESH_EVENT_MAX,
+} mesh_event_id_t;
+
+typedef enum { MESH_PROTO_BIN, MESH_PROTO_HTTP, MESH_PROTO_JSON, MESH_PROTO_MQTT, MESH_PROTO_AP, MESH_PROTO_STA } mesh_proto_t;
+typedef enum { MESH_TOS_P2P, MESH_TOS_E2E, MESH_TOS_DEF } mesh_tos_t;
+typedef enum { MESH_IDLE, MESH_ROOT, MESH_NODE, MESH_LEAF, MESH_STA } mesh_type_t;
+typedef enum { MESH_VOTE_REASON_ROOT_INITIATED = 1, MESH_VOTE_REASON_CHILD_INITIATED } mesh_vote_reason_t;
+typedef enum { MESH_TODS_UNREACHABLE, MESH_TODS_REACHABLE } mesh_event_toDS_state_t;
+
+typedef struct { esp_ip4_addr_t ip4; uint16_t port; } __attribute__((packed)) mip_t;
+typedef union { uint8_t addr[6]; mip_t mip; } mesh_addr_t;
+
+typedef struct { uint8_t* data; uint16_t size; mesh_proto_t proto; mesh_tos_t tos; } mesh_data_t;
+typedef struct { uint8_t type; uint16_t len; uint8_t* val; } __attribute__((packed)) mesh_opt_t;
+
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t password[64]; bool allow_router_switch; } mesh_router_t;
+typedef struct { uint8_t password[64]; uint8_t max_connection; uint8_t nonmesh_max_connection; } mesh_ap_cfg_t;
+typedef struct { void* dummy; } mesh_crypto_funcs_t;
+extern const mesh_crypto_funcs_t g_wifi_default_mesh_crypto_funcs;
+typedef struct { uint8_t channel; bool allow_channel_switch; mesh_addr_t mesh_id; mesh_router_t router; mesh_ap_cfg_t mesh_ap; const mesh_crypto_funcs_t* crypto_funcs; } mesh_cfg_t;
+#define MESH_INIT_CONFIG_DEFAULT() { .crypto_funcs = &g_wifi_default_mesh_crypto_funcs, }
+
+typedef struct { int to_parent; int to_parent_p2p; int to_child; int to_child_p2p; int mgmt; int broadcast; } mesh_tx_pending_t;
+typedef struct { int toDS; int toSelf; } mesh_rx_pending_t;
+
+typedef struct { uint8_t channel; } mesh_event_channel_switch_t;
+typedef struct { uint8_t mac[6]; uint8_t aid; } mesh_event_child_connected_t;
+typedef mesh_event_child_connected_t mesh_event_child_disconnected_t;
+typedef struct { uint16_t rt_size_new; uint16_t rt_size_change; } mesh_event_routing_table_change_t;
+typedef struct { wifi_event_sta_connected_t connected; uint16_t self_layer; uint8_t duty; } mesh_event_connected_t;
+typedef wifi_event_sta_disconnected_t mesh_event_disconnected_t;
+typedef struct { int scan_times; } mesh_event_no_parent_found_t;
+typedef struct { uint16_t new_layer; } mesh_event_layer_change_t;
+typedef mesh_addr_t mesh_event_root_address_t;
+typedef struct { int reason; int attempts; mesh_addr_t rc_addr; } mesh_event_vote_started_t;
+typedef struct { int reason; mesh_addr_t rc_addr; } mesh_event_root_switch_req_t;
+typedef struct { uint8_t addr[6]; int8_t rssi; int capacity; } mesh_event_root_conflict_t;
+typedef struct { bool is_fixed; } mesh_event_root_fixed_t;
+typedef struct { uint8_t number; } mesh_event_scan_done_t;
+typedef struct { bool is_rootless; } mesh_event_network_state_t;
+typedef struct { uint8_t channel; uint8_t router_bssid[6]; } mesh_event_find_network_t;
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t channel; } mesh_event_router_switch_t;
+
+esp_err_t esp_mesh_init(void);
+esp_err_t esp_mesh_deinit(void);
+esp_err_t esp_mesh_start(void);
+esp_err_t esp_mesh_stop(void);
+esp_err_t esp_mesh_send(const mesh_addr_t* to, const mesh_data_t* data, int flag, const mesh_opt_t opt[], int opt_count);
+esp_err_t esp_mesh_recv(mesh_addr_t* from, mesh_data_t* data, int timeout_ms, int* flag, mesh_opt_t opt[], int opt_count);
+esp_err_t esp_mesh_set_config(const mesh_cfg_t* config);
+esp_err_t esp_mesh_get_config(mesh_cfg_t* config);
+esp_err_t esp_mesh_set_max_layer(int max_layer);
+int esp_mesh_get_max_layer(void);
+esp_err_t esp_mesh_set_vote_percentage(float percentage);
+esp_err_t esp_mesh_set_ap_assoc_expire(int seconds);
+esp_err_t esp_mesh_set_ap_authmode(wifi_auth_mode_t authmode);
+esp_err_t esp_mesh_get_id(mesh_addr_t* id);
+int esp_mesh_get_layer(void);
+bool esp_mesh_is_root(void);
+esp_err_t esp_mesh_post_toDS_state(bool reachable);
+bool esp_mesh_is_root_fixed(void);
+esp_err_t esp_mesh_fix_root(bool enable);
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t* bssid);
+mesh_type_t esp_mesh_get_type(void);
+esp_err_t esp_mesh_get_routing_table(mesh_addr_t* mac, int len, int* size);
+int esp_mesh_get_routing_table_size(void);
+int esp_mesh_get_total_node_num(void);
+esp_err_t esp_mesh_set_group_id(const mesh_addr_t* addr, int num);
+esp_err_t esp_mesh_delete_group_id(const mesh_addr_t* addr, int num);
+int esp_mesh_get_group_num(void);
+esp_err_t esp_mesh_get_group_list(mesh_addr_t* addr, int num);
+bool esp_mesh_is_my_group(const mesh_addr_t* addr);
+esp_err_t esp_mesh_get_tx_pending(mesh_tx_pending_t* pending);
+esp_err_t esp_mesh_get_rx_pending(mesh_rx_pending_t* pending);
+esp_err_t esp_mesh_set_xon_qsize(int qsize);
+int esp_mesh_get_xon_qsize(void);
+esp_err_t esp_mesh_set_parent(const wifi_config_t* parent, const mesh_addr_t* parent_mesh_id, mesh_type_t my_type, int my_layer);
+esp_err_t esp_mesh_set_self_organized(bool enable, bool select_parent);
+bool esp_mesh_get_self_organized(void);
+esp_err_t esp_mesh_connect(void);
+esp_err_t esp_mesh_disconnect(void);
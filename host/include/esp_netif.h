@@ -0,0 +1,92 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif_ip_addr.h"
+typedef struct esp_netif_obj esp_netif_t;
+typedef void* esp_netif_iodriver_handle;
+typedef struct esp_netif_driver_base_s {
+    esp_err_t (*post_attach)(esp_netif_t* netif, esp_netif_iodriver_handle h);
+    esp_netif_t* netif;
+} esp_netif_driver_base_t;
+typedef struct esp_netif_driver_ifconfig {
+    esp_netif_iodriver_handle handle;
+    esp_err_t (*transmit)(void* h, void* buffer, size_t len);
+    esp_err_t (*transmit_wrap)(void* h, void* buffer, size_t len, void* netstack_buffer);
+    void (*driver_free_rx_buffer)(void* h, void* buffer);
+} esp_netif_driver_ifconfig_t;
+typedef struct { esp_ip4_addr_t ip; esp_ip4_addr_t netmask; esp_ip4_addr_t gw; } esp_netif_ip_info_t;
+typedef enum { ESP_NETIF_DHCP_SERVER = 1, ESP_NETIF_DHCP_CLIENT = 2, ESP_NETIF_FLAG_GARP = 8, ESP_NETIF_FLAG_EVENT_IP_MODIFIED = 16, ESP_NETIF_FLAG_AUTOUP = 64 } esp_netif_flags_t;
+typedef struct esp_netif_inherent_config {
+    esp_netif_flags_t flags;
+    uint8_t mac[6];
+    const esp_netif_ip_info_t* ip_info;
+    uint32_t get_ip_event;
+    uint32_t lost_ip_event;
+    const char* if_key;
+    const char* if_desc;
+    int route_prio;
+} esp_netif_inherent_config_t;
+typedef struct esp_netif_netstack_config esp_netif_netstack_config_t;
+typedef struct esp_netif_driver_base_s* esp_netif_driver_config_ptr_t;
+typedef struct esp_netif_config {
+    const esp_netif_inherent_config_t* base;
+    const void* driver;
+    const esp_netif_netstack_config_t* stack;
+} esp_netif_config_t;
+typedef struct { esp_ip_addr_t ip; } esp_netif_dns_info_t;
+typedef enum { ESP_NETIF_DNS_MAIN = 0, ESP_NETIF_DNS_BACKUP, ESP_NETIF_DNS_FALLBACK, ESP_NETIF_DNS_MAX } esp_netif_dns_type_t;
+typedef enum { ESP_NETIF_OP_START = 0, ESP_NETIF_OP_SET, ESP_NETIF_OP_GET, ESP_NETIF_OP_MAX } esp_netif_dhcp_option_mode_t;
+typedef enum { ESP_NETIF_SUBNET_MASK = 1, ESP_NETIF_DOMAIN_NAME_SERVER = 6, ESP_NETIF_ROUTER_SOLICITATION_ADDRESS = 32, ESP_NETIF_REQUESTED_IP_ADDRESS = 50, ESP_NETIF_IP_ADDRESS_LEASE_TIME = 51, ESP_NETIF_IP_REQUEST_RETRY_TIME = 52 } esp_netif_dhcp_option_id_t;
+typedef enum { ESP_NETIF_DHCP_INIT = 0, ESP_NETIF_DHCP_STARTED, ESP_NETIF_DHCP_STOPPED, ESP_NETIF_DHCP_STATUS_MAX } esp_netif_dhcp_status_t;
+#define OFFER_START 0x00
+#define OFFER_ROUTER 0x01
+#define OFFER_DNS 0x02
+#define OFFER_END 0x03
+typedef uint8_t dhcps_offer_t;
+typedef struct { bool enable; esp_ip4_addr_t start_ip; esp_ip4_addr_t end_ip; } dhcps_lease_t;
+extern const esp_netif_netstack_config_t* _g_esp_netif_netstack_default_wifi_sta;
+extern const esp_netif_netstack_config_t* _g_esp_netif_netstack_default_wifi_ap;
+extern const esp_netif_inherent_config_t _g_esp_netif_inherent_sta_config;
+extern const esp_netif_inherent_config_t _g_esp_netif_inherent_ap_config;
+#define ESP_NETIF_NETSTACK_DEFAULT_WIFI_STA _g_esp_netif_netstack_default_wifi_sta
+#define ESP_NETIF_NETSTACK_DEFAULT_WIFI_AP _g_esp_netif_netstack_default_wifi_ap
+#define ESP_NETIF_INHERENT_DEFAULT_WIFI_STA() _g_esp_netif_inherent_sta_config
+#define ESP_NETIF_INHERENT_DEFAULT_WIFI_AP() _g_esp_netif_inherent_ap_config
+#define ESP_NETIF_DEFAULT_WIFI_STA() { .base = &_g_esp_netif_inherent_sta_config, .driver = NULL, .stack = _g_esp_netif_netstack_default_wifi_sta }
+#define ESP_NETIF_DEFAULT_WIFI_AP() { .base = &_g_esp_netif_inherent_ap_config, .driver = NULL, .stack = _g_esp_netif_netstack_default_wifi_ap }
+esp_err_t esp_netif_init(void);
+esp_netif_t* esp_netif_new(const esp_netif_config_t* cfg);
+void esp_netif_destroy(esp_netif_t* netif);
+esp_err_t esp_netif_attach(esp_netif_t* netif, esp_netif_iodriver_handle driver);
+esp_err_t esp_netif_set_driver_config(esp_netif_t* netif, const esp_netif_driver_ifconfig_t* cfg);
+esp_err_t esp_netif_receive(esp_netif_t* netif, void* buffer, size_t len, void* eb);
+void esp_netif_free_rx_buffer(void* netif, void* buffer);
+esp_err_t esp_netif_transmit(esp_netif_t* netif, void* data, size_t len);
+esp_netif_iodriver_handle esp_netif_get_io_driver(esp_netif_t* netif);
+const char* esp_netif_get_desc(esp_netif_t* netif);
+const char* esp_netif_get_ifkey(esp_netif_t* netif);
+esp_err_t esp_netif_set_mac(esp_netif_t* netif, uint8_t mac[]);
+esp_err_t esp_netif_get_mac(esp_netif_t* netif, uint8_t mac[]);
+bool esp_netif_is_netif_up(esp_netif_t* netif);
+esp_err_t esp_netif_get_ip_info(esp_netif_t* netif, esp_netif_ip_info_t* ip_info);
+esp_err_t esp_netif_set_ip_info(esp_netif_t* netif, const esp_netif_ip_info_t* ip_info);
+esp_err_t esp_netif_dhcps_option(esp_netif_t* netif, esp_netif_dhcp_option_mode_t op, esp_netif_dhcp_option_id_t id, void* val, uint32_t len);
+esp_err_t esp_netif_dhcpc_option(esp_netif_t* netif, esp_netif_dhcp_option_mode_t op, esp_netif_dhcp_option_id_t id, void* val, uint32_t len);
+esp_err_t esp_netif_dhcps_start(esp_netif_t* netif);
+esp_err_t esp_netif_dhcps_stop(esp_netif_t* netif);
+esp_err_t esp_netif_dhcpc_start(esp_netif_t* netif);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t* netif);
+esp_err_t esp_netif_dhcpc_get_status(esp_netif_t* netif, esp_netif_dhcp_status_t* status);
+esp_err_t esp_netif_set_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns);
+esp_err_t esp_netif_get_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns);
+void esp_netif_action_start(void* netif, esp_event_base_t base, int32_t id, void* data);
+void esp_netif_action_stop(void* netif, esp_event_base_t base, int32_t id, void* data);
+void esp_netif_action_connected(void* netif, esp_event_base_t base, int32_t id, void* data);
+void esp_netif_action_disconnected(void* netif, esp_event_base_t base, int32_t id, void* data);
+void esp_netif_action_got_ip(void* netif, esp_event_base_t base, int32_t id, void* data);
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+typedef enum { IP_EVENT_STA_GOT_IP, IP_EVENT_STA_LOST_IP, IP_EVENT_AP_STAIPASSIGNED, IP_EVENT_GOT_IP6, IP_EVENT_ETH_GOT_IP, IP_EVENT_PPP_GOT_IP, IP_EVENT_PPP_LOST_IP } ip_event_t;
+typedef struct { int if_index; esp_netif_t* esp_netif; esp_netif_ip_info_t ip_info; bool ip_changed; } ip_event_got_ip_t;
+typedef struct { esp_ip4_addr_t ip; } ip_event_ap_staipassigned_t;
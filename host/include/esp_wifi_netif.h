@@ -0,0 +1,4 @@
+#pragma once
+#include "esp_wifi.h"
+typedef esp_err_t (*esp_netif_receive_t)(esp_netif_t* esp_netif, void* buffer, size_t len, void* eb);
+esp_err_t esp_wifi_register_if_rxcb(wifi_netif_driver_t ifx, esp_netif_receive_t fn, void* arg);
@@ -0,0 +1,9 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef struct EventGroupDef* EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g);
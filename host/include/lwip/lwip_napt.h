@@ -0,0 +1,3 @@
+#pragma once
+#include <stdint.h>
+void ip_napt_enable(uint32_t addr, int enable);
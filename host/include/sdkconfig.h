@@ -0,0 +1,69 @@
+/*
+ * Configuration of the host simulator build, mirrors the defaults of main/Kconfig.projbuild
+ * except for the routing table size which is raised to the maximum for large simulated meshes,
+ * the benchmark which is compiled in, mesh_sim -B starts it, and the restart after a mesh OTA
+ * update, which would end the node process
+ */
+#pragma once
+
+#define CONFIG_IDF_TARGET_LINUX 1
+#define CONFIG_LOG_MAXIMUM_LEVEL 4
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_FREERTOS_USE_TRACE_FACILITY 1
+
+#define CONFIG_MESH_CHANNEL 0
+#define CONFIG_MESH_FAST_JOIN 1
+#define CONFIG_MESH_FAST_JOIN_TIMEOUT_MS 5000
+#define CONFIG_MESH_STATE_DEBOUNCE_MS 500
+#define CONFIG_MESH_ROUTER_SSID "ROUTER_SSID"
+#define CONFIG_MESH_ROUTER_PASSWD "ROUTER_PASSWD"
+#define CONFIG_MESH_AP_AUTHMODE 3
+#define CONFIG_MESH_AP_PASSWD "MAP_PASSWD"
+#define CONFIG_MESH_AP_CONNECTIONS 6
+#define CONFIG_MESH_MAX_LAYER 6
+#define CONFIG_MESH_ROUTE_TABLE_SIZE 300
+#define CONFIG_MESH_NETIF_RX_POOL_SIZE 8
+#define CONFIG_MESH_GROUP_BROADCAST 1
+#define CONFIG_MESH_ARP_PROXY 1
+#define CONFIG_MESH_NODE_DIRECT_FORWARD 1
+#define CONFIG_MESH_LEASES 1
+#define CONFIG_MESH_LEASE_WAIT_MS 2000
+#define CONFIG_MESH_TX_QUEUE_LEN 8
+#define CONFIG_MESH_TX_POOL_LEN 16
+#define CONFIG_MESH_TX_DROP_PRIORITY 1
+#define CONFIG_MESH_TRAFFIC_INTERACTIVE_MAX_LEN 256
+#define CONFIG_MESH_RAW_MAX_SIZE 4096
+#define CONFIG_MESH_RAW_REASSEMBLY_SLOTS 2
+#define CONFIG_MESH_MQTT_GATEWAY 1
+#define CONFIG_MESH_MQTT_GATEWAY_BATCH_MS 20
+#define CONFIG_MESH_MQTT_GATEWAY_REFRESH_S 30
+#define CONFIG_MESH_MQTT_STORE 1
+#define CONFIG_MESH_MQTT_STORE_SIZE 8192
+#define CONFIG_MESH_MQTT_STORE_REPLAY_BATCH 8
+#define CONFIG_MESH_MQTT_STORE_REPLAY_MS 100
+#define CONFIG_MESH_STATUS_PERIOD_MS 2000
+#define CONFIG_MESH_SCHED_JITTER_PERCENT 10
+#define CONFIG_MESH_SCHED_JOBS_MAX 12
+#define CONFIG_MESH_TRACE 1
+#define CONFIG_MESH_TRACE_EVENTS 256
+#define CONFIG_MESH_METRICS 1
+#define CONFIG_MESH_METRICS_PUBLISH_S 60
+#define CONFIG_MESH_METRICS_CONSOLE 1
+#define CONFIG_MESH_PROBE 1
+#define CONFIG_MESH_PROBE_INTERVAL_MS 5000
+#define CONFIG_MESH_PROBE_PUBLISH_S 60
+#define CONFIG_MESH_BENCH 1
+#define CONFIG_MESH_BENCH_PATH_RAW 1
+#define CONFIG_MESH_BENCH_DIRECTION_UP 1
+#define CONFIG_MESH_BENCH_SIZE 512
+#define CONFIG_MESH_BENCH_RATE 20
+#define CONFIG_MESH_BENCH_DURATION_S 10
+#define CONFIG_MESH_BENCH_LAYER 0
+#define CONFIG_MESH_OTA 1
+#define CONFIG_MESH_OTA_UNSIGNED 1 // the simulated OTA only checks the first byte of an image
+#define CONFIG_MESH_OTA_CHUNK_SIZE 1024
+#define CONFIG_MESH_OTA_WINDOW 32
+#define CONFIG_MESH_OTA_ROUNDS 5
+#define CONFIG_MESH_OTA_PROGRESS_S 10
+#define CONFIG_MESH_OTA_RESTART_DELAY_S 0
+#define CONFIG_MESH_OTA_VALIDATE_S 300
@@ -0,0 +1,135 @@
+/*
+ * Default event loop: events are copied into a queue and dispatched from one task, in order
+ */
+#include "esp_event.h"
+#include "esp_log.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EVENT_QUEUE_LEN (32)
+#define EVENT_HANDLERS_MAX (32)
+
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    void* pData;
+} eventItem_t;
+
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void* arg;
+} eventHandler_t;
+
+static const char* TAG = "esp_event";
+static QueueHandle_t eventQueue = NULL;
+static eventHandler_t handlers[EVENT_HANDLERS_MAX];
+static int handlerCount = 0;
+static pthread_mutex_t handlersLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void eventTask(void* arg)
+{
+    eventItem_t item;
+    while (1)
+    {
+        xQueueReceive(eventQueue, &item, portMAX_DELAY);
+        for (int i = 0; ; i++)
+        {
+            pthread_mutex_lock(&handlersLock);
+            if (i >= handlerCount)
+            {
+                pthread_mutex_unlock(&handlersLock);
+                break;
+            }
+            eventHandler_t handler = handlers[i];
+            pthread_mutex_unlock(&handlersLock);
+            // bases are compared by pointer, as in ESP-IDF
+            if (handler.base == item.base && (handler.id == ESP_EVENT_ANY_ID || handler.id == item.id))
+            {
+                handler.handler(handler.arg, item.base, item.id, item.pData);
+            }
+        }
+        free(item.pData);
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    if (eventQueue)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    eventQueue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(eventItem_t));
+    if (eventQueue == NULL || xTaskCreate(eventTask, "sys_evt", 3072, NULL, 20, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void* arg)
+{
+    esp_err_t err = ESP_OK;
+    pthread_mutex_lock(&handlersLock);
+    if (handlerCount == EVENT_HANDLERS_MAX)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        handlers[handlerCount++] = (eventHandler_t){ .base = base, .id = id, .handler = handler, .arg = arg };
+    }
+    pthread_mutex_unlock(&handlersLock);
+    return err;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t handler)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    pthread_mutex_lock(&handlersLock);
+    for (int i = 0; i < handlerCount; i++)
+    {
+        if (handlers[i].base == base && handlers[i].id == id && handlers[i].handler == handler)
+        {
+            memmove(&handlers[i], &handlers[i + 1], (handlerCount - i - 1) * sizeof(handlers[0]));
+            handlerCount--;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&handlersLock);
+    return err;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, void* data, size_t size, TickType_t ticks)
+{
+    eventItem_t item = { .base = base, .id = id };
+
+    if (eventQueue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (size)
+    {
+        item.pData = malloc(size);
+        if (item.pData == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(item.pData, data, size);
+    }
+    if (xQueueSend(eventQueue, &item, ticks) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Event queue full, dropping %s:%d", base, id);
+        free(item.pData);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,83 @@
+/*
+ * HTTP client of a simulated node: file:// URLs are read from the host, the nodes run on the same machine,
+ * other URLs fail to connect
+ */
+#include "esp_http_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_SCHEME "file://"
+
+struct esp_http_client
+{
+    char* pPath;
+    FILE* pFile;
+    int status;
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+    if (client)
+    {
+        client->pPath = strdup(config->url);
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    if (strncmp(client->pPath, FILE_SCHEME, strlen(FILE_SCHEME)) != 0)
+    {
+        return ESP_FAIL;
+    }
+    client->pFile = fopen(client->pPath + strlen(FILE_SCHEME), "rb");
+    client->status = client->pFile ? 200 : 404;
+    return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    if (client->pFile == NULL || fseek(client->pFile, 0, SEEK_END) != 0)
+    {
+        return 0;
+    }
+    int64_t len = ftell(client->pFile);
+    rewind(client->pFile);
+    return len;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len)
+{
+    if (client->pFile == NULL)
+    {
+        return -1;
+    }
+    size_t read = fread(buffer, 1, len, client->pFile);
+    return read == 0 && ferror(client->pFile) ? -1 : (int)read;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->pFile)
+    {
+        fclose(client->pFile);
+        client->pFile = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client->pPath);
+    free(client);
+    return ESP_OK;
+}
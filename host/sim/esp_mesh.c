@@ -0,0 +1,562 @@
+/*
+ * esp_mesh of a simulated node. The node's place in the tree is fixed by the coordinator,
+ * esp_mesh_start() connects it after a delay and sends go to the coordinator which models
+ * the air. A self-organized join scans for the network once per layer, all channels unless the
+ * configured one is right, a parent set by esp_mesh_set_parent() is joined without scanning if
+ * it is the node's parent and refused otherwise. The coordinator can take a node's parent away
+ * for a while, the node connects to it again without a scan. Sends are paced by the node's own radio: a payload occupies it for its airtime and
+ * non-blocking sends fail with ESP_ERR_MESH_QUEUE_FULL once TX_WINDOW payloads are waiting,
+ * like the tx queue of the mesh stack.
+ */
+#include "sim.h"
+
+#include "esp_log.h"
+#include "esp_mesh.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RX_QUEUE_LEN   (64)
+#define TX_WINDOW      (16)
+#define GROUPS_MAX     (4)
+#define SCAN_CHANNEL_MS (150)  // scan of one channel
+#define SCAN_CHANNELS  (13)
+#define REASON_NO_AP_FOUND (201)
+#define REASON_BEACON_TIMEOUT (200)
+
+static const char* TAG = "sim_mesh";
+const mesh_crypto_funcs_t g_wifi_default_mesh_crypto_funcs = { 0 };
+ESP_EVENT_DEFINE_BASE(MESH_EVENT);
+
+static mesh_cfg_t meshConfig = { 0 };
+static bool started = false;
+static volatile bool connected = false;
+static QueueHandle_t rxQueue = NULL;
+static mesh_addr_t groups[GROUPS_MAX];
+static int groupCount = 0;
+static pthread_mutex_t txLock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t txBusyUntilUs = 0;
+static int maxLayer = CONFIG_MESH_MAX_LAYER;
+static TaskHandle_t joinTaskHandle = NULL;
+static volatile bool parentSet = false; // esp_mesh_set_parent() called, cleared when self-organized again
+static wifi_config_t setParent;
+static int setParentLayer = 0;
+
+void simMeshDeliver(const simMsgMesh_t* pMsg)
+{
+    simMsgMesh_t* pCopy;
+
+    // payloads for a node without parent are lost in the air
+    if (rxQueue == NULL || !started || !connected)
+    {
+        return;
+    }
+    pCopy = malloc(sizeof(*pMsg) + pMsg->len);
+    if (pCopy == NULL)
+    {
+        return;
+    }
+    memcpy(pCopy, pMsg, sizeof(*pMsg) + pMsg->len);
+    // blocks the connection reader like a full rx queue stalls the radio, the coordinator never waits for it
+    xQueueSend(rxQueue, &pCopy, portMAX_DELAY);
+}
+
+// Wait for the parent set by esp_mesh_set_parent(), returns false if it is not the node's parent
+static bool joinSetParent(const uint8_t* pBssid)
+{
+    if (memcmp(setParent.sta.bssid, pBssid, sizeof(setParent.sta.bssid)) == 0
+            && setParentLayer == simConfig()->layer)
+    {
+        return true;
+    }
+    mesh_event_disconnected_t event = { .reason = REASON_NO_AP_FOUND };
+    vTaskDelay(pdMS_TO_TICKS(SCAN_CHANNEL_MS));
+    memcpy(event.bssid, setParent.sta.bssid, sizeof(event.bssid));
+    esp_event_post(MESH_EVENT, MESH_EVENT_PARENT_DISCONNECTED, &event, sizeof(event), portMAX_DELAY);
+    // the set parent is retried until the mesh selects a parent again
+    while (parentSet)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    return false;
+}
+
+// Scan for the network layer by layer, every layer waits for the one above to show up
+static void joinScan(void)
+{
+    const simMsgConfig_t* pConfig = simConfig();
+    bool channelKnown = meshConfig.channel == SIM_CHANNEL;
+
+    vTaskDelay(pdMS_TO_TICKS(pConfig->layer * SCAN_CHANNEL_MS * (channelKnown ? 1 : SCAN_CHANNELS)));
+    if (!channelKnown)
+    {
+        mesh_event_find_network_t event = { .channel = SIM_CHANNEL };
+        memcpy(event.router_bssid, pConfig->router, sizeof(event.router_bssid));
+        esp_event_post(MESH_EVENT, MESH_EVENT_FIND_NETWORK, &event, sizeof(event), portMAX_DELAY);
+    }
+}
+
+// Event of the connection to the node's parent in the topology
+static void joinEvent(mesh_event_connected_t* pEvent)
+{
+    const simMsgConfig_t* pConfig = simConfig();
+
+    memset(pEvent, 0, sizeof(*pEvent));
+    pEvent->self_layer = pConfig->layer;
+    memcpy(pEvent->connected.bssid, pConfig->parent, sizeof(pEvent->connected.bssid));
+    pEvent->connected.channel = SIM_CHANNEL;
+    if (pConfig->isRoot)
+    {
+        pEvent->connected.ssid_len = strlen(CONFIG_MESH_ROUTER_SSID);
+        memcpy(pEvent->connected.ssid, CONFIG_MESH_ROUTER_SSID, pEvent->connected.ssid_len);
+    }
+    else
+    {
+        pEvent->connected.bssid[5] += 1; // nodes associate with the softAP of their parent
+        pEvent->connected.ssid_len = snprintf((char*)pEvent->connected.ssid, sizeof(pEvent->connected.ssid),
+                "ESPM_%02X%02X%02X", pEvent->connected.bssid[3], pEvent->connected.bssid[4],
+                pEvent->connected.bssid[5]);
+    }
+}
+
+static void joinTask(void* arg)
+{
+    const simMsgConfig_t* pConfig = simConfig();
+    mesh_event_connected_t event;
+
+    vTaskDelay(pdMS_TO_TICKS(pConfig->joinDelayMs));
+    joinEvent(&event);
+    if (!parentSet || !joinSetParent(event.connected.bssid))
+    {
+        joinScan();
+    }
+    connected = true;
+    esp_event_post(MESH_EVENT, MESH_EVENT_PARENT_CONNECTED, &event, sizeof(event), portMAX_DELAY);
+    mesh_event_root_address_t rootAddress;
+    simNodeStaMac(0, rootAddress.addr);
+    esp_event_post(MESH_EVENT, MESH_EVENT_ROOT_ADDRESS, &rootAddress, sizeof(rootAddress), portMAX_DELAY);
+    if (pConfig->isRoot)
+    {
+        mesh_event_toDS_state_t toDs = MESH_TODS_REACHABLE;
+        simWifiStaConnected();
+        esp_event_post(MESH_EVENT, MESH_EVENT_TODS_STATE, &toDs, sizeof(toDs), portMAX_DELAY);
+    }
+    if (pConfig->tableSize > 1)
+    {
+        mesh_event_routing_table_change_t table = { .rt_size_new = pConfig->tableSize,
+                .rt_size_change = pConfig->tableSize - 1 };
+        esp_event_post(MESH_EVENT, MESH_EVENT_ROUTING_TABLE_ADD, &table, sizeof(table), portMAX_DELAY);
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_mesh_init(void)
+{
+    if (rxQueue == NULL)
+    {
+        rxQueue = xQueueCreate(RX_QUEUE_LEN, sizeof(simMsgMesh_t*));
+    }
+    return rxQueue ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_mesh_deinit(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_start(void)
+{
+    if (started)
+    {
+        return ESP_OK;
+    }
+    started = true;
+    esp_event_post(MESH_EVENT, MESH_EVENT_STARTED, NULL, 0, portMAX_DELAY);
+    xTaskCreate(joinTask, "mesh join", 2048, NULL, 5, &joinTaskHandle);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_stop(void)
+{
+    started = false;
+    connected = false;
+    return esp_event_post(MESH_EVENT, MESH_EVENT_STOPPED, NULL, 0, portMAX_DELAY);
+}
+
+// Occupy the radio for the airtime of a payload, returns false if the tx window is full and flag is non-blocking
+static bool txAirtimeReserve(size_t size, int flag)
+{
+    const simMsgConfig_t* pConfig = simConfig();
+    int64_t airtimeUs = (int64_t)size * 8 * 1000 / pConfig->bandwidthKbps;
+    int64_t windowUs = (int64_t)MESH_MPS * 8 * 1000 / pConfig->bandwidthKbps * TX_WINDOW;
+    int64_t now = simNowUs();
+
+    pthread_mutex_lock(&txLock);
+    int64_t backlog = txBusyUntilUs - now;
+    if (backlog > windowUs)
+    {
+        if (flag & MESH_DATA_NONBLOCK)
+        {
+            pthread_mutex_unlock(&txLock);
+            return false;
+        }
+        pthread_mutex_unlock(&txLock);
+        vTaskDelay(pdMS_TO_TICKS((backlog - windowUs) / 1000) + 1);
+        pthread_mutex_lock(&txLock);
+        now = simNowUs();
+    }
+    txBusyUntilUs = (txBusyUntilUs > now ? txBusyUntilUs : now) + airtimeUs;
+    pthread_mutex_unlock(&txLock);
+    return true;
+}
+
+esp_err_t esp_mesh_send(const mesh_addr_t* to, const mesh_data_t* data, int flag, const mesh_opt_t opt[],
+        int opt_count)
+{
+    uint8_t msg[sizeof(simMsgMesh_t) + MESH_MPS];
+    simMsgMesh_t* pMsg = (simMsgMesh_t*)msg;
+    esp_err_t err = ESP_OK;
+
+    if (!started || !connected)
+    {
+        err = ESP_ERR_MESH_DISCONNECTED;
+    }
+    else if (data == NULL || data->data == NULL || (to == NULL && !(flag & MESH_DATA_TODS)))
+    {
+        err = ESP_ERR_MESH_ARGUMENT;
+    }
+    else if (data->size > simConfig()->mtu)
+    {
+        err = ESP_ERR_MESH_EXCEED_MTU;
+    }
+    else if (!txAirtimeReserve(data->size, flag))
+    {
+        err = ESP_ERR_MESH_QUEUE_FULL;
+    }
+    if (err != ESP_OK)
+    {
+        if (err != ESP_ERR_MESH_QUEUE_FULL)
+        {
+            __atomic_fetch_add(&g_simCounters.meshSendErrors, 1, __ATOMIC_RELAXED);
+        }
+        return err;
+    }
+    memset(pMsg->addr, 0, sizeof(pMsg->addr));
+    if (to)
+    {
+        memcpy(pMsg->addr, to->addr, sizeof(pMsg->addr));
+    }
+    pMsg->flag = flag;
+    pMsg->proto = data->proto;
+    pMsg->tos = data->tos;
+    pMsg->len = data->size;
+    memcpy(pMsg->data, data->data, data->size);
+    err = simSend(SIM_MSG_MESH_SEND, pMsg, sizeof(*pMsg) + data->size);
+    __atomic_fetch_add(err == ESP_OK ? &g_simCounters.meshSent : &g_simCounters.meshSendErrors, 1, __ATOMIC_RELAXED);
+    return err;
+}
+
+esp_err_t esp_mesh_recv(mesh_addr_t* from, mesh_data_t* data, int timeout_ms, int* flag, mesh_opt_t opt[],
+        int opt_count)
+{
+    simMsgMesh_t* pMsg;
+    TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+
+    if (rxQueue == NULL)
+    {
+        return ESP_ERR_MESH_NOT_INIT;
+    }
+    if (xQueueReceive(rxQueue, &pMsg, ticks) != pdTRUE)
+    {
+        return ESP_ERR_MESH_TIMEOUT;
+    }
+    if (pMsg->len > data->size)
+    {
+        ESP_LOGW(TAG, "Receive buffer of %d bytes too small for %d", data->size, pMsg->len);
+        free(pMsg);
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    memcpy(from->addr, pMsg->addr, sizeof(from->addr));
+    memcpy(data->data, pMsg->data, pMsg->len);
+    data->size = pMsg->len;
+    data->proto = pMsg->proto;
+    data->tos = pMsg->tos;
+    if (flag)
+    {
+        *flag = pMsg->flag;
+    }
+    free(pMsg);
+    __atomic_fetch_add(&g_simCounters.meshReceived, 1, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_config(const mesh_cfg_t* config)
+{
+    meshConfig = *config;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_config(mesh_cfg_t* config)
+{
+    *config = meshConfig;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_max_layer(int max_layer)
+{
+    maxLayer = max_layer;
+    return ESP_OK;
+}
+
+int esp_mesh_get_max_layer(void)
+{
+    return maxLayer;
+}
+
+esp_err_t esp_mesh_set_vote_percentage(float percentage)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_ap_assoc_expire(int seconds)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_ap_authmode(wifi_auth_mode_t authmode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_id(mesh_addr_t* id)
+{
+    memcpy(id->addr, meshConfig.mesh_id.addr, sizeof(id->addr));
+    return ESP_OK;
+}
+
+int esp_mesh_get_layer(void)
+{
+    return connected ? simConfig()->layer : -1;
+}
+
+bool esp_mesh_is_root(void)
+{
+    return simConfig()->isRoot;
+}
+
+esp_err_t esp_mesh_post_toDS_state(bool reachable)
+{
+    simMsgToDsState_t msg = { .reachable = reachable };
+
+    return esp_mesh_is_root() ? simSend(SIM_MSG_TODS_STATE, &msg, sizeof(msg)) : ESP_ERR_MESH_NOT_ALLOWED;
+}
+
+// Lose the parent for downMs and connect to it again, like after missed beacons
+static void flapTask(void* arg)
+{
+    mesh_event_disconnected_t down = { .reason = REASON_BEACON_TIMEOUT };
+    mesh_event_connected_t event;
+    mesh_event_root_address_t rootAddress;
+
+    joinEvent(&event);
+    memcpy(down.bssid, event.connected.bssid, sizeof(down.bssid));
+    connected = false;
+    esp_event_post(MESH_EVENT, MESH_EVENT_PARENT_DISCONNECTED, &down, sizeof(down), portMAX_DELAY);
+    vTaskDelay(pdMS_TO_TICKS((uint32_t)(uintptr_t)arg));
+    connected = true;
+    esp_event_post(MESH_EVENT, MESH_EVENT_PARENT_CONNECTED, &event, sizeof(event), portMAX_DELAY);
+    simNodeStaMac(0, rootAddress.addr);
+    esp_event_post(MESH_EVENT, MESH_EVENT_ROOT_ADDRESS, &rootAddress, sizeof(rootAddress), portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+void simMeshFlap(uint16_t downMs)
+{
+    // the root's parent is the router, its outage is modelled by the coordinator
+    if (started && connected && !simConfig()->isRoot)
+    {
+        xTaskCreate(flapTask, "mesh flap", 2048, (void*)(uintptr_t)downMs, 5, NULL);
+    }
+}
+
+void simMeshToDsState(bool reachable)
+{
+    mesh_event_toDS_state_t toDs = reachable ? MESH_TODS_REACHABLE : MESH_TODS_UNREACHABLE;
+
+    if (started)
+    {
+        esp_event_post(MESH_EVENT, MESH_EVENT_TODS_STATE, &toDs, sizeof(toDs), portMAX_DELAY);
+    }
+}
+
+bool esp_mesh_is_root_fixed(void)
+{
+    return true;
+}
+
+esp_err_t esp_mesh_fix_root(bool enable)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t* bssid)
+{
+    memcpy(bssid->addr, simConfig()->parent, sizeof(bssid->addr));
+    bssid->addr[5] += !simConfig()->isRoot;
+    return ESP_OK;
+}
+
+mesh_type_t esp_mesh_get_type(void)
+{
+    if (!connected)
+    {
+        return MESH_IDLE;
+    }
+    return simConfig()->isRoot ? MESH_ROOT : simConfig()->tableSize > 1 ? MESH_NODE : MESH_LEAF;
+}
+
+esp_err_t esp_mesh_get_routing_table(mesh_addr_t* mac, int len, int* size)
+{
+    const simMsgConfig_t* pConfig = simConfig();
+    int count = len / (int)sizeof(mesh_addr_t);
+
+    if (mac == NULL || size == NULL)
+    {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    count = count < pConfig->tableSize ? count : pConfig->tableSize;
+    memcpy(mac, pConfig->table, count * sizeof(mesh_addr_t));
+    *size = count;
+    return ESP_OK;
+}
+
+int esp_mesh_get_routing_table_size(void)
+{
+    return simConfig()->tableSize;
+}
+
+int esp_mesh_get_total_node_num(void)
+{
+    return simConfig()->totalNodes;
+}
+
+esp_err_t esp_mesh_set_group_id(const mesh_addr_t* addr, int num)
+{
+    for (int i = 0; i < num; i++)
+    {
+        simMsgGroupJoin_t msg;
+        if (esp_mesh_is_my_group(&addr[i]))
+        {
+            continue;
+        }
+        if (groupCount == GROUPS_MAX)
+        {
+            return ESP_ERR_MESH_NO_MEMORY;
+        }
+        groups[groupCount++] = addr[i];
+        memcpy(msg.group, addr[i].addr, sizeof(msg.group));
+        simSend(SIM_MSG_GROUP_JOIN, &msg, sizeof(msg));
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_delete_group_id(const mesh_addr_t* addr, int num)
+{
+    return ESP_ERR_MESH_NOT_SUPPORT;
+}
+
+int esp_mesh_get_group_num(void)
+{
+    return groupCount;
+}
+
+esp_err_t esp_mesh_get_group_list(mesh_addr_t* addr, int num)
+{
+    for (int i = 0; i < num && i < groupCount; i++)
+    {
+        addr[i] = groups[i];
+    }
+    return ESP_OK;
+}
+
+bool esp_mesh_is_my_group(const mesh_addr_t* addr)
+{
+    for (int i = 0; i < groupCount; i++)
+    {
+        if (memcmp(groups[i].addr, addr->addr, sizeof(addr->addr)) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t esp_mesh_get_tx_pending(mesh_tx_pending_t* pending)
+{
+    int64_t backlogUs = txBusyUntilUs - simNowUs();
+    int64_t airtimeUs = (int64_t)MESH_MPS * 8 * 1000 / simConfig()->bandwidthKbps;
+    memset(pending, 0, sizeof(*pending));
+    pending->to_parent = backlogUs > 0 ? (int)(backlogUs / airtimeUs) + 1 : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_rx_pending(mesh_rx_pending_t* pending)
+{
+    pending->toDS = 0;
+    pending->toSelf = rxQueue ? uxQueueMessagesWaiting(rxQueue) : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_xon_qsize(int qsize)
+{
+    return ESP_OK;
+}
+
+int esp_mesh_get_xon_qsize(void)
+{
+    return 32;
+}
+
+esp_err_t esp_mesh_set_parent(const wifi_config_t* parent, const mesh_addr_t* parent_mesh_id, mesh_type_t my_type,
+        int my_layer)
+{
+    if (connected)
+    {
+        return ESP_ERR_MESH_NOT_SUPPORT;
+    }
+    setParent = *parent;
+    setParentLayer = my_layer;
+    parentSet = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_self_organized(bool enable, bool select_parent)
+{
+    // with select_parent false the set parent is kept, but the mesh heals itself again
+    if (enable && parentSet)
+    {
+        parentSet = false;
+        if (joinTaskHandle && !connected)
+        {
+            xTaskNotifyGive(joinTaskHandle);
+        }
+    }
+    return ESP_OK;
+}
+
+bool esp_mesh_get_self_organized(void)
+{
+    return !parentSet;
+}
+
+esp_err_t esp_mesh_connect(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_disconnect(void)
+{
+    return ESP_OK;
+}
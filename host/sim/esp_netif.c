@@ -0,0 +1,919 @@
+/*
+ * Minimal IPv4 stack standing in for esp_netif and lwIP: ARP with a pending queue, ICMP echo,
+ * UDP to bound ports and forwarding between interfaces once NAPT is enabled. DHCP is replaced
+ * by fixed leases handed out when a station interface connects. Frames are received on one
+ * tcpip task and the driver's buffer is returned through driver_free_rx_buffer() afterwards,
+ * so the firmware's rx buffer accounting works as on the target.
+ */
+#include "sim.h"
+
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "lwip/lwip_napt.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NETIF_MAX          (4)
+#define ARP_CACHE_SIZE     (64)
+#define ARP_PENDING_MAX    (16)
+#define ARP_PENDING_us     (2000 * 1000)
+#define UDP_PORTS_MAX      (8)
+#define TCPIP_QUEUE_LEN    (64)
+#define ETH_HDR_LEN        (14)
+#define ETH_MTU            (1500)
+#define ETH_FRAME_MAX      (ETH_HDR_LEN + ETH_MTU)
+#define ETH_TYPE_IP        (0x0800)
+#define ETH_TYPE_ARP       (0x0806)
+#define ARP_LEN            (28)
+#define IP_HDR_LEN         (20)
+#define IP_PROTO_ICMP      (1)
+#define IP_PROTO_UDP       (17)
+#define UDP_HDR_LEN        (8)
+#define IP_TTL             (64)
+#define GET_BE16(p)        ((uint16_t)(((p)[0] << 8) | (p)[1]))
+#define PUT_BE16(p, v)     do { (p)[0] = (uint8_t)((v) >> 8); (p)[1] = (uint8_t)(v); } while (0)
+
+struct esp_netif_netstack_config
+{
+    int dummy;
+};
+
+struct esp_netif_obj
+{
+    char ifKey[32];
+    char desc[32];
+    esp_netif_flags_t flags;
+    uint8_t mac[6];
+    esp_netif_ip_info_t ipInfo;
+    esp_ip4_addr_t dns;
+    bool up;
+    bool hasIp;
+    bool connected;    // between esp_netif_action_connected() and esp_netif_action_disconnected()
+    bool dhcpcStopped; // the address is set by esp_netif_set_ip_info()
+    esp_netif_iodriver_handle driver;
+    esp_err_t (*transmit)(void* h, void* buffer, size_t len);
+    void (*freeRxBuffer)(void* h, void* buffer);
+};
+
+typedef struct
+{
+    esp_netif_t* pNetif;
+    void* pBuffer;
+    size_t len;
+    void* pDriver;
+    void (*freeRxBuffer)(void* h, void* buffer);
+    void* eb;
+} tcpipItem_t;
+
+typedef struct
+{
+    uint32_t ip; // network byte order, 0 marks a free entry
+    uint8_t mac[6];
+} arpEntry_t;
+
+typedef struct
+{
+    esp_netif_t* pNetif;
+    uint32_t nextHop;
+    int64_t queuedUs;
+    size_t len;
+    uint8_t packet[ETH_MTU];
+} arpPending_t;
+
+typedef struct
+{
+    uint16_t port;
+    simUdpRecvFn_t* pRecvFn;
+    void* arg;
+} udpPort_t;
+
+static const char* TAG = "sim_netif";
+static const esp_netif_netstack_config_t netstackDefault = { 0 };
+const esp_netif_netstack_config_t* _g_esp_netif_netstack_default_wifi_sta = &netstackDefault;
+const esp_netif_netstack_config_t* _g_esp_netif_netstack_default_wifi_ap = &netstackDefault;
+static const esp_netif_ip_info_t apIpDefault = { .ip = { .addr = ESP_IP4TOADDR(192, 168, 4, 1) },
+        .gw = { .addr = ESP_IP4TOADDR(192, 168, 4, 1) }, .netmask = { .addr = ESP_IP4TOADDR(255, 255, 255, 0) } };
+const esp_netif_inherent_config_t _g_esp_netif_inherent_sta_config = { .flags = ESP_NETIF_DHCP_CLIENT
+        | ESP_NETIF_FLAG_GARP | ESP_NETIF_FLAG_EVENT_IP_MODIFIED, .get_ip_event = IP_EVENT_STA_GOT_IP, .lost_ip_event =
+        IP_EVENT_STA_LOST_IP, .if_key = "WIFI_STA_DEF", .if_desc = "sta", .route_prio = 100 };
+const esp_netif_inherent_config_t _g_esp_netif_inherent_ap_config = { .flags = ESP_NETIF_DHCP_SERVER
+        | ESP_NETIF_FLAG_AUTOUP, .ip_info = &apIpDefault, .if_key = "WIFI_AP_DEF", .if_desc = "ap", .route_prio = 10 };
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+static pthread_mutex_t stackLock;
+static esp_netif_t* netifs[NETIF_MAX];
+static arpEntry_t arpCache[ARP_CACHE_SIZE];
+static arpPending_t arpPending[ARP_PENDING_MAX];
+static udpPort_t udpPorts[UDP_PORTS_MAX];
+static QueueHandle_t tcpipQueue = NULL;
+static TaskHandle_t tcpipTask = NULL;
+static bool forwarding = false;
+static uint16_t ipId = 0;
+
+static void ipOutput(esp_netif_t* pNetif, uint32_t nextHop, const uint8_t* pPacket, size_t len);
+
+static uint16_t checksum(const uint8_t* pData, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+    {
+        sum += GET_BE16(pData + i);
+    }
+    if (len & 1)
+    {
+        sum += pData[len - 1] << 8;
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static bool netifExists(const esp_netif_t* pNetif)
+{
+    for (int i = 0; i < NETIF_MAX; i++)
+    {
+        if (netifs[i] == pNetif)
+        {
+            return pNetif != NULL;
+        }
+    }
+    return false;
+}
+
+// Transmit
+static void ethOutput(esp_netif_t* pNetif, const uint8_t* pDest, uint16_t type, const uint8_t* pPayload, size_t len)
+{
+    uint8_t frame[ETH_FRAME_MAX];
+
+    if (pNetif->transmit == NULL || len > ETH_MTU)
+    {
+        return;
+    }
+    memcpy(frame, pDest, 6);
+    memcpy(frame + 6, pNetif->mac, 6);
+    PUT_BE16(frame + 12, type);
+    memcpy(frame + ETH_HDR_LEN, pPayload, len);
+    if (pNetif->transmit(pNetif->driver, frame, ETH_HDR_LEN + len) != ESP_OK)
+    {
+        // ERR_MEM for lwIP, the frame is lost and upper layers retry
+        __atomic_fetch_add(&g_simCounters.netifTxDropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void arpOutput(esp_netif_t* pNetif, uint16_t op, const uint8_t* pTargetMac, uint32_t targetIp)
+{
+    static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    uint8_t arp[ARP_LEN] = { 0x00, 0x01, 0x08, 0x00, 6, 4 };
+
+    PUT_BE16(arp + 6, op);
+    memcpy(arp + 8, pNetif->mac, 6);
+    memcpy(arp + 14, &pNetif->ipInfo.ip.addr, 4);
+    memcpy(arp + 18, op == 1 ? (const uint8_t[6]){ 0 } : pTargetMac, 6);
+    memcpy(arp + 24, &targetIp, 4);
+    ethOutput(pNetif, op == 1 ? broadcast : pTargetMac, ETH_TYPE_ARP, arp, sizeof(arp));
+}
+
+static const arpEntry_t* arpFind(uint32_t ip)
+{
+    for (int i = 0; i < ARP_CACHE_SIZE; i++)
+    {
+        if (arpCache[i].ip == ip)
+        {
+            return &arpCache[i];
+        }
+    }
+    return NULL;
+}
+
+static void arpLearn(esp_netif_t* pNetif, uint32_t ip, const uint8_t* pMac)
+{
+    arpEntry_t* pEntry = (arpEntry_t*)arpFind(ip);
+    if (pEntry == NULL)
+    {
+        pEntry = &arpCache[ip % ARP_CACHE_SIZE];
+        for (int i = 0; i < ARP_CACHE_SIZE; i++)
+        {
+            if (arpCache[i].ip == 0)
+            {
+                pEntry = &arpCache[i];
+                break;
+            }
+        }
+    }
+    pEntry->ip = ip;
+    memcpy(pEntry->mac, pMac, 6);
+    for (int i = 0; i < ARP_PENDING_MAX; i++)
+    {
+        arpPending_t* pPending = &arpPending[i];
+        if (pPending->len && pPending->pNetif == pNetif && pPending->nextHop == ip)
+        {
+            ethOutput(pNetif, pMac, ETH_TYPE_IP, pPending->packet, pPending->len);
+            pPending->len = 0;
+        }
+    }
+}
+
+static void arpQueue(esp_netif_t* pNetif, uint32_t nextHop, const uint8_t* pPacket, size_t len)
+{
+    int64_t now = simNowUs();
+    arpPending_t* pFree = NULL;
+
+    for (int i = 0; i < ARP_PENDING_MAX; i++)
+    {
+        if (arpPending[i].len && now - arpPending[i].queuedUs > ARP_PENDING_us)
+        {
+            arpPending[i].len = 0;
+        }
+        if (arpPending[i].len == 0 && pFree == NULL)
+        {
+            pFree = &arpPending[i];
+        }
+    }
+    if (pFree)
+    {
+        pFree->pNetif = pNetif;
+        pFree->nextHop = nextHop;
+        pFree->queuedUs = now;
+        pFree->len = len;
+        memcpy(pFree->packet, pPacket, len);
+    }
+    else
+    {
+        __atomic_fetch_add(&g_simCounters.netifTxDropped, 1, __ATOMIC_RELAXED);
+    }
+    arpOutput(pNetif, 1, NULL, nextHop);
+}
+
+// Returns the interface towards dst and sets the next hop, NULL if there is no route
+static esp_netif_t* ipRoute(uint32_t dst, uint32_t* pNextHop)
+{
+    esp_netif_t* pDefault = NULL;
+    for (int i = 0; i < NETIF_MAX; i++)
+    {
+        esp_netif_t* pNetif = netifs[i];
+        if (pNetif == NULL || !pNetif->up || !pNetif->hasIp)
+        {
+            continue;
+        }
+        if (((dst ^ pNetif->ipInfo.ip.addr) & pNetif->ipInfo.netmask.addr) == 0)
+        {
+            *pNextHop = dst;
+            return pNetif;
+        }
+        if (!(pNetif->flags & ESP_NETIF_DHCP_SERVER) && pNetif->ipInfo.gw.addr)
+        {
+            pDefault = pNetif;
+        }
+    }
+    if (pDefault)
+    {
+        *pNextHop = pDefault->ipInfo.gw.addr;
+    }
+    return pDefault;
+}
+
+static void ipOutput(esp_netif_t* pNetif, uint32_t nextHop, const uint8_t* pPacket, size_t len)
+{
+    const arpEntry_t* pEntry = arpFind(nextHop);
+    if (pEntry)
+    {
+        ethOutput(pNetif, pEntry->mac, ETH_TYPE_IP, pPacket, len);
+    }
+    else
+    {
+        arpQueue(pNetif, nextHop, pPacket, len);
+    }
+}
+
+static void ipHeaderFill(uint8_t* pPacket, size_t len, uint8_t proto, uint32_t src, uint32_t dst)
+{
+    memset(pPacket, 0, IP_HDR_LEN);
+    pPacket[0] = 0x45;
+    PUT_BE16(pPacket + 2, len);
+    uint16_t id = ipId++;
+    PUT_BE16(pPacket + 4, id);
+    pPacket[8] = IP_TTL;
+    pPacket[9] = proto;
+    memcpy(pPacket + 12, &src, 4);
+    memcpy(pPacket + 16, &dst, 4);
+    uint16_t sum = checksum(pPacket, IP_HDR_LEN);
+    PUT_BE16(pPacket + 10, sum);
+}
+
+esp_err_t simUdpSend(uint16_t srcPort, uint32_t dstIp, uint16_t dstPort, const void* pData, size_t len)
+{
+    uint8_t packet[ETH_MTU];
+    uint32_t nextHop;
+    esp_err_t err = ESP_OK;
+
+    if (len > ETH_MTU - IP_HDR_LEN - UDP_HDR_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&stackLock);
+    esp_netif_t* pNetif = ipRoute(dstIp, &nextHop);
+    if (pNetif == NULL)
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        size_t total = IP_HDR_LEN + UDP_HDR_LEN + len;
+        uint8_t* pUdp = packet + IP_HDR_LEN;
+        ipHeaderFill(packet, total, IP_PROTO_UDP, pNetif->ipInfo.ip.addr, dstIp);
+        PUT_BE16(pUdp, srcPort);
+        PUT_BE16(pUdp + 2, dstPort);
+        PUT_BE16(pUdp + 4, UDP_HDR_LEN + len);
+        PUT_BE16(pUdp + 6, 0);
+        memcpy(pUdp + UDP_HDR_LEN, pData, len);
+        ipOutput(pNetif, nextHop, packet, total);
+    }
+    pthread_mutex_unlock(&stackLock);
+    return err;
+}
+
+esp_err_t simUdpBind(uint16_t port, simUdpRecvFn_t* pRecvFn, void* arg)
+{
+    int slot = -1;
+    pthread_mutex_lock(&stackLock);
+    for (int i = 0; i < UDP_PORTS_MAX; i++)
+    {
+        if (udpPorts[i].port == port || (slot < 0 && udpPorts[i].port == 0))
+        {
+            slot = i;
+        }
+        if (udpPorts[i].port == port)
+        {
+            break;
+        }
+    }
+    if (slot >= 0)
+    {
+        udpPorts[slot] = (udpPort_t){ .port = port, .pRecvFn = pRecvFn, .arg = arg };
+    }
+    pthread_mutex_unlock(&stackLock);
+    return slot >= 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void simUdpUnbind(uint16_t port)
+{
+    pthread_mutex_lock(&stackLock);
+    for (int i = 0; i < UDP_PORTS_MAX; i++)
+    {
+        if (udpPorts[i].port == port)
+        {
+            udpPorts[i] = (udpPort_t){ 0 };
+        }
+    }
+    pthread_mutex_unlock(&stackLock);
+}
+
+// Receive
+static void arpInput(esp_netif_t* pNetif, const uint8_t* pArp, size_t len)
+{
+    uint32_t senderIp;
+    uint32_t targetIp;
+
+    if (len < ARP_LEN)
+    {
+        return;
+    }
+    memcpy(&senderIp, pArp + 14, 4);
+    memcpy(&targetIp, pArp + 24, 4);
+    if (senderIp)
+    {
+        arpLearn(pNetif, senderIp, pArp + 8);
+    }
+    if (GET_BE16(pArp + 6) == 1 && pNetif->hasIp && targetIp == pNetif->ipInfo.ip.addr && senderIp != targetIp)
+    {
+        arpOutput(pNetif, 2, pArp + 8, senderIp);
+    }
+}
+
+static bool ipIsLocal(uint32_t dst)
+{
+    if (dst == 0xFFFFFFFFu)
+    {
+        return true;
+    }
+    for (int i = 0; i < NETIF_MAX; i++)
+    {
+        if (netifs[i] && netifs[i]->hasIp && netifs[i]->ipInfo.ip.addr == dst)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void icmpInput(esp_netif_t* pNetif, const uint8_t* pPacket, size_t len)
+{
+    uint8_t reply[ETH_MTU];
+    uint32_t src;
+    uint32_t dst;
+    uint32_t nextHop;
+    size_t ipHdrLen = (pPacket[0] & 0x0F) * 4;
+
+    if (len < ipHdrLen + 8 || pPacket[ipHdrLen] != 8)
+    {
+        return; // echo requests only
+    }
+    memcpy(&src, pPacket + 12, 4);
+    memcpy(&dst, pPacket + 16, 4);
+    size_t icmpLen = len - ipHdrLen;
+    ipHeaderFill(reply, IP_HDR_LEN + icmpLen, IP_PROTO_ICMP, dst, src);
+    memcpy(reply + IP_HDR_LEN, pPacket + ipHdrLen, icmpLen);
+    reply[IP_HDR_LEN] = 0;
+    PUT_BE16(reply + IP_HDR_LEN + 2, 0);
+    uint16_t sum = checksum(reply + IP_HDR_LEN, icmpLen);
+    PUT_BE16(reply + IP_HDR_LEN + 2, sum);
+    esp_netif_t* pOut = ipRoute(src, &nextHop);
+    if (pOut)
+    {
+        ipOutput(pOut, nextHop, reply, IP_HDR_LEN + icmpLen);
+    }
+}
+
+static void udpInput(const uint8_t* pPacket, size_t len)
+{
+    size_t ipHdrLen = (pPacket[0] & 0x0F) * 4;
+    const uint8_t* pUdp = pPacket + ipHdrLen;
+    uint32_t src;
+
+    if (len < ipHdrLen + UDP_HDR_LEN)
+    {
+        return;
+    }
+    size_t udpLen = GET_BE16(pUdp + 4);
+    if (udpLen < UDP_HDR_LEN || ipHdrLen + udpLen > len)
+    {
+        return;
+    }
+    memcpy(&src, pPacket + 12, 4);
+    for (int i = 0; i < UDP_PORTS_MAX; i++)
+    {
+        if (udpPorts[i].port && udpPorts[i].port == GET_BE16(pUdp + 2))
+        {
+            udpPorts[i].pRecvFn(src, GET_BE16(pUdp), pUdp + UDP_HDR_LEN, udpLen - UDP_HDR_LEN, udpPorts[i].arg);
+            return;
+        }
+    }
+}
+
+static void ipForward(const uint8_t* pPacket, size_t len, uint32_t dst)
+{
+    uint8_t packet[ETH_MTU];
+    uint32_t nextHop;
+
+    if (!forwarding || pPacket[8] <= 1)
+    {
+        return;
+    }
+    esp_netif_t* pOut = ipRoute(dst, &nextHop);
+    if (pOut == NULL)
+    {
+        return;
+    }
+    size_t ipHdrLen = (pPacket[0] & 0x0F) * 4;
+    memcpy(packet, pPacket, len);
+    packet[8]--;
+    PUT_BE16(packet + 10, 0);
+    uint16_t sum = checksum(packet, ipHdrLen);
+    PUT_BE16(packet + 10, sum);
+    ipOutput(pOut, nextHop, packet, len);
+}
+
+static void ipInput(esp_netif_t* pNetif, const uint8_t* pPacket, size_t len)
+{
+    uint32_t dst;
+
+    if (len < IP_HDR_LEN || (pPacket[0] >> 4) != 4 || GET_BE16(pPacket + 2) > len)
+    {
+        return;
+    }
+    len = GET_BE16(pPacket + 2);
+    memcpy(&dst, pPacket + 16, 4);
+    if (!ipIsLocal(dst))
+    {
+        ipForward(pPacket, len, dst);
+        return;
+    }
+    switch (pPacket[9])
+    {
+        case IP_PROTO_ICMP:
+            icmpInput(pNetif, pPacket, len);
+            break;
+        case IP_PROTO_UDP:
+            udpInput(pPacket, len);
+            break;
+        default:
+            break;
+    }
+}
+
+static void ethInput(esp_netif_t* pNetif, const uint8_t* pFrame, size_t len)
+{
+    if (len < ETH_HDR_LEN || !pNetif->up)
+    {
+        return;
+    }
+    if (!(pFrame[0] & 0x01) && memcmp(pFrame, pNetif->mac, 6) != 0)
+    {
+        return;
+    }
+    switch (GET_BE16(pFrame + 12))
+    {
+        case ETH_TYPE_ARP:
+            arpInput(pNetif, pFrame + ETH_HDR_LEN, len - ETH_HDR_LEN);
+            break;
+        case ETH_TYPE_IP:
+            ipInput(pNetif, pFrame + ETH_HDR_LEN, len - ETH_HDR_LEN);
+            break;
+        default:
+            break;
+    }
+}
+
+static void tcpipTaskFn(void* arg)
+{
+    tcpipItem_t item;
+    while (1)
+    {
+        xQueueReceive(tcpipQueue, &item, portMAX_DELAY);
+        pthread_mutex_lock(&stackLock);
+        if (netifExists(item.pNetif))
+        {
+            ethInput(item.pNetif, item.pBuffer, item.len);
+        }
+        pthread_mutex_unlock(&stackLock);
+        if (item.freeRxBuffer)
+        {
+            item.freeRxBuffer(item.pDriver, item.eb);
+        }
+    }
+}
+
+esp_err_t esp_netif_receive(esp_netif_t* netif, void* buffer, size_t len, void* eb)
+{
+    tcpipItem_t item = { .pNetif = netif, .pBuffer = buffer, .len = len, .eb = eb };
+
+    pthread_mutex_lock(&stackLock);
+    item.pDriver = netif->driver;
+    item.freeRxBuffer = netif->freeRxBuffer;
+    pthread_mutex_unlock(&stackLock);
+    // the tcpip task itself never blocks on its own queue
+    TickType_t wait = xTaskGetCurrentTaskHandle() == tcpipTask ? 0 : portMAX_DELAY;
+    if (xQueueSend(tcpipQueue, &item, wait) != pdTRUE)
+    {
+        if (item.freeRxBuffer)
+        {
+            item.freeRxBuffer(item.pDriver, eb);
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void esp_netif_free_rx_buffer(void* netif, void* buffer)
+{
+    esp_netif_t* pNetif = netif;
+    if (pNetif->freeRxBuffer)
+    {
+        pNetif->freeRxBuffer(pNetif->driver, buffer);
+    }
+}
+
+esp_err_t esp_netif_transmit(esp_netif_t* netif, void* data, size_t len)
+{
+    return netif->transmit ? netif->transmit(netif->driver, data, len) : ESP_ERR_INVALID_STATE;
+}
+
+// Interfaces
+esp_err_t esp_netif_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    if (tcpipQueue)
+    {
+        return ESP_OK;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&stackLock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    tcpipQueue = xQueueCreate(TCPIP_QUEUE_LEN, sizeof(tcpipItem_t));
+    if (tcpipQueue == NULL || xTaskCreate(tcpipTaskFn, "tiT", 3072, NULL, 18, &tcpipTask) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_netif_t* esp_netif_new(const esp_netif_config_t* cfg)
+{
+    esp_netif_t* pNetif = calloc(1, sizeof(esp_netif_t));
+
+    if (pNetif == NULL)
+    {
+        return NULL;
+    }
+    strncpy(pNetif->ifKey, cfg->base->if_key ? cfg->base->if_key : "", sizeof(pNetif->ifKey) - 1);
+    strncpy(pNetif->desc, cfg->base->if_desc ? cfg->base->if_desc : "", sizeof(pNetif->desc) - 1);
+    pNetif->flags = cfg->base->flags;
+    memcpy(pNetif->mac, cfg->base->mac, 6);
+    if (cfg->base->ip_info)
+    {
+        pNetif->ipInfo = *cfg->base->ip_info;
+    }
+    pthread_mutex_lock(&stackLock);
+    for (int i = 0; i < NETIF_MAX; i++)
+    {
+        if (netifs[i] == NULL)
+        {
+            netifs[i] = pNetif;
+            pthread_mutex_unlock(&stackLock);
+            return pNetif;
+        }
+    }
+    pthread_mutex_unlock(&stackLock);
+    free(pNetif);
+    return NULL;
+}
+
+void esp_netif_destroy(esp_netif_t* netif)
+{
+    pthread_mutex_lock(&stackLock);
+    for (int i = 0; i < NETIF_MAX; i++)
+    {
+        if (netifs[i] == netif)
+        {
+            netifs[i] = NULL;
+        }
+    }
+    for (int i = 0; i < ARP_PENDING_MAX; i++)
+    {
+        if (arpPending[i].pNetif == netif)
+        {
+            arpPending[i].len = 0;
+        }
+    }
+    pthread_mutex_unlock(&stackLock);
+    free(netif);
+}
+
+esp_err_t esp_netif_attach(esp_netif_t* netif, esp_netif_iodriver_handle driver)
+{
+    esp_netif_driver_base_t* pBase = driver;
+    pBase->netif = netif;
+    return pBase->post_attach ? pBase->post_attach(netif, driver) : ESP_OK;
+}
+
+esp_err_t esp_netif_set_driver_config(esp_netif_t* netif, const esp_netif_driver_ifconfig_t* cfg)
+{
+    pthread_mutex_lock(&stackLock);
+    netif->driver = cfg->handle;
+    netif->transmit = cfg->transmit;
+    netif->freeRxBuffer = cfg->driver_free_rx_buffer;
+    pthread_mutex_unlock(&stackLock);
+    return ESP_OK;
+}
+
+esp_netif_iodriver_handle esp_netif_get_io_driver(esp_netif_t* netif)
+{
+    return netif->driver;
+}
+
+const char* esp_netif_get_desc(esp_netif_t* netif)
+{
+    return netif->desc;
+}
+
+const char* esp_netif_get_ifkey(esp_netif_t* netif)
+{
+    return netif->ifKey;
+}
+
+esp_err_t esp_netif_set_mac(esp_netif_t* netif, uint8_t mac[])
+{
+    memcpy(netif->mac, mac, 6);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_mac(esp_netif_t* netif, uint8_t mac[])
+{
+    memcpy(mac, netif->mac, 6);
+    return ESP_OK;
+}
+
+bool esp_netif_is_netif_up(esp_netif_t* netif)
+{
+    return netif->up;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t* netif, esp_netif_ip_info_t* ip_info)
+{
+    *ip_info = netif->ipInfo;
+    return ESP_OK;
+}
+
+// Like lwIP, a static address of a station is announced and reported as got
+esp_err_t esp_netif_set_ip_info(esp_netif_t* netif, const esp_netif_ip_info_t* ip_info)
+{
+    ip_event_got_ip_t event = { .esp_netif = netif, .ip_info = *ip_info, .ip_changed = true };
+
+    if ((netif->flags & ESP_NETIF_DHCP_CLIENT) && !netif->dhcpcStopped)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_mutex_lock(&stackLock);
+    netif->ipInfo = *ip_info;
+    netif->hasIp = ip_info->ip.addr != 0;
+    if (netif->hasIp && netif->up && (netif->flags & ESP_NETIF_FLAG_GARP))
+    {
+        arpOutput(netif, 1, NULL, netif->ipInfo.ip.addr);
+    }
+    pthread_mutex_unlock(&stackLock);
+    if (netif->hasIp && (netif->flags & ESP_NETIF_DHCP_CLIENT))
+    {
+        esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event), portMAX_DELAY);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns)
+{
+    if (type == ESP_NETIF_DNS_MAIN)
+    {
+        netif->dns = dns->ip.u_addr.ip4;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns)
+{
+    memset(dns, 0, sizeof(*dns));
+    dns->ip.type = IPADDR_TYPE_V4;
+    if (type == ESP_NETIF_DNS_MAIN)
+    {
+        dns->ip.u_addr.ip4 = netif->dns;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_option(esp_netif_t* netif, esp_netif_dhcp_option_mode_t op, esp_netif_dhcp_option_id_t id,
+        void* val, uint32_t len)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_option(esp_netif_t* netif, esp_netif_dhcp_option_mode_t op, esp_netif_dhcp_option_id_t id,
+        void* val, uint32_t len)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_start(esp_netif_t* netif)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_stop(esp_netif_t* netif)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t* netif)
+{
+    if (!netif->dhcpcStopped)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    netif->dhcpcStopped = false;
+    if (netif->connected)
+    {
+        esp_netif_action_connected(netif, NULL, 0, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t* netif)
+{
+    if (netif->dhcpcStopped)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    netif->dhcpcStopped = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_get_status(esp_netif_t* netif, esp_netif_dhcp_status_t* status)
+{
+    if (netif->dhcpcStopped)
+    {
+        *status = ESP_NETIF_DHCP_STOPPED;
+        return ESP_OK;
+    }
+    *status = netif->hasIp ? ESP_NETIF_DHCP_STARTED : ESP_NETIF_DHCP_INIT;
+    return ESP_OK;
+}
+
+void esp_netif_action_start(void* netif, esp_event_base_t base, int32_t id, void* data)
+{
+    esp_netif_t* pNetif = netif;
+    pthread_mutex_lock(&stackLock);
+    pNetif->up = true;
+    pNetif->hasIp = (!(pNetif->flags & ESP_NETIF_DHCP_CLIENT) || pNetif->dhcpcStopped) && pNetif->ipInfo.ip.addr != 0;
+    pthread_mutex_unlock(&stackLock);
+}
+
+void esp_netif_action_stop(void* netif, esp_event_base_t base, int32_t id, void* data)
+{
+    esp_netif_t* pNetif = netif;
+    pthread_mutex_lock(&stackLock);
+    pNetif->up = false;
+    pNetif->connected = false;
+    pthread_mutex_unlock(&stackLock);
+}
+
+// Stands in for the DHCP client: the root's station is leased an address by the router,
+// a node's mesh station the address of its node id in the subnet of the root's AP. With the
+// client stopped a static address already set is reported as got, like esp_netif does.
+void esp_netif_action_connected(void* netif, esp_event_base_t base, int32_t id, void* data)
+{
+    esp_netif_t* pNetif = netif;
+    ip_event_got_ip_t event = { .esp_netif = pNetif, .ip_changed = false };
+
+    if (!(pNetif->flags & ESP_NETIF_DHCP_CLIENT))
+    {
+        return;
+    }
+    pthread_mutex_lock(&stackLock);
+    pNetif->connected = true;
+    if (pNetif->dhcpcStopped)
+    {
+        pNetif->up = true;
+        pNetif->hasIp = pNetif->ipInfo.ip.addr != 0;
+        event.ip_info = pNetif->ipInfo;
+        pthread_mutex_unlock(&stackLock);
+        if (event.ip_info.ip.addr)
+        {
+            esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event), portMAX_DELAY);
+        }
+        return;
+    }
+    event.ip_changed = true;
+    if (strcmp(pNetif->desc, "sta") == 0)
+    {
+        pNetif->ipInfo.ip.addr = esp_netif_htonl(SIM_ROOT_STA_IP);
+        pNetif->ipInfo.gw.addr = esp_netif_htonl(SIM_ROUTER_IP);
+        pNetif->ipInfo.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+    }
+    else
+    {
+        pNetif->ipInfo.ip.addr = esp_netif_htonl(simNodeMeshIp(simNodeId()));
+        pNetif->ipInfo.gw.addr = esp_netif_htonl(SIM_MESH_NET | 1);
+        pNetif->ipInfo.netmask.addr = esp_netif_htonl(SIM_MESH_MASK);
+    }
+    pNetif->dns.addr = esp_netif_htonl(SIM_ROUTER_IP);
+    pNetif->up = true;
+    pNetif->hasIp = true;
+    event.ip_info = pNetif->ipInfo;
+    if (pNetif->flags & ESP_NETIF_FLAG_GARP)
+    {
+        // announce the lease like lwIP does, the root learns the node's address from it
+        arpOutput(pNetif, 1, NULL, pNetif->ipInfo.ip.addr);
+    }
+    pthread_mutex_unlock(&stackLock);
+    ESP_LOGD(TAG, "%s leased " IPSTR, pNetif->desc, IP2STR(&event.ip_info.ip));
+    esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event), portMAX_DELAY);
+}
+
+void esp_netif_action_disconnected(void* netif, esp_event_base_t base, int32_t id, void* data)
+{
+    esp_netif_t* pNetif = netif;
+    pthread_mutex_lock(&stackLock);
+    pNetif->connected = false;
+    if (pNetif->flags & ESP_NETIF_DHCP_CLIENT)
+    {
+        pNetif->hasIp = false;
+    }
+    pthread_mutex_unlock(&stackLock);
+}
+
+void esp_netif_action_got_ip(void* netif, esp_event_base_t base, int32_t id, void* data)
+{
+}
+
+void ip_napt_enable(uint32_t addr, int enable)
+{
+    // addresses are not translated, the simulated router routes the mesh subnet to the root instead
+    pthread_mutex_lock(&stackLock);
+    forwarding = enable != 0;
+    pthread_mutex_unlock(&stackLock);
+}
@@ -0,0 +1,232 @@
+/*
+ * OTA updates of a simulated node: the two app partitions of partitions.csv held in memory, the node always
+ * runs from ota_0 and esp_ota_end() only checks the magic byte of the image header
+ */
+#include "sim.h"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OTA_PARTITIONS    (2)
+#define OTA_PARTITION_SIZE (0x180000)
+#define OTA_IMAGE_MAGIC   (0xE9)
+
+typedef struct
+{
+    uint8_t* pData;
+    size_t len;       // bytes of the image
+    size_t written;   // end of the sequential writes
+    bool open;
+} simPartition_t;
+
+static const char* TAG = "sim_ota";
+static const esp_partition_t partitions[OTA_PARTITIONS] = {
+    { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0, .address = 0x10000,
+      .size = OTA_PARTITION_SIZE, .label = "ota_0" },
+    { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1, .address = 0x190000,
+      .size = OTA_PARTITION_SIZE, .label = "ota_1" },
+};
+static simPartition_t simPartitions[OTA_PARTITIONS];
+static pthread_mutex_t otaLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t crc32(const uint8_t* pData, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= pData[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static simPartition_t* partitionOf(const esp_partition_t* partition)
+{
+    return partition >= partitions && partition < partitions + OTA_PARTITIONS
+            ? &simPartitions[partition - partitions] : NULL;
+}
+
+// Handles are the partition index plus one
+static simPartition_t* handleOf(esp_ota_handle_t handle)
+{
+    return handle >= 1 && handle <= OTA_PARTITIONS && simPartitions[handle - 1].open
+            ? &simPartitions[handle - 1] : NULL;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void)
+{
+    return &partitions[0];
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+    return &partitions[1];
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state)
+{
+    *ota_state = partition == &partitions[0] ? ESP_OTA_IMG_VALID : ESP_OTA_IMG_UNDEFINED;
+    return partitionOf(partition) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    esp_restart();
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle)
+{
+    simPartition_t* pPartition = partitionOf(partition);
+    size_t len = image_size == OTA_SIZE_UNKNOWN ? partition->size : image_size;
+
+    if (pPartition == NULL || partition == esp_ota_get_running_partition())
+    {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+    if (len > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&otaLock);
+    free(pPartition->pData);
+    // erased flash reads as 0xFF
+    pPartition->pData = malloc(len);
+    if (pPartition->pData)
+    {
+        memset(pPartition->pData, 0xFF, len);
+    }
+    pPartition->len = len;
+    pPartition->written = 0;
+    pPartition->open = pPartition->pData != NULL;
+    *out_handle = pPartition - simPartitions + 1;
+    pthread_mutex_unlock(&otaLock);
+    return pPartition->pData ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_ota_write_with_offset(esp_ota_handle_t handle, const void* data, size_t size, uint32_t offset)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&otaLock);
+    simPartition_t* pPartition = handleOf(handle);
+    if (pPartition == NULL)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    else if (offset + size > pPartition->len)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else
+    {
+        memcpy(pPartition->pData + offset, data, size);
+    }
+    pthread_mutex_unlock(&otaLock);
+    return err;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size)
+{
+    pthread_mutex_lock(&otaLock);
+    simPartition_t* pPartition = handleOf(handle);
+    size_t offset = pPartition ? pPartition->written : 0;
+    pthread_mutex_unlock(&otaLock);
+    esp_err_t err = esp_ota_write_with_offset(handle, data, size, offset);
+    if (err == ESP_OK)
+    {
+        pthread_mutex_lock(&otaLock);
+        pPartition->written = offset + size;
+        pthread_mutex_unlock(&otaLock);
+    }
+    return err;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    pthread_mutex_lock(&otaLock);
+    simPartition_t* pPartition = handleOf(handle);
+    if (pPartition)
+    {
+        pPartition->open = false;
+    }
+    pthread_mutex_unlock(&otaLock);
+    return pPartition ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&otaLock);
+    simPartition_t* pPartition = handleOf(handle);
+    if (pPartition == NULL)
+    {
+        pthread_mutex_unlock(&otaLock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    pPartition->open = false;
+    // an image written sequentially ends where the writes ended
+    if (pPartition->written)
+    {
+        pPartition->len = pPartition->written;
+    }
+    if (pPartition->len == 0 || pPartition->pData[0] != OTA_IMAGE_MAGIC)
+    {
+        err = ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    ESP_LOGI(TAG, "Image of %u bytes in %s, crc32 %08x, %s", (unsigned)pPartition->len,
+            partitions[handle - 1].label, crc32(pPartition->pData, pPartition->len), err == ESP_OK ? "valid" : "invalid");
+    pthread_mutex_unlock(&otaLock);
+    return err;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    if (partitionOf(partition) == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Boot partition %s", partition->label);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    esp_err_t err = ESP_OK;
+    simPartition_t* pPartition = partitionOf(partition);
+
+    if (pPartition == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&otaLock);
+    if (src_offset + size > partition->size)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else
+    {
+        // flash beyond the image is erased
+        for (size_t i = 0; i < size; i++)
+        {
+            ((uint8_t*)dst)[i] = src_offset + i < pPartition->len ? pPartition->pData[src_offset + i] : 0xFF;
+        }
+    }
+    pthread_mutex_unlock(&otaLock);
+    return err;
+}
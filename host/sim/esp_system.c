@@ -0,0 +1,517 @@
+/*
+ * System services of a simulated node: logging, errors, random numbers, heap figures,
+ * the boot button, an in-memory NVS kept in a file across runs if given one, esp_timer and the console
+ */
+#include "sim.h"
+
+#include "driver/gpio.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUTTON_PRESS_us   (150 * 1000) // longer than the 50 ms poll period of the button job
+#define NVS_MAX_ENTRIES   (32)
+#define NVS_KEY_MAX       (32)
+#define NVS_VALUE_MAX     (512)
+#define SIM_HEAP_SIZE     (300 * 1024)
+
+typedef struct
+{
+    char key[NVS_KEY_MAX];
+    size_t len;
+    uint8_t value[NVS_VALUE_MAX];
+} nvsEntry_t;
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    uint64_t periodUs;
+    int64_t dueUs;       // 0 when stopped
+    struct esp_timer* pNext;
+};
+
+static int logLevel = ESP_LOG_INFO;
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t bootUs = 0;
+static volatile int64_t buttonReleaseUs = 0;
+static gpio_isr_t buttonIsr = NULL;
+static void* buttonIsrArg = NULL;
+static gpio_int_type_t buttonIntrType = GPIO_INTR_DISABLE;
+static nvsEntry_t nvsEntries[NVS_MAX_ENTRIES];
+static pthread_mutex_t nvsLock = PTHREAD_MUTEX_INITIALIZER;
+static const char* pNvsPath = NULL;
+static struct esp_timer* pTimers = NULL;
+static pthread_mutex_t timerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timerCond;
+static bool timerTaskStarted = false;
+
+int64_t simNowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+}
+
+// Logging
+void simLogSetLevel(int level)
+{
+    logLevel = level;
+    bootUs = simNowUs();
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)((simNowUs() - bootUs) / 1000);
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list args;
+
+    if ((int)level > logLevel)
+    {
+        return;
+    }
+    pthread_mutex_lock(&logLock);
+    fprintf(stderr, "%c (%u) [%d] %s: ", letters[level], esp_log_timestamp(), simNodeId(), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&logLock);
+}
+
+// Errors
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_MESH_EXCEED_MTU:
+            return "ESP_ERR_MESH_EXCEED_MTU";
+        case ESP_ERR_MESH_QUEUE_FULL:
+            return "ESP_ERR_MESH_QUEUE_FULL";
+        case ESP_ERR_MESH_NO_ROUTE_FOUND:
+            return "ESP_ERR_MESH_NO_ROUTE_FOUND";
+        case ESP_ERR_MESH_ARGUMENT:
+            return "ESP_ERR_MESH_ARGUMENT";
+        case ESP_ERR_MESH_NOT_START:
+            return "ESP_ERR_MESH_NOT_START";
+        case ESP_ERR_MESH_TIMEOUT:
+            return "ESP_ERR_MESH_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND:
+            return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_OTA_PARTITION_CONFLICT:
+            return "ESP_ERR_OTA_PARTITION_CONFLICT";
+        case ESP_ERR_OTA_VALIDATE_FAILED:
+            return "ESP_ERR_OTA_VALIDATE_FAILED";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+void _esp_error_check_failed(esp_err_t rc, const char* file, int line, const char* function, const char* expression)
+{
+    fprintf(stderr, "[%d] ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n", simNodeId(), rc,
+            esp_err_to_name(rc), file, line, expression);
+    abort();
+}
+
+// System
+uint32_t esp_random(void)
+{
+    static __thread unsigned int seed = 0;
+    if (seed == 0)
+    {
+        seed = (unsigned int)(simNowUs() ^ (getpid() << 16) ^ (uintptr_t)&seed);
+    }
+    return ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return SIM_HEAP_SIZE;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return SIM_HEAP_SIZE;
+}
+
+void esp_restart(void)
+{
+    ESP_LOGE("sim", "esp_restart() is not simulated, exiting");
+    exit(1);
+}
+
+// Boot button, pressed by the coordinator
+void simButtonPress(void)
+{
+    buttonReleaseUs = simNowUs() + BUTTON_PRESS_us;
+    // the press is a falling edge, the release is not signalled
+    if (buttonIsr && (buttonIntrType == GPIO_INTR_NEGEDGE || buttonIntrType == GPIO_INTR_ANYEDGE))
+    {
+        buttonIsr(buttonIsrArg);
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t* cfg)
+{
+    buttonIntrType = cfg->intr_type;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    return simNowUs() < buttonReleaseUs ? 0 : 1;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    return ESP_OK;
+}
+
+// The only input is the boot button
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr, void* args)
+{
+    buttonIsrArg = args;
+    buttonIsr = isr;
+    return ESP_OK;
+}
+
+// NVS, one namespace shared by all handles, written to the file of simNvsLoad() on every commit
+void simNvsLoad(const char* pPath)
+{
+    FILE* pFile = fopen(pPath, "rb");
+
+    pNvsPath = pPath;
+    if (pFile)
+    {
+        if (fread(nvsEntries, sizeof(nvsEntries), 1, pFile) != 1)
+        {
+            memset(nvsEntries, 0, sizeof(nvsEntries));
+        }
+        fclose(pFile);
+    }
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&nvsLock);
+    memset(nvsEntries, 0, sizeof(nvsEntries));
+    pthread_mutex_unlock(&nvsLock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* ns, nvs_open_mode_t mode, nvs_handle_t* handle)
+{
+    *handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    esp_err_t err = ESP_OK;
+
+    if (pNvsPath == NULL)
+    {
+        return ESP_OK;
+    }
+    pthread_mutex_lock(&nvsLock);
+    FILE* pFile = fopen(pNvsPath, "wb");
+    if (pFile == NULL || fwrite(nvsEntries, sizeof(nvsEntries), 1, pFile) != 1)
+    {
+        err = ESP_FAIL;
+    }
+    if (pFile)
+    {
+        fclose(pFile);
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+static nvsEntry_t* nvsFind(const char* key, bool create)
+{
+    nvsEntry_t* pFree = NULL;
+    for (int i = 0; i < NVS_MAX_ENTRIES; i++)
+    {
+        if (nvsEntries[i].key[0] == '\0')
+        {
+            pFree = pFree ? pFree : &nvsEntries[i];
+        }
+        else if (strncmp(nvsEntries[i].key, key, NVS_KEY_MAX) == 0)
+        {
+            return &nvsEntries[i];
+        }
+    }
+    if (create && pFree)
+    {
+        strncpy(pFree->key, key, NVS_KEY_MAX - 1);
+        return pFree;
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out, size_t* len)
+{
+    esp_err_t err = ESP_OK;
+    pthread_mutex_lock(&nvsLock);
+    nvsEntry_t* pEntry = nvsFind(key, false);
+    if (pEntry == NULL)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else if (out == NULL)
+    {
+        *len = pEntry->len;
+    }
+    else if (*len < pEntry->len)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else
+    {
+        memcpy(out, pEntry->value, pEntry->len);
+        *len = pEntry->len;
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t len)
+{
+    esp_err_t err = ESP_OK;
+    if (len > NVS_VALUE_MAX)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&nvsLock);
+    nvsEntry_t* pEntry = nvsFind(key, true);
+    if (pEntry == NULL)
+    {
+        err = ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    else
+    {
+        memcpy(pEntry->value, value, len);
+        pEntry->len = len;
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out)
+{
+    size_t len = sizeof(*out);
+    return nvs_get_blob(handle, key, out, &len);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    pthread_mutex_lock(&nvsLock);
+    nvsEntry_t* pEntry = nvsFind(key, false);
+    if (pEntry)
+    {
+        memset(pEntry, 0, sizeof(*pEntry));
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvsLock);
+    return err;
+}
+
+// esp_timer, callbacks run on one timer task like ESP_TIMER_TASK dispatch
+int64_t esp_timer_get_time(void)
+{
+    return simNowUs() - bootUs;
+}
+
+static void timerTask(void* arg)
+{
+    pthread_mutex_lock(&timerLock);
+    while (1)
+    {
+        struct esp_timer* pDue = NULL;
+        int64_t now = esp_timer_get_time();
+        int64_t next = INT64_MAX;
+        for (struct esp_timer* pTimer = pTimers; pTimer; pTimer = pTimer->pNext)
+        {
+            if (pTimer->dueUs && pTimer->dueUs <= now)
+            {
+                pDue = pTimer;
+                break;
+            }
+            if (pTimer->dueUs && pTimer->dueUs < next)
+            {
+                next = pTimer->dueUs;
+            }
+        }
+        if (pDue)
+        {
+            pDue->dueUs = pDue->periodUs ? pDue->dueUs + pDue->periodUs : 0;
+            esp_timer_cb_t callback = pDue->callback;
+            void* callbackArg = pDue->arg;
+            pthread_mutex_unlock(&timerLock);
+            callback(callbackArg);
+            pthread_mutex_lock(&timerLock);
+            continue;
+        }
+        if (next == INT64_MAX)
+        {
+            pthread_cond_wait(&timerCond, &timerLock);
+            continue;
+        }
+        struct timespec deadline;
+        int64_t deadlineUs = bootUs + next;
+        deadline.tv_sec = deadlineUs / 1000000;
+        deadline.tv_nsec = (deadlineUs % 1000000) * 1000;
+        pthread_cond_timedwait(&timerCond, &timerLock, &deadline);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out)
+{
+    struct esp_timer* pTimer = calloc(1, sizeof(*pTimer));
+    if (pTimer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    pTimer->callback = args->callback;
+    pTimer->arg = args->arg;
+    pthread_mutex_lock(&timerLock);
+    if (!timerTaskStarted)
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&timerCond, &attr);
+        pthread_condattr_destroy(&attr);
+        xTaskCreate(timerTask, "esp_timer", 4096, NULL, 22, NULL);
+        timerTaskStarted = true;
+    }
+    pTimer->pNext = pTimers;
+    pTimers = pTimer;
+    pthread_mutex_unlock(&timerLock);
+    *out = pTimer;
+    return ESP_OK;
+}
+
+static esp_err_t timerStart(esp_timer_handle_t timer, uint64_t timeoutUs, uint64_t periodUs)
+{
+    pthread_mutex_lock(&timerLock);
+    timer->periodUs = periodUs;
+    timer->dueUs = esp_timer_get_time() + timeoutUs;
+    timer->dueUs = timer->dueUs ? timer->dueUs : 1;
+    pthread_cond_signal(&timerCond);
+    pthread_mutex_unlock(&timerLock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timerStart(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timerStart(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timerLock);
+    esp_err_t err = timer->dueUs ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->dueUs = 0;
+    pthread_mutex_unlock(&timerLock);
+    return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timerLock);
+    for (struct esp_timer** ppTimer = &pTimers; *ppTimer; ppTimer = &(*ppTimer)->pNext)
+    {
+        if (*ppTimer == timer)
+        {
+            *ppTimer = timer->pNext;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&timerLock);
+    free(timer);
+    return ESP_OK;
+}
+
+// Console, commands are accepted but no REPL runs as all nodes share the terminal of mesh_sim
+struct esp_console_repl_s
+{
+    int unused;
+};
+
+esp_err_t esp_console_new_repl_uart(const esp_console_dev_uart_config_t* dev_config,
+        const esp_console_repl_config_t* repl_config, esp_console_repl_t** ret_repl)
+{
+    static esp_console_repl_t repl;
+
+    *ret_repl = &repl;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t* cmd)
+{
+    return cmd->command && cmd->func ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_console_start_repl(esp_console_repl_t* repl)
+{
+    return repl ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
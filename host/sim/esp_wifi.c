@@ -0,0 +1,226 @@
+/*
+ * WiFi driver of a simulated node: MAC addresses derived from the node id and the root's
+ * station link to the router, carried over the coordinator connection
+ */
+#include "sim.h"
+
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_wifi_netif.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    esp_netif_driver_base_t base;
+    wifi_interface_t ifx;
+    esp_netif_receive_t rxFn;
+    void* rxArg;
+} wifiDriver_t;
+
+static const char* TAG = "sim_wifi";
+static wifiDriver_t* pStaDriver = NULL;
+static bool wifiStarted = false;
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+
+void simWifiRouterFrame(const uint8_t* pFrame, size_t len)
+{
+    wifiDriver_t* pDriver = __atomic_load_n(&pStaDriver, __ATOMIC_ACQUIRE);
+    if (pDriver == NULL || pDriver->rxFn == NULL)
+    {
+        return;
+    }
+    // freed by wifiFree() once the stack is done with it
+    void* pBuffer = malloc(len);
+    if (pBuffer)
+    {
+        memcpy(pBuffer, pFrame, len);
+        pDriver->rxFn(pDriver->rxArg, pBuffer, len, pBuffer);
+    }
+}
+
+void simWifiStaConnected(void)
+{
+    wifi_event_sta_connected_t event = { .ssid_len = strlen(CONFIG_MESH_ROUTER_SSID), .channel = SIM_CHANNEL,
+            .authmode = WIFI_AUTH_WPA2_PSK };
+    memcpy(event.ssid, CONFIG_MESH_ROUTER_SSID, event.ssid_len);
+    memcpy(event.bssid, simConfig()->parent, sizeof(event.bssid));
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event, sizeof(event), portMAX_DELAY);
+}
+
+static esp_err_t wifiTransmit(void* h, void* buffer, size_t len)
+{
+    wifiDriver_t* pDriver = h;
+    uint8_t msg[sizeof(simMsgFrame_t) + 1514];
+    simMsgFrame_t* pMsg = (simMsgFrame_t*)msg;
+
+    // only the root is associated with the router, frames of other stations have nowhere to go
+    if (pDriver->ifx != WIFI_IF_STA || !simConfig()->isRoot)
+    {
+        return ESP_OK;
+    }
+    if (len > 1514)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pMsg->len = len;
+    memcpy(pMsg->data, buffer, len);
+    return simSend(SIM_MSG_ROUTER_FRAME, pMsg, sizeof(*pMsg) + len);
+}
+
+static void wifiFree(void* h, void* buffer)
+{
+    free(buffer);
+}
+
+static esp_err_t wifiPostAttach(esp_netif_t* netif, esp_netif_iodriver_handle h)
+{
+    wifiDriver_t* pDriver = h;
+    esp_netif_driver_ifconfig_t config = { .handle = h, .transmit = wifiTransmit, .driver_free_rx_buffer = wifiFree };
+    uint8_t mac[6];
+
+    // the netif takes the interface MAC like esp_wifi_default.c does on start
+    esp_wifi_get_mac(pDriver->ifx, mac);
+    esp_netif_set_mac(netif, mac);
+    return esp_netif_set_driver_config(netif, &config);
+}
+
+static esp_err_t wifiAttach(esp_netif_t* netif, wifi_interface_t ifx)
+{
+    wifiDriver_t* pDriver = calloc(1, sizeof(wifiDriver_t));
+    if (pDriver == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    pDriver->base.post_attach = wifiPostAttach;
+    pDriver->ifx = ifx;
+    esp_err_t err = esp_netif_attach(netif, pDriver);
+    if (err == ESP_OK && ifx == WIFI_IF_STA)
+    {
+        __atomic_store_n(&pStaDriver, pDriver, __ATOMIC_RELEASE);
+    }
+    return err;
+}
+
+esp_err_t esp_netif_attach_wifi_station(esp_netif_t* netif)
+{
+    return wifiAttach(netif, WIFI_IF_STA);
+}
+
+esp_err_t esp_netif_attach_wifi_ap(esp_netif_t* netif)
+{
+    return wifiAttach(netif, WIFI_IF_AP);
+}
+
+esp_err_t esp_wifi_register_if_rxcb(wifi_netif_driver_t ifx, esp_netif_receive_t fn, void* arg)
+{
+    wifiDriver_t* pDriver = ifx;
+    if (pDriver == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pDriver->rxArg = arg;
+    pDriver->rxFn = fn;
+    return ESP_OK;
+}
+
+// The default station handlers drive the station netif like esp_wifi_default.c
+static void wifiStaEventHandler(void* arg, esp_event_base_t base, int32_t id, void* data)
+{
+    wifiDriver_t* pDriver = __atomic_load_n(&pStaDriver, __ATOMIC_ACQUIRE);
+    if (pDriver == NULL || pDriver->base.netif == NULL)
+    {
+        return;
+    }
+    switch (id)
+    {
+        case WIFI_EVENT_STA_START:
+            esp_netif_action_start(pDriver->base.netif, base, id, data);
+            break;
+        case WIFI_EVENT_STA_CONNECTED:
+            pDriver->rxFn = esp_netif_receive;
+            pDriver->rxArg = pDriver->base.netif;
+            esp_netif_action_connected(pDriver->base.netif, base, id, data);
+            break;
+        case WIFI_EVENT_STA_DISCONNECTED:
+            esp_netif_action_disconnected(pDriver->base.netif, base, id, data);
+            break;
+        default:
+            break;
+    }
+}
+
+esp_err_t esp_wifi_set_default_wifi_sta_handlers(void)
+{
+    static bool registered = false;
+    if (!registered)
+    {
+        registered = true;
+        return esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifiStaEventHandler, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_clear_default_wifi_driver_and_handlers(void* esp_netif)
+{
+    wifiDriver_t* pDriver = __atomic_load_n(&pStaDriver, __ATOMIC_ACQUIRE);
+    if (pDriver && pDriver->base.netif == esp_netif)
+    {
+        // the driver is leaked on purpose, frames from the router may still be in flight
+        pDriver->base.netif = NULL;
+        pDriver->rxFn = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    if (wifiStarted)
+    {
+        return ESP_OK;
+    }
+    wifiStarted = true;
+    ESP_LOGD(TAG, "WiFi started");
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, portMAX_DELAY);
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    wifiStarted = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6])
+{
+    simNodeStaMac(simNodeId(), mac);
+    mac[5] += (ifx == WIFI_IF_AP);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_channel(uint8_t* primary, wifi_second_chan_t* second)
+{
+    *primary = 1;
+    *second = WIFI_SECOND_CHAN_NONE;
+    return ESP_OK;
+}
@@ -0,0 +1,600 @@
+/*
+ * FreeRTOS on POSIX threads: every task is a detached thread, queues and notifications use
+ * condition variables on CLOCK_MONOTONIC. Priorities and core affinity are ignored, the Linux
+ * scheduler runs all tasks of a node in parallel.
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TASK_STACK_MIN (256 * 1024) // host printf and logging need more stack than the target
+
+struct tskTaskControlBlock
+{
+    TaskFunction_t fn;
+    void* pParams;
+    char name[16];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notifyValue;
+    bool notifyPending;
+    bool running;                             // false once the task ended, for uxTaskGetSystemState
+    struct tskTaskControlBlock* pNext;        // list of all tasks
+};
+
+struct QueueDefinition
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t* pStorage;
+};
+
+struct EventGroupDef
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+static pthread_mutex_t criticalLock;
+static pthread_once_t criticalOnce = PTHREAD_ONCE_INIT;
+static __thread struct tskTaskControlBlock* pCurrentTask = NULL;
+static pthread_mutex_t tasksLock = PTHREAD_MUTEX_INITIALIZER;
+static struct tskTaskControlBlock* pTasks = NULL;
+static struct timespec startTime;
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+
+static void startTimeInit(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+static void condInit(pthread_cond_t* pCond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(pCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Absolute deadline for a wait of ticks, NULL for portMAX_DELAY
+static struct timespec* deadlineGet(TickType_t ticks, struct timespec* pDeadline)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, pDeadline);
+    uint64_t ns = (uint64_t)ticks * (1000000000ull / configTICK_RATE_HZ) + pDeadline->tv_nsec;
+    pDeadline->tv_sec += ns / 1000000000ull;
+    pDeadline->tv_nsec = ns % 1000000000ull;
+    return pDeadline;
+}
+
+// Returns false once the deadline passed
+static bool condWait(pthread_cond_t* pCond, pthread_mutex_t* pLock, const struct timespec* pDeadline)
+{
+    if (pDeadline == NULL)
+    {
+        pthread_cond_wait(pCond, pLock);
+        return true;
+    }
+    return pthread_cond_timedwait(pCond, pLock, pDeadline) != ETIMEDOUT;
+}
+
+// Critical sections
+static void criticalInit(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&criticalLock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void vPortEnterCritical(portMUX_TYPE* mux)
+{
+    pthread_once(&criticalOnce, criticalInit);
+    pthread_mutex_lock(&criticalLock);
+}
+
+void vPortExitCritical(portMUX_TYPE* mux)
+{
+    pthread_mutex_unlock(&criticalLock);
+}
+
+// Tasks
+static void taskEnd(void)
+{
+    pthread_mutex_lock(&tasksLock);
+    pCurrentTask->running = false;
+    pthread_mutex_unlock(&tasksLock);
+}
+
+static void* taskEntry(void* arg)
+{
+    pCurrentTask = arg;
+    pCurrentTask->fn(pCurrentTask->pParams);
+    taskEnd();
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* params,
+        UBaseType_t prio, TaskHandle_t* handle, BaseType_t core)
+{
+    struct tskTaskControlBlock* pTask = calloc(1, sizeof(*pTask));
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (pTask == NULL)
+    {
+        return pdFAIL;
+    }
+    pTask->fn = fn;
+    pTask->pParams = params;
+    strncpy(pTask->name, name ? name : "", sizeof(pTask->name) - 1);
+    pthread_mutex_init(&pTask->lock, NULL);
+    condInit(&pTask->cond);
+    pTask->running = true;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, stackDepth * 4 > TASK_STACK_MIN ? stackDepth * 4 : TASK_STACK_MIN);
+    int err = pthread_create(&thread, &attr, taskEntry, pTask);
+    pthread_attr_destroy(&attr);
+    if (err != 0)
+    {
+        free(pTask);
+        return pdFAIL;
+    }
+    // control blocks stay allocated, handles of ended tasks remain valid like the TCBs kept by the idle task
+    pthread_mutex_lock(&tasksLock);
+    pTask->pNext = pTasks;
+    pTasks = pTask;
+    pthread_mutex_unlock(&tasksLock);
+    if (handle)
+    {
+        *handle = pTask;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* params, UBaseType_t prio,
+        TaskHandle_t* handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stackDepth, params, prio, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // threads can only end themselves, tasks deleted by others keep their thread parked
+    if (task == NULL || task == pCurrentTask)
+    {
+        if (pCurrentTask)
+        {
+            taskEnd();
+        }
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec delay = { .tv_sec = ticks / configTICK_RATE_HZ,
+            .tv_nsec = (ticks % configTICK_RATE_HZ) * (1000000000l / configTICK_RATE_HZ) };
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+    {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec now;
+    pthread_once(&startOnce, startTimeInit);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ms = (now.tv_sec - startTime.tv_sec) * 1000ull + (now.tv_nsec - startTime.tv_nsec) / 1000000;
+    return (TickType_t)(ms / portTICK_PERIOD_MS);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return TASK_STACK_MIN / 4;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return pCurrentTask;
+}
+
+char* pcTaskGetName(TaskHandle_t task)
+{
+    task = task ? task : pCurrentTask;
+    // app_main runs on the main thread, which has no control block
+    return task ? task->name : "main";
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    UBaseType_t count = 0;
+
+    pthread_mutex_lock(&tasksLock);
+    for (struct tskTaskControlBlock* pTask = pTasks; pTask; pTask = pTask->pNext)
+    {
+        count += pTask->running;
+    }
+    pthread_mutex_unlock(&tasksLock);
+    return count;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* pStatus, UBaseType_t size, uint32_t* pTotalRunTime)
+{
+    UBaseType_t count = 0;
+
+    pthread_mutex_lock(&tasksLock);
+    for (struct tskTaskControlBlock* pTask = pTasks; pTask && count < size; pTask = pTask->pNext)
+    {
+        if (pTask->running)
+        {
+            memset(&pStatus[count], 0, sizeof(pStatus[count]));
+            pStatus[count].xHandle = pTask;
+            pStatus[count].pcTaskName = pTask->name;
+            pStatus[count].usStackHighWaterMark = uxTaskGetStackHighWaterMark(pTask);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&tasksLock);
+    if (pTotalRunTime)
+    {
+        *pTotalRunTime = 0;
+    }
+    return count;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    struct tskTaskControlBlock* pTask = pCurrentTask;
+    struct timespec deadline;
+    struct timespec* pDeadline = deadlineGet(ticks, &deadline);
+    uint32_t value;
+
+    pthread_mutex_lock(&pTask->lock);
+    while (pTask->notifyValue == 0 && ticks != 0 && condWait(&pTask->cond, &pTask->lock, pDeadline))
+    {
+    }
+    value = pTask->notifyValue;
+    if (value)
+    {
+        pTask->notifyValue = clearOnExit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&pTask->lock);
+    return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, int action)
+{
+    BaseType_t ret = pdPASS;
+
+    pthread_mutex_lock(&task->lock);
+    switch (action)
+    {
+        case eSetBits:
+            task->notifyValue |= value;
+            break;
+        case eIncrement:
+            task->notifyValue++;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (task->notifyPending)
+            {
+                ret = pdFAIL;
+                break;
+            }
+            task->notifyValue = value;
+            break;
+        case eSetValueWithOverwrite:
+            task->notifyValue = value;
+            break;
+        default:
+            break;
+    }
+    task->notifyPending = true;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return ret;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+// Interrupts are threads of the simulator, the notification wakes the task on its own
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* pHigherPriorityTaskWoken)
+{
+    xTaskNotify(task, 0, eIncrement);
+    *pHigherPriorityTaskWoken = pdFALSE;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t ticks)
+{
+    struct tskTaskControlBlock* pTask = pCurrentTask;
+    struct timespec deadline;
+    struct timespec* pDeadline = deadlineGet(ticks, &deadline);
+    BaseType_t ret;
+
+    pthread_mutex_lock(&pTask->lock);
+    if (!pTask->notifyPending)
+    {
+        pTask->notifyValue &= ~clearOnEntry;
+    }
+    while (!pTask->notifyPending && ticks != 0 && condWait(&pTask->cond, &pTask->lock, pDeadline))
+    {
+    }
+    if (value)
+    {
+        *value = pTask->notifyValue;
+    }
+    ret = pTask->notifyPending ? pdTRUE : pdFALSE;
+    if (pTask->notifyPending)
+    {
+        pTask->notifyValue &= ~clearOnExit;
+        pTask->notifyPending = false;
+    }
+    pthread_mutex_unlock(&pTask->lock);
+    return ret;
+}
+
+// Queues
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t itemSize)
+{
+    struct QueueDefinition* pQueue = calloc(1, sizeof(*pQueue) + len * itemSize);
+
+    if (pQueue == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&pQueue->lock, NULL);
+    condInit(&pQueue->notEmpty);
+    condInit(&pQueue->notFull);
+    pQueue->length = len;
+    pQueue->itemSize = itemSize;
+    pQueue->pStorage = (uint8_t*)(pQueue + 1);
+    return pQueue;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (q)
+    {
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->notEmpty);
+        pthread_cond_destroy(&q->notFull);
+        free(q);
+    }
+}
+
+static BaseType_t queueSend(QueueHandle_t q, const void* item, TickType_t ticks, bool toFront)
+{
+    struct timespec deadline;
+    struct timespec* pDeadline = deadlineGet(ticks, &deadline);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->length)
+    {
+        if (ticks == 0 || !condWait(&q->notFull, &q->lock, pDeadline))
+        {
+            pthread_mutex_unlock(&q->lock);
+            return errQUEUE_FULL;
+        }
+    }
+    UBaseType_t slot;
+    if (toFront)
+    {
+        q->head = (q->head + q->length - 1) % q->length;
+        slot = q->head;
+    }
+    else
+    {
+        slot = (q->head + q->count) % q->length;
+    }
+    if (q->itemSize)
+    {
+        memcpy(q->pStorage + slot * q->itemSize, item, q->itemSize);
+    }
+    q->count++;
+    pthread_cond_signal(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+    return queueSend(q, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+    return queueSend(q, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+    return queueSend(q, item, ticks, true);
+}
+
+static BaseType_t queueReceive(QueueHandle_t q, void* item, TickType_t ticks, bool peek)
+{
+    struct timespec deadline;
+    struct timespec* pDeadline = deadlineGet(ticks, &deadline);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+    {
+        if (ticks == 0 || !condWait(&q->notEmpty, &q->lock, pDeadline))
+        {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    if (q->itemSize && item)
+    {
+        memcpy(item, q->pStorage + q->head * q->itemSize, q->itemSize);
+    }
+    if (!peek)
+    {
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_signal(&q->notFull);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks)
+{
+    return queueReceive(q, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t ticks)
+{
+    return queueReceive(q, item, ticks, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->count = 0;
+    q->head = 0;
+    pthread_cond_broadcast(&q->notFull);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t spaces = q->length - q->count;
+    pthread_mutex_unlock(&q->lock);
+    return spaces;
+}
+
+// Semaphores are queues of empty items, a mutex is a binary semaphore created given
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    SemaphoreHandle_t s = xQueueCreate(max, 0);
+    if (s)
+    {
+        s->count = initial;
+    }
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks)
+{
+    return queueReceive(s, NULL, ticks, false);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    return queueSend(s, NULL, 0, false);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s)
+{
+    vQueueDelete(s);
+}
+
+// Event groups
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct EventGroupDef* pGroup = calloc(1, sizeof(*pGroup));
+    if (pGroup)
+    {
+        pthread_mutex_init(&pGroup->lock, NULL);
+        condInit(&pGroup->cond);
+    }
+    return pGroup;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    pthread_mutex_lock(&g->lock);
+    g->bits |= bits;
+    EventBits_t ret = g->bits;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+    return ret;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    pthread_mutex_lock(&g->lock);
+    EventBits_t ret = g->bits;
+    g->bits &= ~bits;
+    pthread_mutex_unlock(&g->lock);
+    return ret;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g)
+{
+    pthread_mutex_lock(&g->lock);
+    EventBits_t ret = g->bits;
+    pthread_mutex_unlock(&g->lock);
+    return ret;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits, BaseType_t clear, BaseType_t all,
+        TickType_t ticks)
+{
+    struct timespec deadline;
+    struct timespec* pDeadline = deadlineGet(ticks, &deadline);
+
+    pthread_mutex_lock(&g->lock);
+    while (!(all ? (g->bits & bits) == bits : (g->bits & bits) != 0))
+    {
+        if (ticks == 0 || !condWait(&g->cond, &g->lock, pDeadline))
+        {
+            break;
+        }
+    }
+    EventBits_t ret = g->bits;
+    bool satisfied = all ? (ret & bits) == bits : (ret & bits) != 0;
+    if (satisfied && clear)
+    {
+        g->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&g->lock);
+    return ret;
+}
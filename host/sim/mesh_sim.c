@@ -0,0 +1,1387 @@
+/*
+ * Coordinator of the host simulator. It starts one mesh_sim_node process per node, places
+ * them in a fixed tree and stands in for the air between them, the router of the root and
+ * the MQTT broker behind it.
+ *
+ * Every tree edge is a half-duplex link with its own airtime, loss and latency: a payload
+ * waits for the link to be free, occupies it for size / bandwidth, is retried up to
+ * HOP_ATTEMPTS times when lost and arrives one hop latency after its last attempt. Payloads
+ * are stored and forwarded hop by hop along the tree path, group sends flood the tree.
+ */
+#include "sim_protocol.h"
+#include "sdkconfig.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MESH_MPS           (1472)
+#define MESH_DATA_TODS     (0x08)
+#define MESH_DATA_GROUP    (0x40)
+#define MAX_NODES          (CONFIG_MESH_ROUTE_TABLE_SIZE)
+#define HOP_ATTEMPTS       (4)
+#define HOP_QUEUE_LEN      (32)   // payloads a link holds before dropping, in MESH_MPS airtimes
+#define GROUPS_MAX         (4)
+#define ROUTER_LINK        (nodeCount)
+#define REPORT_TIMEOUT_us  (5 * 1000 * 1000)
+#define SOCKET_BUFFER      (4 * 1024 * 1024)
+#define ETH_HDR_LEN        (14)
+#define IP_HDR_LEN         (20)
+#define UDP_HDR_LEN        (8)
+#define TOPICS_MAX         (32)
+#define SUBSCRIPTIONS_MAX  (MAX_NODES * 4)
+#define BENCH_TOPIC        "/topic/03c8b0f712023b6d/ip_mesh/bench" // MQTT_BENCH_TOPIC of mqtt_app.h
+#define BENCH_DELAY_us     (5 * 1000 * 1000) // time for the nodes to join and connect to the broker
+#define TRACE_TOPIC        "/topic/03c8b0f712023b6d/ip_mesh/trace" // MQTT_TRACE_TOPIC of mqtt_app.h
+#define TRACE_BEFORE_END_us (5 * 1000 * 1000) // time for the nodes to publish their dumps
+#define OTA_TOPIC          "/topic/03c8b0f712023b6d/ip_mesh/ota" // MQTT_OTA_TOPIC of mqtt_app.h
+#define JOIN_TOPIC         "/topic/03c8b0f712023b6d/ip_mesh/join" // MQTT_JOIN_TOPIC of mqtt_app.h
+#define JOIN_PATHS         (4) // meshJoinPath_t of mesh_join.h
+#define CMD_TOPIC_PREFIX   "/topic/03c8b0f712023b6d/ip_mesh/" // MQTT_CMD_TOPIC_PREFIX of mqtt_app.h
+#define CMD_TOPIC_SUFFIX   "/cmd"
+#define GET_BE16(p)        ((uint16_t)(((p)[0] << 8) | (p)[1]))
+#define PUT_BE16(p, v)     do { (p)[0] = (uint8_t)((v) >> 8); (p)[1] = (uint8_t)(v); } while (0)
+
+typedef enum
+{
+    TOPOLOGY_CHAIN,
+    TOPOLOGY_STAR,
+    TOPOLOGY_TREE,
+} topology_t;
+
+typedef enum
+{
+    EVENT_MESH_DELIVER, // mesh payload arrives at node
+    EVENT_ROUTER_OUT,   // ethernet frame from the router arrives at the root
+    EVENT_ROUTER_IN,    // ethernet frame from the root arrives at the router
+} eventKind_t;
+
+typedef struct
+{
+    int64_t dueUs;
+    uint64_t seq;    // keeps events due at the same time in order
+    eventKind_t kind;
+    int node;
+    size_t len;
+    uint8_t* pMsg;
+} event_t;
+
+typedef struct
+{
+    int fd;
+    pid_t pid;
+    int parent;
+    int layer;
+    int firstChild;
+    int nextSibling;
+    uint8_t groups[GROUPS_MAX][SIM_MAC_LEN];
+    int groupCount;
+    bool reported;
+    int64_t startUs;
+    int64_t reportUs;
+    simMsgReport_t report;
+} node_t;
+
+typedef struct
+{
+    int64_t busyUntilUs;
+    uint64_t payloads;
+    uint64_t bytes;
+} link_t;
+
+typedef struct
+{
+    char name[96];
+    uint64_t count;
+    uint64_t forwarded;
+    uint64_t bytes;         // payload bytes of the publishes
+    size_t latencyCap;
+    int64_t* pLatencyUs;
+} topicStats_t;
+
+typedef struct
+{
+    uint32_t ip;
+    uint16_t port;
+    char topic[96];
+} subscription_t;
+
+typedef struct
+{
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t deliveredBytes;
+    uint64_t retries;
+    uint64_t lost;
+    uint64_t queueDrops;
+    uint64_t unroutable;
+    uint64_t overflow;      // node connection full, payload dropped
+    uint64_t routerUp;
+    uint64_t routerDown;
+    uint64_t outageDrops;   // frames of the router link lost to the outage of -O
+    uint64_t connects;
+    uint64_t disconnects;   // sessions ended by their client, a root that lost its role
+    uint64_t publishes;
+    uint32_t joins[JOIN_PATHS]; // join reports of the nodes by path
+    uint32_t joinIpMsSum;       // time from esp_mesh_start() to the IP address over all join reports
+    uint32_t joinIpMsMax;
+    uint32_t flaps;             // parent losses of -F
+} simStats_t;
+
+static const uint8_t routerMac[SIM_MAC_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t meshId[SIM_MAC_LEN] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x76 };
+
+static int nodeCount = 10;
+static topology_t topology = TOPOLOGY_TREE;
+static int fanout = 3;
+static int64_t hopLatencyUs = 2000;
+static uint32_t bandwidthKbps = 6000;
+static double lossRate = 0.0;
+static int mtu = MESH_MPS;
+static int durationS = 30;
+static int buttonIntervalMs = 0;
+static int flapIntervalMs = 0;
+static int flapDownMs = 0;
+static int logLevel = 1;
+static unsigned int seed = 1;
+static const char* pBenchCommand = NULL;
+static const char* pNodeCommand = NULL;
+static const char* pOtaUrl = NULL;
+static const char* pNvsDir = NULL;
+static int outageStartS = -1;
+static int outageS = 0;
+static bool outage = false;
+static bool traceDump = false;
+
+static node_t* nodes = NULL;
+static link_t* links = NULL;
+static event_t* events = NULL;
+static size_t eventCount = 0;
+static size_t eventCap = 0;
+static uint64_t eventSeq = 0;
+static simStats_t stats = { 0 };
+static topicStats_t topics[TOPICS_MAX];
+static int topicCount = 0;
+static subscription_t subscriptions[SUBSCRIPTIONS_MAX];
+static int subscriptionCount = 0;
+static uint16_t routerIpId = 0;
+
+static int64_t nowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+}
+
+// Event queue, a binary min-heap on due time
+static bool eventBefore(const event_t* pA, const event_t* pB)
+{
+    return pA->dueUs < pB->dueUs || (pA->dueUs == pB->dueUs && pA->seq < pB->seq);
+}
+
+static void eventPush(int64_t dueUs, eventKind_t kind, int node, const void* pMsg, size_t len)
+{
+    if (eventCount == eventCap)
+    {
+        eventCap = eventCap ? eventCap * 2 : 1024;
+        events = realloc(events, eventCap * sizeof(event_t));
+    }
+    event_t event = { .dueUs = dueUs, .seq = eventSeq++, .kind = kind, .node = node, .len = len,
+            .pMsg = malloc(len) };
+    memcpy(event.pMsg, pMsg, len);
+    size_t i = eventCount++;
+    while (i > 0 && eventBefore(&event, &events[(i - 1) / 2]))
+    {
+        events[i] = events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    events[i] = event;
+}
+
+static event_t eventPop(void)
+{
+    event_t top = events[0];
+    event_t last = events[--eventCount];
+    size_t i = 0;
+    while (2 * i + 1 < eventCount)
+    {
+        size_t child = 2 * i + 1;
+        if (child + 1 < eventCount && eventBefore(&events[child + 1], &events[child]))
+        {
+            child++;
+        }
+        if (!eventBefore(&events[child], &last))
+        {
+            break;
+        }
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = last;
+    return top;
+}
+
+// Node connections
+static void nodeSend(int node, simMsgType_t type, void* pMsg, size_t len)
+{
+    simMsgHeader_t* pHeader = pMsg;
+    pHeader->type = type;
+    pHeader->nodeId = node;
+    if (nodes[node].fd < 0)
+    {
+        return;
+    }
+    // never block on a node, a stalled node loses payloads like a radio with a full rx queue
+    if (send(nodes[node].fd, pMsg, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len)
+    {
+        stats.overflow++;
+    }
+}
+
+// Link model
+static int64_t airtimeUs(size_t size)
+{
+    return (int64_t)size * 8 * 1000 / bandwidthKbps;
+}
+
+static bool lossDraw(void)
+{
+    return lossRate > 0 && (double)rand_r(&seed) / RAND_MAX < lossRate;
+}
+
+// Returns the arrival time of a payload handed to a link at t, -1 if it is dropped or lost
+static int64_t hopTransmit(int link, size_t size, int64_t t)
+{
+    link_t* pLink = &links[link];
+    int64_t start = t > pLink->busyUntilUs ? t : pLink->busyUntilUs;
+
+    if (start - t > airtimeUs(MESH_MPS) * HOP_QUEUE_LEN)
+    {
+        stats.queueDrops++;
+        return -1;
+    }
+    for (int attempt = 0; attempt < HOP_ATTEMPTS; attempt++)
+    {
+        start += airtimeUs(size);
+        pLink->busyUntilUs = start;
+        if (!lossDraw())
+        {
+            pLink->payloads++;
+            pLink->bytes += size;
+            return start + hopLatencyUs;
+        }
+        // the missing ack is noticed after a hop latency
+        stats.retries++;
+        start += hopLatencyUs;
+    }
+    stats.lost++;
+    return -1;
+}
+
+// Returns the arrival time at dst of a payload sent by src at t, store and forward along the tree path
+static int64_t pathTransmit(int src, int dst, size_t size, int64_t t)
+{
+    int upLinks[MAX_NODES];
+    int downLinks[MAX_NODES];
+    int up = 0;
+    int down = 0;
+    int a = src;
+    int b = dst;
+
+    while (a != b)
+    {
+        if (nodes[a].layer >= nodes[b].layer)
+        {
+            upLinks[up++] = a;
+            a = nodes[a].parent;
+        }
+        else
+        {
+            downLinks[down++] = b;
+            b = nodes[b].parent;
+        }
+    }
+    for (int i = 0; i < up && t >= 0; i++)
+    {
+        t = hopTransmit(upLinks[i], size, t);
+    }
+    for (int i = down - 1; i >= 0 && t >= 0; i--)
+    {
+        t = hopTransmit(downLinks[i], size, t);
+    }
+    return t;
+}
+
+static bool nodeInGroup(int node, const uint8_t* pGroup)
+{
+    for (int i = 0; i < nodes[node].groupCount; i++)
+    {
+        if (memcmp(nodes[node].groups[i], pGroup, SIM_MAC_LEN) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void meshDeliverAt(int64_t dueUs, int dst, int src, const simMsgMesh_t* pSent)
+{
+    uint8_t buffer[sizeof(simMsgMesh_t) + MESH_MPS];
+    simMsgMesh_t* pMsg = (simMsgMesh_t*)buffer;
+
+    *pMsg = *pSent;
+    simNodeStaMac(src, pMsg->addr);
+    memcpy(pMsg->data, pSent->data, pSent->len);
+    eventPush(dueUs, EVENT_MESH_DELIVER, dst, pMsg, sizeof(*pMsg) + pSent->len);
+}
+
+// Flood the tree from src, every member of the group receives one copy
+static void meshGroupSend(int src, const simMsgMesh_t* pMsg, int64_t t)
+{
+    int* pQueue = malloc(nodeCount * sizeof(int));
+    int64_t* pArrival = malloc(nodeCount * sizeof(int64_t));
+    int* pFrom = malloc(nodeCount * sizeof(int));
+    int head = 0;
+    int tail = 0;
+
+    for (int i = 0; i < nodeCount; i++)
+    {
+        pArrival[i] = -1;
+    }
+    pArrival[src] = t;
+    pFrom[src] = -1;
+    pQueue[tail++] = src;
+    while (head < tail)
+    {
+        int node = pQueue[head++];
+        int neighbours[1 + MAX_NODES];
+        int count = 0;
+        if (nodes[node].parent >= 0)
+        {
+            neighbours[count++] = nodes[node].parent;
+        }
+        for (int child = nodes[node].firstChild; child >= 0; child = nodes[child].nextSibling)
+        {
+            neighbours[count++] = child;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int next = neighbours[i];
+            if (next == pFrom[node] || pArrival[next] >= 0)
+            {
+                continue;
+            }
+            int link = nodes[next].parent == node ? next : node;
+            pArrival[next] = hopTransmit(link, pMsg->len, pArrival[node]);
+            if (pArrival[next] < 0)
+            {
+                continue; // the subtree behind a lost hop misses the payload
+            }
+            pFrom[next] = node;
+            pQueue[tail++] = next;
+            if (nodeInGroup(next, pMsg->addr))
+            {
+                meshDeliverAt(pArrival[next], next, src, pMsg);
+            }
+        }
+    }
+    free(pQueue);
+    free(pArrival);
+    free(pFrom);
+}
+
+static void meshSend(int src, const simMsgMesh_t* pMsg, size_t len)
+{
+    int64_t now = nowUs();
+    int dst;
+
+    if (len < sizeof(*pMsg) || sizeof(*pMsg) + pMsg->len > len)
+    {
+        return;
+    }
+    stats.sent++;
+    if (pMsg->flag & MESH_DATA_GROUP)
+    {
+        meshGroupSend(src, pMsg, now);
+        return;
+    }
+    dst = (pMsg->flag & MESH_DATA_TODS) ? 0 : simNodeFromMac(pMsg->addr);
+    if (dst < 0 || dst >= nodeCount)
+    {
+        stats.unroutable++;
+        return;
+    }
+    int64_t arrival = dst == src ? now : pathTransmit(src, dst, pMsg->len, now);
+    if (arrival >= 0)
+    {
+        meshDeliverAt(arrival, dst, src, pMsg);
+    }
+}
+
+// Router and broker
+static uint16_t ipChecksum(const uint8_t* pData, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+    {
+        sum += GET_BE16(pData + i);
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static void routerToRoot(const uint8_t* pFrame, size_t len)
+{
+    uint8_t buffer[sizeof(simMsgFrame_t) + ETH_HDR_LEN + 1500];
+    simMsgFrame_t* pMsg = (simMsgFrame_t*)buffer;
+
+    if (outage)
+    {
+        stats.outageDrops++;
+        return;
+    }
+    int64_t arrival = hopTransmit(ROUTER_LINK, len, nowUs());
+    if (arrival < 0)
+    {
+        return;
+    }
+    stats.routerDown++;
+    pMsg->len = len;
+    memcpy(pMsg->data, pFrame, len);
+    eventPush(arrival, EVENT_ROUTER_OUT, 0, pMsg, sizeof(*pMsg) + len);
+}
+
+// The mesh subnet is routed to the root's station, so every reply goes to its MAC
+static void routerUdpSend(uint32_t dstIp, uint16_t dstPort, const void* pData, size_t len)
+{
+    uint8_t frame[ETH_HDR_LEN + 1500];
+    uint8_t* pIp = frame + ETH_HDR_LEN;
+    uint8_t* pUdp = pIp + IP_HDR_LEN;
+    uint32_t srcIp = htonl(SIM_ROUTER_IP);
+
+    if (len > 1500 - IP_HDR_LEN - UDP_HDR_LEN)
+    {
+        return;
+    }
+    simNodeStaMac(0, frame);
+    memcpy(frame + 6, routerMac, SIM_MAC_LEN);
+    PUT_BE16(frame + 12, 0x0800);
+    memset(pIp, 0, IP_HDR_LEN);
+    pIp[0] = 0x45;
+    PUT_BE16(pIp + 2, IP_HDR_LEN + UDP_HDR_LEN + len);
+    PUT_BE16(pIp + 4, routerIpId);
+    routerIpId++;
+    pIp[8] = 64;
+    pIp[9] = 17;
+    memcpy(pIp + 12, &srcIp, 4);
+    memcpy(pIp + 16, &dstIp, 4);
+    uint16_t sum = ipChecksum(pIp, IP_HDR_LEN);
+    PUT_BE16(pIp + 10, sum);
+    PUT_BE16(pUdp, SIM_BROKER_PORT);
+    PUT_BE16(pUdp + 2, dstPort);
+    PUT_BE16(pUdp + 4, UDP_HDR_LEN + len);
+    PUT_BE16(pUdp + 6, 0);
+    memcpy(pUdp + UDP_HDR_LEN, pData, len);
+    routerToRoot(frame, ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN + len);
+}
+
+static topicStats_t* topicGet(const char* pName, size_t len)
+{
+    for (int i = 0; i < topicCount; i++)
+    {
+        if (strlen(topics[i].name) == len && memcmp(topics[i].name, pName, len) == 0)
+        {
+            return &topics[i];
+        }
+    }
+    if (topicCount == TOPICS_MAX || len >= sizeof(topics[0].name))
+    {
+        return NULL;
+    }
+    topicStats_t* pTopic = &topics[topicCount++];
+    memcpy(pTopic->name, pName, len);
+    return pTopic;
+}
+
+static void brokerReply(uint32_t ip, uint16_t port, simMqttType_t type, uint16_t msgId)
+{
+    simMqttMsg_t reply = { .type = type, .msgId = msgId, .sentUs = nowUs() };
+    routerUdpSend(ip, port, &reply, sizeof(reply));
+}
+
+// Returns whether a topic matches a subscription filter with the MQTT wildcards '+' and '#'
+// Count a join report of a node, "<mac> layer:<layer> path:<path> channel:<channel> parent:<ms> ms ip:<ms> ms"
+static void joinRecord(const char* pData, size_t len)
+{
+    static const char* const pathNames[JOIN_PATHS] = { "pending", "scan", "fast", "fallback" };
+    char text[128];
+    char path[16];
+    unsigned int ipMs;
+    const char* pPath;
+    const char* pIp;
+
+    snprintf(text, sizeof(text), "%.*s", (int)len, pData);
+    pPath = strstr(text, "path:");
+    pIp = strstr(text, " ip:");
+    if (pPath == NULL || pIp == NULL || sscanf(pPath, "path:%15s", path) != 1 || sscanf(pIp, " ip:%u", &ipMs) != 1)
+    {
+        return;
+    }
+    for (int i = 0; i < JOIN_PATHS; i++)
+    {
+        if (strcmp(path, pathNames[i]) == 0)
+        {
+            stats.joins[i]++;
+        }
+    }
+    stats.joinIpMsSum += ipMs;
+    stats.joinIpMsMax = ipMs > stats.joinIpMsMax ? ipMs : stats.joinIpMsMax;
+}
+
+static bool topicMatch(const char* pFilter, const char* pTopic, size_t len)
+{
+    const char* pEnd = pTopic + len;
+
+    if (len && pTopic[0] == '$' && (pFilter[0] == '+' || pFilter[0] == '#'))
+    {
+        return false;
+    }
+    while (*pFilter)
+    {
+        if (pFilter[0] == '#')
+        {
+            return true;
+        }
+        if (pFilter[0] == '+')
+        {
+            while (pTopic < pEnd && *pTopic != '/')
+            {
+                pTopic++;
+            }
+            pFilter++;
+        }
+        else
+        {
+            while (*pFilter && *pFilter != '/' && pTopic < pEnd && *pFilter == *pTopic)
+            {
+                pFilter++;
+                pTopic++;
+            }
+            if ((*pFilter && *pFilter != '/') || (pTopic < pEnd && *pTopic != '/'))
+            {
+                return false;
+            }
+        }
+        if (*pFilter == '\0')
+        {
+            break;
+        }
+        // "a/#" matches "a" as well
+        if (pTopic == pEnd)
+        {
+            return strcmp(pFilter, "/#") == 0;
+        }
+        pFilter++;
+        pTopic++;
+    }
+    return pTopic == pEnd;
+}
+
+static void brokerInput(uint32_t ip, uint16_t port, const uint8_t* pData, size_t len)
+{
+    const simMqttMsg_t* pMsg = (const simMqttMsg_t*)pData;
+
+    if (len < sizeof(*pMsg) || sizeof(*pMsg) + pMsg->topicLen + pMsg->dataLen > len)
+    {
+        return;
+    }
+    switch (pMsg->type)
+    {
+        case SIM_MQTT_CONNECT:
+            stats.connects++;
+            brokerReply(ip, port, SIM_MQTT_CONNACK, pMsg->msgId);
+            break;
+        case SIM_MQTT_PINGREQ:
+            brokerReply(ip, port, SIM_MQTT_PINGRESP, pMsg->msgId);
+            break;
+        case SIM_MQTT_DISCONNECT:
+            // clean session: the subscriptions end with it
+            for (int i = 0; i < subscriptionCount; i++)
+            {
+                if (subscriptions[i].ip == ip && subscriptions[i].port == port)
+                {
+                    subscriptions[i--] = subscriptions[--subscriptionCount];
+                }
+            }
+            stats.disconnects++;
+            break;
+        case SIM_MQTT_SUBSCRIBE:
+        {
+            bool known = false;
+            for (int i = 0; i < subscriptionCount; i++)
+            {
+                known |= subscriptions[i].ip == ip && subscriptions[i].port == port
+                        && strlen(subscriptions[i].topic) == pMsg->topicLen
+                        && memcmp(subscriptions[i].topic, pMsg->payload, pMsg->topicLen) == 0;
+            }
+            if (!known && subscriptionCount < SUBSCRIPTIONS_MAX && pMsg->topicLen < sizeof(subscriptions[0].topic))
+            {
+                subscription_t* pSub = &subscriptions[subscriptionCount++];
+                pSub->ip = ip;
+                pSub->port = port;
+                memcpy(pSub->topic, pMsg->payload, pMsg->topicLen);
+                pSub->topic[pMsg->topicLen] = '\0';
+            }
+            brokerReply(ip, port, SIM_MQTT_SUBACK, pMsg->msgId);
+            break;
+        }
+        case SIM_MQTT_PUBLISH:
+        {
+            topicStats_t* pTopic = topicGet(pMsg->payload, pMsg->topicLen);
+            stats.publishes++;
+            if (pMsg->topicLen == strlen(BENCH_TOPIC "/result")
+                    && memcmp(pMsg->payload, BENCH_TOPIC "/result", pMsg->topicLen) == 0)
+            {
+                printf("bench:  %.*s\n", pMsg->dataLen, pMsg->payload + pMsg->topicLen);
+                fflush(stdout);
+            }
+            if (pMsg->topicLen == strlen(OTA_TOPIC "/status")
+                    && memcmp(pMsg->payload, OTA_TOPIC "/status", pMsg->topicLen) == 0)
+            {
+                printf("ota:    %.*s\n", pMsg->dataLen, pMsg->payload + pMsg->topicLen);
+                fflush(stdout);
+            }
+            if (pMsg->topicLen == strlen(JOIN_TOPIC) && memcmp(pMsg->payload, JOIN_TOPIC, pMsg->topicLen) == 0)
+            {
+                joinRecord(pMsg->payload + pMsg->topicLen, pMsg->dataLen);
+            }
+            if (pMsg->topicLen == strlen(TRACE_TOPIC "/data")
+                    && memcmp(pMsg->payload, TRACE_TOPIC "/data", pMsg->topicLen) == 0)
+            {
+                printf("trace:  %.*s\n", pMsg->dataLen, pMsg->payload + pMsg->topicLen);
+            }
+            if (pTopic)
+            {
+                if (pTopic->count == pTopic->latencyCap)
+                {
+                    pTopic->latencyCap = pTopic->latencyCap ? pTopic->latencyCap * 2 : 256;
+                    pTopic->pLatencyUs = realloc(pTopic->pLatencyUs, pTopic->latencyCap * sizeof(int64_t));
+                }
+                pTopic->pLatencyUs[pTopic->count++] = nowUs() - pMsg->sentUs;
+                pTopic->bytes += pMsg->dataLen;
+            }
+            if (pMsg->qos > 0)
+            {
+                brokerReply(ip, port, SIM_MQTT_PUBACK, pMsg->msgId);
+            }
+            for (int i = 0; i < subscriptionCount; i++)
+            {
+                if (topicMatch(subscriptions[i].topic, pMsg->payload, pMsg->topicLen))
+                {
+                    routerUdpSend(subscriptions[i].ip, subscriptions[i].port, pMsg, len);
+                    if (pTopic)
+                    {
+                        pTopic->forwarded++;
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Publish as the broker itself to every subscriber of the topic
+static void brokerPublish(const char* pTopic, const char* pData)
+{
+    uint8_t buffer[sizeof(simMqttMsg_t) + 256];
+    simMqttMsg_t* pMsg = (simMqttMsg_t*)buffer;
+    size_t topicLen = strlen(pTopic);
+    size_t dataLen = strlen(pData);
+    int sent = 0;
+
+    if (topicLen + dataLen > sizeof(buffer) - sizeof(*pMsg))
+    {
+        return;
+    }
+    *pMsg = (simMqttMsg_t){ .type = SIM_MQTT_PUBLISH, .topicLen = topicLen, .dataLen = dataLen, .sentUs = nowUs() };
+    memcpy(pMsg->payload, pTopic, topicLen);
+    memcpy(pMsg->payload + topicLen, pData, dataLen);
+    for (int i = 0; i < subscriptionCount; i++)
+    {
+        if (topicMatch(subscriptions[i].topic, pTopic, topicLen))
+        {
+            routerUdpSend(subscriptions[i].ip, subscriptions[i].port, pMsg, sizeof(*pMsg) + topicLen + dataLen);
+            sent++;
+        }
+    }
+    printf("broker: published \"%s\" to %s, %d subscribers\n", pData, pTopic, sent);
+    fflush(stdout);
+}
+
+// Publish "<node>:<command>" to the command topic of the node
+static void nodeCommandPublish(const char* pNodeCommand)
+{
+    char topic[96];
+    uint8_t mac[SIM_MAC_LEN];
+    const char* pCommand = strchr(pNodeCommand, ':');
+    int node = atoi(pNodeCommand);
+
+    if (pCommand == NULL || node < 0 || node >= nodeCount)
+    {
+        fprintf(stderr, "invalid node command \"%s\"\n", pNodeCommand);
+        return;
+    }
+    simNodeStaMac(node, mac);
+    snprintf(topic, sizeof(topic), CMD_TOPIC_PREFIX "%02x:%02x:%02x:%02x:%02x:%02x" CMD_TOPIC_SUFFIX, mac[0], mac[1],
+            mac[2], mac[3], mac[4], mac[5]);
+    brokerPublish(topic, pCommand + 1);
+}
+
+static void routerInput(const uint8_t* pFrame, size_t len)
+{
+    static const uint8_t broadcast[SIM_MAC_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    uint32_t routerIp = htonl(SIM_ROUTER_IP);
+
+    if (outage)
+    {
+        stats.outageDrops++;
+        return;
+    }
+    if (len < ETH_HDR_LEN || (memcmp(pFrame, routerMac, SIM_MAC_LEN) != 0
+            && memcmp(pFrame, broadcast, SIM_MAC_LEN) != 0))
+    {
+        return;
+    }
+    const uint8_t* pPayload = pFrame + ETH_HDR_LEN;
+    size_t payloadLen = len - ETH_HDR_LEN;
+    if (GET_BE16(pFrame + 12) == 0x0806 && payloadLen >= 28)
+    {
+        if (GET_BE16(pPayload + 6) == 1 && memcmp(pPayload + 24, &routerIp, 4) == 0)
+        {
+            uint8_t reply[ETH_HDR_LEN + 28];
+            memcpy(reply, pPayload + 8, SIM_MAC_LEN);
+            memcpy(reply + 6, routerMac, SIM_MAC_LEN);
+            PUT_BE16(reply + 12, 0x0806);
+            memcpy(reply + ETH_HDR_LEN, pPayload, 6);
+            PUT_BE16(reply + ETH_HDR_LEN + 6, 2);
+            memcpy(reply + ETH_HDR_LEN + 8, routerMac, SIM_MAC_LEN);
+            memcpy(reply + ETH_HDR_LEN + 14, &routerIp, 4);
+            memcpy(reply + ETH_HDR_LEN + 18, pPayload + 8, 10);
+            routerToRoot(reply, sizeof(reply));
+        }
+        return;
+    }
+    if (GET_BE16(pFrame + 12) != 0x0800 || payloadLen < IP_HDR_LEN || pPayload[9] != 17
+            || memcmp(pPayload + 16, &routerIp, 4) != 0)
+    {
+        return;
+    }
+    size_t ipHdrLen = (pPayload[0] & 0x0F) * 4;
+    const uint8_t* pUdp = pPayload + ipHdrLen;
+    if (payloadLen < ipHdrLen + UDP_HDR_LEN || GET_BE16(pUdp + 2) != SIM_BROKER_PORT
+            || ipHdrLen + GET_BE16(pUdp + 4) > payloadLen)
+    {
+        return;
+    }
+    uint32_t srcIp;
+    memcpy(&srcIp, pPayload + 12, 4);
+    brokerInput(srcIp, GET_BE16(pUdp), pUdp + UDP_HDR_LEN, GET_BE16(pUdp + 4) - UDP_HDR_LEN);
+}
+
+// Messages from nodes
+static void nodeInput(int node, const uint8_t* pBuffer, size_t len)
+{
+    const simMsgHeader_t* pHeader = (const simMsgHeader_t*)pBuffer;
+
+    switch (pHeader->type)
+    {
+        case SIM_MSG_MESH_SEND:
+            meshSend(node, (const simMsgMesh_t*)pBuffer, len);
+            break;
+        case SIM_MSG_GROUP_JOIN:
+        {
+            const simMsgGroupJoin_t* pJoin = (const simMsgGroupJoin_t*)pBuffer;
+            if (nodes[node].groupCount < GROUPS_MAX && !nodeInGroup(node, pJoin->group))
+            {
+                memcpy(nodes[node].groups[nodes[node].groupCount++], pJoin->group, SIM_MAC_LEN);
+            }
+            break;
+        }
+        case SIM_MSG_ROUTER_FRAME:
+        {
+            const simMsgFrame_t* pFrame = (const simMsgFrame_t*)pBuffer;
+            if (node != 0 || sizeof(*pFrame) + pFrame->len > len)
+            {
+                break;
+            }
+            int64_t arrival = hopTransmit(ROUTER_LINK, pFrame->len, nowUs());
+            if (arrival >= 0)
+            {
+                stats.routerUp++;
+                eventPush(arrival, EVENT_ROUTER_IN, 0, pFrame->data, pFrame->len);
+            }
+            break;
+        }
+        case SIM_MSG_TODS_STATE:
+            // the root tells every node, itself included
+            for (int i = 0; node == 0 && len >= sizeof(simMsgToDsState_t) && i < nodeCount; i++)
+            {
+                simMsgToDsState_t toDs = *(const simMsgToDsState_t*)pBuffer;
+                nodeSend(i, SIM_MSG_TODS_STATE, &toDs, sizeof(toDs));
+            }
+            break;
+        case SIM_MSG_REPORT:
+            memcpy(&nodes[node].report, pBuffer, sizeof(simMsgReport_t));
+            nodes[node].reported = true;
+            nodes[node].reportUs = nowUs();
+            break;
+        default:
+            break;
+    }
+}
+
+static void eventsRun(void)
+{
+    int64_t now = nowUs();
+    while (eventCount && events[0].dueUs <= now)
+    {
+        event_t event = eventPop();
+        switch (event.kind)
+        {
+            case EVENT_MESH_DELIVER:
+                stats.delivered++;
+                stats.deliveredBytes += ((simMsgMesh_t*)event.pMsg)->len;
+                nodeSend(event.node, SIM_MSG_MESH_DELIVER, event.pMsg, event.len);
+                break;
+            case EVENT_ROUTER_OUT:
+                nodeSend(event.node, SIM_MSG_ROUTER_FRAME, event.pMsg, event.len);
+                break;
+            case EVENT_ROUTER_IN:
+                routerInput(event.pMsg, event.len);
+                break;
+        }
+        free(event.pMsg);
+    }
+}
+
+// Poll the node connections until untilUs, running events as they become due
+static void loopRun(int64_t untilUs, bool (*pDone)(void))
+{
+    static uint8_t buffer[SIM_MSG_MAX_LEN];
+    struct pollfd* pFds = calloc(nodeCount, sizeof(struct pollfd));
+
+    for (int i = 0; i < nodeCount; i++)
+    {
+        pFds[i].fd = nodes[i].fd;
+        pFds[i].events = POLLIN;
+    }
+    while (!(pDone && pDone()))
+    {
+        int64_t now = nowUs();
+        if (now >= untilUs)
+        {
+            break;
+        }
+        int64_t waitUs = untilUs - now;
+        if (eventCount && events[0].dueUs - now < waitUs)
+        {
+            waitUs = events[0].dueUs > now ? events[0].dueUs - now : 0;
+        }
+        struct timespec timeout = { .tv_sec = waitUs / 1000000, .tv_nsec = (waitUs % 1000000) * 1000 };
+        int ready = ppoll(pFds, nodeCount, &timeout, NULL);
+        for (int i = 0; ready > 0 && i < nodeCount; i++)
+        {
+            if (pFds[i].revents & POLLIN)
+            {
+                // drain the connection so a busy node does not starve the others
+                ssize_t len;
+                while ((len = recv(pFds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+                {
+                    if ((size_t)len >= sizeof(simMsgHeader_t))
+                    {
+                        nodeInput(i, buffer, len);
+                    }
+                }
+                if (len == 0)
+                {
+                    pFds[i].fd = -1;
+                }
+            }
+            else if (pFds[i].revents & (POLLHUP | POLLERR))
+            {
+                pFds[i].fd = -1;
+            }
+        }
+        eventsRun();
+    }
+    free(pFds);
+}
+
+// Topology
+static void topologyBuild(void)
+{
+    for (int i = 0; i < nodeCount; i++)
+    {
+        nodes[i].firstChild = -1;
+        nodes[i].nextSibling = -1;
+        nodes[i].fd = -1;
+        if (i == 0)
+        {
+            nodes[i].parent = -1;
+            nodes[i].layer = 1;
+            continue;
+        }
+        switch (topology)
+        {
+            case TOPOLOGY_CHAIN:
+                nodes[i].parent = i - 1;
+                break;
+            case TOPOLOGY_STAR:
+                nodes[i].parent = 0;
+                break;
+            case TOPOLOGY_TREE:
+            default:
+                nodes[i].parent = (i - 1) / fanout;
+                break;
+        }
+        nodes[i].layer = nodes[nodes[i].parent].layer + 1;
+    }
+    // children in increasing order
+    for (int i = nodeCount - 1; i > 0; i--)
+    {
+        nodes[i].nextSibling = nodes[nodes[i].parent].firstChild;
+        nodes[nodes[i].parent].firstChild = i;
+    }
+}
+
+// Appends the station MACs of node and its subtree to pTable, returns the new size
+static int subtreeCollect(int node, uint8_t (*pTable)[SIM_MAC_LEN], int size)
+{
+    simNodeStaMac(node, pTable[size++]);
+    for (int child = nodes[node].firstChild; child >= 0; child = nodes[child].nextSibling)
+    {
+        size = subtreeCollect(child, pTable, size);
+    }
+    return size;
+}
+
+static void configSend(int node)
+{
+    static uint8_t buffer[SIM_MSG_MAX_LEN];
+    simMsgConfig_t* pConfig = (simMsgConfig_t*)buffer;
+
+    memset(pConfig, 0, sizeof(*pConfig));
+    pConfig->isRoot = node == 0;
+    pConfig->layer = nodes[node].layer;
+    if (node == 0)
+    {
+        memcpy(pConfig->parent, routerMac, SIM_MAC_LEN);
+    }
+    else
+    {
+        simNodeStaMac(nodes[node].parent, pConfig->parent);
+    }
+    memcpy(pConfig->router, routerMac, SIM_MAC_LEN);
+    memcpy(pConfig->meshId, meshId, SIM_MAC_LEN);
+    pConfig->mtu = mtu;
+    pConfig->bandwidthKbps = bandwidthKbps;
+    // parents connect first, like a mesh forming layer by layer
+    pConfig->joinDelayMs = 100 + 100 * (nodes[node].layer - 1);
+    pConfig->totalNodes = nodeCount;
+    pConfig->tableSize = subtreeCollect(node, pConfig->table, 0);
+    nodeSend(node, SIM_MSG_CONFIG, pConfig, sizeof(*pConfig) + pConfig->tableSize * SIM_MAC_LEN);
+}
+
+static bool allReported(void)
+{
+    for (int i = 0; i < nodeCount; i++)
+    {
+        if (!nodes[i].reported && nodes[i].fd >= 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compareInt64(const void* pA, const void* pB)
+{
+    int64_t a = *(const int64_t*)pA;
+    int64_t b = *(const int64_t*)pB;
+    return (a > b) - (a < b);
+}
+
+static double percentileMs(const int64_t* pSorted, size_t count, double p)
+{
+    size_t i = (size_t)(p * (count - 1) + 0.5);
+    return pSorted[i] / 1000.0;
+}
+
+static void reportPrint(int64_t runUs)
+{
+    static const char* const topologyNames[] = { "chain", "star", "tree" };
+    int maxLayer = 0;
+    uint64_t nodeCpuUs = 0;
+    uint64_t sendErrors = 0;
+    uint64_t netifDrops = 0;
+    int reported = 0;
+
+    for (int i = 0; i < nodeCount; i++)
+    {
+        maxLayer = nodes[i].layer > maxLayer ? nodes[i].layer : maxLayer;
+        if (nodes[i].reported)
+        {
+            reported++;
+            sendErrors += nodes[i].report.meshSendErrors;
+            netifDrops += nodes[i].report.netifTxDropped;
+            if (i)
+            {
+                nodeCpuUs += nodes[i].report.cpuUs;
+            }
+        }
+    }
+    printf("mesh_sim: %d nodes, %s", nodeCount, topologyNames[topology]);
+    if (topology == TOPOLOGY_TREE)
+    {
+        printf(" fanout %d", fanout);
+    }
+    printf(", %d layers, %lld us/hop, %u kbps, loss %.1f%%, mtu %d, %d s\n", maxLayer, (long long)hopLatencyUs,
+            bandwidthKbps, lossRate * 100, mtu, durationS);
+    printf("mesh:   sent %llu, delivered %llu (%llu bytes, %.1f kbit/s), lost %llu, hop retries %llu, "
+            "queue drops %llu, unroutable %llu, node overflow %llu\n", (unsigned long long)stats.sent,
+            (unsigned long long)stats.delivered, (unsigned long long)stats.deliveredBytes,
+            stats.deliveredBytes * 8.0 * 1000 / runUs, (unsigned long long)stats.lost,
+            (unsigned long long)stats.retries, (unsigned long long)stats.queueDrops,
+            (unsigned long long)stats.unroutable, (unsigned long long)stats.overflow);
+    printf("router: frames from root %llu, to root %llu, lost to the outage %llu\n",
+            (unsigned long long)stats.routerUp, (unsigned long long)stats.routerDown,
+            (unsigned long long)stats.outageDrops);
+    printf("broker: connects %llu, disconnects %llu, publishes %llu\n", (unsigned long long)stats.connects,
+            (unsigned long long)stats.disconnects, (unsigned long long)stats.publishes);
+    uint32_t joins = stats.joins[0] + stats.joins[1] + stats.joins[2] + stats.joins[3];
+    if (joins)
+    {
+        printf("join:   %u reports, scan %u, fast %u, fallback %u, time to IP avg %u ms, max %u ms\n", joins,
+                stats.joins[1], stats.joins[2], stats.joins[3], stats.joinIpMsSum / joins, stats.joinIpMsMax);
+    }
+    if (stats.flaps)
+    {
+        printf("flap:   %u parent losses of %d ms\n", stats.flaps, flapDownMs);
+    }
+    if (topicCount)
+    {
+        printf("  %-52s %8s %8s %8s %8s %8s %8s %8s  (latency ms)\n", "topic", "count", "fwd", "bytes", "min", "p50",
+                "p99", "max");
+    }
+    for (int i = 0; i < topicCount; i++)
+    {
+        topicStats_t* pTopic = &topics[i];
+        qsort(pTopic->pLatencyUs, pTopic->count, sizeof(int64_t), compareInt64);
+        printf("  %-52s %8llu %8llu %8llu %8.2f %8.2f %8.2f %8.2f\n", pTopic->name, (unsigned long long)pTopic->count,
+                (unsigned long long)pTopic->forwarded, (unsigned long long)pTopic->bytes, pTopic->pLatencyUs[0] / 1000.0,
+                percentileMs(pTopic->pLatencyUs, pTopic->count, 0.5),
+                percentileMs(pTopic->pLatencyUs, pTopic->count, 0.99),
+                pTopic->pLatencyUs[pTopic->count - 1] / 1000.0);
+    }
+    if (nodes[0].reported)
+    {
+        int64_t rootUs = nodes[0].reportUs - nodes[0].startUs;
+        printf("cpu:    root %.1f ms (%.1f%% of one core), nodes avg %.1f ms, rss root %u kB\n",
+                nodes[0].report.cpuUs / 1000.0, nodes[0].report.cpuUs * 100.0 / rootUs,
+                nodeCount > 1 ? nodeCpuUs / 1000.0 / (nodeCount - 1) : 0.0, nodes[0].report.maxRssKb);
+    }
+    printf("nodes:  %d of %d reported, mesh send errors %llu, netif tx drops %llu\n", reported, nodeCount,
+            (unsigned long long)sendErrors, (unsigned long long)netifDrops);
+}
+
+static void usage(const char* pName)
+{
+    fprintf(stderr, "usage: %s [options]\n"
+            "  -n nodes       number of nodes, node 0 is the root (10, at most %d)\n"
+            "  -t topology    chain, star or tree (tree)\n"
+            "  -f fanout      children per node of a tree (3)\n"
+            "  -l latency     per hop latency in us (2000)\n"
+            "  -b bandwidth   air rate of every link in kbit/s (6000)\n"
+            "  -p loss        per attempt loss rate in percent (0)\n"
+            "  -m mtu         largest mesh payload in bytes (%d)\n"
+            "  -d seconds     duration after all nodes started (30)\n"
+            "  -k interval    press the button of a random node every interval ms (0, off)\n"
+            "  -F every:down  take the parent of a random node away for down ms every every ms (off)\n"
+            "  -v level       log level of the nodes, 0 none to 5 verbose (1)\n"
+            "  -s seed        seed of the loss and button draws (1)\n"
+            "  -B command     publish a benchmark command to the root after 5 s, e.g. \"raw up 512 20 10\"\n"
+            "  -C node:cmd    publish a command to the command topic of a node after 5 s, e.g. \"3:metrics\"\n"
+            "  -O start:len   take the router down for len s, start s after all nodes started\n"
+            "  -U url         publish an image URL to the OTA topic after 5 s, e.g. \"file:///tmp/image.bin\"\n"
+            "  -T             ask all nodes for their traces 5 s before the end, for mesh_trace_decode\n"
+            "  -N dir         keep the NVS of every node in dir, a second run starts like after a power cut\n"
+            "  -x path        node executable (mesh_sim_node next to this program)\n", pName, MAX_NODES, MESH_MPS);
+}
+
+int main(int argc, char** argv)
+{
+    char nodePath[PATH_MAX] = { 0 };
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:f:l:b:p:m:d:k:v:s:x:B:C:F:O:U:N:Th")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                nodeCount = atoi(optarg);
+                break;
+            case 't':
+                topology = strcmp(optarg, "chain") == 0 ? TOPOLOGY_CHAIN :
+                        strcmp(optarg, "star") == 0 ? TOPOLOGY_STAR : TOPOLOGY_TREE;
+                break;
+            case 'f':
+                fanout = atoi(optarg);
+                break;
+            case 'l':
+                hopLatencyUs = atoll(optarg);
+                break;
+            case 'b':
+                bandwidthKbps = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                lossRate = atof(optarg) / 100;
+                break;
+            case 'm':
+                mtu = atoi(optarg);
+                break;
+            case 'd':
+                durationS = atoi(optarg);
+                break;
+            case 'k':
+                buttonIntervalMs = atoi(optarg);
+                break;
+            case 'v':
+                logLevel = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'B':
+                pBenchCommand = optarg;
+                break;
+            case 'C':
+                pNodeCommand = optarg;
+                break;
+            case 'F':
+                if (sscanf(optarg, "%d:%d", &flapIntervalMs, &flapDownMs) != 2 || flapIntervalMs <= 0
+                        || flapDownMs <= 0 || flapDownMs > UINT16_MAX)
+                {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'O':
+                if (sscanf(optarg, "%d:%d", &outageStartS, &outageS) != 2)
+                {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'U':
+                pOtaUrl = optarg;
+                break;
+            case 'N':
+                pNvsDir = optarg;
+                break;
+            case 'T':
+                traceDump = true;
+                break;
+            case 'x':
+                strncpy(nodePath, optarg, sizeof(nodePath) - 1);
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (nodeCount < 1 || nodeCount > MAX_NODES || fanout < 1 || bandwidthKbps == 0 || mtu < 64 || mtu > MESH_MPS
+            || lossRate < 0 || lossRate >= 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (nodePath[0] == '\0')
+    {
+        const char* pSlash = strrchr(argv[0], '/');
+        snprintf(nodePath, sizeof(nodePath), "%.*smesh_sim_node", pSlash ? (int)(pSlash - argv[0] + 1) : 0, argv[0]);
+    }
+
+    nodes = calloc(nodeCount, sizeof(node_t));
+    links = calloc(nodeCount + 1, sizeof(link_t));
+    topologyBuild();
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    signal(SIGPIPE, SIG_IGN);
+
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/mesh_sim.%d.sock", getpid());
+    const char* pSocketPath = addr.sun_path;
+    unlink(pSocketPath);
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+    for (int i = 0; i < nodeCount; i++)
+    {
+        char id[16];
+        char level[16];
+        char nvsPath[PATH_MAX];
+        snprintf(id, sizeof(id), "%d", i);
+        snprintf(level, sizeof(level), "%d", logLevel);
+        snprintf(nvsPath, sizeof(nvsPath), "%s/nvs%d.bin", pNvsDir ? pNvsDir : "", i);
+        nodes[i].startUs = nowUs();
+        nodes[i].pid = fork();
+        if (nodes[i].pid == 0)
+        {
+            close(listener);
+            execl(nodePath, nodePath, pSocketPath, id, level, pNvsDir ? nvsPath : NULL, (char*)NULL);
+            perror(nodePath);
+            _exit(127);
+        }
+    }
+    // nodes identify themselves in their first message
+    for (int connected = 0; connected < nodeCount; )
+    {
+        struct pollfd listenFd = { .fd = listener, .events = POLLIN };
+        if (poll(&listenFd, 1, 10 * 1000) <= 0)
+        {
+            fprintf(stderr, "mesh_sim: only %d of %d nodes connected\n", connected, nodeCount);
+            break;
+        }
+        int fd = accept(listener, NULL, NULL);
+        simMsgHello_t hello;
+        if (fd < 0 || recv(fd, &hello, sizeof(hello), 0) != sizeof(hello) || hello.header.type != SIM_MSG_HELLO
+                || hello.header.nodeId >= nodeCount)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            continue;
+        }
+        int size = SOCKET_BUFFER;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        nodes[hello.header.nodeId].fd = fd;
+        connected++;
+    }
+    close(listener);
+    unlink(pSocketPath);
+    for (int i = 0; i < nodeCount; i++)
+    {
+        configSend(i);
+    }
+
+    int64_t startUs = nowUs();
+    int64_t endUs = startUs + durationS * 1000000ll;
+    int64_t nextButtonUs = buttonIntervalMs ? startUs + buttonIntervalMs * 1000ll : endUs;
+    int64_t nextFlapUs = flapIntervalMs ? startUs + flapIntervalMs * 1000ll : endUs;
+    int64_t benchUs = pBenchCommand || pNodeCommand || pOtaUrl ? startUs + BENCH_DELAY_us : endUs;
+    int64_t traceUs = traceDump ? endUs - TRACE_BEFORE_END_us : endUs;
+    int64_t outageUs = outageStartS >= 0 ? startUs + outageStartS * 1000000ll : endUs;
+    while (nowUs() < endUs)
+    {
+        int64_t untilUs = nextButtonUs < endUs ? nextButtonUs : endUs;
+        untilUs = nextFlapUs < untilUs ? nextFlapUs : untilUs;
+        untilUs = traceUs < untilUs ? traceUs : untilUs;
+        untilUs = outageUs < untilUs ? outageUs : untilUs;
+        loopRun(benchUs < untilUs ? benchUs : untilUs, NULL);
+        if (outageStartS >= 0 && nowUs() >= outageUs)
+        {
+            // frames in flight still arrive, new ones are lost until the router is back
+            outage = !outage;
+            outageUs = outage ? outageUs + outageS * 1000000ll : endUs;
+            outageStartS = outage ? outageStartS : -1;
+            printf("router: %s\n", outage ? "down" : "up");
+            fflush(stdout);
+        }
+        if (traceDump && nowUs() >= traceUs)
+        {
+            brokerPublish(TRACE_TOPIC, "dump");
+            traceDump = false;
+            traceUs = endUs;
+        }
+        if (nowUs() >= benchUs)
+        {
+            if (pBenchCommand)
+            {
+                brokerPublish(BENCH_TOPIC, pBenchCommand);
+                pBenchCommand = NULL;
+            }
+            if (pNodeCommand)
+            {
+                nodeCommandPublish(pNodeCommand);
+                pNodeCommand = NULL;
+            }
+            if (pOtaUrl)
+            {
+                brokerPublish(OTA_TOPIC, pOtaUrl);
+                pOtaUrl = NULL;
+            }
+            benchUs = endUs;
+        }
+        if (buttonIntervalMs && nowUs() >= nextButtonUs)
+        {
+            simMsgHeader_t press;
+            int node = nodeCount > 1 ? 1 + rand_r(&seed) % (nodeCount - 1) : 0;
+            nodeSend(node, SIM_MSG_BUTTON, &press, sizeof(press));
+            nextButtonUs += buttonIntervalMs * 1000ll;
+        }
+        if (flapIntervalMs && nowUs() >= nextFlapUs)
+        {
+            simMsgFlap_t flap = { .downMs = flapDownMs };
+            if (nodeCount > 1)
+            {
+                nodeSend(1 + rand_r(&seed) % (nodeCount - 1), SIM_MSG_FLAP, &flap, sizeof(flap));
+                stats.flaps++;
+            }
+            nextFlapUs += flapIntervalMs * 1000ll;
+        }
+    }
+    int64_t runUs = nowUs() - startUs;
+
+    for (int i = 0; i < nodeCount; i++)
+    {
+        simMsgHeader_t quit;
+        nodeSend(i, SIM_MSG_QUIT, &quit, sizeof(quit));
+    }
+    loopRun(nowUs() + REPORT_TIMEOUT_us, allReported);
+    for (int i = 0; i < nodeCount; i++)
+    {
+        if (!nodes[i].reported && nodes[i].pid > 0)
+        {
+            kill(nodes[i].pid, SIGKILL);
+        }
+        waitpid(nodes[i].pid, NULL, 0);
+    }
+    reportPrint(runUs);
+    return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * MQTT client of a simulated node. Messages are UDP datagrams to the coordinator's broker
+ * instead of MQTT over TCP, so they cross the mesh and the root's forwarding like the real
+ * client's segments but are not retransmitted when lost. Every broker URI resolves to the
+ * simulated router.
+ */
+#include "sim.h"
+
+#include "esp_log.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CLIENT_PORT        (49152)
+#define RX_QUEUE_LEN       (16)
+#define CONNECT_RETRY_ms   (1000)
+#define KEEPALIVE_ms       (1000) // ping interval, the connection is lost after 3 without any answer
+#define MSG_MAX            (1024)
+
+typedef struct
+{
+    size_t len;
+    uint8_t data[];
+} mqttDatagram_t;
+
+struct esp_mqtt_client
+{
+    QueueHandle_t rxQueue;
+    esp_event_handler_t handler;
+    void* handlerArg;
+    volatile bool connected;
+    volatile bool started;
+    volatile bool running; // the client task has not left its loop yet
+    uint16_t msgId;
+    TickType_t lastRx;    // last message from the broker
+};
+
+static const char* TAG = "sim_mqtt";
+static const char* const MQTT_EVENTS = "MQTT_EVENTS";
+
+static void clientUdpRecv(uint32_t srcIp, uint16_t srcPort, const uint8_t* pData, size_t len, void* arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+    mqttDatagram_t* pDatagram = malloc(sizeof(*pDatagram) + len);
+
+    if (pDatagram == NULL)
+    {
+        return;
+    }
+    pDatagram->len = len;
+    memcpy(pDatagram->data, pData, len);
+    if (xQueueSend(client->rxQueue, &pDatagram, 0) != pdTRUE)
+    {
+        free(pDatagram);
+    }
+}
+
+static int clientSend(esp_mqtt_client_handle_t client, simMqttType_t type, const char* pTopic, const char* pData,
+        int len, int qos)
+{
+    uint8_t buffer[MSG_MAX];
+    simMqttMsg_t* pMsg = (simMqttMsg_t*)buffer;
+    size_t topicLen = pTopic ? strlen(pTopic) : 0;
+
+    if (sizeof(*pMsg) + topicLen + len > sizeof(buffer))
+    {
+        return -1;
+    }
+    pMsg->type = type;
+    pMsg->qos = qos;
+    pMsg->msgId = __atomic_add_fetch(&client->msgId, 1, __ATOMIC_RELAXED);
+    pMsg->msgId = pMsg->msgId ? pMsg->msgId : __atomic_add_fetch(&client->msgId, 1, __ATOMIC_RELAXED);
+    pMsg->topicLen = topicLen;
+    pMsg->dataLen = len;
+    pMsg->sentUs = simNowUs();
+    memcpy(pMsg->payload, pTopic, topicLen);
+    memcpy(pMsg->payload + topicLen, pData, len);
+    if (simUdpSend(CLIENT_PORT, esp_netif_htonl(SIM_ROUTER_IP), SIM_BROKER_PORT, pMsg, sizeof(*pMsg) + topicLen + len)
+            != ESP_OK)
+    {
+        return -1;
+    }
+    return pMsg->msgId;
+}
+
+static void clientDispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t* pEvent)
+{
+    pEvent->client = client;
+    pEvent->user_context = client->handlerArg;
+    if (client->handler)
+    {
+        client->handler(client->handlerArg, MQTT_EVENTS, pEvent->event_id, pEvent);
+    }
+}
+
+static void clientInput(esp_mqtt_client_handle_t client, const mqttDatagram_t* pDatagram)
+{
+    const simMqttMsg_t* pMsg = (const simMqttMsg_t*)pDatagram->data;
+    esp_mqtt_event_t event = { 0 };
+
+    if (pDatagram->len < sizeof(*pMsg) || sizeof(*pMsg) + pMsg->topicLen + pMsg->dataLen > pDatagram->len)
+    {
+        return;
+    }
+    event.msg_id = pMsg->msgId;
+    client->lastRx = xTaskGetTickCount();
+    switch (pMsg->type)
+    {
+        case SIM_MQTT_CONNACK:
+            if (client->connected)
+            {
+                return;
+            }
+            client->connected = true;
+            event.event_id = MQTT_EVENT_CONNECTED;
+            break;
+        case SIM_MQTT_SUBACK:
+            event.event_id = MQTT_EVENT_SUBSCRIBED;
+            break;
+        case SIM_MQTT_PUBACK:
+            event.event_id = MQTT_EVENT_PUBLISHED;
+            break;
+        case SIM_MQTT_PINGRESP:
+            return;
+        case SIM_MQTT_PUBLISH:
+            event.event_id = MQTT_EVENT_DATA;
+            event.topic = (char*)pMsg->payload;
+            event.topic_len = pMsg->topicLen;
+            event.data = (char*)pMsg->payload + pMsg->topicLen;
+            event.data_len = pMsg->dataLen;
+            event.total_data_len = pMsg->dataLen;
+            event.qos = pMsg->qos;
+            break;
+        default:
+            return;
+    }
+    clientDispatch(client, &event);
+}
+
+static void clientTask(void* arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+    TickType_t lastConnect = 0;
+    TickType_t lastPing = 0;
+    mqttDatagram_t* pDatagram;
+
+    while (client->started)
+    {
+        if (client->connected && xTaskGetTickCount() - lastPing >= pdMS_TO_TICKS(KEEPALIVE_ms))
+        {
+            lastPing = xTaskGetTickCount();
+            if (lastPing - client->lastRx >= 3 * pdMS_TO_TICKS(KEEPALIVE_ms))
+            {
+                esp_mqtt_client_disconnect(client);
+                lastConnect = lastPing | 1;
+                continue;
+            }
+            clientSend(client, SIM_MQTT_PINGREQ, NULL, NULL, 0, 0);
+        }
+        if (!client->connected && (lastConnect == 0 || xTaskGetTickCount() - lastConnect
+                >= pdMS_TO_TICKS(CONNECT_RETRY_ms)))
+        {
+            esp_mqtt_event_t event = { .event_id = MQTT_EVENT_BEFORE_CONNECT };
+            lastConnect = xTaskGetTickCount() | 1;
+            clientDispatch(client, &event);
+            clientSend(client, SIM_MQTT_CONNECT, NULL, NULL, 0, 0);
+        }
+        if (xQueueReceive(client->rxQueue, &pDatagram, pdMS_TO_TICKS(100)) == pdTRUE)
+        {
+            clientInput(client, pDatagram);
+            free(pDatagram);
+        }
+    }
+    client->running = false;
+    vTaskDelete(NULL);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config)
+{
+    esp_mqtt_client_handle_t client = calloc(1, sizeof(struct esp_mqtt_client));
+
+    if (client == NULL)
+    {
+        return NULL;
+    }
+    client->rxQueue = xQueueCreate(RX_QUEUE_LEN, sizeof(mqttDatagram_t*));
+    if (client->rxQueue == NULL)
+    {
+        free(client);
+        return NULL;
+    }
+    ESP_LOGD(TAG, "Broker %s is simulated by the router", config->uri ? config->uri : config->host);
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+        esp_event_handler_t handler, void* arg)
+{
+    client->handler = handler;
+    client->handlerArg = arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (client->started)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t err = simUdpBind(CLIENT_PORT, clientUdpRecv, client);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    client->started = true;
+    client->running = true;
+    if (xTaskCreate(clientTask, "mqtt_task", 6144, client, 5, NULL) != pdPASS)
+    {
+        client->started = false;
+        client->running = false;
+        simUdpUnbind(CLIENT_PORT);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Like the real client, waits for the client task and must not be called from the event handler
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    if (!client->started)
+    {
+        return ESP_FAIL;
+    }
+    if (client->connected)
+    {
+        clientSend(client, SIM_MQTT_DISCONNECT, NULL, NULL, 0, 0);
+    }
+    client->started = false;
+    while (client->running)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    simUdpUnbind(CLIENT_PORT);
+    client->connected = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    mqttDatagram_t* pDatagram;
+
+    if (client == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->started)
+    {
+        esp_mqtt_client_stop(client);
+    }
+    while (xQueueReceive(client->rxQueue, &pDatagram, 0) == pdTRUE)
+    {
+        free(pDatagram);
+    }
+    vQueueDelete(client->rxQueue);
+    free(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client)
+{
+    esp_mqtt_event_t event = { .event_id = MQTT_EVENT_DISCONNECTED };
+    client->connected = false;
+    clientDispatch(client, &event);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos)
+{
+    return client->connected ? clientSend(client, SIM_MQTT_SUBSCRIBE, topic, NULL, 0, qos) : -1;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char* topic)
+{
+    return -1;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+        int retain)
+{
+    if (!client->connected)
+    {
+        return -1;
+    }
+    if (len <= 0)
+    {
+        len = data ? strlen(data) : 0;
+    }
+    return clientSend(client, SIM_MQTT_PUBLISH, topic, data, len, qos);
+}
@@ -0,0 +1,182 @@
+/*
+ * One simulated node: connects to the coordinator, waits for its place in the mesh, runs the
+ * firmware's app_main() and reports its counters when told to quit
+ */
+#include "sim.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+void app_main(void);
+
+simCounters_t g_simCounters = { 0 };
+
+static int nodeId = -1;
+static int sock = -1;
+static pthread_mutex_t sendLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t stateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stateCond = PTHREAD_COND_INITIALIZER;
+static simMsgConfig_t* pConfig = NULL;
+static bool quit = false;
+
+int simNodeId(void)
+{
+    return nodeId;
+}
+
+const simMsgConfig_t* simConfig(void)
+{
+    return pConfig;
+}
+
+esp_err_t simSend(simMsgType_t type, void* pMsg, size_t len)
+{
+    simMsgHeader_t* pHeader = pMsg;
+    pHeader->type = type;
+    pHeader->nodeId = nodeId;
+    pthread_mutex_lock(&sendLock);
+    ssize_t sent = send(sock, pMsg, len, MSG_NOSIGNAL);
+    pthread_mutex_unlock(&sendLock);
+    return sent == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+static void* readerThread(void* arg)
+{
+    static uint8_t buffer[SIM_MSG_MAX_LEN];
+    ssize_t len;
+
+    while ((len = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+    {
+        const simMsgHeader_t* pHeader = (const simMsgHeader_t*)buffer;
+        if ((size_t)len < sizeof(*pHeader))
+        {
+            continue;
+        }
+        switch (pHeader->type)
+        {
+            case SIM_MSG_CONFIG:
+            {
+                simMsgConfig_t* pNew = malloc(len);
+                memcpy(pNew, buffer, len);
+                pthread_mutex_lock(&stateLock);
+                pConfig = pNew;
+                pthread_cond_broadcast(&stateCond);
+                pthread_mutex_unlock(&stateLock);
+                break;
+            }
+            case SIM_MSG_MESH_DELIVER:
+                simMeshDeliver((const simMsgMesh_t*)buffer);
+                break;
+            case SIM_MSG_ROUTER_FRAME:
+            {
+                const simMsgFrame_t* pFrame = (const simMsgFrame_t*)buffer;
+                simWifiRouterFrame(pFrame->data, pFrame->len);
+                break;
+            }
+            case SIM_MSG_BUTTON:
+                simButtonPress();
+                break;
+            case SIM_MSG_TODS_STATE:
+                simMeshToDsState(((const simMsgToDsState_t*)buffer)->reachable);
+                break;
+            case SIM_MSG_FLAP:
+                simMeshFlap(((const simMsgFlap_t*)buffer)->downMs);
+                break;
+            case SIM_MSG_QUIT:
+            default:
+                pthread_mutex_lock(&stateLock);
+                quit = pHeader->type == SIM_MSG_QUIT ? true : quit;
+                pthread_cond_broadcast(&stateCond);
+                pthread_mutex_unlock(&stateLock);
+                break;
+        }
+    }
+    // coordinator gone
+    pthread_mutex_lock(&stateLock);
+    quit = true;
+    pthread_cond_broadcast(&stateCond);
+    pthread_mutex_unlock(&stateLock);
+    return NULL;
+}
+
+static void mainTask(void* arg)
+{
+    app_main();
+    vTaskDelete(NULL);
+}
+
+static void report(void)
+{
+    simMsgReport_t msg = { 0 };
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    msg.cpuUs = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    msg.maxRssKb = usage.ru_maxrss;
+    msg.meshSent = g_simCounters.meshSent;
+    msg.meshSendErrors = g_simCounters.meshSendErrors;
+    msg.meshReceived = g_simCounters.meshReceived;
+    msg.netifTxDropped = g_simCounters.netifTxDropped;
+    simSend(SIM_MSG_REPORT, &msg, sizeof(msg));
+}
+
+int main(int argc, char** argv)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    simMsgHello_t hello = { .pid = getpid() };
+    pthread_t reader;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <coordinator socket> <node id> [log level] [NVS file]\n", argv[0]);
+        return 2;
+    }
+    nodeId = atoi(argv[2]);
+    simLogSetLevel(argc > 3 ? atoi(argv[3]) : ESP_LOG_WARN);
+    if (argc > 4)
+    {
+        simNvsLoad(argv[4]);
+    }
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        perror("connect");
+        return 1;
+    }
+    simSend(SIM_MSG_HELLO, &hello, sizeof(hello));
+    pthread_create(&reader, NULL, readerThread, NULL);
+
+    pthread_mutex_lock(&stateLock);
+    while (pConfig == NULL && !quit)
+    {
+        pthread_cond_wait(&stateCond, &stateLock);
+    }
+    pthread_mutex_unlock(&stateLock);
+    if (pConfig)
+    {
+        xTaskCreate(mainTask, "main", 3584, NULL, 1, NULL);
+    }
+
+    pthread_mutex_lock(&stateLock);
+    while (!quit)
+    {
+        pthread_cond_wait(&stateCond, &stateLock);
+    }
+    pthread_mutex_unlock(&stateLock);
+    report();
+    fflush(stderr);
+    // firmware tasks never return, leave without joining them
+    _exit(0);
+}
@@ -0,0 +1,73 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "sim_protocol.h"
+
+#include "esp_err.h"
+#include "esp_netif.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+// Counters reported to the coordinator when the node quits
+typedef struct
+{
+    uint32_t meshSent;
+    uint32_t meshSendErrors;
+    uint32_t meshReceived;
+    uint32_t netifTxDropped;
+} simCounters_t;
+
+/**
+ * @brief Receives the payload of a UDP datagram addressed to a bound port, called from the tcpip task
+ *
+ * @param srcIp source address, network byte order
+ * @param srcPort source port
+ * @param pData payload
+ * @param len payload length
+ * @param arg argument given to simUdpBind()
+ */
+typedef void (simUdpRecvFn_t)(uint32_t srcIp, uint16_t srcPort, const uint8_t* pData, size_t len, void* arg);
+
+/*******************************************************
+ *                Variable Declarations
+ *******************************************************/
+extern simCounters_t g_simCounters;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+// node_main.c: connection to the coordinator
+int simNodeId(void);
+const simMsgConfig_t* simConfig(void);
+esp_err_t simSend(simMsgType_t type, void* pMsg, size_t len);
+int64_t simNowUs(void);
+
+// esp_system.c
+void simLogSetLevel(int level);
+void simButtonPress(void);
+// keep the NVS in pPath, loaded now and written on every commit
+void simNvsLoad(const char* pPath);
+
+// esp_mesh.c
+void simMeshDeliver(const simMsgMesh_t* pMsg);
+void simMeshToDsState(bool reachable);
+// lose the parent for downMs, nodes only
+void simMeshFlap(uint16_t downMs);
+
+// esp_wifi.c: the root's station link to the router
+void simWifiRouterFrame(const uint8_t* pFrame, size_t len);
+void simWifiStaConnected(void);
+
+// esp_netif.c: minimal IPv4 stack standing in for lwIP
+esp_err_t simUdpBind(uint16_t port, simUdpRecvFn_t* pRecvFn, void* arg);
+// returns once no receive function of the port runs any more
+void simUdpUnbind(uint16_t port);
+esp_err_t simUdpSend(uint16_t srcPort, uint32_t dstIp, uint16_t dstPort, const void* pData, size_t len);
+
+#endif // SIM_H_
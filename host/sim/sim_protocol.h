@@ -0,0 +1,168 @@
+#ifndef SIM_PROTOCOL_H_
+#define SIM_PROTOCOL_H_
+
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define SIM_MSG_MAX_LEN    (8192) // fits the routing table of the largest mesh in CONFIG
+#define SIM_MAC_LEN        (6)
+#define SIM_ROUTER_IP      (0xC0A80101u) // 192.168.1.1, router, DNS and MQTT broker, host byte order
+#define SIM_ROOT_STA_IP    (0xC0A80102u) // 192.168.1.2, address the router leases to the root
+#define SIM_MESH_NET       (0x0A000000u) // 10.0.0.0/16, subnet of the root's mesh AP
+#define SIM_MESH_MASK      (0xFFFF0000u)
+#define SIM_BROKER_PORT    (1883)
+#define SIM_CHANNEL        (6)           // channel of the router and the mesh
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+// Messages between a node process and the coordinator, one per SOCK_SEQPACKET datagram
+typedef enum
+{
+    SIM_MSG_HELLO = 1,    // node -> coordinator, first message after connecting
+    SIM_MSG_CONFIG,       // coordinator -> node, position in the mesh
+    SIM_MSG_MESH_SEND,    // node -> coordinator, esp_mesh_send()
+    SIM_MSG_MESH_DELIVER, // coordinator -> node, data for esp_mesh_recv()
+    SIM_MSG_GROUP_JOIN,   // node -> coordinator, esp_mesh_set_group_id()
+    SIM_MSG_ROUTER_FRAME, // both ways, ethernet frame on the link of the root's station to the router
+    SIM_MSG_BUTTON,       // coordinator -> node, press the boot button
+    SIM_MSG_QUIT,         // coordinator -> node, report and exit
+    SIM_MSG_REPORT,       // node -> coordinator, counters of the node
+    SIM_MSG_TODS_STATE,   // root -> coordinator: esp_mesh_post_toDS_state(), coordinator -> nodes: the event
+    SIM_MSG_FLAP,         // coordinator -> node, lose the parent for a while
+} simMsgType_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint16_t nodeId;
+} simMsgHeader_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint32_t pid;
+} simMsgHello_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint8_t isRoot;
+    uint8_t layer;
+    uint8_t parent[SIM_MAC_LEN];  // station MAC of the parent, router BSSID for the root
+    uint8_t router[SIM_MAC_LEN];  // router BSSID
+    uint8_t meshId[SIM_MAC_LEN];
+    uint16_t mtu;                 // largest mesh payload, at most MESH_MPS
+    uint32_t bandwidthKbps;       // air rate of every link
+    uint16_t joinDelayMs;         // time from esp_mesh_start() to the parent connection
+    uint16_t totalNodes;
+    uint16_t tableSize;
+    uint8_t table[][SIM_MAC_LEN]; // station MACs of the node and its subtree
+} simMsgConfig_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint8_t addr[SIM_MAC_LEN];    // destination for SIM_MSG_MESH_SEND, source for SIM_MSG_MESH_DELIVER
+    int32_t flag;
+    uint8_t proto;
+    uint8_t tos;
+    uint16_t len;
+    uint8_t data[];
+} simMsgMesh_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint8_t group[SIM_MAC_LEN];
+} simMsgGroupJoin_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint16_t len;
+    uint8_t data[];
+} simMsgFrame_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint8_t reachable;
+} simMsgToDsState_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint16_t downMs;
+} simMsgFlap_t;
+
+typedef struct __attribute__((packed))
+{
+    simMsgHeader_t header;
+    uint64_t cpuUs;           // user and system time of the node process
+    uint32_t meshSent;        // esp_mesh_send() calls that succeeded
+    uint32_t meshSendErrors;  // esp_mesh_send() calls that failed
+    uint32_t meshReceived;    // packets returned by esp_mesh_recv()
+    uint32_t netifTxDropped;  // frames the mesh netif driver refused (ERR_MEM in lwIP)
+    uint32_t maxRssKb;
+} simMsgReport_t;
+
+// Stand-in MQTT over UDP between the nodes' clients and the coordinator's broker, host byte order
+typedef enum
+{
+    SIM_MQTT_CONNECT = 1,
+    SIM_MQTT_CONNACK,
+    SIM_MQTT_SUBSCRIBE,
+    SIM_MQTT_SUBACK,
+    SIM_MQTT_PUBLISH,
+    SIM_MQTT_PUBACK,
+    SIM_MQTT_PINGREQ,
+    SIM_MQTT_PINGRESP,
+    SIM_MQTT_DISCONNECT, // the client ended its session, the broker drops its subscriptions
+} simMqttType_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint8_t qos;
+    uint16_t msgId;
+    uint16_t topicLen;
+    uint16_t dataLen;
+    int64_t sentUs;   // CLOCK_MONOTONIC of the publisher, shared by all processes of the host
+    char payload[];   // topic followed by data
+} simMqttMsg_t;
+
+/*******************************************************
+ *                Inline Functions
+ *******************************************************/
+// Station MAC of a node, even so the softAP MAC (station + 1) never carries into another byte
+static inline void simNodeStaMac(int nodeId, uint8_t* pMac)
+{
+    pMac[0] = 0x24;
+    pMac[1] = 0x0A;
+    pMac[2] = 0xC4;
+    pMac[3] = 0x00;
+    pMac[4] = (nodeId * 2) >> 8;
+    pMac[5] = (nodeId * 2) & 0xFF;
+}
+
+// Returns the node of a station or softAP MAC, -1 if it is not a simulated node
+static inline int simNodeFromMac(const uint8_t* pMac)
+{
+    if (pMac[0] != 0x24 || pMac[1] != 0x0A || pMac[2] != 0xC4 || pMac[3] != 0x00)
+    {
+        return -1;
+    }
+    return ((pMac[4] << 8) | pMac[5]) / 2;
+}
+
+// Address leased to the mesh station of a node, host byte order
+static inline uint32_t simNodeMeshIp(int nodeId)
+{
+    uint32_t host = nodeId + 2;
+    return SIM_MESH_NET | ((host / 254) << 8) | (host % 254 + 1);
+}
+
+#endif // SIM_PROTOCOL_H_
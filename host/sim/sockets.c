@@ -0,0 +1,215 @@
+/*
+ * UDP sockets on top of the simulated IP stack, enough of the lwIP socket API for firmware
+ * traffic generators. Received datagrams are queued per socket.
+ */
+#include "sim.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "lwip/sockets.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOCKETS_MAX          (8)
+#define SOCKET_OFFSET        (64) // keeps socket numbers apart from file descriptors of the node process
+#define SOCKET_QUEUE_LEN     (64)
+#define EPHEMERAL_PORT_FIRST (49200)
+
+typedef struct
+{
+    uint32_t srcIp;
+    uint16_t srcPort;
+    size_t len;
+    uint8_t data[];
+} simDatagram_t;
+
+typedef struct
+{
+    bool used;
+    uint16_t port;
+    QueueHandle_t rxQueue;
+    TickType_t rcvTimeout;
+} simSocket_t;
+
+static simSocket_t sockets[SOCKETS_MAX];
+static pthread_mutex_t socketsLock = PTHREAD_MUTEX_INITIALIZER;
+static uint16_t nextEphemeralPort = EPHEMERAL_PORT_FIRST;
+
+static simSocket_t* socketGet(int s)
+{
+    int i = s - SOCKET_OFFSET;
+    return i >= 0 && i < SOCKETS_MAX && sockets[i].used ? &sockets[i] : NULL;
+}
+
+static void socketUdpRecv(uint32_t srcIp, uint16_t srcPort, const uint8_t* pData, size_t len, void* arg)
+{
+    simSocket_t* pSocket = arg;
+    simDatagram_t* pDatagram = malloc(sizeof(*pDatagram) + len);
+
+    if (pDatagram == NULL)
+    {
+        return;
+    }
+    pDatagram->srcIp = srcIp;
+    pDatagram->srcPort = srcPort;
+    pDatagram->len = len;
+    memcpy(pDatagram->data, pData, len);
+    // a full queue drops like a full lwIP receive mailbox
+    if (xQueueSend(pSocket->rxQueue, &pDatagram, 0) != pdTRUE)
+    {
+        free(pDatagram);
+    }
+}
+
+static int socketBindPort(simSocket_t* pSocket, uint16_t port)
+{
+    if (simUdpBind(port, socketUdpRecv, pSocket) != ESP_OK)
+    {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    pSocket->port = port;
+    return 0;
+}
+
+int lwip_socket(int domain, int type, int protocol)
+{
+    if (domain != AF_INET || type != SOCK_DGRAM)
+    {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+    pthread_mutex_lock(&socketsLock);
+    for (int i = 0; i < SOCKETS_MAX; i++)
+    {
+        if (!sockets[i].used)
+        {
+            sockets[i] = (simSocket_t){ .used = true, .rcvTimeout = portMAX_DELAY,
+                    .rxQueue = xQueueCreate(SOCKET_QUEUE_LEN, sizeof(simDatagram_t*)) };
+            pthread_mutex_unlock(&socketsLock);
+            return i + SOCKET_OFFSET;
+        }
+    }
+    pthread_mutex_unlock(&socketsLock);
+    errno = ENFILE;
+    return -1;
+}
+
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen)
+{
+    simSocket_t* pSocket = socketGet(s);
+    const struct sockaddr_in* pAddr = (const struct sockaddr_in*)name;
+
+    if (pSocket == NULL || namelen < sizeof(*pAddr) || pSocket->port)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return socketBindPort(pSocket, ntohs(pAddr->sin_port));
+}
+
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen)
+{
+    simSocket_t* pSocket = socketGet(s);
+
+    if (pSocket == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (level == SOL_SOCKET && optname == SO_RCVTIMEO && optlen >= sizeof(struct timeval))
+    {
+        const struct timeval* pTimeout = optval;
+        uint32_t ms = pTimeout->tv_sec * 1000 + pTimeout->tv_usec / 1000;
+        pSocket->rcvTimeout = ms ? pdMS_TO_TICKS(ms) : portMAX_DELAY;
+    }
+    return 0;
+}
+
+ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen)
+{
+    simSocket_t* pSocket = socketGet(s);
+    const struct sockaddr_in* pAddr = (const struct sockaddr_in*)to;
+
+    if (pSocket == NULL || tolen < sizeof(*pAddr))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (pSocket->port == 0)
+    {
+        pthread_mutex_lock(&socketsLock);
+        uint16_t port = nextEphemeralPort++;
+        nextEphemeralPort = nextEphemeralPort ? nextEphemeralPort : EPHEMERAL_PORT_FIRST;
+        pthread_mutex_unlock(&socketsLock);
+        if (socketBindPort(pSocket, port) != 0)
+        {
+            return -1;
+        }
+    }
+    esp_err_t err = simUdpSend(pSocket->port, pAddr->sin_addr.s_addr, ntohs(pAddr->sin_port), data, size);
+    if (err != ESP_OK)
+    {
+        errno = err == ESP_ERR_INVALID_SIZE ? EMSGSIZE : EHOSTUNREACH;
+        return -1;
+    }
+    return size;
+}
+
+ssize_t lwip_recvfrom(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen)
+{
+    simSocket_t* pSocket = socketGet(s);
+    simDatagram_t* pDatagram;
+
+    if (pSocket == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (xQueueReceive(pSocket->rxQueue, &pDatagram, (flags & MSG_DONTWAIT) ? 0 : pSocket->rcvTimeout) != pdTRUE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t copied = pDatagram->len < len ? pDatagram->len : len;
+    memcpy(mem, pDatagram->data, copied);
+    if (from && fromlen && *fromlen >= sizeof(struct sockaddr_in))
+    {
+        struct sockaddr_in* pAddr = (struct sockaddr_in*)from;
+        memset(pAddr, 0, sizeof(*pAddr));
+        pAddr->sin_family = AF_INET;
+        pAddr->sin_port = htons(pDatagram->srcPort);
+        pAddr->sin_addr.s_addr = pDatagram->srcIp;
+        *fromlen = sizeof(*pAddr);
+    }
+    free(pDatagram);
+    return copied;
+}
+
+int lwip_close(int s)
+{
+    simSocket_t* pSocket = socketGet(s);
+    simDatagram_t* pDatagram;
+
+    if (pSocket == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (pSocket->port)
+    {
+        simUdpUnbind(pSocket->port);
+    }
+    while (xQueueReceive(pSocket->rxQueue, &pDatagram, 0) == pdTRUE)
+    {
+        free(pDatagram);
+    }
+    vQueueDelete(pSocket->rxQueue);
+    pthread_mutex_lock(&socketsLock);
+    pSocket->used = false;
+    pSocket->port = 0;
+    pthread_mutex_unlock(&socketsLock);
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Prints the binary status and keypress records of mesh_telemetry.h as text, read as hex from the
+ * end of each line, e.g. mosquitto_sub -t /topic/ip_mesh -t /topic/03c8b0f712023b6d/ip_mesh/key_pressed
+ * -F "%t %x" | mesh_telemetry_decode
+ * Text in front of the hex, like the topic, is kept. Lines without a record are printed unchanged.
+ */
+#include "mesh_telemetry.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LINE_MAX_LEN (4096)
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Print the line with its record as text, returns false if its last word is not a record
+static bool linePrint(const char* pLine)
+{
+    uint8_t record[MESH_TELEMETRY_RECORD_MAX];
+    char text[MESH_TELEMETRY_TEXT_MAX];
+    size_t end = strlen(pLine);
+
+    while (end && (pLine[end - 1] == '\n' || pLine[end - 1] == '\r' || pLine[end - 1] == ' '))
+    {
+        end--;
+    }
+    size_t start = end;
+    while (start && pLine[start - 1] != ' ')
+    {
+        start--;
+    }
+    size_t len = (end - start) / 2;
+    if ((end - start) % 2 || len > sizeof(record))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        int high = hexValue(pLine[start + 2 * i]);
+        int low = high < 0 ? -1 : hexValue(pLine[start + 2 * i + 1]);
+        if (low < 0)
+        {
+            return false;
+        }
+        record[i] = (uint8_t)(high << 4 | low);
+    }
+    if (meshTelemetryFormat(record, len, text, sizeof(text)) < 0)
+    {
+        return false;
+    }
+    printf("%.*s%s\n", (int)start, pLine, text);
+    return true;
+}
+
+static void fileRead(FILE* pFile)
+{
+    char line[LINE_MAX_LEN];
+
+    while (fgets(line, sizeof(line), pFile))
+    {
+        if (!linePrint(line))
+        {
+            fputs(line, stdout);
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fileRead(stdin);
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        FILE* pFile = fopen(argv[i], "r");
+        if (pFile == NULL)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        fileRead(pFile);
+        fclose(pFile);
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * Decodes trace dumps of CONFIG_MESH_TRACE, read from the serial console or the trace MQTT topic,
+ * e.g. mosquitto_sub -t /topic/03c8b0f712023b6d/ip_mesh/trace/data | mesh_trace_decode
+ * Text in front of the "mt1" tag of a line, like the MAC address of an MQTT dump, names the device.
+ * Events are printed per device in time order.
+ */
+#include "mesh_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LEN   (4096)
+#define DEVICE_NAME_MAX (64)
+
+typedef struct
+{
+    char device[DEVICE_NAME_MAX];
+    int core;
+    meshTraceEvent_t event;
+} traceRecord_t;
+
+#define TRACE_NAME(id, name, addr1, addr2) [id] = { name, addr1, addr2 },
+static const struct
+{
+    const char* pName;
+    const char* pAddr1;
+    const char* pAddr2;
+} traceNames[MESH_TRACE_ID_MAX] = { MESH_TRACE_EVENTS(TRACE_NAME) };
+#undef TRACE_NAME
+
+static traceRecord_t* pRecords = NULL;
+static size_t recordCount = 0;
+static size_t recordCap = 0;
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t)getBE16(p) << 16) | getBE16(p + 2);
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void recordAdd(const char* pDevice, size_t deviceLen, int core, const uint8_t* p)
+{
+    if (recordCount == recordCap)
+    {
+        recordCap = recordCap ? recordCap * 2 : 1024;
+        pRecords = realloc(pRecords, recordCap * sizeof(*pRecords));
+        if (pRecords == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    traceRecord_t* pRecord = &pRecords[recordCount++];
+    deviceLen = deviceLen < DEVICE_NAME_MAX - 1 ? deviceLen : DEVICE_NAME_MAX - 1;
+    memcpy(pRecord->device, pDevice, deviceLen);
+    pRecord->device[deviceLen] = '\0';
+    pRecord->core = core;
+    pRecord->event.seq = getBE32(p);
+    pRecord->event.timeUs = getBE32(p + 4);
+    pRecord->event.id = p[8];
+    pRecord->event.arg = p[9];
+    pRecord->event.size = getBE16(p + 10);
+    pRecord->event.err = (int32_t)getBE32(p + 12);
+    memcpy(pRecord->event.addr1, p + 16, 6);
+    memcpy(pRecord->event.addr2, p + 22, 6);
+}
+
+// Returns the number of events of the line, -1 if it has the tag but is malformed
+static int lineParse(const char* pLine)
+{
+    const char* pTag = strstr(pLine, MESH_TRACE_LINE_TAG " ");
+    uint8_t event[MESH_TRACE_EVENT_LEN];
+    int core;
+    int offset;
+    int events = 0;
+
+    if (pTag == NULL || (pTag != pLine && pTag[-1] != ' '))
+    {
+        return 0;
+    }
+    size_t deviceLen = pTag - pLine;
+    while (deviceLen && pLine[deviceLen - 1] == ' ')
+    {
+        deviceLen--;
+    }
+    if (sscanf(pTag + strlen(MESH_TRACE_LINE_TAG), " %d %n", &core, &offset) != 1)
+    {
+        return -1;
+    }
+    const char* pHex = pTag + strlen(MESH_TRACE_LINE_TAG) + offset;
+    while (hexValue(pHex[0]) >= 0)
+    {
+        for (int i = 0; i < MESH_TRACE_EVENT_LEN; i++)
+        {
+            int high = hexValue(pHex[2 * i]);
+            int low = high < 0 ? -1 : hexValue(pHex[2 * i + 1]);
+            if (low < 0)
+            {
+                return -1;
+            }
+            event[i] = (uint8_t)(high << 4 | low);
+        }
+        recordAdd(pLine, deviceLen, core, event);
+        pHex += 2 * MESH_TRACE_EVENT_LEN;
+        events++;
+    }
+    return events;
+}
+
+static int recordCompare(const void* pA, const void* pB)
+{
+    const traceRecord_t* pRecordA = pA;
+    const traceRecord_t* pRecordB = pB;
+    int device = strcmp(pRecordA->device, pRecordB->device);
+
+    if (device)
+    {
+        return device;
+    }
+    // differences of wrapped 32 bit times stay correct for dumps shorter than 35 minutes
+    int32_t diff = (int32_t)(pRecordA->event.timeUs - pRecordB->event.timeUs);
+    if (diff)
+    {
+        return diff < 0 ? -1 : 1;
+    }
+    if (pRecordA->core != pRecordB->core)
+    {
+        return pRecordA->core - pRecordB->core;
+    }
+    return pRecordA->event.seq < pRecordB->event.seq ? -1 : pRecordA->event.seq > pRecordB->event.seq;
+}
+
+static void addrPrint(const char* pLabel, const uint8_t* pAddr)
+{
+    static const uint8_t none[6] = { 0 };
+
+    if (strcmp(pLabel, "-") != 0 && memcmp(pAddr, none, sizeof(none)) != 0)
+    {
+        printf(" %s:%02x:%02x:%02x:%02x:%02x:%02x", pLabel, pAddr[0], pAddr[1], pAddr[2], pAddr[3], pAddr[4],
+                pAddr[5]);
+    }
+}
+
+static void recordPrint(const traceRecord_t* pRecord)
+{
+    const meshTraceEvent_t* pEvent = &pRecord->event;
+
+    printf("%s%s%u.%06u core:%d seq:%u ", pRecord->device, pRecord->device[0] ? " " : "", pEvent->timeUs / 1000000,
+            pEvent->timeUs % 1000000, pRecord->core, pEvent->seq);
+    if (pEvent->id > MESH_TRACE_NONE && pEvent->id < MESH_TRACE_ID_MAX)
+    {
+        printf("%s arg:%u size:%u", traceNames[pEvent->id].pName, pEvent->arg, pEvent->size);
+        addrPrint(traceNames[pEvent->id].pAddr1, pEvent->addr1);
+        addrPrint(traceNames[pEvent->id].pAddr2, pEvent->addr2);
+    }
+    else
+    {
+        printf("event%u arg:%u size:%u", pEvent->id, pEvent->arg, pEvent->size);
+        addrPrint("addr1", pEvent->addr1);
+        addrPrint("addr2", pEvent->addr2);
+    }
+    if (pEvent->err)
+    {
+        printf(" err:0x%x", (unsigned)pEvent->err);
+    }
+    printf("\n");
+}
+
+static void fileRead(FILE* pFile, const char* pName)
+{
+    char line[LINE_MAX_LEN];
+    int lineNumber = 0;
+
+    while (fgets(line, sizeof(line), pFile))
+    {
+        lineNumber++;
+        if (lineParse(line) < 0)
+        {
+            fprintf(stderr, "%s:%d: malformed trace line\n", pName, lineNumber);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fileRead(stdin, "stdin");
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        FILE* pFile = fopen(argv[i], "r");
+        if (pFile == NULL)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        fileRead(pFile, argv[i]);
+        fclose(pFile);
+    }
+    qsort(pRecords, recordCount, sizeof(*pRecords), recordCompare);
+    for (size_t i = 0; i < recordCount; i++)
+    {
+        recordPrint(&pRecords[i]);
+    }
+    free(pRecords);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef MESH_BENCH_H_
+#define MESH_BENCH_H_
+
+#include "esp_mesh.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// commands of the throughput benchmark, numbers are integers in big endian
+#define CMD_BENCH_START 0x5A
+// CMD_BENCH_START: <session:4> <path:1> <direction:1> <size:2> <rate:2> <duration:2> <layer:1>, root to every node
+#define CMD_BENCH_JOIN 0x5B
+// CMD_BENCH_JOIN: <session:4> <layer:1> <ip:4>, node taking part to the root
+#define CMD_BENCH_GO 0x5C
+// CMD_BENCH_GO: <session:4> <receiver:6> <receiver ip:4>, root to a node that sends
+#define CMD_BENCH_DATA 0x5D
+// CMD_BENCH_DATA: <session:4> <seq:4> <sent us:4> <layer:1> <sender:6> padded to the payload size,
+// also the UDP payload on the IP path
+#define CMD_BENCH_END 0x5E
+// CMD_BENCH_END: <session:4> <sent:4>, sender to receiver after its last data message
+#define CMD_BENCH_RESULT 0x5F
+// CMD_BENCH_RESULT: <session:4> <layer:1> <sent:4> <received:4> <bytes:4> <jitter us:4> <active us:4>,
+// receiving node to the root
+#define MESH_BENCH_IS_CMD(cmd) ((cmd) >= CMD_BENCH_START && (cmd) <= CMD_BENCH_RESULT)
+#define MESH_BENCH_PORT (5001) // UDP port of the IP path
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum
+{
+    MESH_BENCH_PATH_RAW = 0, // MESH_PROTO_BIN messages through meshNetifSendRaw() and the raw receive callback
+    MESH_BENCH_PATH_IP,      // UDP through lwIP and the mesh netif drivers
+} meshBenchPath_t;
+
+typedef enum
+{
+    MESH_BENCH_UP = 0, // every node to the root
+    MESH_BENCH_DOWN,   // root to every node
+    MESH_BENCH_PEER,   // every node to the next node taking part
+} meshBenchDirection_t;
+
+typedef struct
+{
+    meshBenchPath_t path;
+    meshBenchDirection_t direction;
+    uint16_t size;      // bytes of each data message, header included
+    uint16_t rate;      // data messages per second of each flow
+    uint16_t durationS; // time the senders send
+    uint8_t layer;      // only nodes of this layer take part, 0 for all
+} meshBenchConfig_t;
+
+// Flows of one layer, a flow is reported under the layer of its node end (the sender for node to node)
+typedef struct
+{
+    uint32_t flows;
+    uint32_t sent;        // data messages sent
+    uint32_t received;    // data messages received
+    uint32_t goodputKbps; // sum of the flows
+    uint32_t jitterUs;    // mean RFC 3550 interarrival jitter of the flows
+} meshBenchLayerResult_t;
+
+/**
+ * @brief Called on the root when a benchmark is done
+ *
+ * @param pConfig benchmark that ran
+ * @param pLayers results, index 0 is layer 1
+ * @param layers number of entries in pLayers
+ */
+typedef void (meshBenchResultCb_t)(const meshBenchConfig_t* pConfig, const meshBenchLayerResult_t* pLayers,
+        int layers);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Initializes the benchmark, call once before the mesh starts
+ *
+ * @param pCb called with the results on the root
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshBenchInit(meshBenchResultCb_t* pCb);
+
+/**
+ * @brief Fill in a benchmark configuration from text
+ *
+ * Text is "<raw|ip> <up|down|peer> <size> <rate> <seconds> <layer>", missing trailing fields
+ * keep the CONFIG_MESH_BENCH_* defaults. Empty text gives the defaults.
+ *
+ * @param pText text, does not need to be terminated
+ * @param len length of the text
+ * @param pConfig configuration to fill in
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if a field is unknown or out of range
+ */
+esp_err_t meshBenchParse(const char* pText, size_t len, meshBenchConfig_t* pConfig);
+
+/**
+ * @brief Start a benchmark, root only
+ *
+ * Nodes taking part answer within a second, then the senders send for the configured time.
+ * Results arrive at the callback a few seconds after that.
+ *
+ * @param pConfig benchmark to run
+ *
+ * @return ESP_OK if started, ESP_ERR_INVALID_STATE if not root or a benchmark is running
+ */
+esp_err_t meshBenchStart(const meshBenchConfig_t* pConfig);
+
+/**
+ * @brief Returns true while a benchmark is running on this device
+ */
+bool meshBenchIsRunning(void);
+
+/**
+ * @brief Handle a benchmark command received from the mesh
+ *
+ * @param pFrom sender of the message
+ * @param pData message starting with one of the CMD_BENCH_* commands
+ *
+ * @return ESP_OK if handled, ESP_ERR_INVALID_SIZE for malformed messages
+ */
+esp_err_t meshBenchReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData);
+
+#endif // MESH_BENCH_H_
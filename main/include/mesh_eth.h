@@ -0,0 +1,30 @@
+#ifndef MESH_ETH_H_
+#define MESH_ETH_H_
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// offsets into ethernet frames carrying IPv4, for the mesh netif paths that look at frames without lwIP
+#define ETH_HDR_LEN        (14u)
+#define ETH_TYPE_OFFSET    (12u)
+#define ETH_TYPE_IP        (0x0800u)
+#define ETH_TYPE_ARP       (0x0806u)
+#define ETH_ADDR_IS_GROUP(mac) (((mac)[0] & 0x01) != 0) // broadcast or multicast ethernet address
+
+#define IP_LEN_OFFSET      (ETH_HDR_LEN + 2)
+#define IP_PROTO_OFFSET    (ETH_HDR_LEN + 9)
+#define IP_SRC_OFFSET      (ETH_HDR_LEN + 12)
+#define IP_MIN_HDR_LEN     (20u)
+#define IP_PROTO_ICMP      (1u)
+#define IP_PROTO_TCP       (6u)
+#define IP_PROTO_UDP       (17u)
+
+#define TCP_MIN_HDR_LEN    (20u)
+#define TCP_DATA_OFFSET    (12u)
+#define UDP_HDR_LEN        (8u)
+#define DHCP_SERVER_PORT   (67u)
+#define DHCP_CLIENT_PORT   (68u)
+
+#define GET_BE16(p)        ((uint16_t)(((p)[0] << 8) | (p)[1]))
+
+#endif // MESH_ETH_H_
@@ -0,0 +1,87 @@
+#ifndef MESH_JOIN_H_
+#define MESH_JOIN_H_
+
+#include "esp_mesh.h"
+
+#include <stdint.h>
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum
+{
+    MESH_JOIN_PENDING = 0,  // not connected to a parent since the start
+    MESH_JOIN_SCAN,         // no saved network, joined after a scan of all channels
+    MESH_JOIN_FAST,         // joined the saved parent directly
+    MESH_JOIN_FALLBACK,     // the saved parent failed, joined after a scan
+} meshJoinPath_t;
+
+typedef struct
+{
+    meshJoinPath_t path;
+    uint8_t channel;        // channel of the network, 0 before the first connection
+    uint32_t parentMs;      // time from esp_mesh_start() to the first parent connection, 0 before
+    uint32_t ipMs;          // time from esp_mesh_start() to the first IP address, 0 before
+    uint32_t saves;         // writes of the network to NVS since the start
+} meshJoinStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Load the network this device was part of from NVS and prefer it in the mesh configuration
+ *
+ * Sets the saved channel and router BSSID in pConfig with channel and router switches allowed, so the mesh
+ * still scans all channels and takes another router of the same SSID when they are gone. Call after
+ * nvs_flash_init() and meshSchedInit(), before esp_mesh_set_config().
+ *
+ * @param pConfig mesh configuration to update, its mesh ID must be set
+ *
+ * @return ESP_OK, also without a saved network, ESP_ERR_NO_MEM without memory for the timer or the job
+ */
+esp_err_t meshJoinInit(mesh_cfg_t* pConfig);
+
+/**
+ * @brief Connect to the saved parent, call right after esp_mesh_start()
+ *
+ * A device that was root connects to the router, the others to their parent at their layer, without
+ * scanning and voting. If that fails within CONFIG_MESH_FAST_JOIN_TIMEOUT_MS, or the parent refuses
+ * the connection, the mesh organizes itself again as without a saved network.
+ */
+void meshJoinStart(void);
+
+/**
+ * @brief Record the parent, call on MESH_EVENT_PARENT_CONNECTED
+ *
+ * @param pConnected the event data
+ */
+void meshJoinConnected(const mesh_event_connected_t* pConnected);
+
+/**
+ * @brief Call on MESH_EVENT_PARENT_DISCONNECTED, ends a connection attempt to the saved parent
+ */
+void meshJoinDisconnected(void);
+
+/**
+ * @brief Record the channel and router the mesh found, call on MESH_EVENT_FIND_NETWORK and
+ *        MESH_EVENT_CHANNEL_SWITCH with pRouter NULL
+ *
+ * @param channel channel of the network
+ * @param pRouter BSSID of the router, NULL if unchanged
+ */
+void meshJoinNetwork(uint8_t channel, const uint8_t* pRouter);
+
+/**
+ * @brief Take the time to the first IP address, call when the device got one
+ */
+void meshJoinGotIp(void);
+
+/**
+ * @brief Get how this device joined the mesh
+ *
+ * @param pStats returns the figures
+ */
+void meshJoinGetStats(meshJoinStats_t* pStats);
+
+#endif // MESH_JOIN_H_
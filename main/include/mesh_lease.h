@@ -0,0 +1,93 @@
+#ifndef MESH_LEASE_H_
+#define MESH_LEASE_H_
+
+#include "esp_mesh.h"
+
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// commands of the lease table distribution, numbers are integers in big endian, the DNS server address is in
+// network order, an entry is <station MAC:6> <host:2> where host numbers the addresses from 10.0.16.1 on
+#define CMD_LEASE_TABLE 0x6A
+// CMD_LEASE_TABLE: <version:4> <dns:4> <count:2> followed by all entries of the table, entries beyond
+// CONFIG_MESH_RAW_MAX_SIZE follow in CMD_LEASE_ADD messages with version as base
+#define CMD_LEASE_ADD 0x6B
+// CMD_LEASE_ADD: <base version:4> <version:4> <dns:4> <count:2> followed by the entries added since the base
+#define CMD_LEASE_REQUEST 0x6C
+// CMD_LEASE_REQUEST: <version:4> held by a node without a lease, asks the root for the full table
+#define MESH_LEASE_IS_CMD(cmd) ((cmd) >= CMD_LEASE_TABLE && (cmd) <= CMD_LEASE_REQUEST)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct
+{
+    uint32_t version;    // version of the table held
+    uint32_t size;       // leases in the table held
+    uint32_t assigned;   // root: leases added to the table
+    uint32_t moved;      // root: leases not at the address of their MAC because another node had it
+    uint32_t fullSent;   // root: full table messages sent
+    uint32_t deltasSent; // root: messages with the leases added since the last one
+    uint32_t requests;   // full table requests sent by a node or served by the root
+    uint32_t applied;    // node: static addresses set from the table
+    uint32_t dhcp;       // node: connections that used DHCP because the table had no lease in time
+} meshLeaseStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Initializes the lease table, call once after meshSchedInit() and meshNetifsInit()
+ *
+ * The root gives every node of its routing table an address derived from the node's station MAC and sends the
+ * table to all nodes. A node sets its address from the table when it connects instead of asking the DHCP server
+ * of the root, and keeps it when the root changes, since the new root holds the same table. A node not in the
+ * table asks the root for it and waits CONFIG_MESH_LEASE_WAIT_MS, then uses DHCP.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without memory for the lock, the timer or the job
+ */
+esp_err_t meshLeaseInit(void);
+
+/**
+ * @brief Give every node of the root's routing table a lease and send the new ones
+ *
+ * Call on the root after meshNetifRoutingTableUpdate(). Leases of nodes that left are kept until the
+ * table is full.
+ */
+void meshLeaseRootUpdate(void);
+
+/**
+ * @brief Set the DNS server sent along with the leases, call on the root once it has an address
+ *
+ * @param dnsAddr DNS server of the root's station
+ */
+void meshLeaseSetDns(uint32_t dnsAddr);
+
+/**
+ * @brief Set the root a node without a lease asks for it, call on MESH_EVENT_ROOT_ADDRESS
+ *
+ * @param pRoot address of the root
+ */
+void meshLeaseSetRoot(const mesh_addr_t* pRoot);
+
+/**
+ * @brief Handle a lease command received from the mesh
+ *
+ * @param pFrom sender of the message
+ * @param pData message starting with one of the CMD_LEASE_* commands
+ *
+ * @return ESP_OK if handled, ESP_ERR_INVALID_SIZE for malformed messages
+ */
+esp_err_t meshLeaseReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData);
+
+/**
+ * @brief Returns lease counters
+ *
+ * @param pStats structure to fill in
+ */
+void meshLeaseGetStats(meshLeaseStats_t* pStats);
+
+#endif // MESH_LEASE_H_
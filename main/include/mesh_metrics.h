@@ -0,0 +1,58 @@
+#ifndef MESH_METRICS_H_
+#define MESH_METRICS_H_
+
+#include "esp_err.h"
+
+#include <stddef.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define MESH_METRICS_SNAPSHOT_MAX (3072) // buffer size that fits a snapshot of every counter and task
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Initializes the metrics, starts the serial console with the "metrics" and "trace" commands if enabled
+ *
+ * Call once after the other modules are initialized.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshMetricsInit(void);
+
+/**
+ * @brief Write a compact JSON snapshot of the counters of the netif drivers, queues, MQTT, heap and tasks
+ *
+ * Keys:
+ * - rx/tx: [packets, bytes] per mesh proto
+ * - err: failed receives, failed sends by esp_err_t code and the other failed sends
+ * - bc: broadcasts, sends, failed sends and the fan-out histogram of mesh_netif.h
+ * - txq/rawq: [queued, sent, dropped, errors, depth, peak depth] per traffic class of the netif and raw queues
+ * - rxq: [packets, dropped, depth] per traffic class
+ * - pool: [size, in use, peak in use, exhausted, dropped] of the rx buffers
+ * - frag: [sent, received, reassembled, timeouts, dropped] fragments of raw messages
+ * - link: [connects, kept, role changes, renewals, ms to the first packet after the last and the slowest
+ *   reconnection] of the parent link
+ * - state: [events, runs, debounced parent losses, us of the last and the longest run] of the state task
+ * - route: [version, size] of the routing table
+ * - mqtt: [published, publish errors, received, connects, disconnects, errors, forwarded, delivered, gateway nodes]
+ * - store: [records, bytes, NVS blobs, stored, replayed, dropped, spilled] of the MQTT store, CONFIG_MESH_MQTT_STORE
+ * - join: [meshJoinPath_t, channel, ms to the parent, ms to the IP address, NVS writes], CONFIG_MESH_FAST_JOIN
+ * - lease: [version, size, assigned, moved, static addresses set, DHCP fallbacks] of the lease table,
+ *   CONFIG_MESH_LEASES
+ * - heap: [free, minimum free] bytes
+ * - tasks: stack high water mark in bytes by task name
+ *
+ * A snapshot that does not fit ends after the last key that did with "truncated":true, so it stays valid JSON
+ *
+ * @param pBuffer buffer, MESH_METRICS_SNAPSHOT_MAX bytes fit every snapshot
+ * @param size size of the buffer, at least 64 bytes
+ *
+ * @return length of the snapshot, at most size - 1
+ */
+size_t meshMetricsSnapshot(char* pBuffer, size_t size);
+
+#endif // MESH_METRICS_H_
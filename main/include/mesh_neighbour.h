@@ -0,0 +1,103 @@
+#ifndef MESH_NEIGHBOUR_H_
+#define MESH_NEIGHBOUR_H_
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define MESH_NEIGHBOUR_ARP_FRAME_SIZE (42u) // ethernet header + ARP payload, no padding
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct
+{
+    uint32_t entries;      // used slots in the cache
+    uint32_t learned;      // new or changed MAC<->IP bindings
+    uint32_t arpAnswered;  // ARP requests answered from the cache
+    uint32_t arpMissed;    // ARP requests for addresses not in the cache
+    uint32_t dhcpDirected; // DHCP server messages sent only to their client
+} meshNeighbourStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Forget all MAC<->IP bindings, call when the node takes or gives up the root role
+ */
+void meshNeighbourClear(void);
+
+/**
+ * @brief Add or refresh a MAC<->IP binding
+ *
+ * @param pMac station MAC address of the node
+ * @param ip IPv4 address in network byte order
+ */
+void meshNeighbourLearn(const uint8_t* pMac, uint32_t ip);
+
+/**
+ * @brief Look up the MAC address bound to an IP address
+ *
+ * @param ip IPv4 address in network byte order
+ * @param pMac filled with the MAC address when found, may be NULL
+ *
+ * @return true if the address is known
+ */
+bool meshNeighbourLookup(uint32_t ip, uint8_t* pMac);
+
+/**
+ * @brief Learn bindings from an ethernet frame (ARP sender, IPv4 source, DHCP ACK)
+ *
+ * @param pFrame ethernet frame
+ * @param len frame length
+ * @param fromNode true for frames received from a node, false for frames the root sends down
+ */
+void meshNeighbourSnoop(const uint8_t* pFrame, size_t len, bool fromNode);
+
+/**
+ * @brief Check if the frame is an ARP request (not gratuitous) and return the requested address
+ *
+ * @param pFrame ethernet frame
+ * @param len frame length
+ * @param pIp filled with the requested IPv4 address in network byte order
+ *
+ * @return true for ARP requests
+ */
+bool meshNeighbourArpRequestTarget(const uint8_t* pFrame, size_t len, uint32_t* pIp);
+
+/**
+ * @brief Build an ARP reply if the frame is an ARP request for a known address
+ *
+ * @param pFrame ethernet frame
+ * @param len frame length
+ * @param pReply buffer of at least MESH_NEIGHBOUR_ARP_FRAME_SIZE bytes for the reply
+ *
+ * @return length of the reply, 0 if the frame is not an ARP request for a known address
+ */
+size_t meshNeighbourArpReply(const uint8_t* pFrame, size_t len, uint8_t* pReply);
+
+/**
+ * @brief Check if the frame is a DHCP server message and return its client
+ *
+ * @param pFrame ethernet frame
+ * @param len frame length
+ * @param pMac filled with the client hardware address
+ *
+ * @return true for DHCP server to client messages
+ */
+bool meshNeighbourDhcpClient(const uint8_t* pFrame, size_t len, uint8_t* pMac);
+
+/**
+ * @brief Returns cache and proxy counters
+ *
+ * @param pStats structure to fill in
+ */
+void meshNeighbourGetStats(meshNeighbourStats_t* pStats);
+
+#endif // MESH_NEIGHBOUR_H_
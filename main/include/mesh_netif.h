@@ -2,17 +2,96 @@
 #define MESH_NETIF_H_
 
 #include "esp_mesh.h"
+#include "mesh_tx.h"
 
 /*******************************************************
  *                Macros
  *******************************************************/
 #define MAC_ADDR_LEN (6u)
 #define MAC_ADDR_EQUAL(a, b) (0 == memcmp(a, b, MAC_ADDR_LEN))
+#define MESH_GROUP_ALL_ADDR { 0x01, 0x00, 0x5E, 0x77, 0x77, 0x76 } // mesh group joined by every node
+#define MESH_NETIF_RAW_FRAGMENT (0xF0) // first byte of raw message fragments, not usable as an application command
+#define MESH_NETIF_PROTOS (MESH_PROTO_STA + 1) // entries of the per proto counters, indexed by mesh_proto_t
+#define MESH_NETIF_ERROR_CODES (8) // distinct esp_mesh_send error codes counted, further codes count as other
+#define MESH_NETIF_FANOUT_BUCKETS (8) // bucket i counts broadcasts of 2^i to 2^(i+1)-1 sends, the last one the rest
 
 /*******************************************************
  *                Type Definitions
  *******************************************************/
 typedef void (mesh_raw_recv_cb_t)(mesh_addr_t* pFrom, mesh_data_t* pData);
+// Returns the traffic class of a received raw message, decides which worker task handles it
+typedef meshTrafficClass_t (mesh_raw_class_cb_t)(const mesh_data_t* pData);
+// Returns the static address of the node station of MAC pMac: ESP_OK with the address, ESP_ERR_NOT_FINISHED
+// if it is set later by meshNetifSetStaticIp() or meshNetifStartDhcp(), ESP_ERR_NOT_FOUND to use DHCP now
+typedef esp_err_t (mesh_address_cb_t)(const uint8_t* pMac, esp_netif_ip_info_t* pIpInfo, uint32_t* pDnsAddr);
+
+typedef struct
+{
+    uint32_t size;      // number of buffers in the rx pool
+    uint32_t inUse;     // buffers currently held by the receive task or lwIP
+    uint32_t peakInUse; // highest number of buffers held at once
+    uint32_t exhausted; // times a buffer was asked for while none was free
+    uint32_t dropped;   // messages and unpacked uplink frames dropped for lack of a free buffer
+} meshNetifRxPoolStats_t;
+
+typedef struct
+{
+    uint32_t packets; // messages received from the mesh
+    uint32_t bytes;   // bytes received from the mesh
+    uint32_t dropped; // raw messages dropped because the worker of the class was busy
+    uint32_t depth;   // messages waiting for the worker of the class, 0 for bulk which has none
+} meshNetifRxStats_t;
+
+typedef struct
+{
+    uint32_t rxPackets; // esp_mesh_recv() results
+    uint32_t rxBytes;
+    uint32_t txPackets; // successful esp_mesh_send() calls
+    uint32_t txBytes;
+} meshNetifProtoStats_t;
+
+typedef struct
+{
+    uint32_t recvErrors; // failed esp_mesh_recv() calls
+    struct
+    {
+        esp_err_t code;  // 0 for an unused entry
+        uint32_t count;
+    } sendErrors[MESH_NETIF_ERROR_CODES]; // failed esp_mesh_send() calls by error code
+    uint32_t otherSendErrors;             // failed calls with a code not in sendErrors
+} meshNetifErrorStats_t;
+
+typedef struct
+{
+    uint32_t fragmentsSent;     // fragments of raw messages larger than MESH_MPS queued for sending
+    uint32_t fragmentsReceived; // fragments added to a reassembly
+    uint32_t reassembled;       // complete messages delivered
+    uint32_t timeouts;          // messages dropped because the rest did not arrive in time
+    uint32_t dropped;           // fragments dropped: lost predecessor, no free slot or message too large
+} meshNetifFragmentStats_t;
+
+typedef struct
+{
+    uint32_t broadcasts; // broadcast/multicast messages requested
+    uint32_t sends;      // esp_mesh_send calls issued for them
+    uint32_t errors;     // failed sends
+    uint32_t fanout[MESH_NETIF_FANOUT_BUCKETS]; // broadcasts by the number of sends they took
+} meshNetifBroadcastStats_t;
+
+typedef struct
+{
+    uint32_t connects;         // parent connections since the start
+    uint32_t kept;             // reconnections in the same role that kept the netifs, IP address and leases
+    uint32_t roleChanges;      // switches between root and node, each one sets the address again
+    uint32_t renewals;         // kept addresses leased again because the root changed
+    uint32_t firstPacketMs;    // time from the last reconnection to the first message received, 0 until then
+    uint32_t maxFirstPacketMs;
+} meshNetifLinkStats_t;
+
+/*******************************************************
+ *                Variable Declarations
+ *******************************************************/
+extern const esp_netif_ip_info_t g_mesh_netif_subnet_ip; // address of the root's AP in the mesh subnet
 
 /*******************************************************
  *                Function Declarations
@@ -35,24 +114,66 @@ esp_err_t meshNetifsInit(mesh_raw_recv_cb_t* pCb);
 esp_err_t meshNetifsDestroy(void);
 
 /**
- * @brief Start the mesh netifs based on the configuration (root/node)
+ * @brief Start the mesh netifs based on the configuration (root/node), call on MESH_EVENT_PARENT_CONNECTED
+ *
+ * Netifs are created once and kept. A reconnection in the same role only takes up the link again, the station
+ * keeps its IP address and the root's AP its DHCP leases. A role change stops the netifs of the old role and
+ * starts those of the new one, which gets its address again.
  *
  * @return ESP_OK on success
  */
 esp_err_t meshNetifsStart(bool isRoot);
 
 /**
- * @brief Stop the netifs and reset to the default mode
+ * @brief Mark the link to the parent as down, call on MESH_EVENT_PARENT_DISCONNECTED
+ *
+ * The netifs stay up with their addresses, frames sent until the parent is back fail in the mesh.
  *
  * @return ESP_OK on success
  */
 esp_err_t meshNetifsStop(void);
 
+/**
+ * @brief Lease the address of a node station again if the root changed while it was kept, call on
+ *        MESH_EVENT_ROOT_ADDRESS
+ *
+ * A static address of the mesh_address_cb_t is kept, the new root holds the same lease table.
+ *
+ * @param pRoot address of the root
+ */
+void meshNetifSetRoot(const mesh_addr_t* pRoot);
+
+/**
+ * @brief Set the function asked for a static address whenever the node station connects, before DHCP
+ *
+ * @param pCb called on the task calling meshNetifsStart() and meshNetifSetRoot(), NULL for DHCP only
+ */
+void meshNetifSetAddressCb(mesh_address_cb_t* pCb);
+
+/**
+ * @brief Give the node station a static address, the DHCP client is stopped
+ *
+ * @param pIpInfo address, gateway and netmask
+ * @param dnsAddr DNS server, 0 to keep the one set
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the station is not a node station
+ */
+esp_err_t meshNetifSetStaticIp(const esp_netif_ip_info_t* pIpInfo, uint32_t dnsAddr);
+
+/**
+ * @brief Lease the address of the node station by DHCP, after the mesh_address_cb_t returned
+ *        ESP_ERR_NOT_FINISHED and no static address came in time
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the station is not a node station waiting for an address
+ */
+esp_err_t meshNetifStartDhcp(void);
+
 /**
  * @brief Start the netif for root AP
  *
  * Note: The AP netif needs to be started separately after root received
- * an IP address from the router so the DNS address could be used for dhcps
+ * an IP address from the router so the DNS address could be used for dhcps.
+ * An AP already running keeps its DHCP server and leases.
  *
  * @param is_root must be true, ignored otherwise
  * @param dns_addr DNS address to use in DHCP server running on roots AP
@@ -71,5 +192,170 @@ esp_err_t meshNetifStartRootAP(bool isRoot, uint32_t DNS_Addr);
  */
 uint8_t* meshNetifGetStationMAC(void);
 
+/**
+ * @brief Returns the address of this device in the mesh subnet
+ *
+ * That is the root's AP netif or a node's station netif, nodes reach the root at the gateway.
+ *
+ * @param pIpInfo structure to fill in
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the netif is not created yet
+ */
+esp_err_t meshNetifGetMeshIpInfo(esp_netif_ip_info_t* pIpInfo);
+
+/**
+ * @brief Refresh the cached routing table from the mesh stack
+ *
+ * Call from the mesh event handler on MESH_EVENT_ROUTING_TABLE_ADD/REMOVE.
+ * Must only be called from one task (the default event loop), readers never lock.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshNetifRoutingTableUpdate(void);
+
+/**
+ * @brief Replace the cached routing table with one distributed by the root
+ *
+ * Nodes only see their own subtree in esp_mesh_get_routing_table(), ignored on root.
+ *
+ * @param pTable routing table entries
+ * @param size number of entries
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshNetifRoutingTableSet(const mesh_addr_t* pTable, int size);
+
+/**
+ * @brief Returns the cached routing table without locking
+ *
+ * The table stays valid until meshNetifReleaseRoutingTable(), updates wait for the release before they
+ * reuse its memory, so do not hold it across a call that updates the table
+ *
+ * @param ppTable set to the first routing table entry
+ * @param pSize set to the number of entries
+ *
+ * @return Version of the routing table, incremented on every update
+ */
+uint32_t meshNetifGetRoutingTable(const mesh_addr_t** ppTable, int* pSize);
+
+/**
+ * @brief Release a table returned by meshNetifGetRoutingTable()
+ *
+ * @param pTable table returned in ppTable
+ */
+void meshNetifReleaseRoutingTable(const mesh_addr_t* pTable);
+
+/**
+ * @brief Join the mesh group used for broadcasts, call once the mesh is started
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshNetifJoinBroadcastGroup(void);
+
+/**
+ * @brief Send data to every other node in the mesh
+ *
+ * Uses one group addressed send (MESH_DATA_GROUP), or one unicast per routing table
+ * entry when CONFIG_MESH_GROUP_BROADCAST is disabled
+ *
+ * @param pData data to send, any proto
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshNetifBroadcast(const mesh_data_t* pData);
+
+/**
+ * @brief Returns number of broadcasts, the mesh sends they took and their fan-out
+ *
+ * @param pStats structure to fill in
+ */
+void meshNetifGetBroadcastStats(meshNetifBroadcastStats_t* pStats);
+
+/**
+ * @brief Queue a raw message for sending, the data is copied
+ *
+ * Messages of each traffic class have their own queue, control messages are sent
+ * before interactive ones and both before bulk. Waits up to 100 ms for a free slot.
+ * Messages larger than MESH_MPS are sent in fragments and reassembled by the receiver
+ * before they reach its mesh_raw_recv_cb_t.
+ *
+ * @param pTo destination node, NULL to send to every node
+ * @param pData data to send, usually MESH_PROTO_BIN, up to CONFIG_MESH_RAW_MAX_SIZE bytes
+ * @param trafficClass queue the message goes to
+ *
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if the queue is full, ESP_ERR_INVALID_SIZE if too large
+ */
+esp_err_t meshNetifSendRaw(const mesh_addr_t* pTo, const mesh_data_t* pData, meshTrafficClass_t trafficClass);
+
+/**
+ * @brief Set the function classifying received raw messages
+ *
+ * Control messages are handled by the highest priority worker, interactive ones by the next,
+ * bulk ones in the receive task. Without a classifier every raw message is control.
+ *
+ * @param pCb classifier, called from the receive task
+ */
+void meshNetifSetRawClassifier(mesh_raw_class_cb_t* pCb);
+
+/**
+ * @brief Returns tx queue counters of the active mesh netif (root AP or node station)
+ *
+ * @param pStats counters to fill in, one per traffic class
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no mesh netif is running
+ */
+esp_err_t meshNetifGetTxStats(meshTxStats_t pStats[MESH_TRAFFIC_CLASS_MAX]);
+
+/**
+ * @brief Returns counters of the raw message tx queue
+ *
+ * @param pStats counters to fill in, one per traffic class
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE before meshNetifsInit()
+ */
+esp_err_t meshNetifGetRawTxStats(meshTxStats_t pStats[MESH_TRAFFIC_CLASS_MAX]);
+
+/**
+ * @brief Returns receive counters
+ *
+ * @param pStats counters to fill in, one per traffic class
+ */
+void meshNetifGetRxStats(meshNetifRxStats_t pStats[MESH_TRAFFIC_CLASS_MAX]);
+
+/**
+ * @brief Returns packets and bytes sent and received through the mesh stack
+ *
+ * @param pStats counters to fill in, indexed by mesh_proto_t
+ */
+void meshNetifGetProtoStats(meshNetifProtoStats_t pStats[MESH_NETIF_PROTOS]);
+
+/**
+ * @brief Returns failed receives and failed sends by error code
+ *
+ * @param pStats structure to fill in
+ */
+void meshNetifGetErrorStats(meshNetifErrorStats_t* pStats);
+
+/**
+ * @brief Returns fragmentation and reassembly counters of raw messages
+ *
+ * @param pStats structure to fill in
+ */
+void meshNetifGetFragmentStats(meshNetifFragmentStats_t* pStats);
+
+/**
+ * @brief Returns occupancy and exhaustion counters of the rx buffer pool
+ *
+ * @param pStats structure to fill in
+ */
+void meshNetifGetRxPoolStats(meshNetifRxPoolStats_t* pStats);
+
+/**
+ * @brief Returns how parent connections were taken up and how long the first packet took after them
+ *
+ * @param pStats structure to fill in
+ */
+void meshNetifGetLinkStats(meshNetifLinkStats_t* pStats);
+
 #endif // MESH_NETIF_H_
 
@@ -0,0 +1,121 @@
+#ifndef MESH_OTA_H_
+#define MESH_OTA_H_
+
+#include "esp_mesh.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// commands of the mesh OTA update, numbers are integers in big endian, chunks are numbered from 0
+#define CMD_OTA_OFFER 0x65
+// CMD_OTA_OFFER: <session:4> <size:4> <chunk size:2>, root to every node, repeated until the nodes are ready
+#define CMD_OTA_DATA 0x66
+// CMD_OTA_DATA: <session:4> <chunk:2> <data>, root to every node or to the nodes missing the chunk
+#define CMD_OTA_QUERY 0x67
+// CMD_OTA_QUERY: <session:4> <first chunk:2> <count:1>, root to every node, asks for the chunks of a window
+#define CMD_OTA_STATUS 0x68
+// CMD_OTA_STATUS: <session:4> <state:1> <layer:1> <chunks received:2> <first chunk:2> <count:1>
+// <missing:(count + 7) / 8>, node to root in reply to the other commands, bit i of the bitmap (LSB first) is set
+// when chunk first + i is missing, count is 0 in replies to CMD_OTA_OFFER and CMD_OTA_END
+#define CMD_OTA_END 0x69
+// CMD_OTA_END: <session:4> <commit:1>, root to every node or to a node given up on, commit 1 activates the
+// image, 0 drops it
+#define MESH_OTA_IS_CMD(cmd) ((cmd) >= CMD_OTA_OFFER && (cmd) <= CMD_OTA_END)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum
+{
+    MESH_OTA_IDLE = 0,  // no session, or the session was dropped
+    MESH_OTA_RECEIVING, // ready for data, the update partition is erased
+    MESH_OTA_DONE,      // image complete and set as boot partition
+    MESH_OTA_FAILED,    // image incomplete or invalid, or the node stopped answering
+} meshOtaState_t;
+
+// Progress of one node as the root sees it
+typedef struct
+{
+    mesh_addr_t addr;
+    uint8_t layer;
+    meshOtaState_t state;
+    uint32_t received;    // bytes of the image the node reported
+    uint32_t kbps;        // received bits over the time since the first data message
+} meshOtaNodeProgress_t;
+
+typedef struct
+{
+    uint32_t size;        // bytes of the image
+    uint32_t downloadMs;  // time the root took to download the image
+    uint32_t elapsedMs;   // time since the first data message
+    uint32_t bytesSent;   // data bytes the root sent, each retransmission counted again
+    uint32_t broadcasts;  // chunks sent to every node
+    uint32_t unicasts;    // chunks sent again to single nodes
+    bool done;            // last report of the session
+    esp_err_t err;        // ESP_OK unless the download failed, then no node took part
+} meshOtaSummary_t;
+
+/**
+ * @brief Called on the root every CONFIG_MESH_OTA_PROGRESS_S while an update is distributed and when it is done
+ *
+ * @param pSummary figures of the whole session
+ * @param pNodes nodes taking part
+ * @param count number of entries in pNodes
+ */
+typedef void (meshOtaProgressCb_t)(const meshOtaSummary_t* pSummary, const meshOtaNodeProgress_t* pNodes,
+        int count);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Initializes the OTA update, call once before the mesh starts
+ *
+ * A running image that waits for verification is rolled back unless meshOtaConfirm() is called within
+ * CONFIG_MESH_OTA_VALIDATE_S.
+ *
+ * @param pCb called with the progress on the root
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without memory for the task
+ */
+esp_err_t meshOtaInit(meshOtaProgressCb_t* pCb);
+
+/**
+ * @brief Download an image and distribute it to every node, root only
+ *
+ * The root downloads the image once into its own update partition, offers it to the nodes and sends it in
+ * windows of CONFIG_MESH_OTA_WINDOW chunks to every node at once. After each window the nodes report the chunks
+ * they miss, chunks missed by more than one node go to every node again, the others to the nodes missing them.
+ * Nodes that do not complete a window within CONFIG_MESH_OTA_ROUNDS reports are given up on. At the end every
+ * device sets the new image as boot partition and restarts after CONFIG_MESH_OTA_RESTART_DELAY_S.
+ *
+ * @param pUrl HTTP URL of the image, copied
+ *
+ * @return ESP_OK if started, ESP_ERR_INVALID_STATE if not root or an update is running, ESP_ERR_INVALID_ARG for
+ *         a URL that is too long
+ */
+esp_err_t meshOtaStart(const char* pUrl);
+
+/**
+ * @brief Mark the running image as working, cancelling its rollback
+ *
+ * Call once the device is connected, e.g. has an IP address through the mesh. Does nothing for images that do
+ * not wait for verification.
+ */
+void meshOtaConfirm(void);
+
+/**
+ * @brief Handle an OTA command received from the mesh
+ *
+ * @param pFrom sender of the message
+ * @param pData message starting with one of the CMD_OTA_* commands
+ *
+ * @return ESP_OK if handled, ESP_ERR_INVALID_SIZE for malformed messages
+ */
+esp_err_t meshOtaReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData);
+
+#endif // MESH_OTA_H_
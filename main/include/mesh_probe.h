@@ -0,0 +1,97 @@
+#ifndef MESH_PROBE_H_
+#define MESH_PROBE_H_
+
+#include "esp_mesh.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// commands of the round trip probe, numbers are integers in big endian
+#define CMD_PROBE_REQUEST 0x60
+// CMD_PROBE_REQUEST: <seq:4> <sent us:4> <layer:1> of the sender
+#define CMD_PROBE_REPLY 0x61
+// CMD_PROBE_REPLY: the request echoed followed by <layer:1> of the replying device
+#define MESH_PROBE_IS_CMD(cmd) ((cmd) == CMD_PROBE_REQUEST || (cmd) == CMD_PROBE_REPLY)
+// bucket 0 counts round trips below 1 ms, bucket i from 2^(i-1) ms to below 2^i ms, the last one the rest
+#define MESH_PROBE_BUCKETS (12)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum
+{
+    MESH_PROBE_PARENT = 0, // node to its parent, the latency of one hop
+    MESH_PROBE_ROOT,       // node to the root through all hops
+    MESH_PROBE_NODES,      // root to its nodes, one after the other
+    MESH_PROBE_DESTINATIONS,
+} meshProbeDestination_t;
+
+typedef struct
+{
+    uint32_t sent;     // probes sent
+    uint32_t received; // replies received in time, the others are lost
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t sumUs;
+    uint32_t buckets[MESH_PROBE_BUCKETS];
+} meshProbeHistogram_t;
+
+typedef struct
+{
+    mesh_addr_t addresses[MESH_PROBE_DESTINATIONS]; // last address probed
+    meshProbeHistogram_t destinations[MESH_PROBE_DESTINATIONS];
+    // root: replies of the nodes by the layer of the node, index 0 is layer 1, losses only show in
+    // MESH_PROBE_NODES as the layer is learned from the reply; unused on nodes
+    meshProbeHistogram_t layers[CONFIG_MESH_MAX_LAYER];
+} meshProbeStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Initializes the probe and adds the scheduler job sending probes, call once after meshSchedInit() and
+ *        before the mesh starts
+ *
+ * Nodes probe their parent and the root, the root one node of its routing table
+ * every CONFIG_MESH_PROBE_INTERVAL_MS.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshProbeInit(void);
+
+/**
+ * @brief Set the parent to probe, call on MESH_EVENT_PARENT_CONNECTED and MESH_EVENT_PARENT_DISCONNECTED
+ *
+ * @param pBssid softAP address of the parent, NULL when disconnected
+ */
+void meshProbeSetParent(const mesh_addr_t* pBssid);
+
+/**
+ * @brief Set the root to probe, call on MESH_EVENT_ROOT_ADDRESS
+ *
+ * @param pRoot address of the root
+ */
+void meshProbeSetRoot(const mesh_addr_t* pRoot);
+
+/**
+ * @brief Handle a probe command received from the mesh, replies to requests
+ *
+ * @param pFrom sender of the message
+ * @param pData message starting with CMD_PROBE_REQUEST or CMD_PROBE_REPLY
+ *
+ * @return ESP_OK if handled, ESP_ERR_INVALID_SIZE for malformed messages
+ */
+esp_err_t meshProbeReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData);
+
+/**
+ * @brief Returns the histograms collected since the last call and starts new ones
+ *
+ * @param pStats structure to fill in
+ */
+void meshProbeTakeStats(meshProbeStats_t* pStats);
+
+#endif // MESH_PROBE_H_
@@ -0,0 +1,82 @@
+#ifndef MESH_ROUTE_H_
+#define MESH_ROUTE_H_
+
+#include "esp_mesh.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// commands of the routing table distribution, numbers are integers in big endian
+#define CMD_ROUTE_TABLE 0x56
+// CMD_ROUTE_TABLE: <version:4> followed by all entries of the table
+#define CMD_ROUTE_DELTA 0x57
+// CMD_ROUTE_DELTA: <base version:4> <version:4> <added:2> <removed:2> followed by added then removed entries
+#define CMD_ROUTE_HEARTBEAT 0x58
+// CMD_ROUTE_HEARTBEAT: <version:4> of the table held by the root
+#define CMD_ROUTE_RESYNC 0x59
+// CMD_ROUTE_RESYNC: <version:4> held by the node, asks the root for the full table
+#define CMD_ROUTE_PART 0x6D
+// CMD_ROUTE_PART: <version:4> <offset:2> <total:2> followed by entries from offset on of a table of total entries,
+// sent in order instead of CMD_ROUTE_TABLE for tables larger than CONFIG_MESH_RAW_MAX_SIZE
+#define MESH_ROUTE_IS_CMD(cmd) (((cmd) >= CMD_ROUTE_TABLE && (cmd) <= CMD_ROUTE_RESYNC) || (cmd) == CMD_ROUTE_PART)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct
+{
+    uint32_t version;    // version of the table held
+    uint32_t size;       // entries in the table held
+    uint32_t fullSent;   // full table messages sent by the root
+    uint32_t deltasSent; // delta messages sent by the root
+    uint32_t heartbeats; // heartbeats sent by the root
+    uint32_t resyncs;    // full table requests sent by a node or served by the root
+    uint32_t bytesSent;  // payload bytes of all the above
+} meshRouteStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Initializes the routing table distribution, call once before the mesh starts
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t meshRouteInit(void);
+
+/**
+ * @brief Send the changes of the root's routing table since the last call to every node
+ *
+ * Call on the root after meshNetifRoutingTableUpdate(), does nothing if the table did not change.
+ */
+void meshRouteRootUpdate(void);
+
+/**
+ * @brief Send the version of the root's routing table to every node
+ *
+ * Nodes holding another version ask for the full table. Call periodically on the root.
+ */
+void meshRouteHeartbeat(void);
+
+/**
+ * @brief Handle a routing table command received from the mesh
+ *
+ * @param pFrom sender of the message
+ * @param pData message starting with one of the CMD_ROUTE_* commands
+ *
+ * @return ESP_OK if handled, ESP_ERR_INVALID_SIZE for malformed messages
+ */
+esp_err_t meshRouteReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData);
+
+/**
+ * @brief Returns distribution counters
+ *
+ * @param pStats structure to fill in
+ */
+void meshRouteGetStats(meshRouteStats_t* pStats);
+
+#endif // MESH_ROUTE_H_
@@ -0,0 +1,78 @@
+#ifndef MESH_SCHED_H_
+#define MESH_SCHED_H_
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define MESH_SCHED_JOBS_MAX CONFIG_MESH_SCHED_JOBS_MAX
+#define MESH_SCHED_JOB_NONE (-1) // triggers of a job not added yet are ignored
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef int meshSchedJob_t;
+
+typedef void (meshSchedJobCb_t)(void* pArg);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Create the scheduler tasks, call before the other functions
+ *
+ * Periodic jobs of all modules run one after the other on one task, so they must not block for long. Jobs of
+ * meshSchedAddInteractive() run on a second task of a higher priority and are not held up by them.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without memory for the task
+ */
+esp_err_t meshSchedInit(void);
+
+/**
+ * @brief Add a job
+ *
+ * The first run is at a random phase within the period, later runs follow every period moved by up to
+ * CONFIG_MESH_SCHED_JITTER_PERCENT, so devices powered on together do not run their jobs in step.
+ *
+ * @param pName name of the job for logs
+ * @param periodMs time between runs, 0 for jobs run only by meshSchedTrigger()
+ * @param pCb called on the scheduler task
+ * @param pArg passed to pCb
+ * @param pJob returns the job
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM with MESH_SCHED_JOBS_MAX jobs, ESP_ERR_INVALID_STATE before
+ *         meshSchedInit()
+ */
+esp_err_t meshSchedAdd(const char* pName, uint32_t periodMs, meshSchedJobCb_t* pCb, void* pArg,
+        meshSchedJob_t* pJob);
+
+/**
+ * @brief meshSchedAdd() for short jobs a user waits for, e.g. the button
+ *
+ * The job runs on the interactive scheduler task, so publishes and trace dumps of the other jobs do not
+ * delay it.
+ */
+esp_err_t meshSchedAddInteractive(const char* pName, uint32_t periodMs, meshSchedJobCb_t* pCb, void* pArg,
+        meshSchedJob_t* pJob);
+
+/**
+ * @brief Run a job as soon as the scheduler is free, without moving its periodic runs
+ *
+ * Triggers before the job ran are merged into one run.
+ *
+ * @param job job of meshSchedAdd()
+ */
+void meshSchedTrigger(meshSchedJob_t job);
+
+/**
+ * @brief meshSchedTrigger() for interrupt handlers
+ *
+ * @param job job of meshSchedAdd()
+ */
+void meshSchedTriggerFromISR(meshSchedJob_t job);
+
+#endif // MESH_SCHED_H_
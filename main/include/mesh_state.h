@@ -0,0 +1,76 @@
+#ifndef MESH_STATE_H_
+#define MESH_STATE_H_
+
+#include "esp_mesh.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct
+{
+    uint32_t events;    // events posted to the state task
+    uint32_t runs;      // runs of the state task, each one handles every event posted before it
+    uint32_t debounced; // parent losses that ended within CONFIG_MESH_STATE_DEBOUNCE_MS, never applied
+    uint32_t lastUs;    // time the last run took
+    uint32_t maxUs;     // longest run
+} meshStateStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Create the state task, call after meshNetifsInit() and before the mesh starts
+ *
+ * Connection, role and routing changes of the mesh are handed to this task instead of being handled on the
+ * event loop, where creating netifs and drivers would hold up the IP and MQTT events. Events posted while the
+ * task is busy are merged, so a burst of them costs one run with the latest state. A parent loss waits
+ * CONFIG_MESH_STATE_DEBOUNCE_MS for the parent to come back before the netifs are told.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without memory for the task
+ */
+esp_err_t meshStateInit(void);
+
+/**
+ * @brief Call on MESH_EVENT_PARENT_CONNECTED
+ *
+ * @param isRoot role the device connected in
+ */
+void meshStateParentConnected(bool isRoot);
+
+/**
+ * @brief Call on MESH_EVENT_PARENT_DISCONNECTED
+ */
+void meshStateParentDisconnected(void);
+
+/**
+ * @brief Call on MESH_EVENT_ROOT_ADDRESS
+ *
+ * @param pRoot address of the root, copied
+ */
+void meshStateRootAddress(const mesh_addr_t* pRoot);
+
+/**
+ * @brief Call on MESH_EVENT_ROUTING_TABLE_ADD and MESH_EVENT_ROUTING_TABLE_REMOVE
+ */
+void meshStateRoutingTableChanged(void);
+
+/**
+ * @brief Call when the station got an IP address, starts the root's AP
+ *
+ * @param isRoot role of the device when it got the address
+ * @param dnsAddr DNS server the root's DHCP server offers
+ */
+void meshStateGotIp(bool isRoot, uint32_t dnsAddr);
+
+/**
+ * @brief Returns the counters of the state task
+ *
+ * @param pStats structure to fill in
+ */
+void meshStateGetStats(meshStateStats_t* pStats);
+
+#endif // MESH_STATE_H_
@@ -0,0 +1,69 @@
+#ifndef MESH_TELEMETRY_H_
+#define MESH_TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// Wire format of a record: <version:1> <type:1> followed by the fixed layout of its type,
+// integers in big endian, IPv4 addresses in network order
+#define MESH_TELEMETRY_VERSION      (1)
+#define MESH_TELEMETRY_HDR_LEN      (2)
+// MESH_TELEMETRY_STATUS: <layer:1> <ip:4>
+#define MESH_TELEMETRY_STATUS_LEN   (MESH_TELEMETRY_HDR_LEN + 1 + 4)
+// MESH_TELEMETRY_KEYPRESS: <station mac:6>
+#define MESH_TELEMETRY_KEYPRESS_LEN (MESH_TELEMETRY_HDR_LEN + 6)
+#define MESH_TELEMETRY_RECORD_MAX   (MESH_TELEMETRY_KEYPRESS_LEN) // longest record
+#define MESH_TELEMETRY_TEXT_MAX     (48) // longest text of meshTelemetryFormat(), including the terminating zero
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum
+{
+    MESH_TELEMETRY_STATUS = 1,   // periodic status of a device
+    MESH_TELEMETRY_KEYPRESS = 2, // button pressed on a node
+} meshTelemetryType_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Write a status record
+ *
+ * @param pBuffer MESH_TELEMETRY_STATUS_LEN bytes
+ * @param layer mesh layer of the device
+ * @param ipAddr IPv4 address in network order, as in esp_ip4_addr_t
+ *
+ * @return length of the record
+ */
+size_t meshTelemetryStatus(uint8_t* pBuffer, int layer, uint32_t ipAddr);
+
+/**
+ * @brief Write a keypress record
+ *
+ * @param pBuffer MESH_TELEMETRY_KEYPRESS_LEN bytes
+ * @param pMac station MAC address of the node
+ *
+ * @return length of the record
+ */
+size_t meshTelemetryKeypress(uint8_t* pBuffer, const uint8_t* pMac);
+
+/**
+ * @brief Print a record into pText as the text earlier versions published
+ *
+ * Status records read "layer:<layer> IP:<ip>", keypress records are the MAC address.
+ *
+ * @param pRecord record
+ * @param len length of the record
+ * @param pText buffer for the text, MESH_TELEMETRY_TEXT_MAX bytes fit every record
+ * @param size size of pText
+ *
+ * @return length of the text, -1 for records of another version, unknown types or a wrong length
+ */
+int meshTelemetryFormat(const uint8_t* pRecord, size_t len, char* pText, size_t size);
+
+#endif // MESH_TELEMETRY_H_
@@ -0,0 +1,95 @@
+#ifndef MESH_TRACE_H_
+#define MESH_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+// Events of the trace: id, name and the meaning of the two addresses, shared with the host decoder
+#define MESH_TRACE_EVENTS(X)                                                                  \
+    X(MESH_TRACE_RX_FROM_NODE, "rx_from_node", "dst", "src") /* root: frame of a node */      \
+    X(MESH_TRACE_RX_FROM_ROOT, "rx_from_root", "dst", "src") /* node: frame from the root */  \
+    X(MESH_TRACE_RX_DROP, "rx_drop", "from", "-")            /* arg: traffic class */         \
+    X(MESH_TRACE_RX_ERROR, "rx_error", "-", "-")             /* err: esp_mesh_recv() */       \
+    X(MESH_TRACE_TX_TO_NODE, "tx_to_node", "dst", "src")     /* root: frame for a node */     \
+    X(MESH_TRACE_TX_TO_ROOT, "tx_to_root", "dst", "src")     /* node: frame via the root */   \
+    X(MESH_TRACE_TX_DIRECT, "tx_direct", "dst", "src")       /* node: frame to another node */\
+    X(MESH_TRACE_TX_DHCP, "tx_dhcp", "client", "-")          /* root: DHCP reply unicast */   \
+    X(MESH_TRACE_TX_DROP, "tx_drop", "dst", "src")           /* tx queue full */              \
+    X(MESH_TRACE_SEND, "send", "to", "-")                    /* arg: proto, err: send */
+
+// Wire format of a dump line: "mt1 <core> <hex>", hex holds up to MESH_TRACE_LINE_EVENTS events of
+// MESH_TRACE_EVENT_LEN bytes: <seq:4> <time us:4> <id:1> <arg:1> <size:2> <err:4> <addr1:6> <addr2:6>
+// with integers in big endian
+#define MESH_TRACE_LINE_TAG    "mt1"
+#define MESH_TRACE_EVENT_LEN   (28)
+#define MESH_TRACE_LINE_EVENTS (8)
+#define MESH_TRACE_LINE_MAX    (sizeof(MESH_TRACE_LINE_TAG) + 4 + MESH_TRACE_LINE_EVENTS * MESH_TRACE_EVENT_LEN * 2 + 1)
+
+#if CONFIG_MESH_TRACE
+#define MESH_TRACE(id, arg, size, err, pAddr1, pAddr2) meshTraceRecord((id), (arg), (size), (err), (pAddr1), (pAddr2))
+#else
+#define MESH_TRACE(id, arg, size, err, pAddr1, pAddr2) do {} while (0)
+#endif
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+#define MESH_TRACE_ENUM(id, name, addr1, addr2) id,
+typedef enum
+{
+    MESH_TRACE_NONE = 0,
+    MESH_TRACE_EVENTS(MESH_TRACE_ENUM)
+    MESH_TRACE_ID_MAX,
+} meshTraceId_t;
+#undef MESH_TRACE_ENUM
+
+typedef struct
+{
+    uint32_t seq;    // position in the ring of its core, 0 while the event is written
+    uint32_t timeUs; // low 32 bits of esp_timer_get_time(), wraps after 71 minutes
+    uint8_t id;      // meshTraceId_t
+    uint8_t arg;     // by event, see MESH_TRACE_EVENTS
+    uint16_t size;
+    int32_t err;
+    uint8_t addr1[6];
+    uint8_t addr2[6];
+} meshTraceEvent_t;
+
+// Called with each line of a dump, the line has no newline
+typedef void (meshTraceLineCb_t)(const char* pLine, void* pContext);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Record an event in the ring of the calling core, use the MESH_TRACE macro
+ *
+ * Lock free and without formatting, safe from any task. The oldest events of the ring are overwritten.
+ *
+ * @param id event
+ * @param arg event specific byte
+ * @param size size of the frame or message
+ * @param err error code, ESP_OK for none
+ * @param pAddr1 first MAC address of the event, may be NULL
+ * @param pAddr2 second MAC address of the event, may be NULL
+ */
+void meshTraceRecord(meshTraceId_t id, uint8_t arg, size_t size, int32_t err, const uint8_t* pAddr1,
+        const uint8_t* pAddr2);
+
+/**
+ * @brief Dump the events of all rings as hex lines for mesh_trace_decode, oldest first per core
+ *
+ * The rings are copied to the heap first, so a slow pCb does not lose events to newer ones.
+ *
+ * @param pCb called with every line
+ * @param pContext passed to pCb
+ *
+ * @return number of events dumped, -1 without memory for the copy
+ */
+int meshTraceDump(meshTraceLineCb_t* pCb, void* pContext);
+
+#endif // MESH_TRACE_H_
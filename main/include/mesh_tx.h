@@ -0,0 +1,137 @@
+#ifndef MESH_TX_H_
+#define MESH_TX_H_
+
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define MESH_TX_AGGREGATE_ETH_TYPE (0x88B5u) // local experimental ethertype marking packed uplink frames
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct meshTxQueue meshTxQueue_t;
+
+// Traffic classes in order of priority, each has its own queue and counters
+typedef enum
+{
+    MESH_TRAFFIC_CONTROL = 0, // mesh control messages, ARP/DHCP, TCP acks
+    MESH_TRAFFIC_INTERACTIVE, // user events and small frames
+    MESH_TRAFFIC_BULK,        // everything else
+    MESH_TRAFFIC_CLASS_MAX
+} meshTrafficClass_t;
+
+// Where and how a queued frame is sent, filled in by the owner of the queue
+typedef struct
+{
+    mesh_addr_t dest;
+    int flag;          // MESH_DATA_* flags, MESH_DATA_NONBLOCK is added by the queue
+    mesh_proto_t proto;
+    mesh_tos_t tos;
+    bool broadcast;    // send to every node instead of dest
+} meshTxInfo_t;
+
+typedef struct
+{
+    uint32_t queued;       // frames accepted into the queue
+    uint32_t sent;         // frames handed to the mesh stack
+    uint32_t dropped;      // frames refused because the queue was full
+    uint32_t errors;       // frames the mesh stack failed to send
+    uint32_t depth;        // frames currently waiting
+    uint32_t peakDepth;    // highest number of frames of the class waiting at once
+    uint32_t latencyAvgUs; // moving average of time from queueing to sent
+    uint32_t latencyMaxUs; // longest time from queueing to sent
+    uint32_t aggregated;   // frames sent packed together with others
+} meshTxStats_t;
+
+/**
+ * @brief Sends one frame, called from the sender task of the queue
+ *
+ * @param pInfo destination and flags given when the frame was queued
+ * @param pData frame data
+ *
+ * @return ESP_OK or the esp_mesh_send() error, queue full errors are retried
+ */
+typedef esp_err_t (meshTxSendFn_t)(const meshTxInfo_t* pInfo, const mesh_data_t* pData);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Create a bounded tx queue with its own sender task
+ *
+ * Queues are never deleted, they live as long as the persistent netifs sending through them. The frames of
+ * all queues come from one pool of CONFIG_MESH_TX_POOL_LEN, a queue holds at most CONFIG_MESH_TX_QUEUE_LEN
+ *
+ * @param pName name of the sender task
+ * @param pSendFn function sending a frame from the sender task
+ *
+ * @return Queue handle, NULL if out of memory
+ */
+meshTxQueue_t* meshTxQueueCreate(const char* pName, meshTxSendFn_t* pSendFn);
+
+/**
+ * @brief Pack small frames to the root (MESH_DATA_TODS) into one mesh payload
+ *
+ * The sender collects queued frames into an ethernet frame of type MESH_TX_AGGREGATE_ETH_TYPE
+ * carrying each frame behind its 16 bit big endian length, up to MESH_MPS bytes.
+ *
+ * @param pQueue queue handle
+ * @param frameMax largest frame to pack, 0 disables aggregation
+ * @param deadlineUs longest time the first frame waits for others
+ */
+void meshTxQueueSetAggregation(meshTxQueue_t* pQueue, uint32_t frameMax, uint32_t deadlineUs);
+
+/**
+ * @brief Iterate over the frames packed in an aggregate
+ *
+ * @param pData received mesh payload
+ * @param len payload length
+ * @param pOffset iterator state, must be 0 on the first call
+ * @param ppFrame set to the next frame
+ * @param pFrameLen set to its length
+ *
+ * @return false when there are no more frames or pData is not an aggregate
+ */
+bool meshTxAggregateNext(const uint8_t* pData, size_t len, size_t* pOffset, const uint8_t** ppFrame,
+        size_t* pFrameLen);
+
+/**
+ * @brief Copy a frame into the queue
+ *
+ * @param pQueue queue handle
+ * @param pInfo destination and flags
+ * @param pBuffer frame data
+ * @param len frame length
+ * @param trafficClass queue the frame goes to, bulk frames cannot take the slots reserved
+ *        by the priority drop policy
+ * @param wait ticks to wait for a free slot, must be 0 from the tcpip thread
+ *
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if dropped (maps to ERR_MEM in lwIP),
+ *         ESP_ERR_INVALID_SIZE if the frame does not fit a queue slot
+ */
+esp_err_t meshTxQueuePush(meshTxQueue_t* pQueue, const meshTxInfo_t* pInfo, const void* pBuffer, size_t len,
+        meshTrafficClass_t trafficClass, TickType_t wait);
+
+/**
+ * @brief Copy a frame made of a header and data into the queue
+ *
+ * Same as meshTxQueuePush() with the header copied in front of the data
+ *
+ * @param pHeader header data, may be NULL if headerLen is 0
+ * @param headerLen header length
+ */
+esp_err_t meshTxQueuePushWithHeader(meshTxQueue_t* pQueue, const meshTxInfo_t* pInfo, const void* pHeader,
+        size_t headerLen, const void* pBuffer, size_t len, meshTrafficClass_t trafficClass, TickType_t wait);
+
+/**
+ * @brief Returns counters of the queue
+ *
+ * @param pQueue queue handle
+ * @param pStats counters to fill in, one per traffic class
+ */
+void meshTxQueueGetStats(const meshTxQueue_t* pQueue, meshTxStats_t pStats[MESH_TRAFFIC_CLASS_MAX]);
+
+#endif // MESH_TX_H_
@@ -1,10 +1,72 @@
 #ifndef MQTT_APP_H_
 #define MQTT_APP_H_
 
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// commands of the MQTT gateway (CONFIG_MESH_MQTT_GATEWAY), records are <topic len:1> <data len:2> <topic> <data>
+// with integers in big endian
+#define CMD_MQTT_PUBLISH 0x62
+// CMD_MQTT_PUBLISH: node to root, one or more records the root publishes for the node
+#define CMD_MQTT_SUBSCRIBE 0x63
+// CMD_MQTT_SUBSCRIBE: node to root, <count:1> followed by <topic len:1> <topic> for every topic of the node
+#define CMD_MQTT_DATA 0x64
+// CMD_MQTT_DATA: root to nodes, one record received from the broker on a topic the nodes subscribed to or on
+// the command topic of the node
+#define MQTT_APP_IS_CMD(cmd) ((cmd) >= CMD_MQTT_PUBLISH && (cmd) <= CMD_MQTT_DATA)
+
+typedef void (MQTT_AppDataCb_t)(const char* pData, int len);
+
+typedef struct
+{
+    uint32_t published;     // publishes handed to the client
+    uint32_t publishErrors; // publishes the client refused, e.g. while disconnected
+    uint32_t received;      // messages received on subscribed topics
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t errors;        // MQTT_EVENT_ERROR events
+    uint32_t forwarded;     // root: publishes of the nodes handed to the client
+    uint32_t delivered;     // root: messages relayed to the nodes, a broadcast counts once
+    uint32_t gatewayNodes;  // root: nodes with subscriptions
+} MQTT_AppStats_t;
+
 void MQTT_AppStart(void);
 void MQTT_AppPublish(const char* pTopic, const char* pPublishString);
+// Publish len bytes of binary data, a node queues small publishes for the root in preallocated slots
+void MQTT_AppPublishData(const char* pTopic, const void* pData, size_t len);
+// Subscribe to pTopic on every connect and hand its messages to pCb, call before MQTT_AppStart(), pTopic may
+// hold the wildcards '+' and '#'
+esp_err_t MQTT_AppSubscribe(const char* pTopic, MQTT_AppDataCb_t* pCb);
+// Hand the messages of the command topic of this device, MQTT_CMD_TOPIC_PREFIX <MAC> MQTT_CMD_TOPIC_SUFFIX,
+// to pCb, call before MQTT_AppStart()
+void MQTT_AppSetCommandCb(MQTT_AppDataCb_t* pCb);
+void MQTT_AppGetStats(MQTT_AppStats_t* pStats);
+// Publishes wait in the store (CONFIG_MESH_MQTT_STORE) while the root reports the toDS state unreachable,
+// call on MESH_EVENT_TODS_STATE
+void MQTT_AppSetToDS(bool reachable);
+// Gateway: set the root nodes publish through, call on MESH_EVENT_ROOT_ADDRESS
+void MQTT_AppSetRoot(const mesh_addr_t* pRoot);
+// Gateway: handle a message starting with one of the CMD_MQTT_ commands, called from the raw receive callback
+esp_err_t MQTT_AppMeshReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData);
 
 #define MQTT_BUTTON_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/key_pressed" //topic randomized to avoid conflict with Espressif example
+#define MQTT_BENCH_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/bench" // benchmark command, see CONFIG_MESH_BENCH
+#define MQTT_BENCH_RESULT_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/bench/result"
+#define MQTT_METRICS_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/metrics" // JSON snapshots, see CONFIG_MESH_METRICS
+#define MQTT_TRACE_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/trace" // any message dumps the traces, see CONFIG_MESH_TRACE
+#define MQTT_TRACE_DATA_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/trace/data"
+#define MQTT_PROBE_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/probe" // round trip histograms, see CONFIG_MESH_PROBE
+#define MQTT_OTA_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/ota" // URL of an image for the mesh, see CONFIG_MESH_OTA
+#define MQTT_OTA_STATUS_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/ota/status"
+#define MQTT_JOIN_TOPIC "/topic/03c8b0f712023b6d/ip_mesh/join" // time to join at boot, see CONFIG_MESH_FAST_JOIN
+// commands for one device, the MAC address of its station in lower case hex with ':' separators between
+#define MQTT_CMD_TOPIC_PREFIX "/topic/03c8b0f712023b6d/ip_mesh/"
+#define MQTT_CMD_TOPIC_SUFFIX "/cmd"
+#define MQTT_CMD_TOPIC_ALL MQTT_CMD_TOPIC_PREFIX "+" MQTT_CMD_TOPIC_SUFFIX
 
 
 #endif // MQTT_APP_H_
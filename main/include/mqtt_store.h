@@ -0,0 +1,101 @@
+#ifndef MQTT_STORE_H_
+#define MQTT_STORE_H_
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define MQTT_STORE_TOPIC(pRecord) ((pRecord)->payload)
+#define MQTT_STORE_DATA(pRecord)  ((pRecord)->payload + (pRecord)->topicLen + 1)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct MQTT_StoreRecord
+{
+    struct MQTT_StoreRecord* pNext;
+    uint8_t topicLen;
+    uint16_t dataLen;
+    char payload[]; // topic and data, both zero terminated
+} MQTT_StoreRecord_t;
+
+typedef struct
+{
+    uint32_t records;  // records waiting in RAM
+    uint32_t bytes;    // RAM taken by them
+    uint32_t blobs;    // NVS blobs waiting
+    uint32_t stored;   // publishes kept for later
+    uint32_t replayed; // publishes handed on again
+    uint32_t dropped;  // oldest publishes dropped for newer ones or too large to keep
+    uint32_t spilled;  // publishes moved from RAM to NVS
+} MQTT_StoreStats_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Create the store and, with CONFIG_MESH_MQTT_STORE_NVS, find the publishes left in NVS by an earlier run
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without memory for the lock
+ */
+esp_err_t MQTT_StoreInit(void);
+
+/**
+ * @brief Keep a publish until MQTT_StoreTake() returns it, in order of arrival
+ *
+ * Beyond CONFIG_MESH_MQTT_STORE_SIZE bytes the oldest publishes in RAM move to NVS as long as
+ * CONFIG_MESH_MQTT_STORE_NVS_BLOBS allows, otherwise they are dropped.
+ *
+ * @param pTopic topic of the publish
+ * @param topicLen length of the topic
+ * @param pData data of the publish
+ * @param dataLen length of the data
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE for publishes larger than the store,
+ *         ESP_ERR_NO_MEM without memory, ESP_ERR_INVALID_STATE before MQTT_StoreInit()
+ */
+esp_err_t MQTT_StorePut(const char* pTopic, size_t topicLen, const char* pData, size_t dataLen);
+
+/**
+ * @brief Take the oldest publish out of the store
+ *
+ * Publishes in NVS are older than those in RAM and come first. Hand the record to MQTT_StoreDone() once
+ * it is published or to MQTT_StoreReturn() if it could not be.
+ *
+ * @return the publish, NULL if the store is empty or without memory for the oldest publish in NVS
+ */
+MQTT_StoreRecord_t* MQTT_StoreTake(void);
+
+/**
+ * @brief Put a publish of MQTT_StoreTake() back in front of all others
+ *
+ * @param pRecord record of MQTT_StoreTake()
+ */
+void MQTT_StoreReturn(MQTT_StoreRecord_t* pRecord);
+
+/**
+ * @brief Free a publish of MQTT_StoreTake() that was handed on
+ *
+ * @param pRecord record of MQTT_StoreTake()
+ */
+void MQTT_StoreDone(MQTT_StoreRecord_t* pRecord);
+
+/**
+ * @brief Returns whether no publish waits in RAM or NVS and none of MQTT_StoreTake() is still being handed on
+ */
+bool MQTT_StoreIsEmpty(void);
+
+/**
+ * @brief Get the counters of the store
+ *
+ * @param pStats returns the counters
+ */
+void MQTT_StoreGetStats(MQTT_StoreStats_t* pStats);
+
+#endif // MQTT_STORE_H_
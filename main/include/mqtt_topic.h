@@ -0,0 +1,81 @@
+#ifndef MQTT_TOPIC_H_
+#define MQTT_TOPIC_H_
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define MQTT_TOPIC_LEVEL_MAX    (32) // longest level of a filter, including the terminating zero
+#define MQTT_TOPIC_NODES_MAX    (64) // filter levels of all registered filters together
+#define MQTT_TOPIC_HANDLERS_MAX (32) // registered handlers
+#define MQTT_TOPIC_MATCH_MAX    (8)  // handlers called for one message, further matches are skipped
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct
+{
+    const char* pTopic; // not zero terminated
+    int topicLen;
+    const char* pData;
+    int dataLen;
+    void* pContext;     // passed to MQTT_TopicDispatch()
+} MQTT_TopicMessage_t;
+
+typedef void (MQTT_TopicHandler_t)(const MQTT_TopicMessage_t* pMessage, void* pArg);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Create the registry, call before the other functions
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM without memory for the lock
+ */
+esp_err_t MQTT_TopicInit(void);
+
+/**
+ * @brief Register a handler for the topics matching a filter
+ *
+ * Filters follow MQTT: levels are separated by '/', '+' matches one level and a final '#' any
+ * number of levels including none. The same handler and argument are registered only once per filter.
+ *
+ * @param pFilter topic filter
+ * @param pHandler called from MQTT_TopicDispatch() for matching topics
+ * @param pArg passed to pHandler
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for invalid filters, ESP_ERR_NO_MEM without room in the trie,
+ *         ESP_ERR_INVALID_STATE before MQTT_TopicInit()
+ */
+esp_err_t MQTT_TopicAdd(const char* pFilter, MQTT_TopicHandler_t* pHandler, void* pArg);
+
+/**
+ * @brief Call the handlers of all filters matching a topic
+ *
+ * Takes O(topic length) times the siblings of each level. Handlers are called after the registry is
+ * unlocked, so they may register filters.
+ *
+ * @param pTopic topic of the message, not zero terminated
+ * @param topicLen length of the topic
+ * @param pData data of the message
+ * @param dataLen length of the data
+ * @param pContext passed to the handlers in the message
+ *
+ * @return number of handlers called
+ */
+int MQTT_TopicDispatch(const char* pTopic, int topicLen, const char* pData, int dataLen, void* pContext);
+
+/**
+ * @brief Returns whether a topic filter is valid
+ *
+ * @param pFilter topic filter
+ *
+ * @return true if wildcards only take whole levels, '#' is last and no level is too long
+ */
+bool MQTT_TopicFilterValid(const char* pFilter);
+
+#endif // MQTT_TOPIC_H_
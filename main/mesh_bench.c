@@ -0,0 +1,831 @@
+#include "mesh_bench.h"
+#include "mesh_netif.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "lwip/sockets.h"
+
+#include <errno.h>
+#include <stdio.h>  // for sscanf
+#include <stdlib.h> // for calloc,free
+#include <string.h> // for memcpy,memcmp,strcmp
+
+#define BENCH_START_MSG_LEN   (1 + 4 + 1 + 1 + 2 + 2 + 2 + 1)
+#define BENCH_JOIN_MSG_LEN    (1 + 4 + 1 + 4)
+#define BENCH_GO_MSG_LEN      (1 + 4 + 6 + 4)
+#define BENCH_DATA_HDR_LEN    (1 + 4 + 4 + 4 + 1 + 6)
+#define BENCH_END_MSG_LEN     (1 + 4 + 4)
+#define BENCH_RESULT_MSG_LEN  (1 + 4 + 1 + 4 * 5)
+#define BENCH_RAW_MAX_SIZE    (CONFIG_MESH_RAW_MAX_SIZE)
+#define BENCH_IP_MAX_SIZE     (1400) // UDP payload that fits one mesh packet with the ethernet, IP and UDP headers
+#define BENCH_MAX_RATE        (1000)
+#define BENCH_MAX_DURATION_S  (600)
+#define BENCH_ROOT_FLOWS      (CONFIG_MESH_ROUTE_TABLE_SIZE)
+#define BENCH_NODE_RX_FLOWS   (4)
+#define BENCH_JOIN_WINDOW_ms  (1000)
+#define BENCH_GO_WAIT_ms      (1000)  // beyond the join window
+#define BENCH_DRAIN_ms        (2000)  // time for data in flight after the senders stop
+#define BENCH_RESULT_WAIT_ms  (3000)
+#define BENCH_POLL_ms         (100)
+#define BENCH_SPREAD_ms       (500)   // nodes answer at a random time within this, the root rx queues are short
+#define BENCH_TASK_PRIORITY   (4)     // below the mesh netif tasks, so a saturated sender does not starve them
+#define BENCH_TEXT_MAX        (64)
+
+typedef struct
+{
+    mesh_addr_t peer;      // receiver of a sent flow, sender of a received one
+    uint32_t ip;           // receiver address on the IP path, network byte order
+    uint8_t layer;         // layer the flow is reported under
+    bool ended;            // end message of the sender received
+    uint32_t sent;         // sender: messages sent, receiver: count from the end message
+    uint32_t received;
+    uint32_t bytes;
+    uint32_t nextSeq;      // highest sequence number received plus one
+    int64_t firstUs;
+    int64_t lastUs;
+    int32_t lastTransitUs;
+    uint32_t jitter;       // RFC 3550 interarrival jitter in 1/16 us
+} benchFlow_t;
+
+typedef struct
+{
+    uint8_t layer;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t bytes;
+    uint32_t jitterUs;
+    uint32_t activeUs;     // time from the first to the last message received
+} benchResult_t;
+
+static const char* TAG = "mesh_bench";
+static SemaphoreHandle_t benchLock = NULL;
+static meshBenchResultCb_t* pBenchResultCb = NULL;
+static bool benchRunning = false;      // set by the starter, cleared by the bench task when it is done
+static uint32_t benchSession = 0;
+static meshBenchConfig_t benchConfig = { 0 };
+static mesh_addr_t benchRoot = { 0 };
+// station MAC, the mesh address of this device also on the root where the station netif is not a mesh netif
+static uint8_t benchSelf[MAC_ADDR_LEN] = { 0 };
+static int64_t benchStartUs = 0;
+static TaskHandle_t benchTask = NULL;
+// root: nodes that joined, they are also the received flows going up or the sent flows going down
+static benchFlow_t* pBenchPeers = NULL;
+static int benchPeerCount = 0;
+static bool benchJoinOpen = false;
+static benchResult_t* pBenchResults = NULL;
+static int benchResultCount = 0;
+static benchFlow_t* pBenchTx = NULL;
+static int benchTxCount = 0;
+static benchFlow_t* pBenchRx = NULL;
+static int benchRxCount = 0;
+static int benchRxMax = 0;
+static bool benchIpRxRun = false;
+static SemaphoreHandle_t benchIpRxDone = NULL;
+static uint32_t benchTxErrors = 0;
+static uint8_t benchTxBuffer[BENCH_RAW_MAX_SIZE];
+static uint8_t benchIpRxBuffer[BENCH_IP_MAX_SIZE];
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void putBE32(uint8_t* p, uint32_t value)
+{
+    putBE16(p, value >> 16);
+    putBE16(p + 2, value & 0xFFFF);
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t)getBE16(p) << 16) | getBE16(p + 2);
+}
+
+static const char* benchPathName(meshBenchPath_t path)
+{
+    return path == MESH_BENCH_PATH_IP ? "ip" : "raw";
+}
+
+static const char* benchDirectionName(meshBenchDirection_t direction)
+{
+    return direction == MESH_BENCH_DOWN ? "down" : direction == MESH_BENCH_PEER ? "peer" : "up";
+}
+
+static esp_err_t benchSendControl(const mesh_addr_t* pTo, uint8_t* pMsg, size_t len)
+{
+    mesh_data_t data = { .data = pMsg, .size = len, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+    esp_err_t err = meshNetifSendRaw(pTo, &data, MESH_TRAFFIC_CONTROL);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Benchmark command 0x%02x not sent, err code %d %s", pMsg[0], err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void benchSendEnd(const benchFlow_t* pFlow)
+{
+    uint8_t msg[BENCH_END_MSG_LEN] = { CMD_BENCH_END };
+    putBE32(msg + 1, benchSession);
+    putBE32(msg + 5, pFlow->sent);
+    benchSendControl(&pFlow->peer, msg, sizeof(msg));
+}
+
+static void benchSendResult(const benchResult_t* pResult)
+{
+    uint8_t msg[BENCH_RESULT_MSG_LEN] = { CMD_BENCH_RESULT };
+    putBE32(msg + 1, benchSession);
+    msg[5] = pResult->layer;
+    putBE32(msg + 6, pResult->sent);
+    putBE32(msg + 10, pResult->received);
+    putBE32(msg + 14, pResult->bytes);
+    putBE32(msg + 18, pResult->jitterUs);
+    putBE32(msg + 22, pResult->activeUs);
+    benchSendControl(&benchRoot, msg, sizeof(msg));
+}
+
+static void benchResultFromFlow(const benchFlow_t* pFlow, benchResult_t* pResult)
+{
+    pResult->layer = pFlow->layer;
+    pResult->sent = pFlow->ended ? pFlow->sent : pFlow->nextSeq;
+    pResult->received = pFlow->received;
+    pResult->bytes = pFlow->bytes;
+    pResult->jitterUs = pFlow->jitter >> 4;
+    pResult->activeUs = pFlow->received > 1 ? pFlow->lastUs - pFlow->firstUs : 0;
+}
+
+// Received flow of a sender, created on nodes for new senders, call with benchLock taken
+static benchFlow_t* benchRxFlowGet(const uint8_t* pSender, uint8_t senderLayer)
+{
+    for (int i = 0; i < benchRxCount; i++)
+    {
+        if (MAC_ADDR_EQUAL(pBenchRx[i].peer.addr, pSender))
+        {
+            return &pBenchRx[i];
+        }
+    }
+    // the root only counts nodes that joined
+    if (esp_mesh_is_root() || benchRxCount == benchRxMax)
+    {
+        return NULL;
+    }
+    benchFlow_t* pFlow = &pBenchRx[benchRxCount++];
+    memset(pFlow, 0, sizeof(*pFlow));
+    memcpy(pFlow->peer.addr, pSender, MAC_ADDR_LEN);
+    // going down the node end is the receiver, node to node it is the sender
+    pFlow->layer = benchConfig.direction == MESH_BENCH_DOWN ? esp_mesh_get_layer() : senderLayer;
+    return pFlow;
+}
+
+// Data message from either path
+static void benchDataInput(const uint8_t* pMsg, size_t len)
+{
+    int64_t nowUs = esp_timer_get_time();
+
+    if (len < BENCH_DATA_HDR_LEN || pMsg[0] != CMD_BENCH_DATA || !__atomic_load_n(&benchRunning, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    benchFlow_t* pFlow = getBE32(pMsg + 1) == benchSession ? benchRxFlowGet(pMsg + 14, pMsg[13]) : NULL;
+    if (pFlow)
+    {
+        uint32_t seq = getBE32(pMsg + 5);
+        // clocks of sender and receiver are not synchronised, only changes of the transit time count
+        int32_t transitUs = (int32_t)((uint32_t)nowUs - getBE32(pMsg + 9));
+        if (pFlow->received)
+        {
+            int32_t delta = transitUs - pFlow->lastTransitUs;
+            uint32_t deviation = delta < 0 ? -delta : delta;
+            pFlow->jitter += deviation - ((pFlow->jitter + 8) >> 4);
+        }
+        else
+        {
+            pFlow->firstUs = nowUs;
+        }
+        pFlow->lastTransitUs = transitUs;
+        pFlow->lastUs = nowUs;
+        pFlow->received++;
+        pFlow->bytes += len;
+        if (seq >= pFlow->nextSeq)
+        {
+            pFlow->nextSeq = seq + 1;
+        }
+    }
+    xSemaphoreGive(benchLock);
+}
+
+static void benchIpRxTask(void* arg)
+{
+    int sock = (int)(intptr_t)arg;
+
+    while (__atomic_load_n(&benchIpRxRun, __ATOMIC_ACQUIRE))
+    {
+        int len = recvfrom(sock, benchIpRxBuffer, sizeof(benchIpRxBuffer), 0, NULL, NULL);
+        if (len > 0)
+        {
+            benchDataInput(benchIpRxBuffer, len);
+        }
+    }
+    close(sock);
+    xSemaphoreGive(benchIpRxDone);
+    vTaskDelete(NULL);
+}
+
+// Receive data of the IP path on MESH_BENCH_PORT until benchIpRxStop()
+static void benchIpRxStart(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(MESH_BENCH_PORT),
+            .sin_addr.s_addr = htonl(INADDR_ANY) };
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = BENCH_POLL_ms * 1000 };
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+        return;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to bind port %d: errno %d", MESH_BENCH_PORT, errno);
+        close(sock);
+        return;
+    }
+    __atomic_store_n(&benchIpRxRun, true, __ATOMIC_RELEASE);
+    if (xTaskCreate(benchIpRxTask, "bench rx task", 3072, (void*)(intptr_t)sock, BENCH_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        __atomic_store_n(&benchIpRxRun, false, __ATOMIC_RELEASE);
+        close(sock);
+    }
+}
+
+static void benchIpRxStop(void)
+{
+    if (__atomic_load_n(&benchIpRxRun, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&benchIpRxRun, false, __ATOMIC_RELEASE);
+        xSemaphoreTake(benchIpRxDone, portMAX_DELAY);
+    }
+}
+
+static void benchSendData(benchFlow_t* pFlow, int sock, uint8_t layer, const uint8_t* pSelf)
+{
+    uint8_t* pMsg = benchTxBuffer;
+    esp_err_t err = ESP_OK;
+
+    pMsg[0] = CMD_BENCH_DATA;
+    putBE32(pMsg + 1, benchSession);
+    putBE32(pMsg + 5, pFlow->sent++);
+    putBE32(pMsg + 9, (uint32_t)esp_timer_get_time());
+    pMsg[13] = layer;
+    memcpy(pMsg + 14, pSelf, MAC_ADDR_LEN);
+    if (benchConfig.path == MESH_BENCH_PATH_IP)
+    {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(MESH_BENCH_PORT),
+                .sin_addr.s_addr = pFlow->ip };
+        if (sendto(sock, pMsg, benchConfig.size, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            err = ESP_FAIL;
+        }
+    }
+    else
+    {
+        mesh_data_t data = { .data = pMsg, .size = benchConfig.size, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+        err = meshNetifSendRaw(&pFlow->peer, &data, MESH_TRAFFIC_BULK);
+    }
+    // a message that could not be sent counts as lost, the receiver sees the gap
+    if (err != ESP_OK)
+    {
+        benchTxErrors++;
+    }
+}
+
+// Send every flow in pBenchTx at the configured rate for the configured time, then the end messages
+static void benchSendFlows(void)
+{
+    uint8_t layer = esp_mesh_get_layer();
+    const uint8_t* pSelf = benchSelf;
+    int sock = -1;
+
+    if (benchConfig.path == MESH_BENCH_PATH_IP)
+    {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sock < 0)
+        {
+            ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+            return;
+        }
+    }
+    memset(benchTxBuffer, 0, sizeof(benchTxBuffer));
+    benchTxErrors = 0;
+    int64_t startUs = esp_timer_get_time();
+    int64_t endUs = startUs + benchConfig.durationS * 1000000LL;
+    for (int64_t nowUs = startUs; nowUs < endUs; nowUs = esp_timer_get_time())
+    {
+        // messages are due in evenly spaced slots, a tick sends every one that came due since the last;
+        // the slots of the flows are staggered so they do not all hit the tx queue in the same tick
+        for (int i = 0; i < benchTxCount; i++)
+        {
+            int64_t offsetUs = 1000000LL * i / benchTxCount / benchConfig.rate;
+            int64_t elapsedUs = nowUs - startUs - offsetUs;
+            uint32_t due = elapsedUs < 0 ? 0 : elapsedUs * benchConfig.rate / 1000000 + 1;
+            while (pBenchTx[i].sent < due && esp_timer_get_time() < endUs)
+            {
+                benchSendData(&pBenchTx[i], sock, layer, pSelf);
+            }
+        }
+        vTaskDelay(1);
+    }
+    for (int i = 0; i < benchTxCount; i++)
+    {
+        benchSendEnd(&pBenchTx[i]);
+    }
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    if (benchTxErrors)
+    {
+        ESP_LOGW(TAG, "Session %08x: %u data messages not sent", benchSession, benchTxErrors);
+    }
+}
+
+static void benchFree(void)
+{
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    if (pBenchTx != pBenchPeers)
+    {
+        free(pBenchTx);
+    }
+    if (pBenchRx != pBenchPeers)
+    {
+        free(pBenchRx);
+    }
+    free(pBenchPeers);
+    free(pBenchResults);
+    pBenchTx = pBenchRx = pBenchPeers = NULL;
+    pBenchResults = NULL;
+    benchTxCount = benchRxCount = benchRxMax = benchPeerCount = benchResultCount = 0;
+    benchJoinOpen = false;
+    benchTask = NULL;
+    xSemaphoreGive(benchLock);
+    __atomic_store_n(&benchRunning, false, __ATOMIC_RELEASE);
+}
+
+static void benchReport(void)
+{
+    meshBenchLayerResult_t layers[CONFIG_MESH_MAX_LAYER] = { 0 };
+    uint64_t jitterSum[CONFIG_MESH_MAX_LAYER] = { 0 };
+
+    for (int i = 0; i < benchResultCount; i++)
+    {
+        const benchResult_t* pResult = &pBenchResults[i];
+        int layer = pResult->layer < 1 ? 1 : pResult->layer > CONFIG_MESH_MAX_LAYER ? CONFIG_MESH_MAX_LAYER :
+                pResult->layer;
+        meshBenchLayerResult_t* pLayer = &layers[layer - 1];
+        pLayer->flows++;
+        pLayer->sent += pResult->sent;
+        pLayer->received += pResult->received;
+        if (pResult->activeUs)
+        {
+            pLayer->goodputKbps += (uint64_t)pResult->bytes * 8 * 1000 / pResult->activeUs;
+        }
+        jitterSum[layer - 1] += pResult->jitterUs;
+    }
+    for (int i = 0; i < CONFIG_MESH_MAX_LAYER; i++)
+    {
+        if (layers[i].flows)
+        {
+            layers[i].jitterUs = jitterSum[i] / layers[i].flows;
+        }
+    }
+    ESP_LOGI(TAG, "Session %08x done, %d flows", benchSession, benchResultCount);
+    if (pBenchResultCb)
+    {
+        pBenchResultCb(&benchConfig, layers, CONFIG_MESH_MAX_LAYER);
+    }
+}
+
+static void benchRootTask(void* arg)
+{
+    uint8_t msg[BENCH_GO_MSG_LEN > BENCH_START_MSG_LEN ? BENCH_GO_MSG_LEN : BENCH_START_MSG_LEN];
+    esp_netif_ip_info_t ipInfo = { 0 };
+
+    msg[0] = CMD_BENCH_START;
+    putBE32(msg + 1, benchSession);
+    msg[5] = benchConfig.path;
+    msg[6] = benchConfig.direction;
+    putBE16(msg + 7, benchConfig.size);
+    putBE16(msg + 9, benchConfig.rate);
+    putBE16(msg + 11, benchConfig.durationS);
+    msg[13] = benchConfig.layer;
+    benchSendControl(NULL, msg, BENCH_START_MSG_LEN);
+    vTaskDelay(pdMS_TO_TICKS(BENCH_JOIN_WINDOW_ms));
+
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    benchJoinOpen = false;
+    int peers = benchPeerCount;
+    if (benchConfig.direction == MESH_BENCH_UP)
+    {
+        pBenchRx = pBenchPeers;
+        benchRxCount = benchRxMax = peers;
+    }
+    else if (benchConfig.direction == MESH_BENCH_DOWN)
+    {
+        pBenchTx = pBenchPeers;
+        benchTxCount = peers;
+    }
+    xSemaphoreGive(benchLock);
+    ESP_LOGI(TAG, "Session %08x: %s %s, %d nodes taking part", benchSession, benchPathName(benchConfig.path),
+            benchDirectionName(benchConfig.direction), peers);
+
+    if (benchConfig.direction == MESH_BENCH_UP)
+    {
+        if (benchConfig.path == MESH_BENCH_PATH_IP)
+        {
+            benchIpRxStart();
+        }
+        meshNetifGetMeshIpInfo(&ipInfo);
+        for (int i = 0; i < peers; i++)
+        {
+            msg[0] = CMD_BENCH_GO;
+            memcpy(msg + 5, benchSelf, MAC_ADDR_LEN);
+            memcpy(msg + 11, &ipInfo.ip.addr, 4);
+            benchSendControl(&pBenchPeers[i].peer, msg, BENCH_GO_MSG_LEN);
+        }
+        vTaskDelay(pdMS_TO_TICKS(benchConfig.durationS * 1000 + BENCH_DRAIN_ms));
+        xSemaphoreTake(benchLock, portMAX_DELAY);
+        for (int i = 0; i < peers; i++)
+        {
+            benchResultFromFlow(&pBenchPeers[i], &pBenchResults[i]);
+        }
+        benchResultCount = peers;
+        xSemaphoreGive(benchLock);
+        benchIpRxStop();
+    }
+    else
+    {
+        if (benchConfig.direction == MESH_BENCH_DOWN)
+        {
+            benchSendFlows();
+        }
+        else if (peers > 1)
+        {
+            // every node sends to the next one that joined
+            for (int i = 0; i < peers; i++)
+            {
+                const benchFlow_t* pNext = &pBenchPeers[(i + 1) % peers];
+                msg[0] = CMD_BENCH_GO;
+                memcpy(msg + 5, pNext->peer.addr, MAC_ADDR_LEN);
+                memcpy(msg + 11, &pNext->ip, 4);
+                benchSendControl(&pBenchPeers[i].peer, msg, BENCH_GO_MSG_LEN);
+            }
+            vTaskDelay(pdMS_TO_TICKS(benchConfig.durationS * 1000));
+        }
+        // receiving nodes report on their own, once their sender ended or after the drain time
+        int64_t deadlineUs = esp_timer_get_time() + (BENCH_DRAIN_ms + BENCH_RESULT_WAIT_ms) * 1000LL;
+        while (esp_timer_get_time() < deadlineUs)
+        {
+            xSemaphoreTake(benchLock, portMAX_DELAY);
+            bool complete = benchResultCount >= peers;
+            xSemaphoreGive(benchLock);
+            if (complete)
+            {
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(BENCH_POLL_ms));
+        }
+    }
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    benchReport();
+    xSemaphoreGive(benchLock);
+    benchFree();
+    vTaskDelete(NULL);
+}
+
+static bool benchRxComplete(void)
+{
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    bool complete = benchRxCount > 0;
+    for (int i = 0; i < benchRxCount; i++)
+    {
+        complete &= pBenchRx[i].ended;
+    }
+    xSemaphoreGive(benchLock);
+    return complete;
+}
+
+static void benchNodeTask(void* arg)
+{
+    uint8_t msg[BENCH_JOIN_MSG_LEN] = { CMD_BENCH_JOIN };
+    esp_netif_ip_info_t ipInfo = { 0 };
+
+    meshNetifGetMeshIpInfo(&ipInfo);
+    putBE32(msg + 1, benchSession);
+    msg[5] = esp_mesh_get_layer();
+    memcpy(msg + 6, &ipInfo.ip.addr, 4);
+    vTaskDelay(pdMS_TO_TICKS(esp_random() % BENCH_SPREAD_ms));
+    benchSendControl(&benchRoot, msg, sizeof(msg));
+
+    if (benchConfig.direction != MESH_BENCH_DOWN
+            && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BENCH_JOIN_WINDOW_ms + BENCH_GO_WAIT_ms)) && benchTxCount)
+    {
+        benchSendFlows();
+    }
+    if (benchConfig.direction != MESH_BENCH_UP)
+    {
+        int64_t deadlineUs = benchStartUs
+                + (BENCH_JOIN_WINDOW_ms + BENCH_GO_WAIT_ms + BENCH_DRAIN_ms + benchConfig.durationS * 1000) * 1000LL;
+        while (esp_timer_get_time() < deadlineUs && !benchRxComplete())
+        {
+            vTaskDelay(pdMS_TO_TICKS(BENCH_POLL_ms));
+        }
+        benchIpRxStop();
+        vTaskDelay(pdMS_TO_TICKS(esp_random() % BENCH_SPREAD_ms));
+        benchResult_t result = { .layer = esp_mesh_get_layer() };
+        xSemaphoreTake(benchLock, portMAX_DELAY);
+        int flows = benchRxCount;
+        xSemaphoreGive(benchLock);
+        // a node that received nothing still reports, so the root does not wait for it
+        for (int i = 0; i < flows || (i == 0 && flows == 0); i++)
+        {
+            if (flows)
+            {
+                xSemaphoreTake(benchLock, portMAX_DELAY);
+                benchResultFromFlow(&pBenchRx[i], &result);
+                xSemaphoreGive(benchLock);
+            }
+            benchSendResult(&result);
+        }
+    }
+    benchFree();
+    vTaskDelete(NULL);
+}
+
+// Allocate the flows of a session, call with benchRunning set
+static esp_err_t benchAlloc(bool isRoot)
+{
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    if (isRoot)
+    {
+        pBenchPeers = calloc(BENCH_ROOT_FLOWS, sizeof(benchFlow_t));
+        pBenchResults = calloc(BENCH_ROOT_FLOWS, sizeof(benchResult_t));
+    }
+    else
+    {
+        pBenchTx = calloc(1, sizeof(benchFlow_t));
+        pBenchRx = calloc(BENCH_NODE_RX_FLOWS, sizeof(benchFlow_t));
+        benchRxMax = BENCH_NODE_RX_FLOWS;
+    }
+    bool ok = isRoot ? pBenchPeers && pBenchResults : pBenchTx && pBenchRx;
+    benchJoinOpen = isRoot;
+    xSemaphoreGive(benchLock);
+    return ok ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void benchReceiveStart(const mesh_addr_t* pFrom, const uint8_t* pMsg)
+{
+    meshBenchConfig_t config = { .path = pMsg[5], .direction = pMsg[6], .size = getBE16(pMsg + 7),
+            .rate = getBE16(pMsg + 9), .durationS = getBE16(pMsg + 11), .layer = pMsg[13] };
+
+    if (esp_mesh_is_root() || (config.layer && config.layer != esp_mesh_get_layer()))
+    {
+        return;
+    }
+    if (__atomic_exchange_n(&benchRunning, true, __ATOMIC_ACQ_REL))
+    {
+        ESP_LOGW(TAG, "Session %08x ignored, another one is running", getBE32(pMsg + 1));
+        return;
+    }
+    benchSession = getBE32(pMsg + 1);
+    benchConfig = config;
+    benchRoot = *pFrom;
+    esp_wifi_get_mac(WIFI_IF_STA, benchSelf);
+    benchStartUs = esp_timer_get_time();
+    if (benchAlloc(false) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "No memory for session %08x", benchSession);
+        benchFree();
+        return;
+    }
+    if (config.path == MESH_BENCH_PATH_IP && config.direction != MESH_BENCH_UP)
+    {
+        benchIpRxStart();
+    }
+    if (xTaskCreate(benchNodeTask, "bench task", 3072, NULL, BENCH_TASK_PRIORITY, &benchTask) != pdPASS)
+    {
+        benchIpRxStop();
+        benchFree();
+    }
+}
+
+esp_err_t meshBenchInit(meshBenchResultCb_t* pCb)
+{
+    if (benchLock == NULL)
+    {
+        benchLock = xSemaphoreCreateMutex();
+        benchIpRxDone = xSemaphoreCreateBinary();
+        if (benchLock == NULL || benchIpRxDone == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    pBenchResultCb = pCb;
+    return ESP_OK;
+}
+
+esp_err_t meshBenchParse(const char* pText, size_t len, meshBenchConfig_t* pConfig)
+{
+    char text[BENCH_TEXT_MAX];
+    char path[8] = "";
+    char direction[8] = "";
+    unsigned int size = CONFIG_MESH_BENCH_SIZE;
+    unsigned int rate = CONFIG_MESH_BENCH_RATE;
+    unsigned int durationS = CONFIG_MESH_BENCH_DURATION_S;
+    unsigned int layer = CONFIG_MESH_BENCH_LAYER;
+
+#if CONFIG_MESH_BENCH_PATH_IP
+    pConfig->path = MESH_BENCH_PATH_IP;
+#else
+    pConfig->path = MESH_BENCH_PATH_RAW;
+#endif
+#if CONFIG_MESH_BENCH_DIRECTION_DOWN
+    pConfig->direction = MESH_BENCH_DOWN;
+#elif CONFIG_MESH_BENCH_DIRECTION_PEER
+    pConfig->direction = MESH_BENCH_PEER;
+#else
+    pConfig->direction = MESH_BENCH_UP;
+#endif
+    if (len >= sizeof(text))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(text, pText, len);
+    text[len] = '\0';
+    int fields = sscanf(text, "%7s %7s %u %u %u %u", path, direction, &size, &rate, &durationS, &layer);
+    if (fields >= 1)
+    {
+        if (strcmp(path, "raw") == 0)
+        {
+            pConfig->path = MESH_BENCH_PATH_RAW;
+        }
+        else if (strcmp(path, "ip") == 0)
+        {
+            pConfig->path = MESH_BENCH_PATH_IP;
+        }
+        else
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (fields >= 2)
+    {
+        if (strcmp(direction, "up") == 0)
+        {
+            pConfig->direction = MESH_BENCH_UP;
+        }
+        else if (strcmp(direction, "down") == 0)
+        {
+            pConfig->direction = MESH_BENCH_DOWN;
+        }
+        else if (strcmp(direction, "peer") == 0)
+        {
+            pConfig->direction = MESH_BENCH_PEER;
+        }
+        else
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    unsigned int maxSize = pConfig->path == MESH_BENCH_PATH_IP ? BENCH_IP_MAX_SIZE : BENCH_RAW_MAX_SIZE;
+    if (size < BENCH_DATA_HDR_LEN || size > maxSize || rate < 1 || rate > BENCH_MAX_RATE || durationS < 1
+            || durationS > BENCH_MAX_DURATION_S || layer > CONFIG_MESH_MAX_LAYER)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pConfig->size = size;
+    pConfig->rate = rate;
+    pConfig->durationS = durationS;
+    pConfig->layer = layer;
+    return ESP_OK;
+}
+
+esp_err_t meshBenchStart(const meshBenchConfig_t* pConfig)
+{
+    if (benchLock == NULL || !esp_mesh_is_root())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (__atomic_exchange_n(&benchRunning, true, __ATOMIC_ACQ_REL))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    benchSession = esp_random();
+    benchConfig = *pConfig;
+    esp_wifi_get_mac(WIFI_IF_STA, benchSelf);
+    memcpy(benchRoot.addr, benchSelf, MAC_ADDR_LEN);
+    benchStartUs = esp_timer_get_time();
+    if (benchAlloc(true) != ESP_OK)
+    {
+        benchFree();
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(benchRootTask, "bench task", 3072, NULL, BENCH_TASK_PRIORITY, &benchTask) != pdPASS)
+    {
+        benchFree();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool meshBenchIsRunning(void)
+{
+    return __atomic_load_n(&benchRunning, __ATOMIC_ACQUIRE);
+}
+
+esp_err_t meshBenchReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    const uint8_t* pMsg = pData->data;
+    static const size_t lengths[] = { BENCH_START_MSG_LEN, BENCH_JOIN_MSG_LEN, BENCH_GO_MSG_LEN, BENCH_DATA_HDR_LEN,
+            BENCH_END_MSG_LEN, BENCH_RESULT_MSG_LEN };
+
+    if (benchLock == NULL || !MESH_BENCH_IS_CMD(pMsg[0]) || pData->size < lengths[pMsg[0] - CMD_BENCH_START])
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (pMsg[0] == CMD_BENCH_START)
+    {
+        benchReceiveStart(pFrom, pMsg);
+        return ESP_OK;
+    }
+    if (pMsg[0] == CMD_BENCH_DATA)
+    {
+        benchDataInput(pMsg, pData->size);
+        return ESP_OK;
+    }
+    if (!__atomic_load_n(&benchRunning, __ATOMIC_ACQUIRE))
+    {
+        return ESP_OK;
+    }
+    xSemaphoreTake(benchLock, portMAX_DELAY);
+    if (getBE32(pMsg + 1) != benchSession)
+    {
+        xSemaphoreGive(benchLock);
+        return ESP_OK;
+    }
+    switch (pMsg[0])
+    {
+        case CMD_BENCH_JOIN:
+            if (benchJoinOpen && benchPeerCount < BENCH_ROOT_FLOWS)
+            {
+                benchFlow_t* pPeer = &pBenchPeers[benchPeerCount++];
+                pPeer->peer = *pFrom;
+                pPeer->layer = pMsg[5];
+                memcpy(&pPeer->ip, pMsg + 6, 4);
+            }
+            break;
+        case CMD_BENCH_GO:
+            if (pBenchTx && benchTask)
+            {
+                memcpy(pBenchTx->peer.addr, pMsg + 5, MAC_ADDR_LEN);
+                memcpy(&pBenchTx->ip, pMsg + 11, 4);
+                benchTxCount = 1;
+                xTaskNotifyGive(benchTask);
+            }
+            break;
+        case CMD_BENCH_END:
+        {
+            benchFlow_t* pFlow = pBenchRx ? benchRxFlowGet(pFrom->addr, 0) : NULL;
+            if (pFlow)
+            {
+                pFlow->ended = true;
+                pFlow->sent = getBE32(pMsg + 5);
+            }
+            break;
+        }
+        case CMD_BENCH_RESULT:
+            if (pBenchResults && benchResultCount < BENCH_ROOT_FLOWS)
+            {
+                benchResult_t* pResult = &pBenchResults[benchResultCount++];
+                pResult->layer = pMsg[5];
+                pResult->sent = getBE32(pMsg + 6);
+                pResult->received = getBE32(pMsg + 10);
+                pResult->bytes = getBE32(pMsg + 14);
+                pResult->jitterUs = getBE32(pMsg + 18);
+                pResult->activeUs = getBE32(pMsg + 22);
+            }
+            break;
+        default:
+            break;
+    }
+    xSemaphoreGive(benchLock);
+    return ESP_OK;
+}
@@ -0,0 +1,254 @@
+#include "mesh_join.h"
+#include "mesh_sched.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+
+#include <string.h> // for memcmp,memcpy,strlen
+
+#define JOIN_RECORD_VERSION  (1)
+#define JOIN_NVS_NAMESPACE   "mesh_join"
+#define JOIN_NVS_KEY         "network"
+#define JOIN_SAVE_PERIOD_ms  (10000) // parents change while the mesh forms, they are written at most this often
+
+// Network of the device as saved in NVS
+typedef struct __attribute__((packed))
+{
+    uint8_t version;
+    uint8_t meshId[6];
+    uint8_t channel;
+    uint8_t layer;
+    uint8_t router[6];      // BSSID of the router, all zero if not known
+    uint8_t parent[6];      // BSSID of the parent, the router for the root
+    uint8_t parentSsidLen;
+    uint8_t parentSsid[32];
+} joinRecord_t;
+
+static const char* TAG = "mesh_join";
+
+static SemaphoreHandle_t joinLock = NULL;
+static nvs_handle_t joinNvs;
+static bool joinNvsOpen = false;
+static joinRecord_t joinSaved;     // record in NVS, valid if joinHaveSaved
+static bool joinHaveSaved = false;
+static joinRecord_t joinCurrent;   // record of the running network, written to NVS when it differs from joinSaved
+static esp_timer_handle_t joinTimer = NULL;
+static meshSchedJob_t joinSaveJob = MESH_SCHED_JOB_NONE;
+static int joinFastPending = 0;    // set while connecting to the saved parent, cleared once by whoever ends it
+static int64_t joinStartUs = 0;
+static meshJoinStats_t joinStats;
+
+static bool joinMacIsZero(const uint8_t* pMac)
+{
+    static const uint8_t zero[6] = { 0 };
+
+    return memcmp(pMac, zero, sizeof(zero)) == 0;
+}
+
+// Time since meshJoinStart(), rounded up so 0 is left for not yet
+static uint32_t joinElapsedMs(void)
+{
+    return (esp_timer_get_time() - joinStartUs + 999) / 1000;
+}
+
+// Let the mesh pick a parent again, called once the attempt to the saved parent failed
+static void joinFallback(const char* pReason)
+{
+    if (!__atomic_exchange_n(&joinFastPending, 0, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+    ESP_LOGW(TAG, "Saved parent " MACSTR " %s, scanning", MAC2STR(joinSaved.parent), pReason);
+    joinStats.path = MESH_JOIN_FALLBACK;
+    esp_mesh_set_self_organized(true, true);
+}
+
+static void joinTimeout(void* arg)
+{
+    joinFallback("not reached in time");
+}
+
+// Write the record of the running network to NVS when it changed, runs on the scheduler
+static void joinSave(void* pArg)
+{
+    joinRecord_t record;
+
+    // parents taken while the mesh forms are not worth a write until the device got an IP address
+    if (!joinNvsOpen || joinStats.ipMs == 0)
+    {
+        return;
+    }
+    xSemaphoreTake(joinLock, portMAX_DELAY);
+    record = joinCurrent;
+    xSemaphoreGive(joinLock);
+    if (record.channel == 0 || (joinHaveSaved && memcmp(&record, &joinSaved, sizeof(record)) == 0))
+    {
+        return;
+    }
+    esp_err_t err = nvs_set_blob(joinNvs, JOIN_NVS_KEY, &record, sizeof(record));
+    err = err == ESP_OK ? nvs_commit(joinNvs) : err;
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to save the network: %s", esp_err_to_name(err));
+        return;
+    }
+    joinSaved = record;
+    joinHaveSaved = true;
+    joinStats.saves++;
+    ESP_LOGI(TAG, "Saved channel %d, layer %d, parent " MACSTR, record.channel, record.layer,
+            MAC2STR(record.parent));
+}
+
+esp_err_t meshJoinInit(mesh_cfg_t* pConfig)
+{
+    esp_timer_create_args_t timerArgs = { .callback = joinTimeout, .name = "join timeout" };
+    size_t len = sizeof(joinSaved);
+
+    joinLock = xSemaphoreCreateMutex();
+    if (joinLock == NULL || esp_timer_create(&timerArgs, &joinTimer) != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = meshSchedAdd("join save", JOIN_SAVE_PERIOD_ms, joinSave, NULL, &joinSaveJob);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    memset(&joinCurrent, 0, sizeof(joinCurrent));
+    joinCurrent.version = JOIN_RECORD_VERSION;
+    memcpy(joinCurrent.meshId, pConfig->mesh_id.addr, sizeof(joinCurrent.meshId));
+    // without NVS every start scans
+    joinNvsOpen = nvs_open(JOIN_NVS_NAMESPACE, NVS_READWRITE, &joinNvs) == ESP_OK;
+    joinHaveSaved = joinNvsOpen && nvs_get_blob(joinNvs, JOIN_NVS_KEY, &joinSaved, &len) == ESP_OK
+            && len == sizeof(joinSaved) && joinSaved.version == JOIN_RECORD_VERSION
+            && memcmp(joinSaved.meshId, joinCurrent.meshId, sizeof(joinSaved.meshId)) == 0
+            && joinSaved.channel && joinSaved.layer;
+    if (!joinHaveSaved)
+    {
+        ESP_LOGI(TAG, "No saved network");
+        return ESP_OK;
+    }
+    // a configured channel wins over the saved one
+    if (pConfig->channel == 0)
+    {
+        pConfig->channel = joinSaved.channel;
+        pConfig->allow_channel_switch = true;
+    }
+    if (!joinMacIsZero(joinSaved.router) && joinMacIsZero(pConfig->router.bssid))
+    {
+        memcpy(pConfig->router.bssid, joinSaved.router, sizeof(pConfig->router.bssid));
+        pConfig->router.allow_router_switch = true;
+    }
+    joinCurrent = joinSaved;
+    ESP_LOGI(TAG, "Saved network: channel %d, router " MACSTR ", layer %d, parent " MACSTR, joinSaved.channel,
+            MAC2STR(joinSaved.router), joinSaved.layer, MAC2STR(joinSaved.parent));
+    return ESP_OK;
+}
+
+void meshJoinStart(void)
+{
+    wifi_config_t parent = { 0 };
+    mesh_addr_t meshId;
+    mesh_type_t type = joinSaved.layer == MESH_ROOT_LAYER ? MESH_ROOT : MESH_NODE;
+
+    joinStartUs = esp_timer_get_time();
+    joinStats.path = MESH_JOIN_PENDING;
+    if (!joinHaveSaved)
+    {
+        return;
+    }
+    if (type == MESH_ROOT)
+    {
+        memcpy(parent.sta.ssid, CONFIG_MESH_ROUTER_SSID, strlen(CONFIG_MESH_ROUTER_SSID));
+        memcpy(parent.sta.password, CONFIG_MESH_ROUTER_PASSWD, strlen(CONFIG_MESH_ROUTER_PASSWD));
+    }
+    else
+    {
+        memcpy(parent.sta.ssid, joinSaved.parentSsid, joinSaved.parentSsidLen);
+        memcpy(parent.sta.password, CONFIG_MESH_AP_PASSWD, strlen(CONFIG_MESH_AP_PASSWD));
+    }
+    memcpy(parent.sta.bssid, joinSaved.parent, sizeof(parent.sta.bssid));
+    parent.sta.bssid_set = true;
+    parent.sta.channel = joinSaved.channel;
+    memcpy(meshId.addr, joinSaved.meshId, sizeof(meshId.addr));
+    __atomic_store_n(&joinFastPending, 1, __ATOMIC_RELEASE);
+    esp_err_t err = esp_mesh_set_parent(&parent, &meshId, type, joinSaved.layer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to set the saved parent: %s", esp_err_to_name(err));
+        joinFallback("refused");
+        return;
+    }
+    esp_timer_start_once(joinTimer, CONFIG_MESH_FAST_JOIN_TIMEOUT_MS * 1000ULL);
+    ESP_LOGI(TAG, "Joining saved parent " MACSTR " at layer %d", MAC2STR(joinSaved.parent), joinSaved.layer);
+}
+
+void meshJoinConnected(const mesh_event_connected_t* pConnected)
+{
+    if (__atomic_exchange_n(&joinFastPending, 0, __ATOMIC_ACQ_REL))
+    {
+        esp_timer_stop(joinTimer);
+        joinStats.path = MESH_JOIN_FAST;
+        // the mesh heals itself again from now on, keeping this parent
+        esp_mesh_set_self_organized(true, false);
+    }
+    else if (joinStats.path == MESH_JOIN_PENDING)
+    {
+        joinStats.path = MESH_JOIN_SCAN;
+    }
+    if (joinStats.parentMs == 0)
+    {
+        joinStats.parentMs = joinElapsedMs();
+        ESP_LOGI(TAG, "Joined in %u ms", joinStats.parentMs);
+    }
+    xSemaphoreTake(joinLock, portMAX_DELAY);
+    joinCurrent.layer = pConnected->self_layer;
+    joinCurrent.channel = pConnected->connected.channel ? pConnected->connected.channel : joinCurrent.channel;
+    memcpy(joinCurrent.parent, pConnected->connected.bssid, sizeof(joinCurrent.parent));
+    joinCurrent.parentSsidLen = pConnected->connected.ssid_len < sizeof(joinCurrent.parentSsid)
+            ? pConnected->connected.ssid_len : sizeof(joinCurrent.parentSsid);
+    memset(joinCurrent.parentSsid, 0, sizeof(joinCurrent.parentSsid));
+    memcpy(joinCurrent.parentSsid, pConnected->connected.ssid, joinCurrent.parentSsidLen);
+    if (pConnected->self_layer == MESH_ROOT_LAYER)
+    {
+        memcpy(joinCurrent.router, pConnected->connected.bssid, sizeof(joinCurrent.router));
+    }
+    joinStats.channel = joinCurrent.channel;
+    xSemaphoreGive(joinLock);
+}
+
+void meshJoinDisconnected(void)
+{
+    joinFallback("refused the connection");
+}
+
+void meshJoinNetwork(uint8_t channel, const uint8_t* pRouter)
+{
+    xSemaphoreTake(joinLock, portMAX_DELAY);
+    joinCurrent.channel = channel;
+    if (pRouter)
+    {
+        memcpy(joinCurrent.router, pRouter, sizeof(joinCurrent.router));
+    }
+    joinStats.channel = channel;
+    xSemaphoreGive(joinLock);
+}
+
+void meshJoinGotIp(void)
+{
+    if (joinStats.ipMs)
+    {
+        return;
+    }
+    joinStats.ipMs = joinElapsedMs();
+    // the network works, save it now rather than at the next period
+    meshSchedTrigger(joinSaveJob);
+}
+
+void meshJoinGetStats(meshJoinStats_t* pStats)
+{
+    *pStats = joinStats;
+}
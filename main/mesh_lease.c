@@ -0,0 +1,559 @@
+#include "mesh_lease.h"
+#include "mesh_netif.h"
+#include "mesh_sched.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <string.h> // for memcpy,memcmp,memmove
+
+#define LEASE_TABLE_SIZE   (CONFIG_MESH_ROUTE_TABLE_SIZE)
+#define LEASE_ENTRY_SIZE   (6 + 2)
+#define LEASE_FULL_HDR_LEN (1 + 4 + 4 + 2)
+#define LEASE_ADD_HDR_LEN  (1 + 4 + 4 + 4 + 2)
+#define LEASE_REQUEST_LEN  (1 + 4)
+#define LEASE_TABLE_LEN    (LEASE_ADD_HDR_LEN + LEASE_TABLE_SIZE * LEASE_ENTRY_SIZE)
+// larger tables go out in several messages, each up to the largest raw message
+#define LEASE_MSG_MAX_LEN \
+    (LEASE_TABLE_LEN < CONFIG_MESH_RAW_MAX_SIZE ? LEASE_TABLE_LEN : CONFIG_MESH_RAW_MAX_SIZE)
+#define LEASE_MSG_ENTRIES  ((LEASE_MSG_MAX_LEN - LEASE_ADD_HDR_LEN) / LEASE_ENTRY_SIZE)
+#define LEASE_FIRST_NET    (16) // third byte of the first address, the DHCP server of the root leases in 10.0.0.x
+#define LEASE_HOSTS        ((256 - LEASE_FIRST_NET) * 254)
+#define LEASE_NONE         (0xFFFF)
+#define LEASE_PERIOD_ms    (30000) // the root sends the full table this often, for nodes that missed an addition
+#define LEASE_WAIT_us      (CONFIG_MESH_LEASE_WAIT_MS * 1000ULL)
+
+typedef struct
+{
+    uint8_t mac[MAC_ADDR_LEN];
+    uint16_t host;    // number of the address from 10.0.16.1 on
+    uint32_t version; // table version the lease was added in
+} leaseEntry_t;
+
+typedef struct
+{
+    uint32_t version;
+    int size;
+    leaseEntry_t entries[LEASE_TABLE_SIZE]; // in the order they were added, the oldest make room when full
+} leaseTable_t;
+
+static const char* TAG = "mesh_lease";
+static SemaphoreHandle_t leaseLock = NULL;
+static leaseTable_t leaseTable = { 0 };    // table assigned by this root or received from it
+static uint32_t leaseDns = 0;              // DNS server of the root, network byte order
+static uint32_t leaseSentVersion = 0;      // root: version of the last table message, 0 before the first
+static bool leaseSendPending = false;      // root: leases or DNS changed since the last table message
+static uint8_t leaseOwnMac[MAC_ADDR_LEN];  // node: MAC of the station, valid if leaseOwnKnown
+static bool leaseOwnKnown = false;
+static uint16_t leaseApplied = LEASE_NONE; // node: host set on the station, LEASE_NONE with DHCP
+static uint32_t leaseAppliedDns = 0;
+static int leaseWaiting = 0;               // node: set while the station waits for its lease, cleared once
+static mesh_addr_t leaseRoot;              // node: root asked for the table, valid if leaseRootKnown
+static bool leaseRootKnown = false;
+static esp_timer_handle_t leaseTimer = NULL;
+static meshSchedJob_t leaseJob = MESH_SCHED_JOB_NONE;
+static meshLeaseStats_t leaseStats = { 0 };
+static uint8_t leaseTxBuffer[LEASE_MSG_MAX_LEN]; // messages larger than MESH_MPS are fragmented by mesh_netif
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void putBE32(uint8_t* p, uint32_t value)
+{
+    putBE16(p, value >> 16);
+    putBE16(p + 2, value & 0xFFFF);
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t)getBE16(p) << 16) | getBE16(p + 2);
+}
+
+// Host the lease of a MAC address gets unless another node has it
+static uint16_t leaseHash(const uint8_t* pMac)
+{
+    // the last bytes of a MAC address are the ones that differ between devices
+    uint32_t hash = ((uint32_t)pMac[2] << 24) | ((uint32_t)pMac[3] << 16) | ((uint32_t)pMac[4] << 8) | pMac[5];
+    hash *= 0x9E3779B1u;
+    return (hash >> 8) % LEASE_HOSTS;
+}
+
+// Address of a host in the mesh subnet, a /16 of which the first 16 /24s are left to the DHCP server
+static void leaseIpInfo(uint16_t host, esp_netif_ip_info_t* pIpInfo)
+{
+    const uint8_t* pNet = (const uint8_t*)&g_mesh_netif_subnet_ip.ip.addr;
+
+    pIpInfo->ip.addr = ESP_IP4TOADDR(pNet[0], pNet[1], LEASE_FIRST_NET + host / 254, host % 254 + 1);
+    pIpInfo->gw = g_mesh_netif_subnet_ip.ip;
+    pIpInfo->netmask = g_mesh_netif_subnet_ip.netmask;
+}
+
+// Returns index of the lease of the MAC address, -1 if not found, call with leaseLock taken
+static int leaseFind(const uint8_t* pMac)
+{
+    for (int i = 0; i < leaseTable.size; i++)
+    {
+        if (MAC_ADDR_EQUAL(leaseTable.entries[i].mac, pMac))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool leaseHostUsed(uint16_t host)
+{
+    for (int i = 0; i < leaseTable.size; i++)
+    {
+        if (leaseTable.entries[i].host == host)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool leaseRouted(const uint8_t* pMac, const mesh_addr_t* pRoutes, int routes)
+{
+    for (int i = 0; i < routes; i++)
+    {
+        if (MAC_ADDR_EQUAL(pRoutes[i].addr, pMac))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void leaseRemove(int index)
+{
+    memmove(&leaseTable.entries[index], &leaseTable.entries[index + 1],
+            (leaseTable.size - index - 1) * sizeof(leaseEntry_t));
+    leaseTable.size--;
+}
+
+static void leaseAppend(const uint8_t* pMac, uint16_t host, uint32_t version)
+{
+    leaseEntry_t* pEntry = &leaseTable.entries[leaseTable.size++];
+
+    memcpy(pEntry->mac, pMac, MAC_ADDR_LEN);
+    pEntry->host = host;
+    pEntry->version = version;
+}
+
+// Root: add a lease for the MAC address, the oldest lease of a node not in pRoutes makes room when the table
+// is full, call with leaseLock taken
+static bool leaseAssign(const uint8_t* pMac, const mesh_addr_t* pRoutes, int routes)
+{
+    if (leaseTable.size == LEASE_TABLE_SIZE)
+    {
+        int i = 0;
+        while (i < leaseTable.size && leaseRouted(leaseTable.entries[i].mac, pRoutes, routes))
+        {
+            i++;
+        }
+        if (i == leaseTable.size)
+        {
+            return false;
+        }
+        leaseRemove(i);
+    }
+    uint16_t preferred = leaseHash(pMac);
+    uint16_t host = preferred;
+    while (leaseHostUsed(host))
+    {
+        host = (host + 1) % LEASE_HOSTS;
+    }
+    leaseAppend(pMac, host, leaseTable.version + 1);
+    leaseStats.assigned++;
+    leaseStats.moved += host != preferred;
+    return true;
+}
+
+// Node: put a received lease into the table, older leases of the MAC address or the host are dropped,
+// call with leaseLock taken
+static void leaseStore(const uint8_t* pMac, uint16_t host, uint32_t version)
+{
+    int kept = 0;
+
+    for (int i = 0; i < leaseTable.size; i++)
+    {
+        if (leaseTable.entries[i].host != host && !MAC_ADDR_EQUAL(leaseTable.entries[i].mac, pMac))
+        {
+            leaseTable.entries[kept++] = leaseTable.entries[i];
+        }
+    }
+    leaseTable.size = kept;
+    if (leaseTable.size == LEASE_TABLE_SIZE)
+    {
+        leaseRemove(0);
+    }
+    leaseAppend(pMac, host, version);
+}
+
+// Root: index of the next entry to send from index on, leaseTable.size if none is left, call with leaseLock taken
+static int leaseSendNext(int index, bool delta)
+{
+    while (index < leaseTable.size && delta && leaseTable.entries[index].version <= leaseSentVersion)
+    {
+        index++;
+    }
+    return index;
+}
+
+// Root: send the leases added since the last table message, or the whole table, call with leaseLock taken.
+// Entries beyond LEASE_MSG_ENTRIES follow in CMD_LEASE_ADD messages based on the version sent.
+static esp_err_t leaseSendTable(const mesh_addr_t* pTo, bool delta)
+{
+    int next = leaseSendNext(0, delta);
+    bool first = true;
+
+    do
+    {
+        bool add = delta || !first;
+        uint8_t* pEntry = leaseTxBuffer + 1;
+        int count = 0;
+
+        leaseTxBuffer[0] = add ? CMD_LEASE_ADD : CMD_LEASE_TABLE;
+        if (add)
+        {
+            putBE32(pEntry, first ? leaseSentVersion : leaseTable.version);
+            pEntry += 4;
+        }
+        putBE32(pEntry, leaseTable.version);
+        memcpy(pEntry + 4, &leaseDns, 4);
+        uint8_t* pCount = pEntry + 4 + 4;
+        pEntry += 4 + 4 + 2;
+        for (; next < leaseTable.size && count < LEASE_MSG_ENTRIES; next = leaseSendNext(next + 1, delta))
+        {
+            memcpy(pEntry, leaseTable.entries[next].mac, MAC_ADDR_LEN);
+            putBE16(pEntry + MAC_ADDR_LEN, leaseTable.entries[next].host);
+            pEntry += LEASE_ENTRY_SIZE;
+            count++;
+        }
+        putBE16(pCount, count);
+        mesh_data_t data = { .data = leaseTxBuffer, .size = pEntry - leaseTxBuffer, .proto = MESH_PROTO_BIN,
+                .tos = MESH_TOS_P2P };
+        esp_err_t err = meshNetifSendRaw(pTo, &data, MESH_TRAFFIC_CONTROL);
+        if (err != ESP_OK)
+        {
+            // the whole table goes out again, nodes that missed a part wait for the next full table
+            ESP_LOGW(TAG, "Lease table not sent, err code %d %s", err, esp_err_to_name(err));
+            return err;
+        }
+        first = false;
+    } while (next < leaseTable.size);
+    leaseStats.deltasSent += delta;
+    leaseStats.fullSent += !delta;
+    return ESP_OK;
+}
+
+// Root: send the leases added since the last message, or the whole table, runs on the scheduler
+static void leaseSend(void* pArg)
+{
+    int added = 0;
+
+    if (leaseLock == NULL || !esp_mesh_is_root())
+    {
+        return;
+    }
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    for (int i = 0; i < leaseTable.size; i++)
+    {
+        added += leaseTable.entries[i].version > leaseSentVersion;
+    }
+    // periodic runs and nodes that may hold another version get the whole table
+    bool delta = leaseSendPending && leaseSentVersion && added * 2 <= leaseTable.size;
+    if (leaseSendTable(NULL, delta) == ESP_OK)
+    {
+        // a failed message is sent again at the next addition or period
+        leaseSentVersion = leaseTable.version;
+        leaseSendPending = false;
+    }
+    xSemaphoreGive(leaseLock);
+}
+
+// Node: ask the root for the full table while the station waits for its lease
+static void leaseRequest(void)
+{
+    uint8_t msg[LEASE_REQUEST_LEN] = { CMD_LEASE_REQUEST };
+    mesh_data_t data = { .data = msg, .size = sizeof(msg), .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    bool ask = leaseRootKnown && __atomic_load_n(&leaseWaiting, __ATOMIC_ACQUIRE);
+    mesh_addr_t root = leaseRoot;
+    putBE32(msg + 1, leaseTable.version);
+    leaseStats.requests += ask;
+    xSemaphoreGive(leaseLock);
+    if (ask && meshNetifSendRaw(&root, &data, MESH_TRAFFIC_CONTROL) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Lease request to " MACSTR " not sent", MAC2STR(root.addr));
+    }
+}
+
+// Node: the lease did not come in time, runs on the esp_timer task
+static void leaseWaitTimeout(void* arg)
+{
+    if (!__atomic_exchange_n(&leaseWaiting, 0, __ATOMIC_ACQ_REL) || meshNetifStartDhcp() != ESP_OK)
+    {
+        return;
+    }
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    leaseStats.dhcp++;
+    xSemaphoreGive(leaseLock);
+    ESP_LOGW(TAG, "No lease in %d ms, using DHCP", CONFIG_MESH_LEASE_WAIT_MS);
+}
+
+// mesh_address_cb_t of the node station, runs on the state task
+static esp_err_t leaseAddressCb(const uint8_t* pMac, esp_netif_ip_info_t* pIpInfo, uint32_t* pDnsAddr)
+{
+    esp_err_t err = ESP_ERR_NOT_FINISHED;
+
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    memcpy(leaseOwnMac, pMac, MAC_ADDR_LEN);
+    leaseOwnKnown = true;
+    leaseApplied = LEASE_NONE;
+    int own = leaseFind(pMac);
+    if (own >= 0)
+    {
+        leaseApplied = leaseTable.entries[own].host;
+        leaseAppliedDns = leaseDns;
+        leaseIpInfo(leaseApplied, pIpInfo);
+        *pDnsAddr = leaseDns;
+        leaseStats.applied++;
+        err = ESP_OK;
+    }
+    else if (CONFIG_MESH_LEASE_WAIT_MS == 0)
+    {
+        leaseStats.dhcp++;
+        err = ESP_ERR_NOT_FOUND;
+    }
+    else
+    {
+        __atomic_store_n(&leaseWaiting, 1, __ATOMIC_RELEASE);
+    }
+    xSemaphoreGive(leaseLock);
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Leased " IPSTR " from the table", IP2STR(&pIpInfo->ip));
+    }
+    else if (err == ESP_ERR_NOT_FINISHED)
+    {
+        esp_timer_stop(leaseTimer);
+        esp_timer_start_once(leaseTimer, LEASE_WAIT_us);
+        leaseRequest();
+    }
+    return err;
+}
+
+esp_err_t meshLeaseInit(void)
+{
+    esp_timer_create_args_t timerArgs = { .callback = leaseWaitTimeout, .name = "lease wait" };
+
+    if (leaseLock)
+    {
+        return ESP_OK;
+    }
+    leaseLock = xSemaphoreCreateMutex();
+    if (leaseLock == NULL || esp_timer_create(&timerArgs, &leaseTimer) != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = meshSchedAdd("lease", LEASE_PERIOD_ms, leaseSend, NULL, &leaseJob);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    meshNetifSetAddressCb(leaseAddressCb);
+    return ESP_OK;
+}
+
+void meshLeaseRootUpdate(void)
+{
+    const mesh_addr_t* pRoutes;
+    int routes;
+    int added = 0;
+
+    if (leaseLock == NULL || !esp_mesh_is_root())
+    {
+        return;
+    }
+    meshNetifGetRoutingTable(&pRoutes, &routes);
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    for (int i = 0; i < routes; i++)
+    {
+        if (leaseFind(pRoutes[i].addr) < 0 && leaseAssign(pRoutes[i].addr, pRoutes, routes))
+        {
+            added++;
+        }
+    }
+    meshNetifReleaseRoutingTable(pRoutes);
+    if (added)
+    {
+        leaseTable.version++;
+        leaseSendPending = true;
+        ESP_LOGI(TAG, "Lease table version %u, %d leases, %d new", leaseTable.version, leaseTable.size, added);
+    }
+    // a new root sends the table it held as a node first
+    bool send = leaseSendPending;
+    xSemaphoreGive(leaseLock);
+    if (send)
+    {
+        meshSchedTrigger(leaseJob);
+    }
+}
+
+void meshLeaseSetDns(uint32_t dnsAddr)
+{
+    if (leaseLock == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    bool changed = dnsAddr != leaseDns;
+    leaseDns = dnsAddr;
+    leaseSendPending = leaseSendPending || changed;
+    xSemaphoreGive(leaseLock);
+    if (changed)
+    {
+        meshSchedTrigger(leaseJob);
+    }
+}
+
+void meshLeaseSetRoot(const mesh_addr_t* pRoot)
+{
+    if (leaseLock == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    leaseRoot = *pRoot;
+    leaseRootKnown = true;
+    xSemaphoreGive(leaseLock);
+    leaseRequest();
+}
+
+// Root: answer a node without a lease with the full table
+static esp_err_t leaseServeRequest(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    if (pData->size != LEASE_REQUEST_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (!esp_mesh_is_root())
+    {
+        return ESP_OK;
+    }
+    // the node may have joined after the last update
+    meshLeaseRootUpdate();
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    ESP_LOGD(TAG, "Request of " MACSTR " from version %u", MAC2STR(pFrom->addr), getBE32(pData->data + 1));
+    leaseStats.requests++;
+    leaseSendTable(pFrom, false);
+    xSemaphoreGive(leaseLock);
+    return ESP_OK;
+}
+
+esp_err_t meshLeaseReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    const uint8_t* pMsg = pData->data;
+    bool isAdd = pMsg[0] == CMD_LEASE_ADD;
+    int hdrLen = isAdd ? LEASE_ADD_HDR_LEN : LEASE_FULL_HDR_LEN;
+    esp_netif_ip_info_t ipInfo;
+    bool set = false;
+    bool waited = false;
+
+    if (leaseLock && pMsg[0] == CMD_LEASE_REQUEST)
+    {
+        return leaseServeRequest(pFrom, pData);
+    }
+    if (leaseLock == NULL || pData->size < hdrLen)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int count = getBE16(pMsg + hdrLen - 2);
+    if (count > LEASE_TABLE_SIZE || pData->size != hdrLen + count * LEASE_ENTRY_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (esp_mesh_is_root())
+    {
+        // the root assigns the leases itself
+        return ESP_OK;
+    }
+    uint32_t version = getBE32(pMsg + hdrLen - 10);
+    const uint8_t* pEntry = pMsg + hdrLen;
+
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    // additions to another version than the one held only count for the own lease
+    bool apply = !isAdd || getBE32(pMsg + 1) == leaseTable.version;
+    if (!isAdd)
+    {
+        leaseTable.size = 0;
+    }
+    for (int i = 0; i < count; i++, pEntry += LEASE_ENTRY_SIZE)
+    {
+        uint16_t host = getBE16(pEntry + MAC_ADDR_LEN);
+        if (host < LEASE_HOSTS && (apply || (leaseOwnKnown && MAC_ADDR_EQUAL(pEntry, leaseOwnMac))))
+        {
+            leaseStore(pEntry, host, version);
+        }
+    }
+    if (apply)
+    {
+        leaseTable.version = version;
+    }
+    memcpy(&leaseDns, pMsg + hdrLen - 6, 4);
+    // this node sends the whole table first if it becomes root
+    leaseSentVersion = 0;
+    leaseSendPending = true;
+    int own = leaseOwnKnown ? leaseFind(leaseOwnMac) : -1;
+    if (own >= 0)
+    {
+        uint16_t host = leaseTable.entries[own].host;
+        waited = __atomic_exchange_n(&leaseWaiting, 0, __ATOMIC_ACQ_REL);
+        // a station that went on with DHCP keeps that address until it connects again
+        set = waited || (leaseApplied != LEASE_NONE && (leaseApplied != host || leaseAppliedDns != leaseDns));
+        if (set)
+        {
+            leaseApplied = host;
+            leaseAppliedDns = leaseDns;
+            leaseIpInfo(host, &ipInfo);
+            leaseStats.applied += waited;
+        }
+    }
+    uint32_t dnsAddr = leaseDns;
+    xSemaphoreGive(leaseLock);
+    if (set)
+    {
+        esp_timer_stop(leaseTimer);
+        esp_err_t err = meshNetifSetStaticIp(&ipInfo, dnsAddr);
+        ESP_LOGI(TAG, "Leased " IPSTR " from table version %u%s", IP2STR(&ipInfo.ip), version,
+                err == ESP_OK ? "" : ", station not connected");
+    }
+    return ESP_OK;
+}
+
+void meshLeaseGetStats(meshLeaseStats_t* pStats)
+{
+    if (leaseLock == NULL)
+    {
+        memset(pStats, 0, sizeof(*pStats));
+        return;
+    }
+    xSemaphoreTake(leaseLock, portMAX_DELAY);
+    *pStats = leaseStats;
+    pStats->version = leaseTable.version;
+    pStats->size = leaseTable.size;
+    xSemaphoreGive(leaseLock);
+}
@@ -1,8 +1,21 @@
+#include "mesh_bench.h"
+#include "mesh_join.h"
+#include "mesh_lease.h"
+#include "mesh_metrics.h"
 #include "mesh_netif.h"
+#include "mesh_ota.h"
+#include "mesh_probe.h"
+#include "mesh_route.h"
+#include "mesh_sched.h"
+#include "mesh_state.h"
+#include "mesh_telemetry.h"
+#include "mesh_trace.h"
 #include "mqtt_app.h"
 
 #include "driver/gpio.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include <string.h> // for strlen,memcpy
@@ -21,14 +34,13 @@
 #define CMD_KEYPRESSED 0x55
 // CMD_KEYPRESSED: payload is always 6 bytes identifying address of node sending keypress event
 #define CMD_KEYPRESSED_PAYLOAD_SIZE MESH_ID_SIZE
-#define CMD_ROUTE_TABLE 0x56
-// CMD_ROUTE_TABLE: payload is a multiple of 6 listing addresses in a routing table
-#define CMD_ROUTE_TABLE_SIZE_PER_ENTRY 6
+// CMD_ROUTE_*: routing table distribution, see mesh_route.h
+// CMD_PROBE_*: round trip probes, see mesh_probe.h
+// CMD_OTA_*: mesh OTA updates, see mesh_ota.h
 
 #define COMMAND_SIZE 1
 
 #define MACSTR_FMT MACSTR
-#define MACSTR_LEN ((6 * 3 -1) + 1) // MAC address string size in hex with seperators + terminator
 
 static const char* MESH_TAG = "mesh_main";
 static const uint8_t MESH_ID[MESH_ID_SIZE] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x76 };
@@ -38,41 +50,30 @@ typedef struct
     mesh_addr_t MeshParentAddr;
     int MeshLayer;
     esp_ip4_addr_t currentIp;
-    mesh_addr_t RouteTable[CONFIG_MESH_ROUTE_TABLE_SIZE];
-    int RouteTableSize;
-    SemaphoreHandle_t routeTableLock;
-    uint8_t MeshTxPayload[CONFIG_MESH_ROUTE_TABLE_SIZE * CMD_ROUTE_TABLE_SIZE_PER_ENTRY + COMMAND_SIZE];
 } meshMainStruct_t;
 
 static meshMainStruct_t meshMainStruct = { .MeshLayer = -1 };
 
-#define BUTTON_POLL_PERIOD_ms 50
+#define BUTTON_POLL_PERIOD_ms 50 // without the button interrupt
+#define BUTTON_DEBOUNCE_us (50 * 1000)
+#define TRACE_LINE_DELAY_ms 20
+#define PUBLISH_LINE_MAX 160 // text publishes of this file, formatted on the stack
 
-static void initialiseButton(void)
-{
-    gpio_config_t io_conf = { .pin_bit_mask = BIT64(EXAMPLE_BUTTON_GPIO), .mode = GPIO_MODE_INPUT, .pull_up_en = 1 };
-    gpio_config(&io_conf);
-}
+static meshSchedJob_t buttonJob = MESH_SCHED_JOB_NONE;
+static bool buttonInterrupt = false;
 
 void static MeshReceiveCb(mesh_addr_t* from, mesh_data_t* data)
 {
-    if (data->data[0] == CMD_ROUTE_TABLE)
+    if (data->size == 0)
     {
-        int size = data->size - COMMAND_SIZE;// ignore command byte in payload size
-        if ((meshMainStruct.routeTableLock == NULL) || ((size % CMD_ROUTE_TABLE_SIZE_PER_ENTRY) != 0))
+        ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+    }
+    else if (MESH_ROUTE_IS_CMD(data->data[0]))
+    {
+        if (meshRouteReceive(from, data) != ESP_OK)
         {
             ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
-            return;
         }
-        xSemaphoreTake(meshMainStruct.routeTableLock, portMAX_DELAY);
-        meshMainStruct.RouteTableSize = size / CMD_ROUTE_TABLE_SIZE_PER_ENTRY;
-        for (int i = 0; i < meshMainStruct.RouteTableSize; ++i)
-        {
-            ESP_LOGI(MESH_TAG, "Received Routing table [%d] " MACSTR, i,
-                    MAC2STR(data->data + CMD_ROUTE_TABLE_SIZE_PER_ENTRY*i + 1));
-        }
-        memcpy(&meshMainStruct.RouteTable, data->data + COMMAND_SIZE, size);
-        xSemaphoreGive(meshMainStruct.routeTableLock);
     }
     else if (data->data[0] == CMD_KEYPRESSED)
     {
@@ -83,104 +84,470 @@ void static MeshReceiveCb(mesh_addr_t* from, mesh_data_t* data)
         }
         ESP_LOGW(MESH_TAG, "Keypressed detected on node: " MACSTR_FMT, MAC2STR(data->data + COMMAND_SIZE));
     }
+#if CONFIG_MESH_PROBE
+    else if (MESH_PROBE_IS_CMD(data->data[0]))
+    {
+        if (meshProbeReceive(from, data) != ESP_OK)
+        {
+            ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+        }
+    }
+#endif
+#if CONFIG_MESH_BENCH
+    else if (MESH_BENCH_IS_CMD(data->data[0]))
+    {
+        if (meshBenchReceive(from, data) != ESP_OK)
+        {
+            ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+        }
+    }
+#endif
+#if CONFIG_MESH_OTA
+    else if (MESH_OTA_IS_CMD(data->data[0]))
+    {
+        if (meshOtaReceive(from, data) != ESP_OK)
+        {
+            ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+        }
+    }
+#endif
+#if CONFIG_MESH_LEASES
+    else if (MESH_LEASE_IS_CMD(data->data[0]))
+    {
+        if (meshLeaseReceive(from, data) != ESP_OK)
+        {
+            ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+        }
+    }
+#endif
+#if CONFIG_MESH_MQTT_GATEWAY
+    else if (MQTT_APP_IS_CMD(data->data[0]))
+    {
+        if (MQTT_AppMeshReceive(from, data) != ESP_OK)
+        {
+            ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Invalid MQTT gateway message");
+        }
+    }
+#endif
     else
     {
         ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unknown command");
     }
 }
 
-static void CheckButton(void* args)
+static meshTrafficClass_t MeshClassifyCb(const mesh_data_t* data)
+{
+    if (data->size == 0)
+    {
+        // no command to classify by, MeshReceiveCb() drops it
+        return MESH_TRAFFIC_CONTROL;
+    }
+#if CONFIG_MESH_BENCH
+    // benchmark data must not hold up the workers of the other classes
+    if (data->data[0] == CMD_BENCH_DATA)
+    {
+        return MESH_TRAFFIC_BULK;
+    }
+#endif
+#if CONFIG_MESH_OTA
+    // image chunks are written to flash on the worker of their class
+    if (data->data[0] == CMD_OTA_DATA)
+    {
+        return MESH_TRAFFIC_BULK;
+    }
+#endif
+#if CONFIG_MESH_PROBE
+    // probes measure the latency keypresses see
+    if (MESH_PROBE_IS_CMD(data->data[0]))
+    {
+        return MESH_TRAFFIC_INTERACTIVE;
+    }
+#endif
+#if CONFIG_MESH_MQTT_GATEWAY
+    // the root only queues publishes of the nodes, messages for subscribers run their callbacks
+    if (data->data[0] == CMD_MQTT_PUBLISH)
+    {
+        return MESH_TRAFFIC_BULK;
+    }
+    if (data->data[0] == CMD_MQTT_DATA)
+    {
+        return MESH_TRAFFIC_INTERACTIVE;
+    }
+#endif
+    // keypresses must reach the broker quickly, everything else is mesh control
+    return data->data[0] == CMD_KEYPRESSED ? MESH_TRAFFIC_INTERACTIVE : MESH_TRAFFIC_CONTROL;
+}
+
+#if CONFIG_MESH_BENCH
+static void BenchResultCb(const meshBenchConfig_t* pConfig, const meshBenchLayerResult_t* pLayers, int layers)
+{
+    char text[PUBLISH_LINE_MAX];
+    for (int i = 0; i < layers; i++)
+    {
+        if (pLayers[i].flows == 0)
+        {
+            continue;
+        }
+        uint32_t lost = pLayers[i].sent > pLayers[i].received ? pLayers[i].sent - pLayers[i].received : 0;
+        snprintf(text, sizeof(text),
+                "%s %s size:%u rate:%u layer:%d flows:%u sent:%u lost:%u goodput:%u kbps jitter:%u us",
+                pConfig->path == MESH_BENCH_PATH_IP ? "ip" : "raw",
+                pConfig->direction == MESH_BENCH_DOWN ? "down" : pConfig->direction == MESH_BENCH_PEER ? "peer" : "up",
+                pConfig->size, pConfig->rate, i + 1, pLayers[i].flows, pLayers[i].sent, lost, pLayers[i].goodputKbps,
+                pLayers[i].jitterUs);
+        ESP_LOGI(MESH_TAG, "Benchmark %s", text);
+        MQTT_AppPublish(MQTT_BENCH_RESULT_TOPIC, text);
+    }
+}
+
+static void BenchCommandCb(const char* pData, int len)
+{
+    meshBenchConfig_t config;
+    if (!esp_mesh_is_root())
+    {
+        return;
+    }
+    if (meshBenchParse(pData, len, &config) != ESP_OK)
+    {
+        ESP_LOGW(MESH_TAG, "Invalid benchmark command: %.*s", len, pData);
+        return;
+    }
+    esp_err_t err = meshBenchStart(&config);
+    ESP_LOGI(MESH_TAG, "Starting benchmark: err code: %d", err);
+}
+#endif
+
+#if CONFIG_MESH_OTA
+static void OtaProgressCb(const meshOtaSummary_t* pSummary, const meshOtaNodeProgress_t* pNodes, int count)
+{
+    static const char* states[] = { "idle", "receiving", "done", "failed" };
+    char text[PUBLISH_LINE_MAX];
+    int done = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(text, sizeof(text), MACSTR_FMT " layer:%d state:%s received:%u/%u kbps:%u",
+                MAC2STR(pNodes[i].addr.addr), pNodes[i].layer, states[pNodes[i].state], pNodes[i].received,
+                pSummary->size, pNodes[i].kbps);
+        MQTT_AppPublish(MQTT_OTA_STATUS_TOPIC, text);
+        done += pNodes[i].state == MESH_OTA_DONE;
+    }
+    if (pSummary->err != ESP_OK)
+    {
+        snprintf(text, sizeof(text), "failed download:%u ms size:%u err:%s", pSummary->downloadMs, pSummary->size,
+                esp_err_to_name(pSummary->err));
+        ESP_LOGW(MESH_TAG, "OTA %s", text);
+        MQTT_AppPublish(MQTT_OTA_STATUS_TOPIC, text);
+        return;
+    }
+    snprintf(text, sizeof(text), "%s size:%u download:%u ms nodes:%d done:%d time:%u ms sent:%u bytes broadcasts:%u "
+            "unicasts:%u", pSummary->done ? "end" : "progress", pSummary->size, pSummary->downloadMs, count, done,
+            pSummary->elapsedMs, pSummary->bytesSent, pSummary->broadcasts, pSummary->unicasts);
+    ESP_LOGI(MESH_TAG, "OTA %s", text);
+    MQTT_AppPublish(MQTT_OTA_STATUS_TOPIC, text);
+}
+
+static void OtaCommandCb(const char* pData, int len)
+{
+    char url[256];
+
+    if (!esp_mesh_is_root())
+    {
+        return;
+    }
+    snprintf(url, sizeof(url), "%.*s", len, pData);
+    esp_err_t err = meshOtaStart(url);
+    ESP_LOGI(MESH_TAG, "Starting OTA update from %s: err code: %d", url, err);
+}
+#endif
+
+#if CONFIG_MESH_PROBE
+static void ProbePublishHistogram(const char* pTarget, const meshProbeHistogram_t* pHistogram)
+{
+    char buckets[MESH_PROBE_BUCKETS * 11];
+    char text[PUBLISH_LINE_MAX + sizeof(buckets)];
+    uint8_t myMAC[MESH_ID_SIZE];
+    int len = 0;
+
+    for (int i = 0; i < MESH_PROBE_BUCKETS; i++)
+    {
+        len += snprintf(buckets + len, sizeof(buckets) - len, "%s%u", i ? "," : "", pHistogram->buckets[i]);
+    }
+    esp_wifi_get_mac(WIFI_IF_STA, myMAC);
+    uint32_t received = pHistogram->received;
+    snprintf(text, sizeof(text), MACSTR_FMT " layer:%d %s sent:%u lost:%u min:%u avg:%u max:%u us hist:%s",
+            MAC2STR(myMAC), esp_mesh_get_layer(), pTarget, pHistogram->sent,
+            pHistogram->sent > received ? pHistogram->sent - received : 0,
+            received ? pHistogram->minUs : 0, received ? (uint32_t)(pHistogram->sumUs / received) : 0,
+            pHistogram->maxUs, buckets);
+    ESP_LOGI(MESH_TAG, "Probe %s", text);
+    MQTT_AppPublish(MQTT_PROBE_TOPIC, text);
+}
+
+// Publish the round trip histograms collected since the last call
+static void ProbePublish(void* pArg)
+{
+    static meshProbeStats_t stats; // too large for the stack of the scheduler
+    static const char* names[MESH_PROBE_DESTINATIONS] = { "parent", "root", "nodes" };
+    char target[32];
+
+    meshProbeTakeStats(&stats);
+    for (int i = 0; i < MESH_PROBE_DESTINATIONS; i++)
+    {
+        if (stats.destinations[i].sent)
+        {
+            snprintf(target, sizeof(target), "to:%s " MACSTR_FMT, names[i], MAC2STR(stats.addresses[i].addr));
+            ProbePublishHistogram(i == MESH_PROBE_NODES ? "to:nodes" : target, &stats.destinations[i]);
+        }
+    }
+    for (int i = 0; i < CONFIG_MESH_MAX_LAYER; i++)
+    {
+        if (stats.layers[i].received)
+        {
+            snprintf(target, sizeof(target), "to:layer%d", i + 1);
+            ProbePublishHistogram(target, &stats.layers[i]);
+        }
+    }
+}
+#endif
+
+#if CONFIG_MESH_TRACE
+static meshSchedJob_t traceJob = MESH_SCHED_JOB_NONE;
+
+static void TraceCommandCb(const char* pData, int len)
+{
+    // the dump is published from the scheduler, not from the client's event handler
+    meshSchedTrigger(traceJob);
+}
+
+static void TracePublishLine(const char* pLine, void* pContext)
+{
+    // static, the dump already holds a line on the stack of the scheduler and runs once at a time
+    static char text[MESH_ID_SIZE * 3 + MESH_TRACE_LINE_MAX];
+
+    snprintf(text, sizeof(text), "%s %s", (const char*)pContext, pLine);
+    MQTT_AppPublish(MQTT_TRACE_DATA_TOPIC, text);
+    // a dump is dozens of lines, paced so they do not overflow the tx queue of the mesh netif
+    vTaskDelay(TRACE_LINE_DELAY_ms / portTICK_RATE_MS);
+}
+
+// Publish the trace rings, every line is prefixed with the MAC address of this device
+static void TracePublish(void* pArg)
+{
+    uint8_t myMAC[MESH_ID_SIZE];
+    char prefix[18];
+
+    esp_wifi_get_mac(WIFI_IF_STA, myMAC);
+    snprintf(prefix, sizeof(prefix), MACSTR_FMT, MAC2STR(myMAC));
+    int events = meshTraceDump(TracePublishLine, prefix);
+    ESP_LOGI(MESH_TAG, "Published %d trace events", events);
+}
+#endif
+
+#if CONFIG_MESH_METRICS
+static void MetricsPublish(void* pArg)
+{
+    char* pSnapshot = malloc(MESH_METRICS_SNAPSHOT_MAX);
+    if (pSnapshot == NULL)
+    {
+        ESP_LOGW(MESH_TAG, "No memory for the metrics snapshot");
+        return;
+    }
+    meshMetricsSnapshot(pSnapshot, MESH_METRICS_SNAPSHOT_MAX);
+    MQTT_AppPublish(MQTT_METRICS_TOPIC, pSnapshot);
+    free(pSnapshot);
+}
+
+static meshSchedJob_t metricsJob = MESH_SCHED_JOB_NONE;
+#endif
+
+// Commands sent to this device on its MQTT command topic, answered from the scheduler
+static void CommandCb(const char* pData, int len)
+{
+#if CONFIG_MESH_METRICS
+    if (len == strlen("metrics") && strncmp(pData, "metrics", len) == 0)
+    {
+        meshSchedTrigger(metricsJob);
+        return;
+    }
+#endif
+#if CONFIG_MESH_TRACE
+    if (len == strlen("trace") && strncmp(pData, "trace", len) == 0)
+    {
+        meshSchedTrigger(traceJob);
+        return;
+    }
+#endif
+    ESP_LOGW(MESH_TAG, "Unknown command %.*s", len, pData);
+}
+
+// Publish a record of mesh_telemetry.h, or its text with CONFIG_MESH_TELEMETRY_TEXT. Records are built on the
+// stack; a publish queued for the root takes a gateway slot, only one kept in the store is copied to the heap.
+static void TelemetryPublish(const char* pTopic, const uint8_t* pRecord, size_t len)
+{
+#if CONFIG_MESH_TELEMETRY_TEXT
+    char text[MESH_TELEMETRY_TEXT_MAX];
+    meshTelemetryFormat(pRecord, len, text, sizeof(text));
+    MQTT_AppPublish(pTopic, text);
+#else
+    MQTT_AppPublishData(pTopic, pRecord, len);
+#endif
+}
+
+// Runs on a falling edge of the button with its interrupt, every BUTTON_POLL_PERIOD_ms without
+static void ButtonJob(void* pArg)
 {
     static bool oldLevel = true;
-    bool runCheckButton = true;
-    initialiseButton();
-    while (runCheckButton)
-    {
-        bool newLevel = gpio_get_level(EXAMPLE_BUTTON_GPIO);
-        if (!newLevel && oldLevel)
-        {
-            if (meshMainStruct.RouteTableSize && !esp_mesh_is_root())
-            {
-                ESP_LOGW(MESH_TAG, "Key pressed!");
-                mesh_data_t data;
-                uint8_t* pMyMAC = meshNetifGetStationMAC();
-                uint8_t txData[COMMAND_SIZE + CMD_KEYPRESSED_PAYLOAD_SIZE] = { CMD_KEYPRESSED, };
-                char MAC_String[MACSTR_LEN];
-                memcpy(txData + COMMAND_SIZE, pMyMAC, CMD_KEYPRESSED_PAYLOAD_SIZE);
-                data.size = sizeof(txData);
-                data.proto = MESH_PROTO_BIN;
-                data.tos = MESH_TOS_P2P;
-                data.data = txData;
-
-                snprintf(MAC_String, sizeof(MAC_String), MACSTR_FMT, MAC2STR(pMyMAC));
-                MQTT_AppPublish(MQTT_BUTTON_TOPIC, MAC_String);
-
-                xSemaphoreTake(meshMainStruct.routeTableLock, portMAX_DELAY);
-                for (int i = 0; i < meshMainStruct.RouteTableSize; i++)
-                {
-                    if (MAC_ADDR_EQUAL(meshMainStruct.RouteTable[i].addr, pMyMAC))
-                    {
-                        continue;
-                    }
-                    esp_err_t err = esp_mesh_send(&meshMainStruct.RouteTable[i], &data, MESH_DATA_P2P, NULL, 0);
-                    ESP_LOGI(MESH_TAG, "Sending to [%d] " MACSTR_FMT ": sent with err code: %d", i,
-                            MAC2STR(meshMainStruct.RouteTable[i].addr), err);
-                }
-                xSemaphoreGive(meshMainStruct.routeTableLock);
-            }
-        }
-        oldLevel = newLevel;
-        vTaskDelay(BUTTON_POLL_PERIOD_ms / portTICK_PERIOD_MS);
-    }
-    vTaskDelete(NULL);
+    static int64_t pressUs = -BUTTON_DEBOUNCE_us;
+    bool newLevel = gpio_get_level(EXAMPLE_BUTTON_GPIO);
+    int64_t nowUs = esp_timer_get_time();
+    // with the interrupt the edge was seen already, the level may have bounced back since
+    bool pressed = buttonInterrupt ? nowUs - pressUs >= BUTTON_DEBOUNCE_us : !newLevel && oldLevel;
+
+    oldLevel = newLevel;
+    if (!pressed)
+    {
+        return;
+    }
+    pressUs = nowUs;
+    const mesh_addr_t* pRouteTable;
+    int routeTableSize;
+    meshNetifGetRoutingTable(&pRouteTable, &routeTableSize);
+    meshNetifReleaseRoutingTable(pRouteTable);
+    if (routeTableSize && !esp_mesh_is_root())
+    {
+        ESP_LOGW(MESH_TAG, "Key pressed!");
+        mesh_data_t data;
+        uint8_t* pMyMAC = meshNetifGetStationMAC();
+        uint8_t txData[COMMAND_SIZE + CMD_KEYPRESSED_PAYLOAD_SIZE] = { CMD_KEYPRESSED, };
+        uint8_t record[MESH_TELEMETRY_KEYPRESS_LEN];
+        memcpy(txData + COMMAND_SIZE, pMyMAC, CMD_KEYPRESSED_PAYLOAD_SIZE);
+        data.size = sizeof(txData);
+        data.proto = MESH_PROTO_BIN;
+        data.tos = MESH_TOS_P2P;
+        data.data = txData;
+
+        TelemetryPublish(MQTT_BUTTON_TOPIC, record, meshTelemetryKeypress(record, pMyMAC));
+
+        esp_err_t err = meshNetifSendRaw(NULL, &data, MESH_TRAFFIC_INTERACTIVE);
+        ESP_LOGI(MESH_TAG, "Broadcasting keypress: sent with err code: %d", err);
+    }
 }
 
-void EspMeshMQTT_Task(void* arg)
+static void StatusJob(void* pArg)
 {
-    char* pPrintBuffer;
-    mesh_data_t data;
-    esp_err_t err;
-    MQTT_AppStart();
-    while (1)
-    {
-        asprintf(&pPrintBuffer, "layer:%d IP:" IPSTR, esp_mesh_get_layer(), IP2STR(&meshMainStruct.currentIp));
-        ESP_LOGI(MESH_TAG, "Tried to publish %s", pPrintBuffer);
-        MQTT_AppPublish("/topic/ip_mesh", pPrintBuffer);
-        free(pPrintBuffer);
-        if (esp_mesh_is_root())
-        {
-            esp_mesh_get_routing_table((mesh_addr_t*) &meshMainStruct.RouteTable, CONFIG_MESH_ROUTE_TABLE_SIZE * 6,
-                    &meshMainStruct.RouteTableSize);
-            data.size = meshMainStruct.RouteTableSize * 6 + 1;
-            data.proto = MESH_PROTO_BIN;
-            data.tos = MESH_TOS_P2P;
-            meshMainStruct.MeshTxPayload[0] = CMD_ROUTE_TABLE;
-            memcpy(meshMainStruct.MeshTxPayload + 1, meshMainStruct.RouteTable, meshMainStruct.RouteTableSize * 6);
-            data.data = meshMainStruct.MeshTxPayload;
-            for (int i = 0; i < meshMainStruct.RouteTableSize; i++)
-            {
-                err = esp_mesh_send(&meshMainStruct.RouteTable[i], &data, MESH_DATA_P2P, NULL, 0);
-                ESP_LOGI(MESH_TAG, "Sending routing table to [%d] " MACSTR_FMT ": sent with err code: %d", i,
-                        MAC2STR(meshMainStruct.RouteTable[i].addr), err);
-            }
-        }
-        vTaskDelay(2 * 1000 / portTICK_RATE_MS);
-    }
-    vTaskDelete(NULL);
+    uint8_t record[MESH_TELEMETRY_STATUS_LEN];
+    meshNetifBroadcastStats_t broadcastStats;
+    meshRouteStats_t routeStats;
+    meshTxStats_t txStats[MESH_TRAFFIC_CLASS_MAX];
+    meshNetifRxStats_t rxStats[MESH_TRAFFIC_CLASS_MAX];
+#if CONFIG_MESH_BENCH_AUTOSTART
+    static bool benchStarted = false;
+
+    if (!benchStarted && esp_mesh_is_root()
+            && esp_timer_get_time() >= CONFIG_MESH_BENCH_AUTOSTART_DELAY_S * 1000000LL)
+    {
+        meshBenchConfig_t benchConfig;
+        meshBenchParse("", 0, &benchConfig);
+        benchStarted = meshBenchStart(&benchConfig) == ESP_OK;
+    }
+#endif
+    meshNetifGetBroadcastStats(&broadcastStats);
+    ESP_LOGD(MESH_TAG, "Broadcasts: %u, mesh sends: %u, errors: %u", broadcastStats.broadcasts,
+            broadcastStats.sends, broadcastStats.errors);
+    if (meshNetifGetTxStats(txStats) == ESP_OK)
+    {
+        meshNetifGetRxStats(rxStats);
+        for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+        {
+            ESP_LOGD(MESH_TAG, "Class %d tx sent: %u, dropped: %u, latency avg: %u us, max: %u us, rx: %u",
+                    i, txStats[i].sent, txStats[i].dropped, txStats[i].latencyAvgUs, txStats[i].latencyMaxUs,
+                    rxStats[i].packets);
+        }
+    }
+    ESP_LOGI(MESH_TAG, "Tried to publish layer:%d IP:" IPSTR, esp_mesh_get_layer(),
+            IP2STR(&meshMainStruct.currentIp));
+    TelemetryPublish("/topic/ip_mesh", record,
+            meshTelemetryStatus(record, esp_mesh_get_layer(), meshMainStruct.currentIp.addr));
+    // nodes ask for the routing table when they miss a change, the root only sends its version
+    meshRouteHeartbeat();
+    meshRouteGetStats(&routeStats);
+    ESP_LOGD(MESH_TAG, "Routing table version %u, %u entries, sent: %u full, %u deltas, %u heartbeats, %u bytes",
+            routeStats.version, routeStats.size, routeStats.fullSent, routeStats.deltasSent, routeStats.heartbeats,
+            routeStats.bytesSent);
 }
 
-esp_err_t EspMeshCommMQTT_TaskStart(void)
+static void IRAM_ATTR ButtonIsr(void* arg)
 {
-    static bool isCommMQTT_TaskStarted = false;
+    meshSchedTriggerFromISR(buttonJob);
+}
+
+// Returns whether the button interrupt is set up, otherwise the button is polled
+static bool initialiseButton(void)
+{
+    gpio_config_t io_conf = { .pin_bit_mask = BIT64(EXAMPLE_BUTTON_GPIO), .mode = GPIO_MODE_INPUT, .pull_up_en = 1,
+            .intr_type = GPIO_INTR_NEGEDGE };
+    gpio_config(&io_conf);
+    esp_err_t err = gpio_install_isr_service(0);
+    // ESP_ERR_INVALID_STATE: installed by another driver already
+    return (err == ESP_OK || err == ESP_ERR_INVALID_STATE)
+            && gpio_isr_handler_add(EXAMPLE_BUTTON_GPIO, ButtonIsr, NULL) == ESP_OK;
+}
+
+#if CONFIG_MESH_FAST_JOIN
+// Publish how long this device took to join the mesh since its start
+static void JoinPublish(void)
+{
+    static const char* paths[] = { "pending", "scan", "fast", "fallback" };
+    meshJoinStats_t stats;
+    uint8_t myMAC[MESH_ID_SIZE];
+    char text[PUBLISH_LINE_MAX];
+
+    meshJoinGetStats(&stats);
+    esp_wifi_get_mac(WIFI_IF_STA, myMAC);
+    snprintf(text, sizeof(text), MACSTR_FMT " layer:%d path:%s channel:%d parent:%u ms ip:%u ms", MAC2STR(myMAC),
+            esp_mesh_get_layer(), paths[stats.path], stats.channel, stats.parentMs, stats.ipMs);
+    ESP_LOGI(MESH_TAG, "Join %s", text);
+    MQTT_AppPublish(MQTT_JOIN_TOPIC, text);
+}
+#endif
 
-    meshMainStruct.routeTableLock = xSemaphoreCreateMutex();
+// Start MQTT and the periodic jobs of this file once the device has an IP address
+esp_err_t EspMeshCommStart(void)
+{
+    static bool isCommStarted = false;
+    meshSchedJob_t job;
 
-    if (!isCommMQTT_TaskStarted)
+    if (isCommStarted)
     {
-        xTaskCreate(EspMeshMQTT_Task, "mqtt task", 3072, NULL, 5, NULL);
-        xTaskCreate(CheckButton, "check button task", 3072, NULL, 5, NULL);
-        isCommMQTT_TaskStarted = true;
+        return ESP_OK;
     }
+    isCommStarted = true;
+#if CONFIG_MESH_OTA
+    // the device reached the network through the mesh, a new image works
+    meshOtaConfirm();
+#endif
+    MQTT_AppStart();
+#if CONFIG_MESH_FAST_JOIN
+    // waits in the MQTT store until the client is connected
+    JoinPublish();
+#endif
+    ESP_ERROR_CHECK(meshSchedAdd("status", CONFIG_MESH_STATUS_PERIOD_MS, StatusJob, NULL, &job));
+#if CONFIG_MESH_METRICS
+    ESP_ERROR_CHECK(meshSchedAdd("metrics", CONFIG_MESH_METRICS_PUBLISH_S * 1000, MetricsPublish, NULL,
+            &metricsJob));
+#endif
+#if CONFIG_MESH_PROBE
+    ESP_ERROR_CHECK(meshSchedAdd("probe publish", CONFIG_MESH_PROBE_PUBLISH_S * 1000, ProbePublish, NULL, &job));
+#endif
+#if CONFIG_MESH_TRACE
+    ESP_ERROR_CHECK(meshSchedAdd("trace", 0, TracePublish, NULL, &traceJob));
+#endif
+    // the interrupt only triggers the job once it exists
+    buttonInterrupt = initialiseButton();
+    // on its own task, a trace dump or a blocked publish of the other jobs does not delay a keypress
+    ESP_ERROR_CHECK(meshSchedAddInteractive("button", buttonInterrupt ? 0 : BUTTON_POLL_PERIOD_ms, ButtonJob, NULL,
+            &buttonJob));
     return ESP_OK;
 }
 
@@ -196,6 +563,7 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             esp_mesh_get_id(&id);
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_MESH_STARTED>ID:"MACSTR_FMT"", MAC2STR(id.addr));
             meshMainStruct.MeshLayer = esp_mesh_get_layer();
+            meshNetifJoinBroadcastGroup();
             break;
         }
         case MESH_EVENT_STOPPED:
@@ -223,6 +591,7 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             mesh_event_routing_table_change_t* pRoutingTable = (mesh_event_routing_table_change_t*) pEventData;
             ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_ADD>add %d, new:%d", pRoutingTable->rt_size_change,
                     pRoutingTable->rt_size_new);
+            meshStateRoutingTableChanged();
             break;
         }
         case MESH_EVENT_ROUTING_TABLE_REMOVE:
@@ -230,6 +599,7 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             mesh_event_routing_table_change_t* pRoutingTable = (mesh_event_routing_table_change_t*) pEventData;
             ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_REMOVE>remove %d, new:%d", pRoutingTable->rt_size_change,
                     pRoutingTable->rt_size_new);
+            meshStateRoutingTableChanged();
             break;
         }
         case MESH_EVENT_NO_PARENT_FOUND:
@@ -245,12 +615,18 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             esp_mesh_get_id(&id);
             meshMainStruct.MeshLayer = pConnected->self_layer;
             memcpy(&meshMainStruct.MeshParentAddr.addr, pConnected->connected.bssid, 6);
+#if CONFIG_MESH_PROBE
+            meshProbeSetParent(&meshMainStruct.MeshParentAddr);
+#endif
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_PARENT_CONNECTED>layer:%d-->%d, parent:"MACSTR_FMT"%s, ID:"MACSTR_FMT"",
                     lastLayer, meshMainStruct.MeshLayer, MAC2STR(meshMainStruct.MeshParentAddr.addr),
                     esp_mesh_is_root() ? "<ROOT>" : (meshMainStruct.MeshLayer == 2) ? "<layer2>" : "",
                     MAC2STR(id.addr));
             lastLayer = meshMainStruct.MeshLayer;
-            meshNetifsStart(esp_mesh_is_root());
+#if CONFIG_MESH_FAST_JOIN
+            meshJoinConnected(pConnected);
+#endif
+            meshStateParentConnected(esp_mesh_is_root());
             break;
         }
         case MESH_EVENT_PARENT_DISCONNECTED:
@@ -258,7 +634,13 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             mesh_event_disconnected_t* pDisconnected = (mesh_event_disconnected_t*) pEventData;
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d", pDisconnected->reason);
             meshMainStruct.MeshLayer = esp_mesh_get_layer();
-            meshNetifsStop();
+#if CONFIG_MESH_PROBE
+            meshProbeSetParent(NULL);
+#endif
+#if CONFIG_MESH_FAST_JOIN
+            meshJoinDisconnected();
+#endif
+            meshStateParentDisconnected();
             break;
         }
         case MESH_EVENT_LAYER_CHANGE:
@@ -274,6 +656,13 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
         {
             mesh_event_root_address_t* pRootAddress = (mesh_event_root_address_t*) pEventData;
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_ADDRESS>root address:"MACSTR_FMT"", MAC2STR(pRootAddress->addr));
+            meshStateRootAddress(pRootAddress);
+#if CONFIG_MESH_PROBE
+            meshProbeSetRoot(pRootAddress);
+#endif
+#if CONFIG_MESH_MQTT_GATEWAY
+            MQTT_AppSetRoot(pRootAddress);
+#endif
             break;
         }
         case MESH_EVENT_VOTE_STARTED:
@@ -310,6 +699,7 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             // This state indicates right now whether the root is capable of sending packets out.
             mesh_event_toDS_state_t* pToDsState = (mesh_event_toDS_state_t*) pEventData;
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_TODS_REACHABLE>state:%d", *pToDsState);
+            MQTT_AppSetToDS(*pToDsState == MESH_TODS_REACHABLE);
             break;
         }
         case MESH_EVENT_ROOT_FIXED:
@@ -329,6 +719,9 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
         {
             mesh_event_channel_switch_t* pChannelSwitch = (mesh_event_channel_switch_t*) pEventData;
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHANNEL_SWITCH>new channel:%d", pChannelSwitch->channel);
+#if CONFIG_MESH_FAST_JOIN
+            meshJoinNetwork(pChannelSwitch->channel, NULL);
+#endif
             break;
         }
         case MESH_EVENT_SCAN_DONE:
@@ -353,6 +746,9 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             mesh_event_find_network_t* pFindNetwork = (mesh_event_find_network_t*) pEventData;
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_FIND_NETWORK>new channel:%d, router BSSID:"MACSTR_FMT"",
                     pFindNetwork->channel, MAC2STR(pFindNetwork->router_bssid));
+#if CONFIG_MESH_FAST_JOIN
+            meshJoinNetwork(pFindNetwork->channel, pFindNetwork->router_bssid);
+#endif
             break;
         }
         case MESH_EVENT_ROUTER_SWITCH:
@@ -360,6 +756,9 @@ void MeshEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id,
             mesh_event_router_switch_t* pRouterSwitch = (mesh_event_router_switch_t*) pEventData;
             ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROUTER_SWITCH>new router:%s, channel:%d, "MACSTR_FMT"", pRouterSwitch->ssid,
                     pRouterSwitch->channel, MAC2STR(pRouterSwitch->bssid));
+#if CONFIG_MESH_FAST_JOIN
+            meshJoinNetwork(pRouterSwitch->channel, pRouterSwitch->bssid);
+#endif
             break;
         }
         default:
@@ -375,11 +774,14 @@ void ipEventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, vo
     ip_event_got_ip_t* pEvent = (ip_event_got_ip_t*) pEventData;
     ESP_LOGI(MESH_TAG, "<IP_EVENT_STA_GOT_IP>IP:" IPSTR, IP2STR(&pEvent->ip_info.ip));
     meshMainStruct.currentIp.addr = pEvent->ip_info.ip.addr;
+#if CONFIG_MESH_FAST_JOIN
+    meshJoinGotIp();
+#endif
     esp_netif_t* pNetif = pEvent->esp_netif;
     esp_netif_dns_info_t dns;
     ESP_ERROR_CHECK(esp_netif_get_dns_info(pNetif, ESP_NETIF_DNS_MAIN, &dns));
-    meshNetifStartRootAP(esp_mesh_is_root(), dns.ip.u_addr.ip4.addr);
-    EspMeshCommMQTT_TaskStart();
+    meshStateGotIp(esp_mesh_is_root(), dns.ip.u_addr.ip4.addr);
+    EspMeshCommStart();
 }
 
 void app_main(void)
@@ -390,7 +792,32 @@ void app_main(void)
 /*  event initialization */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 /*  crete network interfaces for mesh (only station instance saved for further manipulation, soft AP instance ignored */
+    ESP_ERROR_CHECK(meshRouteInit());
+    ESP_ERROR_CHECK(meshSchedInit());
     ESP_ERROR_CHECK(meshNetifsInit(MeshReceiveCb));
+    meshNetifSetRawClassifier(MeshClassifyCb);
+    ESP_ERROR_CHECK(meshStateInit());
+#if CONFIG_MESH_LEASES
+    ESP_ERROR_CHECK(meshLeaseInit());
+#endif
+#if CONFIG_MESH_PROBE
+    ESP_ERROR_CHECK(meshProbeInit());
+#endif
+#if CONFIG_MESH_BENCH
+    ESP_ERROR_CHECK(meshBenchInit(BenchResultCb));
+    ESP_ERROR_CHECK(MQTT_AppSubscribe(MQTT_BENCH_TOPIC, BenchCommandCb));
+#endif
+#if CONFIG_MESH_TRACE
+    ESP_ERROR_CHECK(MQTT_AppSubscribe(MQTT_TRACE_TOPIC, TraceCommandCb));
+#endif
+#if CONFIG_MESH_OTA
+    ESP_ERROR_CHECK(meshOtaInit(OtaProgressCb));
+    ESP_ERROR_CHECK(MQTT_AppSubscribe(MQTT_OTA_TOPIC, OtaCommandCb));
+#endif
+#if CONFIG_MESH_METRICS
+    ESP_ERROR_CHECK(meshMetricsInit());
+#endif
+    MQTT_AppSetCommandCb(CommandCb);
 
 /*  wifi initialization */
     wifi_init_config_t wifiConfig = WIFI_INIT_CONFIG_DEFAULT()
@@ -418,9 +845,16 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_mesh_set_ap_authmode(CONFIG_MESH_AP_AUTHMODE));
     meshConfig.mesh_ap.max_connection = CONFIG_MESH_AP_CONNECTIONS;
     memcpy((uint8_t*) &meshConfig.mesh_ap.password, CONFIG_MESH_AP_PASSWD, strlen(CONFIG_MESH_AP_PASSWD));
+#if CONFIG_MESH_FAST_JOIN
+/* channel, router and parent of the last boot */
+    ESP_ERROR_CHECK(meshJoinInit(&meshConfig));
+#endif
     ESP_ERROR_CHECK(esp_mesh_set_config(&meshConfig));
 /* mesh start */
     ESP_ERROR_CHECK(esp_mesh_start());
+#if CONFIG_MESH_FAST_JOIN
+    meshJoinStart();
+#endif
     ESP_LOGI(MESH_TAG, "mesh starts successfully, heap:%d, %s\n", esp_get_free_heap_size(),
             esp_mesh_is_root_fixed() ? "root fixed" : "root not fixed");
 }
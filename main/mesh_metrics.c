@@ -0,0 +1,318 @@
+#include "mesh_metrics.h"
+#if CONFIG_MESH_FAST_JOIN
+#include "mesh_join.h"
+#endif
+#if CONFIG_MESH_LEASES
+#include "mesh_lease.h"
+#endif
+#include "mesh_netif.h"
+#include "mesh_route.h"
+#include "mesh_state.h"
+#include "mesh_trace.h"
+#include "mqtt_app.h"
+#if CONFIG_MESH_MQTT_STORE
+#include "mqtt_store.h"
+#endif
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#if CONFIG_MESH_METRICS_CONSOLE
+#include "esp_console.h"
+#endif
+
+#include <stdarg.h> // for va_list
+#include <stdio.h>  // for vsnprintf,printf
+#include <stdlib.h> // for malloc,free
+#include <string.h> // for strcpy,strlen
+
+#define METRICS_TASKS_MAX (32) // tasks listed in a snapshot
+#define METRICS_TRUNCATED "\"truncated\":true}" // closes a snapshot cut after its last complete key
+#define METRICS_SIZE_MIN  (64)
+
+typedef struct
+{
+    char* pBuffer;
+    size_t size;
+    size_t len;
+    size_t complete; // length up to the last complete top level key
+    int depth;       // open objects and arrays
+    bool truncated;
+} metricsWriter_t;
+
+static const char* const metricsProtoNames[MESH_NETIF_PROTOS] = { "bin", "http", "json", "mqtt", "ap", "sta" };
+
+// Appends to the snapshot, room for the truncation marker is kept so a snapshot that does not fit stays valid JSON
+static void metricsAppend(metricsWriter_t* pWriter, const char* pFormat, ...)
+{
+    va_list args;
+    size_t limit = pWriter->size - sizeof("," METRICS_TRUNCATED);
+
+    if (pWriter->truncated)
+    {
+        return;
+    }
+    va_start(args, pFormat);
+    int written = vsnprintf(pWriter->pBuffer + pWriter->len, limit - pWriter->len, pFormat, args);
+    va_end(args);
+    if (written < 0 || pWriter->len + written >= limit)
+    {
+        pWriter->truncated = true;
+        return;
+    }
+    for (int i = 0; i < written; i++)
+    {
+        char c = pWriter->pBuffer[pWriter->len + i];
+        pWriter->depth += (c == '{' || c == '[') - (c == '}' || c == ']');
+    }
+    pWriter->len += written;
+    if (pWriter->depth == 1)
+    {
+        pWriter->complete = pWriter->len;
+    }
+}
+
+// Cuts a truncated snapshot back to its last complete key and closes it
+static size_t metricsFinish(metricsWriter_t* pWriter)
+{
+    if (pWriter->truncated)
+    {
+        // without a complete key the document is only the marker
+        const char* pClose = pWriter->complete ? "," METRICS_TRUNCATED : "{" METRICS_TRUNCATED;
+        strcpy(pWriter->pBuffer + pWriter->complete, pClose);
+        pWriter->len = pWriter->complete + strlen(pClose);
+    }
+    return pWriter->len;
+}
+
+static void metricsAppendTxStats(metricsWriter_t* pWriter, const char* pKey, const meshTxStats_t* pStats)
+{
+    metricsAppend(pWriter, ",\"%s\":[", pKey);
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        metricsAppend(pWriter, "%s[%u,%u,%u,%u,%u,%u]", i ? "," : "", pStats[i].queued, pStats[i].sent,
+                pStats[i].dropped, pStats[i].errors, pStats[i].depth, pStats[i].peakDepth);
+    }
+    metricsAppend(pWriter, "]");
+}
+
+static void metricsAppendTasks(metricsWriter_t* pWriter)
+{
+    metricsAppend(pWriter, ",\"tasks\":{");
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    UBaseType_t count = uxTaskGetNumberOfTasks();
+    count = count < METRICS_TASKS_MAX ? count : METRICS_TASKS_MAX;
+    TaskStatus_t* pTasks = malloc(count * sizeof(TaskStatus_t));
+    if (pTasks)
+    {
+        count = uxTaskGetSystemState(pTasks, count, NULL);
+        for (UBaseType_t i = 0; i < count; i++)
+        {
+            metricsAppend(pWriter, "%s\"%s\":%u", i ? "," : "", pTasks[i].pcTaskName,
+                    (unsigned)pTasks[i].usStackHighWaterMark);
+        }
+        free(pTasks);
+    }
+#else
+    // without the trace facility only the calling task can be looked at
+    metricsAppend(pWriter, "\"%s\":%u", pcTaskGetName(NULL), (unsigned)uxTaskGetStackHighWaterMark(NULL));
+#endif
+    metricsAppend(pWriter, "}");
+}
+
+size_t meshMetricsSnapshot(char* pBuffer, size_t size)
+{
+    metricsWriter_t writer = { .pBuffer = pBuffer, .size = size, .len = 0 };
+    meshNetifProtoStats_t protoStats[MESH_NETIF_PROTOS];
+    meshNetifErrorStats_t errorStats;
+    meshNetifBroadcastStats_t broadcastStats;
+    meshTxStats_t txStats[MESH_TRAFFIC_CLASS_MAX];
+    meshNetifRxStats_t rxStats[MESH_TRAFFIC_CLASS_MAX];
+    meshNetifRxPoolStats_t poolStats;
+    meshNetifFragmentStats_t fragmentStats;
+    meshNetifLinkStats_t linkStats;
+    meshStateStats_t stateStats;
+    meshRouteStats_t routeStats;
+    MQTT_AppStats_t mqttStats;
+#if CONFIG_MESH_MQTT_STORE
+    MQTT_StoreStats_t storeStats;
+#endif
+#if CONFIG_MESH_FAST_JOIN
+    meshJoinStats_t joinStats;
+#endif
+#if CONFIG_MESH_LEASES
+    meshLeaseStats_t leaseStats;
+#endif
+
+    if (size < METRICS_SIZE_MIN)
+    {
+        return 0;
+    }
+    pBuffer[0] = '\0';
+    metricsAppend(&writer, "{\"up\":%u,\"layer\":%d,\"root\":%d", (unsigned)(esp_timer_get_time() / 1000000),
+            esp_mesh_get_layer(), esp_mesh_is_root());
+
+    meshNetifGetProtoStats(protoStats);
+    for (int direction = 0; direction < 2; direction++)
+    {
+        metricsAppend(&writer, ",\"%s\":{", direction ? "tx" : "rx");
+        for (int i = 0; i < MESH_NETIF_PROTOS; i++)
+        {
+            metricsAppend(&writer, "%s\"%s\":[%u,%u]", i ? "," : "", metricsProtoNames[i],
+                    direction ? protoStats[i].txPackets : protoStats[i].rxPackets,
+                    direction ? protoStats[i].txBytes : protoStats[i].rxBytes);
+        }
+        metricsAppend(&writer, "}");
+    }
+
+    meshNetifGetErrorStats(&errorStats);
+    metricsAppend(&writer, ",\"err\":{\"recv\":%u,\"send\":{", errorStats.recvErrors);
+    for (int i = 0, n = 0; i < MESH_NETIF_ERROR_CODES; i++)
+    {
+        if (errorStats.sendErrors[i].code != 0)
+        {
+            metricsAppend(&writer, "%s\"0x%x\":%u", n++ ? "," : "", errorStats.sendErrors[i].code,
+                    errorStats.sendErrors[i].count);
+        }
+    }
+    metricsAppend(&writer, "},\"other\":%u}", errorStats.otherSendErrors);
+
+    meshNetifGetBroadcastStats(&broadcastStats);
+    metricsAppend(&writer, ",\"bc\":[%u,%u,%u,[", broadcastStats.broadcasts, broadcastStats.sends,
+            broadcastStats.errors);
+    for (int i = 0; i < MESH_NETIF_FANOUT_BUCKETS; i++)
+    {
+        metricsAppend(&writer, "%s%u", i ? "," : "", broadcastStats.fanout[i]);
+    }
+    metricsAppend(&writer, "]]");
+
+    if (meshNetifGetTxStats(txStats) == ESP_OK)
+    {
+        metricsAppendTxStats(&writer, "txq", txStats);
+    }
+    if (meshNetifGetRawTxStats(txStats) == ESP_OK)
+    {
+        metricsAppendTxStats(&writer, "rawq", txStats);
+    }
+    meshNetifGetRxStats(rxStats);
+    metricsAppend(&writer, ",\"rxq\":[");
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        metricsAppend(&writer, "%s[%u,%u,%u]", i ? "," : "", rxStats[i].packets, rxStats[i].dropped, rxStats[i].depth);
+    }
+    metricsAppend(&writer, "]");
+
+    meshNetifGetRxPoolStats(&poolStats);
+    metricsAppend(&writer, ",\"pool\":[%u,%u,%u,%u,%u]", poolStats.size, poolStats.inUse,
+            poolStats.peakInUse, poolStats.exhausted, poolStats.dropped);
+    meshNetifGetFragmentStats(&fragmentStats);
+    metricsAppend(&writer, ",\"frag\":[%u,%u,%u,%u,%u]", fragmentStats.fragmentsSent, fragmentStats.fragmentsReceived,
+            fragmentStats.reassembled, fragmentStats.timeouts, fragmentStats.dropped);
+    meshStateGetStats(&stateStats);
+    metricsAppend(&writer, ",\"state\":[%u,%u,%u,%u,%u]", stateStats.events, stateStats.runs, stateStats.debounced,
+            stateStats.lastUs, stateStats.maxUs);
+    meshRouteGetStats(&routeStats);
+    meshNetifGetLinkStats(&linkStats);
+    metricsAppend(&writer, ",\"link\":[%u,%u,%u,%u,%u,%u]", linkStats.connects, linkStats.kept, linkStats.roleChanges,
+            linkStats.renewals, linkStats.firstPacketMs, linkStats.maxFirstPacketMs);
+    metricsAppend(&writer, ",\"route\":[%u,%u]", routeStats.version, routeStats.size);
+    MQTT_AppGetStats(&mqttStats);
+    metricsAppend(&writer, ",\"mqtt\":[%u,%u,%u,%u,%u,%u,%u,%u,%u]", mqttStats.published, mqttStats.publishErrors,
+            mqttStats.received, mqttStats.connects, mqttStats.disconnects, mqttStats.errors, mqttStats.forwarded,
+            mqttStats.delivered, mqttStats.gatewayNodes);
+#if CONFIG_MESH_MQTT_STORE
+    MQTT_StoreGetStats(&storeStats);
+    metricsAppend(&writer, ",\"store\":[%u,%u,%u,%u,%u,%u,%u]", storeStats.records, storeStats.bytes, storeStats.blobs,
+            storeStats.stored, storeStats.replayed, storeStats.dropped, storeStats.spilled);
+#endif
+#if CONFIG_MESH_FAST_JOIN
+    meshJoinGetStats(&joinStats);
+    metricsAppend(&writer, ",\"join\":[%d,%u,%u,%u,%u]", joinStats.path, joinStats.channel, joinStats.parentMs,
+            joinStats.ipMs, joinStats.saves);
+#endif
+#if CONFIG_MESH_LEASES
+    meshLeaseGetStats(&leaseStats);
+    metricsAppend(&writer, ",\"lease\":[%u,%u,%u,%u,%u,%u]", leaseStats.version, leaseStats.size,
+            leaseStats.assigned, leaseStats.moved, leaseStats.applied, leaseStats.dhcp);
+#endif
+    metricsAppend(&writer, ",\"heap\":[%u,%u]", esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
+    metricsAppendTasks(&writer);
+    metricsAppend(&writer, "}");
+    return metricsFinish(&writer);
+}
+
+#if CONFIG_MESH_METRICS_CONSOLE
+static const char* TAG = "mesh_metrics";
+
+static int metricsCommand(int argc, char** argv)
+{
+    char* pBuffer = malloc(MESH_METRICS_SNAPSHOT_MAX);
+
+    if (pBuffer == NULL)
+    {
+        printf("No memory for the snapshot\n");
+        return 1;
+    }
+    meshMetricsSnapshot(pBuffer, MESH_METRICS_SNAPSHOT_MAX);
+    printf("%s\n", pBuffer);
+    free(pBuffer);
+    return 0;
+}
+
+#if CONFIG_MESH_TRACE
+static void traceLinePrint(const char* pLine, void* pContext)
+{
+    printf("%s\n", pLine);
+}
+
+static int traceCommand(int argc, char** argv)
+{
+    printf("%d events\n", meshTraceDump(traceLinePrint, NULL));
+    return 0;
+}
+#endif
+
+static esp_err_t metricsConsoleStart(void)
+{
+    esp_console_repl_t* pRepl = NULL;
+    esp_console_repl_config_t replConfig = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uartConfig = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    const esp_console_cmd_t command = { .command = "metrics", .help = "Print the metrics snapshot as JSON",
+            .func = metricsCommand };
+
+    replConfig.prompt = "mesh>";
+    esp_err_t err = esp_console_new_repl_uart(&uartConfig, &replConfig, &pRepl);
+    if (err == ESP_OK)
+    {
+        err = esp_console_cmd_register(&command);
+    }
+#if CONFIG_MESH_TRACE
+    const esp_console_cmd_t trace = { .command = "trace", .help = "Dump the trace rings for mesh_trace_decode",
+            .func = traceCommand };
+    if (err == ESP_OK)
+    {
+        err = esp_console_cmd_register(&trace);
+    }
+#endif
+    if (err == ESP_OK)
+    {
+        err = esp_console_start_repl(pRepl);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Console not started, err code %d %s", err, esp_err_to_name(err));
+    }
+    return err;
+}
+#endif
+
+esp_err_t meshMetricsInit(void)
+{
+#if CONFIG_MESH_METRICS_CONSOLE
+    return metricsConsoleStart();
+#else
+    return ESP_OK;
+#endif
+}
@@ -0,0 +1,285 @@
+#include "mesh_neighbour.h"
+#include "mesh_eth.h"
+#include "mesh_netif.h"
+
+#include "esp_log.h"
+
+#include <string.h> // for memcpy,memcmp,memset
+
+// Open addressing hash table keyed by IP, sized for the whole routing table at a low load factor
+#define NEIGHBOUR_TABLE_SIZE (512u)
+#define NEIGHBOUR_EXPIRE_ms  (20 * 60 * 1000)
+
+#define ARP_OP_OFFSET     (ETH_HDR_LEN + 6)
+#define ARP_SHA_OFFSET    (ETH_HDR_LEN + 8)
+#define ARP_SPA_OFFSET    (ETH_HDR_LEN + 14)
+#define ARP_THA_OFFSET    (ETH_HDR_LEN + 18)
+#define ARP_TPA_OFFSET    (ETH_HDR_LEN + 24)
+#define ARP_OP_REQUEST    (1u)
+#define ARP_OP_REPLY      (2u)
+
+#define DHCP_YIADDR_OFFSET (16u)
+#define DHCP_CHADDR_OFFSET (28u)
+#define DHCP_OPTIONS_OFFSET (240u) // after the magic cookie
+#define DHCP_OPTION_PAD   (0u)
+#define DHCP_OPTION_MSG_TYPE (53u)
+#define DHCP_OPTION_END   (255u)
+#define DHCP_MSG_ACK      (5u)
+
+typedef struct
+{
+    uint32_t ip;       // network byte order, 0 marks a never used slot
+    TickType_t lastSeen;
+    uint8_t mac[MAC_ADDR_LEN];
+} neighbourEntry_t;
+
+static const char* TAG = "mesh_neighbour";
+static neighbourEntry_t neighbourTable[NEIGHBOUR_TABLE_SIZE] = { 0 };
+static portMUX_TYPE neighbourLock = portMUX_INITIALIZER_UNLOCKED;
+static meshNeighbourStats_t neighbourStats = { 0 };
+
+static inline uint32_t neighbourHash(uint32_t ip)
+{
+    ip ^= ip >> 16;
+    ip *= 0x45d9f3bu;
+    ip ^= ip >> 16;
+    return ip & (NEIGHBOUR_TABLE_SIZE - 1);
+}
+
+static inline bool neighbourExpired(const neighbourEntry_t* pEntry, TickType_t now)
+{
+    return (now - pEntry->lastSeen) > pdMS_TO_TICKS(NEIGHBOUR_EXPIRE_ms);
+}
+
+void meshNeighbourClear(void)
+{
+    portENTER_CRITICAL(&neighbourLock);
+    memset(neighbourTable, 0, sizeof(neighbourTable));
+    neighbourStats.entries = 0;
+    portEXIT_CRITICAL(&neighbourLock);
+}
+
+void meshNeighbourLearn(const uint8_t* pMac, uint32_t ip)
+{
+    TickType_t now = xTaskGetTickCount();
+    uint32_t index = neighbourHash(ip);
+    neighbourEntry_t* pFree = NULL;
+
+    if (ip == 0 || ip == 0xFFFFFFFFu)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&neighbourLock);
+    for (uint32_t probe = 0; probe < NEIGHBOUR_TABLE_SIZE; probe++)
+    {
+        neighbourEntry_t* pEntry = &neighbourTable[(index + probe) & (NEIGHBOUR_TABLE_SIZE - 1)];
+        if (pEntry->ip == ip)
+        {
+            if (memcmp(pEntry->mac, pMac, MAC_ADDR_LEN) != 0)
+            {
+                memcpy(pEntry->mac, pMac, MAC_ADDR_LEN);
+                neighbourStats.learned++;
+            }
+            pEntry->lastSeen = now;
+            portEXIT_CRITICAL(&neighbourLock);
+            return;
+        }
+        if (pEntry->ip == 0)
+        {
+            if (pFree == NULL)
+            {
+                pFree = pEntry;
+                neighbourStats.entries++;
+            }
+            break;
+        }
+        if (pFree == NULL && neighbourExpired(pEntry, now))
+        {
+            // reuse an expired slot, it stays occupied so probe chains are not broken
+            pFree = pEntry;
+        }
+    }
+    if (pFree)
+    {
+        pFree->ip = ip;
+        pFree->lastSeen = now;
+        memcpy(pFree->mac, pMac, MAC_ADDR_LEN);
+        neighbourStats.learned++;
+    }
+    portEXIT_CRITICAL(&neighbourLock);
+}
+
+bool meshNeighbourLookup(uint32_t ip, uint8_t* pMac)
+{
+    TickType_t now = xTaskGetTickCount();
+    uint32_t index = neighbourHash(ip);
+    bool found = false;
+
+    portENTER_CRITICAL(&neighbourLock);
+    for (uint32_t probe = 0; probe < NEIGHBOUR_TABLE_SIZE; probe++)
+    {
+        const neighbourEntry_t* pEntry = &neighbourTable[(index + probe) & (NEIGHBOUR_TABLE_SIZE - 1)];
+        if (pEntry->ip == 0)
+        {
+            break;
+        }
+        if (pEntry->ip == ip)
+        {
+            found = !neighbourExpired(pEntry, now);
+            if (found && pMac)
+            {
+                memcpy(pMac, pEntry->mac, MAC_ADDR_LEN);
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&neighbourLock);
+    return found;
+}
+
+// Returns pointer to the BOOTP header of a DHCP message with the given source port, NULL otherwise
+static const uint8_t* getDhcp(const uint8_t* pFrame, size_t len, uint16_t srcPort, size_t* pDhcpLen)
+{
+    if (len < ETH_HDR_LEN + IP_MIN_HDR_LEN || GET_BE16(pFrame + ETH_TYPE_OFFSET) != ETH_TYPE_IP
+            || pFrame[IP_PROTO_OFFSET] != IP_PROTO_UDP)
+    {
+        return NULL;
+    }
+    size_t ipHdrLen = (pFrame[ETH_HDR_LEN] & 0x0F) * 4;
+    const uint8_t* pUdp = pFrame + ETH_HDR_LEN + ipHdrLen;
+    size_t udpOffset = ETH_HDR_LEN + ipHdrLen;
+    if (len < udpOffset + UDP_HDR_LEN + DHCP_OPTIONS_OFFSET || GET_BE16(pUdp) != srcPort)
+    {
+        return NULL;
+    }
+    *pDhcpLen = len - udpOffset - UDP_HDR_LEN;
+    return pUdp + UDP_HDR_LEN;
+}
+
+static uint8_t getDhcpMessageType(const uint8_t* pDhcp, size_t len)
+{
+    size_t i = DHCP_OPTIONS_OFFSET;
+    while (i < len && pDhcp[i] != DHCP_OPTION_END)
+    {
+        if (pDhcp[i] == DHCP_OPTION_PAD)
+        {
+            i++;
+            continue;
+        }
+        if (i + 2 >= len)
+        {
+            break;
+        }
+        if (pDhcp[i] == DHCP_OPTION_MSG_TYPE)
+        {
+            return pDhcp[i + 2];
+        }
+        i += 2 + pDhcp[i + 1];
+    }
+    return 0;
+}
+
+void meshNeighbourSnoop(const uint8_t* pFrame, size_t len, bool fromNode)
+{
+    if (len < ETH_HDR_LEN)
+    {
+        return;
+    }
+    uint16_t type = GET_BE16(pFrame + ETH_TYPE_OFFSET);
+    if (fromNode && type == ETH_TYPE_ARP && len >= MESH_NEIGHBOUR_ARP_FRAME_SIZE)
+    {
+        uint32_t senderIp;
+        memcpy(&senderIp, pFrame + ARP_SPA_OFFSET, sizeof(senderIp));
+        meshNeighbourLearn(pFrame + ARP_SHA_OFFSET, senderIp);
+    }
+    else if (fromNode && type == ETH_TYPE_IP && len >= ETH_HDR_LEN + IP_MIN_HDR_LEN)
+    {
+        uint32_t srcIp;
+        memcpy(&srcIp, pFrame + IP_SRC_OFFSET, sizeof(srcIp));
+        // source MAC of the ethernet header, nodes never forward frames of other hosts
+        meshNeighbourLearn(pFrame + MAC_ADDR_LEN, srcIp);
+    }
+    else if (!fromNode)
+    {
+        size_t dhcpLen;
+        const uint8_t* pDhcp = getDhcp(pFrame, len, DHCP_SERVER_PORT, &dhcpLen);
+        if (pDhcp && getDhcpMessageType(pDhcp, dhcpLen) == DHCP_MSG_ACK)
+        {
+            uint32_t yourIp;
+            memcpy(&yourIp, pDhcp + DHCP_YIADDR_OFFSET, sizeof(yourIp));
+            ESP_LOGD(TAG, "DHCP lease " MACSTR " -> " IPSTR, MAC2STR(pDhcp + DHCP_CHADDR_OFFSET),
+                    IP2STR((esp_ip4_addr_t*)&yourIp));
+            meshNeighbourLearn(pDhcp + DHCP_CHADDR_OFFSET, yourIp);
+        }
+    }
+}
+
+bool meshNeighbourArpRequestTarget(const uint8_t* pFrame, size_t len, uint32_t* pIp)
+{
+    if (len < MESH_NEIGHBOUR_ARP_FRAME_SIZE || GET_BE16(pFrame + ETH_TYPE_OFFSET) != ETH_TYPE_ARP
+            || GET_BE16(pFrame + ARP_OP_OFFSET) != ARP_OP_REQUEST)
+    {
+        return false;
+    }
+    // gratuitous ARP announces the sender, nothing to answer
+    if (memcmp(pFrame + ARP_SPA_OFFSET, pFrame + ARP_TPA_OFFSET, sizeof(*pIp)) == 0)
+    {
+        return false;
+    }
+    memcpy(pIp, pFrame + ARP_TPA_OFFSET, sizeof(*pIp));
+    return true;
+}
+
+size_t meshNeighbourArpReply(const uint8_t* pFrame, size_t len, uint8_t* pReply)
+{
+    uint8_t targetMac[MAC_ADDR_LEN];
+    uint32_t targetIp;
+
+    if (!meshNeighbourArpRequestTarget(pFrame, len, &targetIp))
+    {
+        return 0;
+    }
+    if (!meshNeighbourLookup(targetIp, targetMac))
+    {
+        __atomic_fetch_add(&neighbourStats.arpMissed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    // the target answering itself would not be proxied
+    if (memcmp(targetMac, pFrame + ARP_SHA_OFFSET, MAC_ADDR_LEN) == 0)
+    {
+        return 0;
+    }
+    // ethernet header: to the requester, from the target
+    memcpy(pReply, pFrame + ARP_SHA_OFFSET, MAC_ADDR_LEN);
+    memcpy(pReply + MAC_ADDR_LEN, targetMac, MAC_ADDR_LEN);
+    // hardware/protocol types and sizes are the same as in the request
+    memcpy(pReply + ETH_TYPE_OFFSET, pFrame + ETH_TYPE_OFFSET, ARP_OP_OFFSET - ETH_TYPE_OFFSET);
+    pReply[ARP_OP_OFFSET] = 0;
+    pReply[ARP_OP_OFFSET + 1] = ARP_OP_REPLY;
+    memcpy(pReply + ARP_SHA_OFFSET, targetMac, MAC_ADDR_LEN);
+    memcpy(pReply + ARP_SPA_OFFSET, &targetIp, sizeof(targetIp));
+    memcpy(pReply + ARP_THA_OFFSET, pFrame + ARP_SHA_OFFSET, MAC_ADDR_LEN);
+    memcpy(pReply + ARP_TPA_OFFSET, pFrame + ARP_SPA_OFFSET, sizeof(targetIp));
+    __atomic_fetch_add(&neighbourStats.arpAnswered, 1, __ATOMIC_RELAXED);
+    return MESH_NEIGHBOUR_ARP_FRAME_SIZE;
+}
+
+bool meshNeighbourDhcpClient(const uint8_t* pFrame, size_t len, uint8_t* pMac)
+{
+    size_t dhcpLen;
+    const uint8_t* pDhcp = getDhcp(pFrame, len, DHCP_SERVER_PORT, &dhcpLen);
+    if (pDhcp == NULL || GET_BE16(pFrame + ETH_HDR_LEN + (pFrame[ETH_HDR_LEN] & 0x0F) * 4 + 2) != DHCP_CLIENT_PORT)
+    {
+        return false;
+    }
+    memcpy(pMac, pDhcp + DHCP_CHADDR_OFFSET, MAC_ADDR_LEN);
+    __atomic_fetch_add(&neighbourStats.dhcpDirected, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void meshNeighbourGetStats(meshNeighbourStats_t* pStats)
+{
+    portENTER_CRITICAL(&neighbourLock);
+    *pStats = neighbourStats;
+    portEXIT_CRITICAL(&neighbourLock);
+}
@@ -1,20 +1,82 @@
 #include "mesh_netif.h"
+#include "mesh_eth.h"
+#include "mesh_neighbour.h"
+#include "mesh_trace.h"
+#include "mesh_tx.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi_netif.h"
 #include "lwip/lwip_napt.h"
 
 #include <string.h>  // for memcpy,memcmp
 
 #define RX_SIZE      (1560)
+#define RX_POOL_SIZE (CONFIG_MESH_NETIF_RX_POOL_SIZE)
+#define RX_POOL_WAIT_MS (100) // longest wait of the receive task for lwIP to return a buffer
+#define RX_CLASS_QUEUE_LEN (4)
+#define RX_TASK_PRIORITY             (5)
+#define RX_INTERACTIVE_TASK_PRIORITY (6)
+#define RX_CONTROL_TASK_PRIORITY     (7)
+#define RAW_TX_WAIT_ms (100)
+#define RAW_MAX_SIZE (CONFIG_MESH_RAW_MAX_SIZE)
+#define RAW_REASSEMBLY_SLOTS (CONFIG_MESH_RAW_REASSEMBLY_SLOTS)
+#define RAW_REASSEMBLY_TIMEOUT_us (2000 * 1000)
+#define RAW_FRAGMENT_HDR_LEN (1 + 2 + 2 + 2) // <MESH_NETIF_RAW_FRAGMENT> <id:2> <offset:2> <total:2>, big endian
+#define RAW_FRAGMENT_PAYLOAD (MESH_MPS - RAW_FRAGMENT_HDR_LEN)
+#define INTERACTIVE_MAX_LEN (CONFIG_MESH_TRAFFIC_INTERACTIVE_MAX_LEN)
+#define ROUTE_INDEX_SIZE (1024) // power of two, at least twice CONFIG_MESH_ROUTE_TABLE_SIZE
 
 
 
 typedef struct{
     esp_netif_driver_base_t base;
     uint8_t sta_mac_addr[MAC_ADDR_LEN];
+    meshTxQueue_t* pTxQueue;
 }meshNetifDriver;
 
+// Fixed pool of receive buffers, filled by esp_mesh_recv() and owned by lwIP until returned in MeshFree()
+typedef struct{
+    QueueHandle_t freeQueue;
+    uint32_t peakInUse;
+    uint32_t exhausted;
+    uint32_t dropped;
+    uint8_t buffers[RX_POOL_SIZE][RX_SIZE];
+}meshNetifRxPool;
+
+// Versioned copy of the mesh routing table, rebuilt only on routing table events
+typedef struct{
+    uint32_t version;
+    int size;
+    int selfIndex;// index of our own station address in entries, -1 if not present
+    mesh_addr_t entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    int16_t index[ROUTE_INDEX_SIZE];// open addressing hash of entries by MAC, -1 marks an empty slot
+}meshNetifRouteSnapshot;
+
+// Raw message handed from the receive task to the worker of its traffic class
+typedef struct{
+    mesh_addr_t from;
+    mesh_data_t data;
+    uint8_t* pBuffer;
+}meshNetifRxItem;
+
+typedef enum{
+    RAW_SLOT_FREE = 0,
+    RAW_SLOT_ASSEMBLING, // owned by the receive task
+    RAW_SLOT_DELIVERED,  // owned by the worker handling the message until it frees the slot
+}meshNetifRawSlotState;
+
+// Reassembly buffer of a fragmented raw message, fragments must arrive in order
+typedef struct{
+    uint8_t state;
+    mesh_addr_t from;
+    uint16_t id;
+    uint16_t total;
+    uint16_t received;
+    int64_t lastUs;
+    uint8_t data[RAW_MAX_SIZE];
+}meshNetifRawSlot;
+
 static const char* TAG = "mesh_netif";
 const esp_netif_ip_info_t g_mesh_netif_subnet_ip = {// mesh subnet IP info
         .ip = { .addr = ESP_IP4TOADDR(10, 0, 0, 1) }, .gw = { .addr = ESP_IP4TOADDR(10, 0, 0, 1) }, .netmask = { .addr =
@@ -23,8 +85,40 @@ const esp_netif_ip_info_t g_mesh_netif_subnet_ip = {// mesh subnet IP info
 static esp_netif_t* pNetifSta = NULL;
 static esp_netif_t* pNetifAP = NULL;
 static bool receiveTaskIsRunning = false;
-static mesh_addr_t routeTable[CONFIG_MESH_ROUTE_TABLE_SIZE] = { 0 };
+// Double buffered: the event loop fills the inactive snapshot and publishes it with a single pointer store,
+// transmit paths only load the pointer and never take a lock
+static meshNetifRouteSnapshot routeSnapshots[2] = { { .selfIndex = -1, .index = { [0 ... ROUTE_INDEX_SIZE - 1] = -1 } },
+        { .selfIndex = -1, .index = { [0 ... ROUTE_INDEX_SIZE - 1] = -1 } } };
+static meshNetifRouteSnapshot* pRouteSnapshot = &routeSnapshots[0];
+// Getters still using each copy, the event loop rewrites a copy only once its count is back to 0
+static uint32_t routeSnapshotReaders[2] = { 0 };
+// Mesh group every node joins, used as destination for broadcasts
+static const mesh_addr_t meshGroupAll = { .addr = MESH_GROUP_ALL_ADDR };
+static meshNetifBroadcastStats_t broadcastStats = { 0 };
 static mesh_raw_recv_cb_t* pMeshRawReceiveCb = NULL;
+static mesh_raw_class_cb_t* pMeshRawClassCb = NULL;
+static meshNetifRxPool rxPool = { 0 };
+// Control and interactive raw messages have their own workers above the receive task, bulk is handled inline
+static QueueHandle_t rxClassQueues[MESH_TRAFFIC_BULK] = { 0 };
+static meshNetifRxStats_t rxStats[MESH_TRAFFIC_CLASS_MAX] = { 0 };
+static meshTxQueue_t* pRawTxQueue = NULL;
+static meshNetifRawSlot rawSlots[RAW_REASSEMBLY_SLOTS] = { 0 };
+static uint16_t rawTxId = 0;
+static meshNetifFragmentStats_t fragmentStats = { 0 };
+static meshNetifProtoStats_t protoStats[MESH_NETIF_PROTOS] = { 0 };
+static meshNetifErrorStats_t errorStats = { 0 };
+static esp_netif_t* pNetifMeshSta = NULL; // node station over the mesh, kept while root for the next node role
+static bool linkRoleKnown = false;
+static bool linkIsRoot = false;
+static bool linkLeaseKept = false;        // the station kept its address over the last reconnection
+static int64_t linkReconnectUs = 0;       // time of the last reconnection until its first frame, 0 otherwise
+static mesh_addr_t linkRoot;
+static meshNetifLinkStats_t linkStats = { 0 };
+static mesh_address_cb_t* pAddressCb = NULL;
+static bool linkStaticIp = false;         // the node station has a static address or waits for one, DHCP is stopped
+
+static esp_err_t broadcastSend(const mesh_data_t* pData, int flag);
+static esp_err_t meshSend(const mesh_addr_t* pTo, const mesh_data_t* pData, int flag);
 
 //  setup DHCP server's DNS OFFER
 static esp_err_t setDhcpsDNS(esp_netif_t* pNetif, uint32_t addr)
@@ -40,40 +134,515 @@ static esp_err_t setDhcpsDNS(esp_netif_t* pNetif, uint32_t addr)
     return ESP_OK;
 }
 
+static esp_err_t rxPoolInit(void)
+{
+    if (rxPool.freeQueue)
+    {
+        return ESP_OK;
+    }
+    rxPool.freeQueue = xQueueCreate(RX_POOL_SIZE, sizeof(uint8_t*));
+    if (rxPool.freeQueue == NULL)
+    {
+        ESP_LOGE(TAG, "No memory to create the rx pool");
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < RX_POOL_SIZE; i++)
+    {
+        uint8_t* pBuffer = rxPool.buffers[i];
+        xQueueSend(rxPool.freeQueue, &pBuffer, 0);
+    }
+    return ESP_OK;
+}
+
+// Raise the peak of buffers in use after an allocation, buffers are taken from several tasks
+static void rxPoolPeakUpdate(void)
+{
+    uint32_t inUse = RX_POOL_SIZE - uxQueueMessagesWaiting(rxPool.freeQueue);
+    uint32_t peak = __atomic_load_n(&rxPool.peakInUse, __ATOMIC_RELAXED);
+
+    while (inUse > peak
+            && !__atomic_compare_exchange_n(&rxPool.peakInUse, &peak, inUse, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+// Take a free rx buffer, waits up to RX_POOL_WAIT_MS for lwIP to return one if the pool is exhausted
+static uint8_t* rxPoolAlloc(void)
+{
+    uint8_t* pBuffer = NULL;
+    if (xQueueReceive(rxPool.freeQueue, &pBuffer, 0) != pdTRUE)
+    {
+        __atomic_fetch_add(&rxPool.exhausted, 1, __ATOMIC_RELAXED);
+        if (xQueueReceive(rxPool.freeQueue, &pBuffer, pdMS_TO_TICKS(RX_POOL_WAIT_MS)) != pdTRUE)
+        {
+            return NULL;
+        }
+    }
+    rxPoolPeakUpdate();
+    return pBuffer;
+}
+
+#if CONFIG_MESH_ARP_PROXY || CONFIG_MESH_UPLINK_AGGREGATION
+// Take a free rx buffer without waiting, for the tcpip thread which is the one returning them and for frames
+// unpacked by the receive task, which must not stall on each one
+static uint8_t* rxPoolTryAlloc(void)
+{
+    uint8_t* pBuffer = NULL;
+    if (xQueueReceive(rxPool.freeQueue, &pBuffer, 0) != pdTRUE)
+    {
+        __atomic_fetch_add(&rxPool.exhausted, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    rxPoolPeakUpdate();
+    return pBuffer;
+}
+#endif
+
+static void rxPoolFree(uint8_t* pBuffer)
+{
+    if (pBuffer)
+    {
+        xQueueSend(rxPool.freeQueue, &pBuffer, 0);
+    }
+}
+
+#if CONFIG_MESH_ARP_PROXY
+/**
+ * @brief Handle an ARP request of a node for another node without the root's IP stack
+ *
+ * Known addresses are answered from the neighbour cache, with direct forwarding unknown ones
+ * are passed to the other nodes so the owner can answer
+ *
+ * @return true if the frame was consumed
+ */
+static bool proxyArpForNode(const mesh_addr_t* pFrom, mesh_data_t* pData)
+{
+    uint8_t reply[MESH_NEIGHBOUR_ARP_FRAME_SIZE];
+    mesh_data_t replyData = { .data = reply, .proto = MESH_PROTO_STA, .tos = MESH_TOS_P2P };
+
+    replyData.size = meshNeighbourArpReply(pData->data, pData->size, reply);
+    if (replyData.size)
+    {
+        esp_err_t err = meshSend(pFrom, &replyData, MESH_DATA_P2P);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "ARP reply with err code %d %s", err, esp_err_to_name(err));
+        }
+        return true;
+    }
+#if CONFIG_MESH_NODE_DIRECT_FORWARD
+    // requests for the root itself are answered by lwIP, without direct forwarding the owner's reply would go
+    // to the root's AP and be dropped there, so the request is left to lwIP as well
+    uint32_t targetIp;
+    if (meshNeighbourArpRequestTarget(pData->data, pData->size, &targetIp)
+            && targetIp != g_mesh_netif_subnet_ip.ip.addr)
+    {
+        mesh_data_t forward = { .data = pData->data, .size = pData->size, .proto = MESH_PROTO_STA, .tos = MESH_TOS_P2P };
+        meshNetifBroadcast(&forward);
+        return true;
+    }
+#endif
+    return false;
+}
+#endif
+
+// ARP, ICMP, DHCP and TCP segments without payload are control, other small IP packets interactive
+static meshTrafficClass_t ethFrameClass(const uint8_t* pFrame, size_t len)
+{
+    if (len < ETH_HDR_LEN)
+    {
+        return MESH_TRAFFIC_BULK;
+    }
+    uint16_t type = GET_BE16(pFrame + ETH_TYPE_OFFSET);
+    if (type == ETH_TYPE_ARP)
+    {
+        return MESH_TRAFFIC_CONTROL;
+    }
+    if (type != ETH_TYPE_IP || len < ETH_HDR_LEN + IP_MIN_HDR_LEN)
+    {
+        return MESH_TRAFFIC_BULK;
+    }
+    size_t ipHdrLen = (pFrame[ETH_HDR_LEN] & 0x0F) * 4;
+    size_t ipLen = GET_BE16(pFrame + IP_LEN_OFFSET);
+    const uint8_t* pTransport = pFrame + ETH_HDR_LEN + ipHdrLen;
+    switch (pFrame[IP_PROTO_OFFSET])
+    {
+        case IP_PROTO_ICMP:
+            return MESH_TRAFFIC_CONTROL;
+        case IP_PROTO_UDP:
+            if (len >= ETH_HDR_LEN + ipHdrLen + UDP_HDR_LEN
+                    && (GET_BE16(pTransport + 2) == DHCP_SERVER_PORT || GET_BE16(pTransport + 2) == DHCP_CLIENT_PORT))
+            {
+                return MESH_TRAFFIC_CONTROL;
+            }
+            break;
+        case IP_PROTO_TCP:
+            if (len >= ETH_HDR_LEN + ipHdrLen + TCP_MIN_HDR_LEN
+                    && ipLen == ipHdrLen + (pTransport[TCP_DATA_OFFSET] >> 4) * 4)
+            {
+                return MESH_TRAFFIC_CONTROL;
+            }
+            break;
+        default:
+            return MESH_TRAFFIC_BULK;
+    }
+    return ipLen <= INTERACTIVE_MAX_LEN ? MESH_TRAFFIC_INTERACTIVE : MESH_TRAFFIC_BULK;
+}
+
+// Returns a raw message buffer, either to the rx pool or to the reassembly slots
+static void rxRawFree(uint8_t* pBuffer)
+{
+    for (int i = 0; i < RAW_REASSEMBLY_SLOTS; i++)
+    {
+        if (pBuffer == rawSlots[i].data)
+        {
+            __atomic_store_n(&rawSlots[i].state, RAW_SLOT_FREE, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    rxPoolFree(pBuffer);
+}
+
+/**
+ * @brief Add a fragment to the reassembly of its message, called from the receive task only
+ *
+ * Messages not completed within the timeout are dropped, so are messages with a missing fragment
+ *
+ * @return the slot holding the complete message, NULL if the message is not complete yet
+ */
+static meshNetifRawSlot* rxReassemble(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    meshNetifRawSlot* pSlot = NULL;
+    meshNetifRawSlot* pFree = NULL;
+    int64_t now = esp_timer_get_time();
+
+    if (pData->size <= RAW_FRAGMENT_HDR_LEN)
+    {
+        fragmentStats.dropped++;
+        return NULL;
+    }
+    uint16_t id = GET_BE16(pData->data + 1);
+    uint16_t offset = GET_BE16(pData->data + 3);
+    uint16_t total = GET_BE16(pData->data + 5);
+    size_t len = pData->size - RAW_FRAGMENT_HDR_LEN;
+
+    for (int i = 0; i < RAW_REASSEMBLY_SLOTS; i++)
+    {
+        meshNetifRawSlot* pCurrent = &rawSlots[i];
+        uint8_t state = __atomic_load_n(&pCurrent->state, __ATOMIC_ACQUIRE);
+        if (state == RAW_SLOT_ASSEMBLING && now - pCurrent->lastUs > RAW_REASSEMBLY_TIMEOUT_us)
+        {
+            fragmentStats.timeouts++;
+            pCurrent->state = state = RAW_SLOT_FREE;
+        }
+        if (state == RAW_SLOT_ASSEMBLING && pCurrent->id == id && MAC_ADDR_EQUAL(pCurrent->from.addr, pFrom->addr))
+        {
+            pSlot = pCurrent;
+        }
+        else if (state == RAW_SLOT_FREE && pFree == NULL)
+        {
+            pFree = pCurrent;
+        }
+    }
+    if (pSlot == NULL)
+    {
+        if (offset != 0 || pFree == NULL || total > RAW_MAX_SIZE)
+        {
+            fragmentStats.dropped++;
+            return NULL;
+        }
+        pSlot = pFree;
+        pSlot->from = *pFrom;
+        pSlot->id = id;
+        pSlot->total = total;
+        pSlot->received = 0;
+        pSlot->state = RAW_SLOT_ASSEMBLING;
+    }
+    if (offset != pSlot->received || total != pSlot->total || offset + len > total)
+    {
+        // lost or reordered fragment, the message cannot be completed
+        fragmentStats.dropped++;
+        pSlot->state = RAW_SLOT_FREE;
+        return NULL;
+    }
+    memcpy(pSlot->data + offset, pData->data + RAW_FRAGMENT_HDR_LEN, len);
+    pSlot->received += len;
+    pSlot->lastUs = now;
+    fragmentStats.fragmentsReceived++;
+    if (pSlot->received < pSlot->total)
+    {
+        return NULL;
+    }
+    fragmentStats.reassembled++;
+    pSlot->state = RAW_SLOT_DELIVERED;
+    return pSlot;
+}
+
+// Count a failed send under its code, the first sender of a new code claims a free entry
+static void sendErrorCount(esp_err_t err)
+{
+    for (int i = 0; i < MESH_NETIF_ERROR_CODES; i++)
+    {
+        esp_err_t code = __atomic_load_n(&errorStats.sendErrors[i].code, __ATOMIC_RELAXED);
+        if (code == 0)
+        {
+            esp_err_t expected = 0;
+            if (__atomic_compare_exchange_n(&errorStats.sendErrors[i].code, &expected, err, false, __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED))
+            {
+                code = err;
+            }
+            else
+            {
+                code = expected;
+            }
+        }
+        if (code == err)
+        {
+            __atomic_fetch_add(&errorStats.sendErrors[i].count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_fetch_add(&errorStats.otherSendErrors, 1, __ATOMIC_RELAXED);
+}
+
+// Every esp_mesh_send() of the drivers goes through here so traffic and errors are counted
+static esp_err_t meshSend(const mesh_addr_t* pTo, const mesh_data_t* pData, int flag)
+{
+    esp_err_t err = esp_mesh_send(pTo, pData, flag, NULL, 0);
+    MESH_TRACE(MESH_TRACE_SEND, pData->proto, pData->size, err, pTo ? pTo->addr : NULL, NULL);
+    if (err != ESP_OK)
+    {
+        sendErrorCount(err);
+    }
+    else if (pData->proto < MESH_NETIF_PROTOS)
+    {
+        __atomic_fetch_add(&protoStats[pData->proto].txPackets, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&protoStats[pData->proto].txBytes, pData->size, __ATOMIC_RELAXED);
+    }
+    return err;
+}
+
+// Take the time from the last reconnection to the first message received from the mesh
+static void linkDelivered(void)
+{
+    if (__atomic_load_n(&linkReconnectUs, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+    int64_t reconnectUs = __atomic_exchange_n(&linkReconnectUs, 0, __ATOMIC_ACQ_REL);
+    if (reconnectUs == 0)
+    {
+        return;
+    }
+    uint32_t ms = (esp_timer_get_time() - reconnectUs + 999) / 1000;
+    linkStats.firstPacketMs = ms;
+    linkStats.maxFirstPacketMs = ms > linkStats.maxFirstPacketMs ? ms : linkStats.maxFirstPacketMs;
+    ESP_LOGI(TAG, "First packet %u ms after the reconnection", ms);
+}
+
+static void rxStatsCount(meshTrafficClass_t trafficClass, size_t len)
+{
+    __atomic_fetch_add(&rxStats[trafficClass].packets, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rxStats[trafficClass].bytes, len, __ATOMIC_RELAXED);
+}
+
+static void rxClassTask(void* arg)
+{
+    QueueHandle_t queue = arg;
+    meshNetifRxItem item;
+
+    while (1)
+    {
+        xQueueReceive(queue, &item, portMAX_DELAY);
+        if (pMeshRawReceiveCb)
+        {
+            pMeshRawReceiveCb(&item.from, &item.data);
+        }
+        rxRawFree(item.pBuffer);
+    }
+}
+
+static esp_err_t rxClassTasksInit(void)
+{
+    static const char* const names[MESH_TRAFFIC_BULK] = { "netif rx ctrl task", "netif rx event task" };
+    static const UBaseType_t priorities[MESH_TRAFFIC_BULK] = { RX_CONTROL_TASK_PRIORITY, RX_INTERACTIVE_TASK_PRIORITY };
+
+    for (int i = 0; i < MESH_TRAFFIC_BULK; i++)
+    {
+        if (rxClassQueues[i])
+        {
+            continue;
+        }
+        rxClassQueues[i] = xQueueCreate(RX_CLASS_QUEUE_LEN, sizeof(meshNetifRxItem));
+        if (rxClassQueues[i] == NULL
+                || xTaskCreate(rxClassTask, names[i], 3072, rxClassQueues[i], priorities[i], NULL) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to create rx worker for traffic class %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+// Hand a raw message to the worker of its class, takes ownership of the buffer
+static void rxDispatchRaw(const mesh_addr_t* pFrom, const mesh_data_t* pData, uint8_t* pBuffer)
+{
+    meshTrafficClass_t trafficClass = pMeshRawClassCb ? pMeshRawClassCb(pData) : MESH_TRAFFIC_CONTROL;
+    meshNetifRxItem item = { .from = *pFrom, .data = *pData, .pBuffer = pBuffer };
+
+    if (trafficClass >= MESH_TRAFFIC_CLASS_MAX)
+    {
+        trafficClass = MESH_TRAFFIC_BULK;
+    }
+    rxStatsCount(trafficClass, pData->size);
+    if (trafficClass == MESH_TRAFFIC_BULK)
+    {
+        if (pMeshRawReceiveCb)
+        {
+            pMeshRawReceiveCb(&item.from, &item.data);
+        }
+        rxRawFree(pBuffer);
+        return;
+    }
+    if (xQueueSend(rxClassQueues[trafficClass], &item, 0) != pdTRUE)
+    {
+        __atomic_fetch_add(&rxStats[trafficClass].dropped, 1, __ATOMIC_RELAXED);
+        MESH_TRACE(MESH_TRACE_RX_DROP, trafficClass, pData->size, ESP_OK, pFrom->addr, NULL);
+        rxRawFree(pBuffer);
+    }
+}
+
+// Frame from a node's station to the root's AP, takes ownership of the buffer
+static void rxFromNode(const mesh_addr_t* pFrom, mesh_data_t* pData, uint8_t* pBuffer)
+{
+    MESH_TRACE(MESH_TRACE_RX_FROM_NODE, pData->proto, pData->size, ESP_OK, pData->data, pData->data + 6);
+    rxStatsCount(ethFrameClass(pData->data, pData->size), pData->size);
+#if CONFIG_MESH_ARP_PROXY
+    meshNeighbourSnoop(pData->data, pData->size, true);
+    if (proxyArpForNode(pFrom, pData))
+    {
+        rxPoolFree(pBuffer);
+        return;
+    }
+#endif
+    if (pNetifAP)
+    {
+        // actual receive to TCP/IP stack, lwIP returns the buffer through MeshFree()
+        esp_netif_receive(pNetifAP, pData->data, pData->size, pBuffer);
+        return;
+    }
+    rxPoolFree(pBuffer);
+}
+
+#if CONFIG_MESH_UPLINK_AGGREGATION
+// Unpack frames a node packed into one mesh payload, each gets its own pool buffer for lwIP, frames left once
+// the pool is exhausted are dropped
+static void rxFromNodeAggregate(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    const uint8_t* pFrame;
+    size_t frameLen;
+    size_t offset = 0;
+
+    while (meshTxAggregateNext(pData->data, pData->size, &offset, &pFrame, &frameLen))
+    {
+        uint8_t* pBuffer = rxPoolTryAlloc();
+        if (pBuffer == NULL)
+        {
+            uint32_t dropped = 1;
+            while (meshTxAggregateNext(pData->data, pData->size, &offset, &pFrame, &frameLen))
+            {
+                dropped++;
+            }
+            __atomic_fetch_add(&rxPool.dropped, dropped, __ATOMIC_RELAXED);
+            MESH_TRACE(MESH_TRACE_RX_DROP, MESH_TRAFFIC_CLASS_MAX, pData->size, ESP_ERR_NO_MEM, pFrom->addr, NULL);
+            return;
+        }
+        mesh_data_t frame = { .data = pBuffer, .size = frameLen, .proto = pData->proto, .tos = pData->tos };
+        memcpy(pBuffer, pFrame, frameLen);
+        rxFromNode(pFrom, &frame, pBuffer);
+    }
+}
+#endif
+
 static void receiveTask(void* arg)
 {
     esp_err_t err;
     mesh_addr_t from;
     int flag = 0;
     mesh_data_t data;
-    static uint8_t rx_buf[RX_SIZE] = { 0, };
+    uint8_t* pBuffer;
+    // a message arriving while lwIP holds every pool buffer is received here and dropped, so the mesh stack
+    // does not stall behind the tcpip thread
+    static uint8_t dropBuffer[RX_SIZE];
 
     ESP_LOGD(TAG, "Receiving task started");
     while (receiveTaskIsRunning)
     {
-        data.data = rx_buf;
+        pBuffer = rxPoolAlloc();
+        if (pBuffer == NULL)
+        {
+            data.data = dropBuffer;
+            data.size = sizeof(dropBuffer);
+            if (esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, NULL, 0) == ESP_OK)
+            {
+                __atomic_fetch_add(&rxPool.dropped, 1, __ATOMIC_RELAXED);
+                MESH_TRACE(MESH_TRACE_RX_DROP, MESH_TRAFFIC_CLASS_MAX, data.size, ESP_ERR_NO_MEM, from.addr, NULL);
+            }
+            continue;
+        }
+        data.data = pBuffer;
         data.size = RX_SIZE;
         err = esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, NULL, 0);
         if (err != ESP_OK)
         {
+            __atomic_fetch_add(&errorStats.recvErrors, 1, __ATOMIC_RELAXED);
+            MESH_TRACE(MESH_TRACE_RX_ERROR, 0, 0, err, NULL, NULL);
             ESP_LOGE(TAG, "Received with err code %d %s", err, esp_err_to_name(err));
+            rxPoolFree(pBuffer);
             continue;
         }
-        if (data.proto == MESH_PROTO_BIN && pMeshRawReceiveCb)
+        linkDelivered();
+        if (data.proto < MESH_NETIF_PROTOS)
         {
-            pMeshRawReceiveCb(&from, &data);
+            __atomic_fetch_add(&protoStats[data.proto].rxPackets, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&protoStats[data.proto].rxBytes, data.size, __ATOMIC_RELAXED);
+        }
+        if (data.proto == MESH_PROTO_BIN)
+        {
+            if (data.size && data.data[0] == MESH_NETIF_RAW_FRAGMENT)
+            {
+                meshNetifRawSlot* pSlot = rxReassemble(&from, &data);
+                rxPoolFree(pBuffer);
+                if (pSlot)
+                {
+                    mesh_data_t message = { .data = pSlot->data, .size = pSlot->total, .proto = data.proto,
+                            .tos = data.tos };
+                    rxDispatchRaw(&pSlot->from, &message, pSlot->data);
+                }
+                continue;
+            }
+            rxDispatchRaw(&from, &data, pBuffer);
+            continue;
         }
+        // IP frames all go to lwIP from this task, they are only counted per class
         if (esp_mesh_is_root())
         {
             if (data.proto == MESH_PROTO_AP)
             {
-                ESP_LOGD(TAG, "Root received: from: " MACSTR " to " MACSTR " size: %d", MAC2STR((uint8_t*)data.data),
-                        MAC2STR((uint8_t*)(data.data+6)), data.size);
-                if (pNetifAP)
+#if CONFIG_MESH_UPLINK_AGGREGATION
+                size_t offset = 0;
+                const uint8_t* pFrame;
+                size_t frameLen;
+                if (meshTxAggregateNext(data.data, data.size, &offset, &pFrame, &frameLen))
                 {
-                    // actual receive to TCP/IP stack
-                    esp_netif_receive(pNetifAP, data.data, data.size, NULL);
+                    rxFromNodeAggregate(&from, &data);
+                    rxPoolFree(pBuffer);
+                    continue;
                 }
+#endif
+                rxFromNode(&from, &data, pBuffer);
+                continue;
             }
             else if (data.proto == MESH_PROTO_STA)
             {
@@ -88,73 +657,133 @@ static void receiveTask(void* arg)
             }
             else if (data.proto == MESH_PROTO_STA)
             {
-                ESP_LOGD(TAG, "Node received: from: " MACSTR " to " MACSTR " size: %d", MAC2STR((uint8_t*)data.data),
-                        MAC2STR((uint8_t*)(data.data+6)), data.size);
+                MESH_TRACE(MESH_TRACE_RX_FROM_ROOT, data.proto, data.size, ESP_OK, data.data, data.data + 6);
+                rxStatsCount(ethFrameClass(data.data, data.size), data.size);
                 if (pNetifSta)
                 {
-// actual receive to TCP/IP stack
-                    esp_netif_receive(pNetifSta, data.data, data.size, NULL);
+// actual receive to TCP/IP stack, lwIP returns the buffer through MeshFree()
+                    esp_netif_receive(pNetifSta, data.data, data.size, pBuffer);
+                    continue;
                 }
             }
         }
+        rxPoolFree(pBuffer);
     }
     vTaskDelete(NULL);
 }
 
-// Free RX buffer (not used as the buffer is static)
+// Free RX buffer (return it to the rx pool once lwIP is done with it)
 static void MeshFree(void* pDriver, void* pBuffer)
 {
-    free(pBuffer);
+    rxPoolFree(pBuffer);
 }
 
 // Transmit function variants
+// Take the current snapshot, it is not rewritten until routeSnapshotPut()
+static const meshNetifRouteSnapshot* routeSnapshotGet(void)
+{
+    for (;;)
+    {
+        meshNetifRouteSnapshot* pSnapshot = __atomic_load_n(&pRouteSnapshot, __ATOMIC_SEQ_CST);
+        uint32_t* pReaders = &routeSnapshotReaders[pSnapshot - routeSnapshots];
+        __atomic_fetch_add(pReaders, 1, __ATOMIC_SEQ_CST);
+        // the copy may have been swapped out and taken for rewriting before it was counted, retry on the new one
+        if (__atomic_load_n(&pRouteSnapshot, __ATOMIC_SEQ_CST) == pSnapshot)
+        {
+            return pSnapshot;
+        }
+        __atomic_fetch_sub(pReaders, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void routeSnapshotPut(const meshNetifRouteSnapshot* pSnapshot)
+{
+    __atomic_fetch_sub(&routeSnapshotReaders[pSnapshot - routeSnapshots], 1, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t routeIndexHash(const uint8_t* pMac)
+{
+    // the last bytes of a MAC address are the ones that differ between devices
+    uint32_t hash = ((uint32_t)pMac[2] << 24) | ((uint32_t)pMac[3] << 16) | ((uint32_t)pMac[4] << 8) | pMac[5];
+    hash *= 0x9E3779B1u;
+    return (hash >> 16) & (ROUTE_INDEX_SIZE - 1);
+}
+
+// Returns index of the MAC address in the snapshot entries, -1 if not found
+static int routeSnapshotFind(const meshNetifRouteSnapshot* pSnapshot, const uint8_t* pMac)
+{
+    uint32_t slot = routeIndexHash(pMac);
+    for (int probe = 0; probe < ROUTE_INDEX_SIZE; probe++)
+    {
+        int16_t i = pSnapshot->index[(slot + probe) & (ROUTE_INDEX_SIZE - 1)];
+        if (i < 0)
+        {
+            break;
+        }
+        if (MAC_ADDR_EQUAL(pSnapshot->entries[i].addr, pMac))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Called from the sender task of the driver's tx queue
+static esp_err_t txQueueSend(const meshTxInfo_t* pInfo, const mesh_data_t* pData)
+{
+    if (pInfo->broadcast)
+    {
+        return broadcastSend(pData, pInfo->flag & MESH_DATA_NONBLOCK);
+    }
+    return meshSend(pInfo->flag & MESH_DATA_TODS ? NULL : &pInfo->dest, pData, pInfo->flag);
+}
+
+static esp_err_t txQueuePush(meshNetifDriver* pDriver, const meshTxInfo_t* pInfo, void* pBuffer, size_t len)
+{
+    esp_err_t err = meshTxQueuePush(pDriver->pTxQueue, pInfo, pBuffer, len, ethFrameClass(pBuffer, len), 0);
+    if (err != ESP_OK)
+    {
+        // lwIP sees ERR_MEM and backs off instead of waiting for the mesh
+        MESH_TRACE(MESH_TRACE_TX_DROP, pInfo->proto, len, err, pBuffer, (uint8_t*)pBuffer + 6);
+    }
+    return err;
+}
+
 static esp_err_t meshNetifTransmitFromRootAP(void* pDriver, void* pBuffer, size_t len)
 {
     // Use only to transmit data from root AP to node's AP
-    static const uint8_t ethBroadcast[MAC_ADDR_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
-    int routeTableSize = 0;
-    meshNetifDriver* meshDriver = pDriver;
-    mesh_addr_t destAddr;
-    mesh_data_t data;
+    meshNetifDriver* pMeshDriver = pDriver;
+    meshTxInfo_t info = { .flag = MESH_DATA_P2P, .proto = MESH_PROTO_STA, .tos = MESH_TOS_P2P };// root AP -> Node's STA
 
-    ESP_LOGD(TAG, "Sending to node: " MACSTR ", size: %d", MAC2STR((uint8_t*)pBuffer), len);
-    memcpy(destAddr.addr, pBuffer, MAC_ADDR_LEN);
-    data.data = pBuffer;
-    data.size = len;
-    data.proto = MESH_PROTO_STA;// sending from root AP -> Node's STA
-    data.tos = MESH_TOS_P2P;
-    if (MAC_ADDR_EQUAL(destAddr.addr, ethBroadcast))
-    {
-        ESP_LOGD(TAG, "Broadcasting!");
-        esp_mesh_get_routing_table( (mesh_addr_t*) &routeTable,
-                                    CONFIG_MESH_ROUTE_TABLE_SIZE * 6,
-                                    &routeTableSize);
-        for (int i = 0; i < routeTableSize; i++)
-        {
-            if (MAC_ADDR_EQUAL(routeTable[i].addr, meshDriver->sta_mac_addr))
-            {
-                ESP_LOGD(TAG, "That was me, skipping!");
-                continue;
-            }
-            ESP_LOGD(TAG, "Broadcast: Sending to [%d] " MACSTR, i, MAC2STR(routeTable[i].addr));
-            esp_err_t err = esp_mesh_send(&routeTable[i], &data, MESH_DATA_P2P, NULL, 0);
-            if (ESP_OK != err)
+    MESH_TRACE(MESH_TRACE_TX_TO_NODE, info.proto, len, ESP_OK, pBuffer, (uint8_t*)pBuffer + 6);
+    memcpy(info.dest.addr, pBuffer, MAC_ADDR_LEN);
+#if CONFIG_MESH_ARP_PROXY
+    meshNeighbourSnoop(pBuffer, len, false);
+    if (ETH_ADDR_IS_GROUP(info.dest.addr))
+    {
+        uint8_t* pReply = rxPoolTryAlloc();
+        if (pReply)
+        {
+            size_t replyLen = meshNeighbourArpReply(pBuffer, len, pReply);
+            if (replyLen)
             {
-                ESP_LOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
+                // answer our own stack's ARP request for a known node locally
+                esp_netif_receive(pMeshDriver->base.netif, pReply, replyLen, pReply);
+                return ESP_OK;
             }
+            rxPoolFree(pReply);
         }
-    }
-    else
-    {
-        // Standard P2P
-        esp_err_t err = esp_mesh_send(&destAddr, &data, MESH_DATA_P2P, NULL, 0);
-        if (err != ESP_OK)
+        if (meshNeighbourDhcpClient(pBuffer, len, info.dest.addr))
         {
-            ESP_LOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
-            return err;
+            // DHCP offers and acks are broadcast, but only their client needs them
+            MESH_TRACE(MESH_TRACE_TX_DHCP, info.proto, len, ESP_OK, info.dest.addr, NULL);
+            return txQueuePush(pMeshDriver, &info, pBuffer, len);
         }
     }
-    return ESP_OK;
+#endif
+    // Broadcast and multicast frames go to every node, the rest is standard P2P
+    info.broadcast = ETH_ADDR_IS_GROUP(info.dest.addr);
+    return txQueuePush(pMeshDriver, &info, pBuffer, len);
 }
 
 static esp_err_t meshNetifTransmitFromRootAP_Wrap(void* pDriver, void* pBuffer, size_t len, void* pNetstackBuffer)
@@ -164,18 +793,29 @@ static esp_err_t meshNetifTransmitFromRootAP_Wrap(void* pDriver, void* pBuffer,
 
 static esp_err_t meshNetifTransmitFromNodeSta(void* pDriver, void* pBuffer, size_t len)
 {
-    mesh_data_t data;
-    ESP_LOGD(TAG, "Sending to root, dest addr: " MACSTR ", size: %d", MAC2STR((uint8_t*)pBuffer), len);
-    data.data = pBuffer;
-    data.size = len;
-    data.proto = MESH_PROTO_AP;// Node's station transmits data to root's AP
-    data.tos = MESH_TOS_P2P;
-    esp_err_t err = esp_mesh_send(NULL, &data, MESH_DATA_TODS, NULL, 0);
-    if (err != ESP_OK)
+    meshTxInfo_t info = { .tos = MESH_TOS_P2P };
+#if CONFIG_MESH_NODE_DIRECT_FORWARD
+    const meshNetifRouteSnapshot* pSnapshot = routeSnapshotGet();
+    int nodeIndex = ETH_ADDR_IS_GROUP((uint8_t*)pBuffer) ? -1 : routeSnapshotFind(pSnapshot, pBuffer);
+    bool direct = nodeIndex >= 0 && nodeIndex != pSnapshot->selfIndex;
+    if (direct)
     {
-        ESP_LOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
+        info.dest = pSnapshot->entries[nodeIndex];
     }
-    return err;
+    routeSnapshotPut(pSnapshot);
+    if (direct)
+    {
+        // destination is another node, send it straight to its station instead of via the root's IP stack
+        MESH_TRACE(MESH_TRACE_TX_DIRECT, MESH_PROTO_STA, len, ESP_OK, pBuffer, (uint8_t*)pBuffer + 6);
+        info.flag = MESH_DATA_P2P;
+        info.proto = MESH_PROTO_STA;
+        return txQueuePush(pDriver, &info, pBuffer, len);
+    }
+#endif
+    MESH_TRACE(MESH_TRACE_TX_TO_ROOT, MESH_PROTO_AP, len, ESP_OK, pBuffer, (uint8_t*)pBuffer + 6);
+    info.flag = MESH_DATA_TODS;
+    info.proto = MESH_PROTO_AP;// Node's station transmits data to root's AP
+    return txQueuePush(pDriver, &info, pBuffer, len);
 }
 
 static esp_err_t meshNetifTransmitFromNodeStaWrap(void* pDriver, void* pBuffer, size_t len, void* pNetifBuffer)
@@ -205,13 +845,6 @@ static esp_err_t MeshDriverStartNodeSta(esp_netif_t* pEspNetif, void* args)
     return esp_netif_set_driver_config(pEspNetif, &driver_ifconfig);
 }
 
-void MeshDeleteIfDriver(meshNetifDriver* driver)
-{
-// Stop the task once both drivers are removed
-//    receive_task_is_running = true;
-    free(driver);
-}
-
 meshNetifDriver* MeshCreateIfDriver(bool is_ap, bool is_root)
 {
     meshNetifDriver* driver = calloc(1, sizeof(meshNetifDriver));
@@ -230,13 +863,27 @@ meshNetifDriver* MeshCreateIfDriver(bool is_ap, bool is_root)
     }
     else
     {
+        free(driver);
         return NULL;
     }
+    driver->pTxQueue = meshTxQueueCreate(is_ap ? "netif ap tx task" : "netif sta tx task", txQueueSend);
+    if (driver->pTxQueue == NULL)
+    {
+        free(driver);
+        return NULL;
+    }
+#if CONFIG_MESH_UPLINK_AGGREGATION
+    if (!is_ap)
+    {
+        meshTxQueueSetAggregation(driver->pTxQueue, CONFIG_MESH_UPLINK_AGGREGATION_FRAME_MAX,
+                CONFIG_MESH_UPLINK_AGGREGATION_DEADLINE_US);
+    }
+#endif
 
     if (!receiveTaskIsRunning)
     {
         receiveTaskIsRunning = true;
-        xTaskCreate(receiveTask, "netif rx task", 3072, NULL, 5, NULL);
+        xTaskCreate(receiveTask, "netif rx task", 3072, NULL, RX_TASK_PRIORITY, NULL);
     }
 
 // save station mac address to exclude it from routing-table on broadcast
@@ -264,6 +911,23 @@ static void meshNetifInitStation(void)
 // Init by default for both potential root and node
 esp_err_t meshNetifsInit(mesh_raw_recv_cb_t* pCb)
 {
+    esp_err_t err = rxPoolInit();
+    if (err == ESP_OK)
+    {
+        err = rxClassTasksInit();
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (pRawTxQueue == NULL)
+    {
+        pRawTxQueue = meshTxQueueCreate("netif raw tx task", txQueueSend);
+        if (pRawTxQueue == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
     meshNetifInitStation();
     pMeshRawReceiveCb = pCb;
     return ESP_OK;
@@ -301,6 +965,53 @@ static esp_err_t startWifiLinkSta(void)
     return ESP_OK;
 }
 
+// Give the node station a static address, its DHCP client must be stopped
+static void linkSetIp(const esp_netif_ip_info_t* pIpInfo, uint32_t dnsAddr)
+{
+    esp_netif_ip_info_t current;
+
+    if (dnsAddr)
+    {
+        esp_netif_dns_info_t dns;
+        dns.ip.u_addr.ip4.addr = dnsAddr;
+        dns.ip.type = IPADDR_TYPE_V4;
+        esp_netif_set_dns_info(pNetifSta, ESP_NETIF_DNS_MAIN, &dns);
+    }
+    // setting an address reports it as got, the one the station already has is left alone
+    esp_netif_get_ip_info(pNetifSta, &current);
+    if (memcmp(&current, pIpInfo, sizeof(current)) != 0)
+    {
+        esp_netif_set_ip_info(pNetifSta, pIpInfo);
+    }
+}
+
+// Connect the node station with the address of the mesh_address_cb_t, by DHCP without one
+static void linkAddressStart(void)
+{
+    esp_netif_ip_info_t ipInfo = { 0 };
+    uint32_t dnsAddr = 0;
+    uint8_t mac[MAC_ADDR_LEN];
+    bool wasStatic = linkStaticIp;
+
+    esp_netif_get_mac(pNetifSta, mac);
+    esp_err_t err = pAddressCb ? pAddressCb(mac, &ipInfo, &dnsAddr) : ESP_ERR_NOT_FOUND;
+    linkStaticIp = err != ESP_ERR_NOT_FOUND;
+    if (linkStaticIp)
+    {
+        esp_netif_dhcpc_stop(pNetifSta);
+    }
+    else if (wasStatic)
+    {
+        // the station is not connected, the client starts with the connection
+        esp_netif_dhcpc_start(pNetifSta);
+    }
+    esp_netif_action_connected(pNetifSta, NULL, 0, NULL);
+    if (err == ESP_OK)
+    {
+        linkSetIp(&ipInfo, dnsAddr);
+    }
+}
+
 /**
  * @brief Starts station link over mesh (node to root over mesh)
  */
@@ -310,7 +1021,7 @@ static esp_err_t startMeshLinkSta(void)
     esp_wifi_get_mac(WIFI_IF_STA, mac);
     esp_netif_set_mac(pNetifSta, mac);
     esp_netif_action_start(pNetifSta, NULL, 0, NULL);
-    esp_netif_action_connected(pNetifSta, NULL, 0, NULL);
+    linkAddressStart();
     return ESP_OK;
 }
 
@@ -356,21 +1067,27 @@ esp_err_t meshNetifStartRootAP(bool isRoot, uint32_t addr)
 {
     if (isRoot)
     {
-        if (pNetifAP)
+        if (pNetifAP && esp_netif_is_netif_up(pNetifAP))
         {
-            esp_netif_action_disconnected(pNetifAP, NULL, 0, NULL);
-            MeshDeleteIfDriver(esp_netif_get_io_driver(pNetifAP));
-            esp_netif_destroy(pNetifAP);
-            pNetifAP = NULL;
+            // the router link came back, the nodes keep their leases
+            ESP_LOGI(TAG, "Root AP already running, keeping its leases");
+            return ESP_OK;
         }
-        pNetifAP = createMeshLinkAP();
-        meshNetifDriver* driver = MeshCreateIfDriver(true, true);
-        if (driver == NULL)
+        if (pNetifAP == NULL)
         {
-            ESP_LOGE(TAG, "Failed to create wifi interface handle");
-            return ESP_FAIL;
+            pNetifAP = createMeshLinkAP();
+            meshNetifDriver* driver = MeshCreateIfDriver(true, true);
+            if (driver == NULL)
+            {
+                ESP_LOGE(TAG, "Failed to create wifi interface handle");
+                esp_netif_destroy(pNetifAP);
+                pNetifAP = NULL;
+                return ESP_FAIL;
+            }
+            esp_netif_attach(pNetifAP, driver);
         }
-        esp_netif_attach(pNetifAP, driver);
+        meshNetifRoutingTableUpdate();
+        meshNeighbourClear();
         setDhcpsDNS(pNetifAP, addr);
         startMeshLinkAP();
         ip_napt_enable(g_mesh_netif_subnet_ip.ip.addr, 1);
@@ -378,111 +1095,442 @@ esp_err_t meshNetifStartRootAP(bool isRoot, uint32_t addr)
     return ESP_OK;
 }
 
-esp_err_t meshNetifsStart(bool is_root)
+// Root: the station uses standard wifi, the AP is started by meshNetifStartRootAP() once the root has an address
+static esp_err_t linkStartRoot(void)
 {
-    if (is_root)
+    if (pNetifSta && pNetifSta == pNetifMeshSta)
     {
-// ROOT: need both sta should use standard wifi, AP mesh link netif
-
-// Root: Station
-        if (pNetifSta && strcmp(esp_netif_get_desc(pNetifSta), "sta") == 0)
-        {
-            ESP_LOGI(TAG, "Already wifi station, no need to do anything");
-        }
-        else if (pNetifSta && strcmp(esp_netif_get_desc(pNetifSta), "mesh_link_sta") == 0)
-        {
-            esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
-            MeshDeleteIfDriver(esp_netif_get_io_driver(pNetifSta));
-            esp_netif_destroy(pNetifSta);
-            meshNetifInitStation();
-        }
-        else if (pNetifSta == NULL)
-        {
-            meshNetifInitStation();
-        }
+        // the mesh station keeps its driver for the next time this device is a node
+        esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
+        esp_netif_action_stop(pNetifSta, NULL, 0, NULL);
+        pNetifSta = NULL;
     }
-    else
+    if (pNetifSta == NULL)
     {
-// NODE: create only STA in form of mesh link
-        if (pNetifSta && strcmp(esp_netif_get_desc(pNetifSta), "mesh_link_sta") == 0)
-        {
-            ESP_LOGI(TAG, "Already mesh link station, no need to do anything");
-            return ESP_OK;
-        }
-        if (pNetifSta)
-        {
-            esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
-// should remove the actual driver
-            if (strcmp(esp_netif_get_desc(pNetifSta), "sta") == 0)
-            {
-                ESP_LOGI(TAG, "It was a wifi station removing stuff");
-                esp_wifi_clear_default_wifi_driver_and_handlers(pNetifSta);
-            }
-            esp_netif_destroy(pNetifSta);
+        meshNetifInitStation();
+        startWifiLinkSta();
+    }
+    return ESP_OK;
+}
 
-        }
-        pNetifSta = createMeshLinkSta();
+// Node: only the station, in form of a mesh link
+static esp_err_t linkStartNode(void)
+{
+    if (pNetifSta && pNetifSta != pNetifMeshSta)
+    {
+        // the wifi station's driver belongs to esp_wifi, it is built again when this device becomes root
+        ESP_LOGI(TAG, "It was a wifi station removing stuff");
+        esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
+        esp_wifi_clear_default_wifi_driver_and_handlers(pNetifSta);
+        esp_netif_destroy(pNetifSta);
+        pNetifSta = NULL;
+    }
+    if (pNetifMeshSta == NULL)
+    {
+        pNetifMeshSta = createMeshLinkSta();
 // now we create a mesh driver and attach it to the existing netif
         meshNetifDriver* pDriver = MeshCreateIfDriver(false, false);
         if (pDriver == NULL)
         {
             ESP_LOGE(TAG, "Failed to create wifi interface handle");
+            esp_netif_destroy(pNetifMeshSta);
+            pNetifMeshSta = NULL;
             return ESP_FAIL;
         }
-        esp_netif_attach(pNetifSta, pDriver);
-        startMeshLinkSta();
-// If we have a AP on NODE -> stop and remove it!
-        if (pNetifAP)
+        esp_netif_attach(pNetifMeshSta, pDriver);
+    }
+    pNetifSta = pNetifMeshSta;
+    startMeshLinkSta();
+// The AP of a former root is stopped, its DHCP server does not serve a node's children
+    if (pNetifAP)
+    {
+        esp_netif_action_disconnected(pNetifAP, NULL, 0, NULL);
+        esp_netif_action_stop(pNetifAP, NULL, 0, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t meshNetifsStart(bool is_root)
+{
+    esp_err_t err = ESP_OK;
+
+    linkStats.connects++;
+    if (linkRoleKnown && linkIsRoot == is_root && pNetifSta)
+    {
+        // same role: the netifs are still up, the station keeps its address and the root's AP its leases
+        linkStats.kept++;
+        linkLeaseKept = !is_root;
+        ESP_LOGI(TAG, "Parent back, keeping the %s netifs", is_root ? "root" : "node");
+    }
+    else
+    {
+        linkStats.roleChanges += linkRoleKnown;
+        linkLeaseKept = false;
+        err = is_root ? linkStartRoot() : linkStartNode();
+    }
+    linkRoleKnown = err == ESP_OK;
+    linkIsRoot = is_root;
+    if (linkStats.connects > 1)
+    {
+        __atomic_store_n(&linkReconnectUs, esp_timer_get_time(), __ATOMIC_RELEASE);
+    }
+    return err;
+}
+
+esp_err_t meshNetifsStop(void)
+{
+    // nothing is torn down, a brief loss of the parent must not cost a new address; a frame not delivered
+    // until the next reconnection does not count for it
+    __atomic_store_n(&linkReconnectUs, 0, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void meshNetifSetRoot(const mesh_addr_t* pRoot)
+{
+    static const uint8_t none[MAC_ADDR_LEN] = { 0 };
+    bool changed = !MAC_ADDR_EQUAL(linkRoot.addr, none) && !MAC_ADDR_EQUAL(linkRoot.addr, pRoot->addr);
+
+    linkRoot = *pRoot;
+    // a static address is in the lease table every root holds
+    if (changed && linkLeaseKept && !linkStaticIp && pNetifSta && pNetifSta == pNetifMeshSta)
+    {
+        // the kept address came from the DHCP server of the old root, the new one does not know it
+        ESP_LOGI(TAG, "Root changed to " MACSTR ", leasing the address again", MAC2STR(pRoot->addr));
+        linkLeaseKept = false;
+        linkStats.renewals++;
+        esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
+        linkAddressStart();
+    }
+}
+
+void meshNetifSetAddressCb(mesh_address_cb_t* pCb)
+{
+    pAddressCb = pCb;
+}
+
+esp_err_t meshNetifSetStaticIp(const esp_netif_ip_info_t* pIpInfo, uint32_t dnsAddr)
+{
+    if (pNetifSta == NULL || pNetifSta != pNetifMeshSta)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!linkStaticIp)
+    {
+        linkStaticIp = true;
+        esp_netif_dhcpc_stop(pNetifSta);
+    }
+    linkSetIp(pIpInfo, dnsAddr);
+    return ESP_OK;
+}
+
+esp_err_t meshNetifStartDhcp(void)
+{
+    if (pNetifSta == NULL || pNetifSta != pNetifMeshSta || !linkStaticIp)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    linkStaticIp = false;
+    return esp_netif_dhcpc_start(pNetifSta);
+}
+
+uint8_t* meshNetifGetStationMAC(void)
+{
+    meshNetifDriver* pMesh = esp_netif_get_io_driver(pNetifSta);
+    return pMesh->sta_mac_addr;
+}
+
+esp_err_t meshNetifGetMeshIpInfo(esp_netif_ip_info_t* pIpInfo)
+{
+    esp_netif_t* pNetif = esp_mesh_is_root() ? pNetifAP : pNetifSta;
+    if (pNetif == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_netif_get_ip_info(pNetif, pIpInfo);
+}
+
+// Returns the copy not published, once the last getter that took it before the previous swap is done with it
+static meshNetifRouteSnapshot* routeSnapshotNext(void)
+{
+    int next = pRouteSnapshot == &routeSnapshots[0];
+    while (__atomic_load_n(&routeSnapshotReaders[next], __ATOMIC_SEQ_CST))
+    {
+        vTaskDelay(1);
+    }
+    return &routeSnapshots[next];
+}
+
+// Index the entries of pNext and make it the current snapshot, pNext comes from routeSnapshotNext() so no
+// transmit path probes its index while it is rebuilt
+static void routeSnapshotPublish(meshNetifRouteSnapshot* pCurrent, meshNetifRouteSnapshot* pNext)
+{
+    uint8_t staMAC[MAC_ADDR_LEN];
+
+    esp_wifi_get_mac(WIFI_IF_STA, staMAC);
+    memset(pNext->index, 0xFF, sizeof(pNext->index));
+    for (int i = 0; i < pNext->size; i++)
+    {
+        uint32_t slot = routeIndexHash(pNext->entries[i].addr);
+        while (pNext->index[slot] >= 0)
         {
-            esp_netif_action_disconnected(pNetifAP, NULL, 0, NULL);
-            MeshDeleteIfDriver(esp_netif_get_io_driver(pNetifAP));
-            esp_netif_destroy(pNetifAP);
-            pNetifAP = NULL;
+            slot = (slot + 1) & (ROUTE_INDEX_SIZE - 1);
         }
+        pNext->index[slot] = i;
+    }
+    pNext->selfIndex = routeSnapshotFind(pNext, staMAC);
+    pNext->version = pCurrent->version + 1;
+    __atomic_store_n(&pRouteSnapshot, pNext, __ATOMIC_SEQ_CST);
+    ESP_LOGD(TAG, "Routing table version %u, size %d", pNext->version, pNext->size);
+}
+
+esp_err_t meshNetifRoutingTableUpdate(void)
+{
+    if (!esp_mesh_is_root())
+    {
+        // nodes only see their own subtree, they take the table distributed by the root instead
+        return ESP_OK;
+    }
+    meshNetifRouteSnapshot* pCurrent = pRouteSnapshot;
+    meshNetifRouteSnapshot* pNext = routeSnapshotNext();
 
+    esp_err_t err = esp_mesh_get_routing_table(pNext->entries, CONFIG_MESH_ROUTE_TABLE_SIZE * 6, &pNext->size);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Routing table update failed with err code %d %s", err, esp_err_to_name(err));
+        return err;
     }
+    routeSnapshotPublish(pCurrent, pNext);
     return ESP_OK;
 }
 
-esp_err_t meshNetifsStop(void)
+esp_err_t meshNetifRoutingTableSet(const mesh_addr_t* pTable, int size)
 {
-    if (pNetifSta && strcmp(esp_netif_get_desc(pNetifSta), "sta") == 0 && pNetifAP == NULL)
+    if (esp_mesh_is_root())
     {
         return ESP_OK;
     }
+    if (size < 0 || size > CONFIG_MESH_ROUTE_TABLE_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    meshNetifRouteSnapshot* pCurrent = pRouteSnapshot;
+    if (size == pCurrent->size && memcmp(pCurrent->entries, pTable, size * sizeof(mesh_addr_t)) == 0)
+    {
+        return ESP_OK;
+    }
+    meshNetifRouteSnapshot* pNext = routeSnapshotNext();
+    memcpy(pNext->entries, pTable, size * sizeof(mesh_addr_t));
+    pNext->size = size;
+    routeSnapshotPublish(pCurrent, pNext);
+    return ESP_OK;
+}
+
+uint32_t meshNetifGetRoutingTable(const mesh_addr_t** ppTable, int* pSize)
+{
+    const meshNetifRouteSnapshot* pSnapshot = routeSnapshotGet();
+    *ppTable = pSnapshot->entries;
+    *pSize = pSnapshot->size;
+    return pSnapshot->version;
+}
+
+void meshNetifReleaseRoutingTable(const mesh_addr_t* pTable)
+{
+    routeSnapshotPut(pTable == routeSnapshots[0].entries ? &routeSnapshots[0] : &routeSnapshots[1]);
+}
 
-    if (pNetifSta)
+esp_err_t meshNetifJoinBroadcastGroup(void)
+{
+    esp_err_t err = esp_mesh_set_group_id(&meshGroupAll, 1);
+    if (err != ESP_OK)
     {
-        if (strcmp(esp_netif_get_desc(pNetifSta), "sta") == 0)
+        ESP_LOGE(TAG, "Joining broadcast group failed with err code %d %s", err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void broadcastFanoutCount(uint32_t sends)
+{
+    int bucket = sends ? 31 - __builtin_clz(sends) : 0;
+    bucket = bucket < MESH_NETIF_FANOUT_BUCKETS ? bucket : MESH_NETIF_FANOUT_BUCKETS - 1;
+    __atomic_fetch_add(&broadcastStats.fanout[bucket], 1, __ATOMIC_RELAXED);
+}
+
+static esp_err_t broadcastSend(const mesh_data_t* pData, int flag)
+{
+    esp_err_t err = ESP_OK;
+    __atomic_fetch_add(&broadcastStats.broadcasts, 1, __ATOMIC_RELAXED);
+#if CONFIG_MESH_GROUP_BROADCAST
+    // one send to the group address, the mesh stack delivers it to every member
+    __atomic_fetch_add(&broadcastStats.sends, 1, __ATOMIC_RELAXED);
+    broadcastFanoutCount(1);
+    err = meshSend(&meshGroupAll, pData, MESH_DATA_P2P | MESH_DATA_GROUP | flag);
+    if (err != ESP_OK)
+    {
+        __atomic_fetch_add(&broadcastStats.errors, 1, __ATOMIC_RELAXED);
+        ESP_LOGE(TAG, "Group send with err code %d %s", err, esp_err_to_name(err));
+    }
+#else
+    // one unicast per routing table entry, failures are only counted so a retry does not repeat the whole fan-out
+    const meshNetifRouteSnapshot* pSnapshot = routeSnapshotGet();
+    ESP_LOGD(TAG, "Broadcasting! routing table version %u", pSnapshot->version);
+    broadcastFanoutCount(pSnapshot->size - (pSnapshot->selfIndex >= 0));
+    for (int i = 0; i < pSnapshot->size; i++)
+    {
+        if (i == pSnapshot->selfIndex)
         {
-            esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
-            esp_netif_action_stop(pNetifSta, NULL, 0, NULL);
-            esp_wifi_clear_default_wifi_driver_and_handlers(pNetifSta);
+            continue;
         }
-        else
+        __atomic_fetch_add(&broadcastStats.sends, 1, __ATOMIC_RELAXED);
+        esp_err_t sendErr = meshSend(&pSnapshot->entries[i], pData, MESH_DATA_P2P | flag);
+        if (sendErr != ESP_OK)
         {
-            esp_netif_action_disconnected(pNetifSta, NULL, 0, NULL);
-            MeshDeleteIfDriver(esp_netif_get_io_driver(pNetifSta));
+            __atomic_fetch_add(&broadcastStats.errors, 1, __ATOMIC_RELAXED);
+            ESP_LOGE(TAG, "Broadcast to " MACSTR " with err code %d %s", MAC2STR(pSnapshot->entries[i].addr), sendErr,
+                    esp_err_to_name(sendErr));
         }
-        esp_netif_destroy(pNetifSta);
-        pNetifSta = NULL;
     }
+    routeSnapshotPut(pSnapshot);
+#endif
+    return err;
+}
 
-    if (pNetifAP)
+esp_err_t meshNetifBroadcast(const mesh_data_t* pData)
+{
+    return broadcastSend(pData, 0);
+}
+
+void meshNetifGetBroadcastStats(meshNetifBroadcastStats_t* pStats)
+{
+    pStats->broadcasts = __atomic_load_n(&broadcastStats.broadcasts, __ATOMIC_RELAXED);
+    pStats->sends = __atomic_load_n(&broadcastStats.sends, __ATOMIC_RELAXED);
+    pStats->errors = __atomic_load_n(&broadcastStats.errors, __ATOMIC_RELAXED);
+    for (int i = 0; i < MESH_NETIF_FANOUT_BUCKETS; i++)
     {
-        esp_netif_action_disconnected(pNetifAP, NULL, 0, NULL);
-        MeshDeleteIfDriver(esp_netif_get_io_driver(pNetifAP));
-        esp_netif_destroy(pNetifAP);
-        pNetifAP = NULL;
+        pStats->fanout[i] = __atomic_load_n(&broadcastStats.fanout[i], __ATOMIC_RELAXED);
+    }
+}
+
+esp_err_t meshNetifSendRaw(const mesh_addr_t* pTo, const mesh_data_t* pData, meshTrafficClass_t trafficClass)
+{
+    meshTxInfo_t info = { .flag = MESH_DATA_P2P, .proto = pData->proto, .tos = pData->tos, .broadcast = (pTo == NULL) };
+
+    if (pRawTxQueue == NULL || trafficClass >= MESH_TRAFFIC_CLASS_MAX)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (pTo)
+    {
+        info.dest = *pTo;
+    }
+    if (pData->size <= MESH_MPS)
+    {
+        return meshTxQueuePush(pRawTxQueue, &info, pData->data, pData->size, trafficClass,
+                pdMS_TO_TICKS(RAW_TX_WAIT_ms));
+    }
+    if (pData->size > RAW_MAX_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // fragments of one message share its class queue, so they are sent in order
+    uint16_t id = __atomic_fetch_add(&rawTxId, 1, __ATOMIC_RELAXED);
+    uint8_t header[RAW_FRAGMENT_HDR_LEN] = { MESH_NETIF_RAW_FRAGMENT, id >> 8, id & 0xFF, 0, 0, pData->size >> 8,
+            pData->size & 0xFF };
+    size_t len;
+    for (size_t offset = 0; offset < pData->size; offset += len)
+    {
+        len = pData->size - offset < RAW_FRAGMENT_PAYLOAD ? pData->size - offset : RAW_FRAGMENT_PAYLOAD;
+        header[3] = offset >> 8;
+        header[4] = offset & 0xFF;
+        esp_err_t err = meshTxQueuePushWithHeader(pRawTxQueue, &info, header, sizeof(header), pData->data + offset, len,
+                trafficClass, pdMS_TO_TICKS(RAW_TX_WAIT_ms));
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        __atomic_fetch_add(&fragmentStats.fragmentsSent, 1, __ATOMIC_RELAXED);
     }
-// reserve the default (STA gets ready to become root)
-    meshNetifInitStation();
-    startWifiLinkSta();
     return ESP_OK;
 }
 
-uint8_t* meshNetifGetStationMAC(void)
+void meshNetifSetRawClassifier(mesh_raw_class_cb_t* pCb)
 {
-    meshNetifDriver* pMesh = esp_netif_get_io_driver(pNetifSta);
-    return pMesh->sta_mac_addr;
+    pMeshRawClassCb = pCb;
+}
+
+esp_err_t meshNetifGetTxStats(meshTxStats_t pStats[MESH_TRAFFIC_CLASS_MAX])
+{
+    esp_netif_t* pNetif = esp_mesh_is_root() ? pNetifAP : pNetifSta;
+    if (pNetif == NULL || (!esp_mesh_is_root() && strcmp(esp_netif_get_desc(pNetif), "mesh_link_sta") != 0))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    meshNetifDriver* pDriver = esp_netif_get_io_driver(pNetif);
+    meshTxQueueGetStats(pDriver->pTxQueue, pStats);
+    return ESP_OK;
+}
+
+esp_err_t meshNetifGetRawTxStats(meshTxStats_t pStats[MESH_TRAFFIC_CLASS_MAX])
+{
+    if (pRawTxQueue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    meshTxQueueGetStats(pRawTxQueue, pStats);
+    return ESP_OK;
+}
+
+void meshNetifGetRxStats(meshNetifRxStats_t pStats[MESH_TRAFFIC_CLASS_MAX])
+{
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        pStats[i].packets = __atomic_load_n(&rxStats[i].packets, __ATOMIC_RELAXED);
+        pStats[i].bytes = __atomic_load_n(&rxStats[i].bytes, __ATOMIC_RELAXED);
+        pStats[i].dropped = __atomic_load_n(&rxStats[i].dropped, __ATOMIC_RELAXED);
+        pStats[i].depth = i < MESH_TRAFFIC_BULK && rxClassQueues[i] ? uxQueueMessagesWaiting(rxClassQueues[i]) : 0;
+    }
+}
+
+void meshNetifGetProtoStats(meshNetifProtoStats_t pStats[MESH_NETIF_PROTOS])
+{
+    for (int i = 0; i < MESH_NETIF_PROTOS; i++)
+    {
+        pStats[i].rxPackets = __atomic_load_n(&protoStats[i].rxPackets, __ATOMIC_RELAXED);
+        pStats[i].rxBytes = __atomic_load_n(&protoStats[i].rxBytes, __ATOMIC_RELAXED);
+        pStats[i].txPackets = __atomic_load_n(&protoStats[i].txPackets, __ATOMIC_RELAXED);
+        pStats[i].txBytes = __atomic_load_n(&protoStats[i].txBytes, __ATOMIC_RELAXED);
+    }
+}
+
+void meshNetifGetErrorStats(meshNetifErrorStats_t* pStats)
+{
+    pStats->recvErrors = __atomic_load_n(&errorStats.recvErrors, __ATOMIC_RELAXED);
+    for (int i = 0; i < MESH_NETIF_ERROR_CODES; i++)
+    {
+        pStats->sendErrors[i].code = __atomic_load_n(&errorStats.sendErrors[i].code, __ATOMIC_RELAXED);
+        pStats->sendErrors[i].count = __atomic_load_n(&errorStats.sendErrors[i].count, __ATOMIC_RELAXED);
+    }
+    pStats->otherSendErrors = __atomic_load_n(&errorStats.otherSendErrors, __ATOMIC_RELAXED);
+}
+
+void meshNetifGetFragmentStats(meshNetifFragmentStats_t* pStats)
+{
+    pStats->fragmentsSent = __atomic_load_n(&fragmentStats.fragmentsSent, __ATOMIC_RELAXED);
+    pStats->fragmentsReceived = fragmentStats.fragmentsReceived;
+    pStats->reassembled = fragmentStats.reassembled;
+    pStats->timeouts = fragmentStats.timeouts;
+    pStats->dropped = fragmentStats.dropped;
+}
+
+void meshNetifGetRxPoolStats(meshNetifRxPoolStats_t* pStats)
+{
+    pStats->size = RX_POOL_SIZE;
+    pStats->inUse = rxPool.freeQueue ? RX_POOL_SIZE - uxQueueMessagesWaiting(rxPool.freeQueue) : 0;
+    pStats->peakInUse = __atomic_load_n(&rxPool.peakInUse, __ATOMIC_RELAXED);
+    pStats->exhausted = __atomic_load_n(&rxPool.exhausted, __ATOMIC_RELAXED);
+    pStats->dropped = __atomic_load_n(&rxPool.dropped, __ATOMIC_RELAXED);
+}
+
+void meshNetifGetLinkStats(meshNetifLinkStats_t* pStats)
+{
+    *pStats = linkStats;
 }
@@ -0,0 +1,950 @@
+#include "mesh_ota.h"
+#include "mesh_netif.h"
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include <stdlib.h> // for calloc,free
+#include <string.h> // for memcpy,memset,strlen
+
+// anyone who can publish to the OTA topic starts an update, only the signature keeps foreign images out
+#if !CONFIG_SECURE_SIGNED_ON_UPDATE && !CONFIG_MESH_OTA_UNSIGNED
+#error "CONFIG_MESH_OTA needs signed app images (CONFIG_SECURE_SIGNED_ON_UPDATE) or CONFIG_MESH_OTA_UNSIGNED"
+#endif
+
+#define OTA_OFFER_MSG_LEN    (1 + 4 + 4 + 2)
+#define OTA_DATA_HDR_LEN     (1 + 4 + 2)
+#define OTA_QUERY_MSG_LEN    (1 + 4 + 2 + 1)
+#define OTA_STATUS_HDR_LEN   (1 + 4 + 1 + 1 + 2 + 2 + 1)
+#define OTA_END_MSG_LEN      (1 + 4 + 1)
+#define OTA_CHUNK_SIZE       (CONFIG_MESH_OTA_CHUNK_SIZE)
+#define OTA_WINDOW           (CONFIG_MESH_OTA_WINDOW)
+#define OTA_WINDOW_BYTES     ((OTA_WINDOW + 7) / 8)
+#define OTA_STATUS_MAX_LEN   (OTA_STATUS_HDR_LEN + OTA_WINDOW_BYTES)
+#define OTA_MAX_CHUNKS       (0xFFFF)
+#define OTA_MAX_NODES        (CONFIG_MESH_ROUTE_TABLE_SIZE)
+#define OTA_URL_MAX          (256)
+#define OTA_OFFER_WAIT_ms    (30000) // nodes erase their update partition before they answer, seconds for 1 MB
+#define OTA_OFFER_REPEAT_ms  (2000)
+#define OTA_REPLY_WAIT_ms    (2000)  // answers queue behind the chunks on the way down and up
+#define OTA_SPREAD_ms        (500)   // nodes answer at a random time within this, the root rx queues are short
+#define OTA_SEND_RETRIES     (50)
+#define OTA_SEND_RETRY_ms    (10)    // the raw tx queue drains at the rate of the link to the first children
+#define OTA_HTTP_TIMEOUT_ms  (10000)
+#define OTA_TASK_PRIORITY    (4)     // below the mesh netif tasks, like the benchmark
+#define OTA_TASK_STACK       (4096)  // the HTTP client is the deepest
+
+// notification bits of the OTA task
+#define OTA_EVENT_START      (1 << 0) // root: meshOtaStart()
+#define OTA_EVENT_OFFER      (1 << 1) // node: offer received
+#define OTA_EVENT_QUERY      (1 << 2) // node: query received
+#define OTA_EVENT_END        (1 << 3) // node: end received
+#define OTA_EVENT_STATUS     (1 << 4) // root: a node answered
+
+// root: what the answers of the nodes currently reply to
+typedef enum
+{
+    OTA_PHASE_OFFER,  // offer, answered with count 0 once the partition is erased
+    OTA_PHASE_WINDOW, // query of the window otaQueryFirst, otaQueryCount
+    OTA_PHASE_END,    // end, answered with count 0 and the final state
+} otaPhase_t;
+
+typedef struct
+{
+    mesh_addr_t addr;
+    uint8_t layer;
+    meshOtaState_t state;
+    bool answered;                    // status of the current offer, query or end received
+    uint16_t received;                // chunks
+    uint8_t missing[OTA_WINDOW_BYTES]; // chunks of the current window the node misses
+} otaNode_t;
+
+static const char* TAG = "mesh_ota";
+static SemaphoreHandle_t otaLock = NULL;
+static TaskHandle_t otaTask = NULL;
+static meshOtaProgressCb_t* pOtaProgressCb = NULL;
+static esp_timer_handle_t otaValidateTimer = NULL;
+static bool otaRunning = false;       // root: set by meshOtaStart(), cleared by the task when the session is done
+static char otaUrl[OTA_URL_MAX];
+// session of this device, on nodes the one offered last
+static uint32_t otaSession = 0;
+static uint32_t otaSize = 0;
+static uint16_t otaChunkSize = 0;
+static uint16_t otaChunks = 0;
+static meshOtaState_t otaState = MESH_OTA_IDLE;
+static const esp_partition_t* pOtaPartition = NULL;
+static esp_ota_handle_t otaHandle = 0;
+// node: root of the session and the offer, query and end waiting for the task
+static mesh_addr_t otaRoot = { 0 };
+static uint32_t otaOfferSession = 0;
+static uint32_t otaOfferSize = 0;
+static uint16_t otaOfferChunkSize = 0;
+static uint16_t otaQueryFirst = 0;    // also the window of the root
+static uint8_t otaQueryCount = 0;
+static bool otaCommit = false;
+static uint8_t* pOtaHave = NULL;      // node: bit per chunk received
+static uint16_t otaReceived = 0;
+// root: nodes taking part
+static otaNode_t* pOtaNodes = NULL;
+static meshOtaNodeProgress_t* pOtaProgress = NULL;
+static int otaNodeCount = 0;
+static bool otaJoinOpen = false;
+static otaPhase_t otaPhase = OTA_PHASE_OFFER;
+static meshOtaSummary_t otaSummary = { 0 };
+static int64_t otaDataStartUs = 0;
+static uint8_t otaTxBuffer[OTA_DATA_HDR_LEN + OTA_CHUNK_SIZE];
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void putBE32(uint8_t* p, uint32_t value)
+{
+    putBE16(p, value >> 16);
+    putBE16(p + 2, value & 0xFFFF);
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t)getBE16(p) << 16) | getBE16(p + 2);
+}
+
+static inline bool otaBitGet(const uint8_t* pBitmap, int bit)
+{
+    return pBitmap[bit / 8] & (1 << (bit % 8));
+}
+
+static inline void otaBitSet(uint8_t* pBitmap, int bit)
+{
+    pBitmap[bit / 8] |= 1 << (bit % 8);
+}
+
+static const char* otaStateName(meshOtaState_t state)
+{
+    static const char* names[] = { "idle", "receiving", "done", "failed" };
+    return state <= MESH_OTA_FAILED ? names[state] : "?";
+}
+
+static size_t otaChunkLen(uint16_t chunk)
+{
+    uint32_t offset = (uint32_t)chunk * otaChunkSize;
+    return otaSize - offset < otaChunkSize ? otaSize - offset : otaChunkSize;
+}
+
+static esp_err_t otaSend(const mesh_addr_t* pTo, uint8_t* pMsg, size_t len, meshTrafficClass_t trafficClass)
+{
+    mesh_data_t data = { .data = pMsg, .size = len, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+    esp_err_t err;
+
+    // bulk messages find the tx queue full whenever the root sends faster than the mesh forwards
+    for (int i = 0; (err = meshNetifSendRaw(pTo, &data, trafficClass)) == ESP_ERR_NO_MEM && i < OTA_SEND_RETRIES; i++)
+    {
+        vTaskDelay(pdMS_TO_TICKS(OTA_SEND_RETRY_ms));
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "OTA command 0x%02x not sent, err code %d %s", pMsg[0], err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void otaSendEnd(const mesh_addr_t* pTo, bool commit)
+{
+    uint8_t msg[OTA_END_MSG_LEN] = { CMD_OTA_END };
+    putBE32(msg + 1, otaSession);
+    msg[5] = commit;
+    otaSend(pTo, msg, sizeof(msg), MESH_TRAFFIC_CONTROL);
+}
+
+/*******************************************************
+ *                Node
+ *******************************************************/
+
+// Drop the image of the session, call with otaLock taken
+static void otaNodeDrop(void)
+{
+    if (otaState == MESH_OTA_RECEIVING)
+    {
+        esp_ota_abort(otaHandle);
+    }
+    otaState = MESH_OTA_IDLE;
+    free(pOtaHave);
+    pOtaHave = NULL;
+    otaReceived = 0;
+}
+
+// Report the state and the chunks of a window missing, count 0 for the state only
+static void otaNodeReply(uint16_t first, uint8_t count)
+{
+    uint8_t msg[OTA_STATUS_MAX_LEN] = { CMD_OTA_STATUS };
+    mesh_addr_t root;
+
+    vTaskDelay(pdMS_TO_TICKS(esp_random() % OTA_SPREAD_ms));
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    root = otaRoot;
+    putBE32(msg + 1, otaSession);
+    msg[5] = otaState;
+    msg[6] = esp_mesh_get_layer();
+    putBE16(msg + 7, otaReceived);
+    putBE16(msg + 9, first);
+    msg[11] = count;
+    memset(msg + OTA_STATUS_HDR_LEN, 0, (count + 7) / 8);
+    for (int i = 0; i < count; i++)
+    {
+        if (first + i < otaChunks && (pOtaHave == NULL || !otaBitGet(pOtaHave, first + i)))
+        {
+            otaBitSet(msg + OTA_STATUS_HDR_LEN, i);
+        }
+    }
+    xSemaphoreGive(otaLock);
+    otaSend(&root, msg, OTA_STATUS_HDR_LEN + (count + 7) / 8, MESH_TRAFFIC_CONTROL);
+}
+
+// Erase the update partition for a new session, answers offers of the current one right away
+static void otaNodeOffer(void)
+{
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    if (otaOfferSession == otaSession && otaState != MESH_OTA_IDLE)
+    {
+        xSemaphoreGive(otaLock);
+        otaNodeReply(0, 0);
+        return;
+    }
+    otaNodeDrop();
+    otaSession = otaOfferSession;
+    otaSize = otaOfferSize;
+    otaChunkSize = otaOfferChunkSize;
+    otaChunks = (otaSize + otaChunkSize - 1) / otaChunkSize;
+    uint32_t session = otaSession;
+    xSemaphoreGive(otaLock);
+
+    ESP_LOGI(TAG, "Session %08x: %u bytes in %u chunks offered", session, otaSize, otaChunks);
+    esp_ota_handle_t handle = 0;
+    const esp_partition_t* pPartition = esp_ota_get_next_update_partition(NULL);
+    // the partition is erased for the size of the image, data arriving meanwhile is sent again later
+    esp_err_t err = pPartition ? esp_ota_begin(pPartition, otaSize, &handle) : ESP_ERR_NOT_FOUND;
+    uint8_t* pHave = err == ESP_OK ? calloc((otaChunks + 7) / 8, 1) : NULL;
+
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    if (session != otaSession)
+    {
+        // offered again meanwhile, the next offer event starts over
+        if (err == ESP_OK)
+        {
+            esp_ota_abort(handle);
+        }
+        free(pHave);
+    }
+    else if (pHave == NULL)
+    {
+        ESP_LOGE(TAG, "Session %08x not started, err code %d %s", session, err, esp_err_to_name(err));
+        if (err == ESP_OK)
+        {
+            esp_ota_abort(handle);
+        }
+        otaState = MESH_OTA_FAILED;
+    }
+    else
+    {
+        pOtaPartition = pPartition;
+        otaHandle = handle;
+        pOtaHave = pHave;
+        otaState = MESH_OTA_RECEIVING;
+    }
+    xSemaphoreGive(otaLock);
+    otaNodeReply(0, 0);
+}
+
+// Check and activate the image, or drop it
+static void otaNodeEnd(void)
+{
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    if (otaState == MESH_OTA_RECEIVING && otaCommit && otaReceived == otaChunks)
+    {
+        free(pOtaHave);
+        pOtaHave = NULL;
+        // esp_ota_end() checks the image
+        esp_err_t err = esp_ota_end(otaHandle);
+        if (err == ESP_OK)
+        {
+            err = esp_ota_set_boot_partition(pOtaPartition);
+        }
+        otaState = err == ESP_OK ? MESH_OTA_DONE : MESH_OTA_FAILED;
+        ESP_LOGI(TAG, "Session %08x: image %s, err code %d %s", otaSession, otaStateName(otaState), err,
+                esp_err_to_name(err));
+    }
+    else if (otaState == MESH_OTA_RECEIVING)
+    {
+        ESP_LOGW(TAG, "Session %08x dropped with %u of %u chunks", otaSession, otaReceived, otaChunks);
+        otaNodeDrop();
+    }
+    meshOtaState_t state = otaState;
+    xSemaphoreGive(otaLock);
+    otaNodeReply(0, 0);
+    if (state == MESH_OTA_DONE && CONFIG_MESH_OTA_RESTART_DELAY_S)
+    {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_MESH_OTA_RESTART_DELAY_S * 1000));
+        esp_restart();
+    }
+}
+
+// Data message, written on the worker of the bulk class so flash writes do not hold up the control messages
+static void otaNodeData(const uint8_t* pMsg, size_t len)
+{
+    uint16_t chunk = getBE16(pMsg + 5);
+
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    if (getBE32(pMsg + 1) == otaSession && otaState == MESH_OTA_RECEIVING && chunk < otaChunks
+            && len - OTA_DATA_HDR_LEN == otaChunkLen(chunk) && !otaBitGet(pOtaHave, chunk))
+    {
+        esp_err_t err = esp_ota_write_with_offset(otaHandle, pMsg + OTA_DATA_HDR_LEN, len - OTA_DATA_HDR_LEN,
+                (uint32_t)chunk * otaChunkSize);
+        if (err == ESP_OK)
+        {
+            otaBitSet(pOtaHave, chunk);
+            otaReceived++;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Chunk %u not written, err code %d %s", chunk, err, esp_err_to_name(err));
+        }
+    }
+    xSemaphoreGive(otaLock);
+}
+
+/*******************************************************
+ *                Root
+ *******************************************************/
+
+// Download the image into the update partition of the root, returns its size in otaSize
+static esp_err_t otaDownload(void)
+{
+    esp_http_client_config_t config = { .url = otaUrl, .timeout_ms = OTA_HTTP_TIMEOUT_ms };
+    esp_ota_handle_t handle = 0;
+    bool begun = false;
+    int len = 0;
+
+    otaSize = 0;
+    pOtaPartition = esp_ota_get_next_update_partition(NULL);
+    if (pOtaPartition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err == ESP_OK && esp_http_client_fetch_headers(client) >= 0 && esp_http_client_get_status_code(client) == 200)
+    {
+        err = esp_ota_begin(pOtaPartition, OTA_SIZE_UNKNOWN, &handle);
+        begun = err == ESP_OK;
+        // the chunk buffer is free until the image is sent
+        while (err == ESP_OK && (len = esp_http_client_read(client, (char*)otaTxBuffer, OTA_CHUNK_SIZE)) > 0)
+        {
+            err = esp_ota_write(handle, otaTxBuffer, len);
+            otaSize += len;
+        }
+        err = err == ESP_OK && len < 0 ? ESP_FAIL : err;
+    }
+    else if (err == ESP_OK)
+    {
+        ESP_LOGE(TAG, "HTTP status %d", esp_http_client_get_status_code(client));
+        err = ESP_ERR_NOT_FOUND;
+    }
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    if (begun && err == ESP_OK)
+    {
+        // esp_ota_end() checks the image, so a broken download is not sent to the nodes
+        err = esp_ota_end(handle);
+    }
+    else if (begun)
+    {
+        esp_ota_abort(handle);
+    }
+    if (err == ESP_OK && (otaSize + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE > OTA_MAX_CHUNKS)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    return err;
+}
+
+// Node of the session, added during the offer, call with otaLock taken
+static otaNode_t* otaNodeGet(const mesh_addr_t* pAddr)
+{
+    for (int i = 0; i < otaNodeCount; i++)
+    {
+        if (MAC_ADDR_EQUAL(pOtaNodes[i].addr.addr, pAddr->addr))
+        {
+            return &pOtaNodes[i];
+        }
+    }
+    if (!otaJoinOpen || otaNodeCount == OTA_MAX_NODES)
+    {
+        return NULL;
+    }
+    otaNode_t* pNode = &pOtaNodes[otaNodeCount++];
+    memset(pNode, 0, sizeof(*pNode));
+    pNode->addr = *pAddr;
+    return pNode;
+}
+
+// Clear the answers of the nodes receiving, returns their number
+static int otaRootAsk(void)
+{
+    int asked = 0;
+
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    for (int i = 0; i < otaNodeCount; i++)
+    {
+        pOtaNodes[i].answered = pOtaNodes[i].state != MESH_OTA_RECEIVING;
+        asked += pOtaNodes[i].state == MESH_OTA_RECEIVING;
+    }
+    xSemaphoreGive(otaLock);
+    return asked;
+}
+
+// Wait until the nodes asked answered, or at most waitMs, returns the number still silent
+static int otaRootWait(uint32_t waitMs)
+{
+    int64_t deadlineUs = esp_timer_get_time() + waitMs * 1000LL;
+    int silent;
+
+    while (1)
+    {
+        silent = 0;
+        xSemaphoreTake(otaLock, portMAX_DELAY);
+        for (int i = 0; i < otaNodeCount; i++)
+        {
+            silent += !pOtaNodes[i].answered;
+        }
+        xSemaphoreGive(otaLock);
+        int64_t leftUs = deadlineUs - esp_timer_get_time();
+        if (silent == 0 || leftUs <= 0)
+        {
+            return silent;
+        }
+        xTaskNotifyWait(0, OTA_EVENT_STATUS, NULL, pdMS_TO_TICKS(leftUs / 1000) + 1);
+    }
+}
+
+static void otaRootProgress(bool done)
+{
+    int64_t elapsedUs = otaDataStartUs ? esp_timer_get_time() - otaDataStartUs : 0;
+    int count;
+
+    if (pOtaProgressCb == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    count = otaNodeCount;
+    otaSummary.elapsedMs = elapsedUs / 1000;
+    otaSummary.done = done;
+    for (int i = 0; i < count; i++)
+    {
+        const otaNode_t* pNode = &pOtaNodes[i];
+        meshOtaNodeProgress_t* pProgress = &pOtaProgress[i];
+        uint32_t received = (uint32_t)pNode->received * otaChunkSize;
+        pProgress->addr = pNode->addr;
+        pProgress->layer = pNode->layer;
+        pProgress->state = pNode->state;
+        pProgress->received = received < otaSize ? received : otaSize;
+        pProgress->kbps = elapsedUs >= 1000 ? (uint64_t)pProgress->received * 8000 / elapsedUs : 0;
+    }
+    xSemaphoreGive(otaLock);
+    pOtaProgressCb(&otaSummary, pOtaProgress, count);
+}
+
+static void otaSendChunk(const mesh_addr_t* pTo, uint16_t chunk)
+{
+    size_t len = otaChunkLen(chunk);
+
+    otaTxBuffer[0] = CMD_OTA_DATA;
+    putBE32(otaTxBuffer + 1, otaSession);
+    putBE16(otaTxBuffer + 5, chunk);
+    esp_partition_read(pOtaPartition, (uint32_t)chunk * otaChunkSize, otaTxBuffer + OTA_DATA_HDR_LEN, len);
+    if (otaSend(pTo, otaTxBuffer, OTA_DATA_HDR_LEN + len, MESH_TRAFFIC_BULK) != ESP_OK)
+    {
+        return;
+    }
+    otaSummary.bytesSent += len;
+    if (pTo)
+    {
+        otaSummary.unicasts++;
+    }
+    else
+    {
+        otaSummary.broadcasts++;
+    }
+}
+
+// Offer the image until every node of the routing table is ready or the offer times out, returns the nodes ready
+static int otaRootOffer(void)
+{
+    uint8_t msg[OTA_OFFER_MSG_LEN] = { CMD_OTA_OFFER };
+    const mesh_addr_t* pTable;
+    int tableSize;
+    int ready = 0;
+    int64_t deadlineUs = esp_timer_get_time() + OTA_OFFER_WAIT_ms * 1000LL;
+
+    putBE32(msg + 1, otaSession);
+    putBE32(msg + 5, otaSize);
+    putBE16(msg + 9, otaChunkSize);
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    otaJoinOpen = true;
+    otaPhase = OTA_PHASE_OFFER;
+    xSemaphoreGive(otaLock);
+    while (esp_timer_get_time() < deadlineUs)
+    {
+        otaSend(NULL, msg, sizeof(msg), MESH_TRAFFIC_CONTROL);
+        vTaskDelay(pdMS_TO_TICKS(OTA_OFFER_REPEAT_ms));
+        meshNetifGetRoutingTable(&pTable, &tableSize);
+        meshNetifReleaseRoutingTable(pTable);
+        ready = 0;
+        xSemaphoreTake(otaLock, portMAX_DELAY);
+        for (int i = 0; i < otaNodeCount; i++)
+        {
+            ready += pOtaNodes[i].state == MESH_OTA_RECEIVING;
+        }
+        // nodes answer once their partition is erased, the routing table holds the root too
+        bool settled = otaNodeCount >= tableSize - 1;
+        xSemaphoreGive(otaLock);
+        if (settled)
+        {
+            break;
+        }
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    otaJoinOpen = false;
+    xSemaphoreGive(otaLock);
+    return ready;
+}
+
+// Copy node i of the session, returns false past the last one
+static bool otaNodeCopy(int i, otaNode_t* pNode)
+{
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    bool found = i < otaNodeCount;
+    if (found)
+    {
+        *pNode = pOtaNodes[i];
+    }
+    xSemaphoreGive(otaLock);
+    return found;
+}
+
+// Send a window, then ask the nodes for the chunks they miss and send those again
+static void otaRootWindow(uint16_t first, uint8_t count)
+{
+    uint8_t msg[OTA_QUERY_MSG_LEN] = { CMD_OTA_QUERY };
+    uint16_t misses[OTA_WINDOW];
+    otaNode_t node;
+
+    for (int i = 0; i < count; i++)
+    {
+        otaSendChunk(NULL, first + i);
+    }
+    putBE32(msg + 1, otaSession);
+    putBE16(msg + 5, first);
+    msg[7] = count;
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    otaQueryFirst = first;
+    otaQueryCount = count;
+    otaPhase = OTA_PHASE_WINDOW;
+    // until a node answers it counts as missing the whole window
+    for (int i = 0; i < otaNodeCount; i++)
+    {
+        memset(pOtaNodes[i].missing, 0xFF, sizeof(pOtaNodes[i].missing));
+    }
+    xSemaphoreGive(otaLock);
+    for (int round = 1; round <= CONFIG_MESH_OTA_ROUNDS; round++)
+    {
+        if (otaRootAsk() == 0)
+        {
+            return;
+        }
+        otaSend(NULL, msg, sizeof(msg), MESH_TRAFFIC_CONTROL);
+        int silent = otaRootWait(OTA_REPLY_WAIT_ms);
+
+        int missing = 0;
+        memset(misses, 0, sizeof(misses));
+        xSemaphoreTake(otaLock, portMAX_DELAY);
+        for (int i = 0; i < otaNodeCount; i++)
+        {
+            const otaNode_t* pNode = &pOtaNodes[i];
+            if (pNode->state != MESH_OTA_RECEIVING || !pNode->answered)
+            {
+                continue;
+            }
+            for (int chunk = 0; chunk < count; chunk++)
+            {
+                misses[chunk] += otaBitGet(pNode->missing, chunk);
+                missing += otaBitGet(pNode->missing, chunk);
+            }
+        }
+        xSemaphoreGive(otaLock);
+        if (missing == 0 && silent == 0)
+        {
+            return;
+        }
+        if (round == CONFIG_MESH_OTA_ROUNDS)
+        {
+            break;
+        }
+        ESP_LOGD(TAG, "Window %u round %d: %d chunks missing, %d nodes silent", first, round, missing, silent);
+        // nothing is sent again for silent nodes, their answers may only be late
+        // one broadcast costs less airtime than sending a chunk along the paths of several nodes
+        for (int chunk = 0; chunk < count; chunk++)
+        {
+            if (misses[chunk] > 1)
+            {
+                otaSendChunk(NULL, first + chunk);
+            }
+        }
+        for (int i = 0; otaNodeCopy(i, &node); i++)
+        {
+            for (int chunk = 0; chunk < count && node.state == MESH_OTA_RECEIVING && node.answered; chunk++)
+            {
+                if (misses[chunk] == 1 && otaBitGet(node.missing, chunk))
+                {
+                    otaSendChunk(&node.addr, first + chunk);
+                }
+            }
+        }
+    }
+    // nodes still missing chunks or silent would hold up the others, they are given up on
+    for (int i = 0; otaNodeCopy(i, &node); i++)
+    {
+        bool drop = false;
+        for (int chunk = 0; chunk < count && node.state == MESH_OTA_RECEIVING; chunk++)
+        {
+            drop |= otaBitGet(node.missing, chunk);
+        }
+        if (drop)
+        {
+            xSemaphoreTake(otaLock, portMAX_DELAY);
+            pOtaNodes[i].state = MESH_OTA_FAILED;
+            xSemaphoreGive(otaLock);
+            ESP_LOGW(TAG, "Node " MACSTR " given up on in window %u", MAC2STR(node.addr.addr), first);
+            otaSendEnd(&node.addr, false);
+        }
+    }
+}
+
+// Activate the image on the nodes that have all of it
+static void otaRootEnd(void)
+{
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    otaPhase = OTA_PHASE_END;
+    xSemaphoreGive(otaLock);
+    for (int round = 1; round <= CONFIG_MESH_OTA_ROUNDS; round++)
+    {
+        if (otaRootAsk() == 0)
+        {
+            return;
+        }
+        otaSendEnd(NULL, true);
+        if (otaRootWait(OTA_REPLY_WAIT_ms) == 0)
+        {
+            return;
+        }
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    for (int i = 0; i < otaNodeCount; i++)
+    {
+        if (!pOtaNodes[i].answered)
+        {
+            pOtaNodes[i].state = MESH_OTA_FAILED;
+        }
+    }
+    xSemaphoreGive(otaLock);
+}
+
+static void otaRootSession(void)
+{
+    int64_t startUs = esp_timer_get_time();
+    esp_err_t err;
+
+    memset(&otaSummary, 0, sizeof(otaSummary));
+    otaDataStartUs = 0;
+    ESP_LOGI(TAG, "Downloading %s", otaUrl);
+    err = otaDownload();
+    otaSummary.size = otaSize;
+    otaSummary.downloadMs = (esp_timer_get_time() - startUs) / 1000;
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Download failed after %u bytes, err code %d %s", otaSize, err, esp_err_to_name(err));
+        otaSummary.done = true;
+        otaSummary.err = err;
+        if (pOtaProgressCb)
+        {
+            pOtaProgressCb(&otaSummary, NULL, 0);
+        }
+        return;
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    otaSession = esp_random();
+    otaChunkSize = OTA_CHUNK_SIZE;
+    otaChunks = (otaSize + otaChunkSize - 1) / otaChunkSize;
+    pOtaNodes = calloc(OTA_MAX_NODES, sizeof(otaNode_t));
+    pOtaProgress = calloc(OTA_MAX_NODES, sizeof(meshOtaNodeProgress_t));
+    otaNodeCount = 0;
+    xSemaphoreGive(otaLock);
+    if (pOtaNodes == NULL || pOtaProgress == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for session %08x", otaSession);
+    }
+    else
+    {
+        int ready = otaRootOffer();
+        ESP_LOGI(TAG, "Session %08x: %u bytes in %u chunks downloaded in %u ms, %d nodes ready", otaSession,
+                otaSize, otaChunks, otaSummary.downloadMs, ready);
+        otaDataStartUs = esp_timer_get_time();
+        int64_t progressUs = otaDataStartUs + CONFIG_MESH_OTA_PROGRESS_S * 1000000LL;
+        for (uint32_t first = 0; ready && first < otaChunks; first += OTA_WINDOW)
+        {
+            otaRootWindow(first, otaChunks - first < OTA_WINDOW ? otaChunks - first : OTA_WINDOW);
+            if (esp_timer_get_time() >= progressUs)
+            {
+                otaRootProgress(false);
+                progressUs += CONFIG_MESH_OTA_PROGRESS_S * 1000000LL;
+            }
+        }
+        otaRootEnd();
+        otaRootProgress(true);
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    free(pOtaNodes);
+    free(pOtaProgress);
+    pOtaNodes = NULL;
+    pOtaProgress = NULL;
+    otaNodeCount = 0;
+    xSemaphoreGive(otaLock);
+    // the root updates itself too, also when no node took part
+    err = esp_ota_set_boot_partition(pOtaPartition);
+    ESP_LOGI(TAG, "Session %08x done in %u ms, boot partition set with err code %d %s", otaSession,
+            otaSummary.elapsedMs, err, esp_err_to_name(err));
+    if (err == ESP_OK && CONFIG_MESH_OTA_RESTART_DELAY_S)
+    {
+        // a little after the nodes, so they do not look for a new root first
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_MESH_OTA_RESTART_DELAY_S * 1000 + OTA_SPREAD_ms));
+        esp_restart();
+    }
+}
+
+static void otaTaskRun(void* arg)
+{
+    uint32_t events;
+
+    while (1)
+    {
+        xTaskNotifyWait(0, OTA_EVENT_START | OTA_EVENT_OFFER | OTA_EVENT_QUERY | OTA_EVENT_END, &events,
+                portMAX_DELAY);
+        if (events & OTA_EVENT_START)
+        {
+            otaRootSession();
+            __atomic_store_n(&otaRunning, false, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (events & OTA_EVENT_OFFER)
+        {
+            otaNodeOffer();
+        }
+        if (events & OTA_EVENT_QUERY)
+        {
+            xSemaphoreTake(otaLock, portMAX_DELAY);
+            uint16_t first = otaQueryFirst;
+            uint8_t count = otaQueryCount;
+            xSemaphoreGive(otaLock);
+            otaNodeReply(first, count);
+        }
+        if (events & OTA_EVENT_END)
+        {
+            otaNodeEnd();
+        }
+    }
+}
+
+static void otaRootStatus(const mesh_addr_t* pFrom, const uint8_t* pMsg, size_t len)
+{
+    uint8_t count = pMsg[11];
+
+    if (len < (size_t)OTA_STATUS_HDR_LEN + (count + 7) / 8 || count > OTA_WINDOW
+            || !__atomic_load_n(&otaRunning, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    otaNode_t* pNode = pOtaNodes && getBE32(pMsg + 1) == otaSession ? otaNodeGet(pFrom) : NULL;
+    // answers to an earlier window, or to the offer during a window or the end, are stale
+    bool current = otaPhase == OTA_PHASE_WINDOW ? getBE16(pMsg + 9) == otaQueryFirst && count == otaQueryCount
+            : count == 0 && (otaPhase == OTA_PHASE_OFFER || pMsg[5] != MESH_OTA_RECEIVING);
+    if (pNode && current)
+    {
+        // a node given up on stays failed
+        pNode->state = pNode->state == MESH_OTA_FAILED ? MESH_OTA_FAILED : pMsg[5];
+        pNode->layer = pMsg[6];
+        pNode->received = getBE16(pMsg + 7);
+        pNode->answered = true;
+        memset(pNode->missing, 0, sizeof(pNode->missing));
+        memcpy(pNode->missing, pMsg + OTA_STATUS_HDR_LEN, (count + 7) / 8);
+        xTaskNotify(otaTask, OTA_EVENT_STATUS, eSetBits);
+    }
+    xSemaphoreGive(otaLock);
+}
+
+/*******************************************************
+ *                Interface
+ *******************************************************/
+
+static void otaValidateTimeout(void* arg)
+{
+    ESP_LOGE(TAG, "Image not confirmed within %d s, rolling back", CONFIG_MESH_OTA_VALIDATE_S);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+esp_err_t meshOtaInit(meshOtaProgressCb_t* pCb)
+{
+    esp_ota_img_states_t state;
+
+    if (otaLock)
+    {
+        pOtaProgressCb = pCb;
+        return ESP_OK;
+    }
+    otaLock = xSemaphoreCreateMutex();
+    if (otaLock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(otaTaskRun, "ota task", OTA_TASK_STACK, NULL, OTA_TASK_PRIORITY, &otaTask) != pdPASS)
+    {
+        vSemaphoreDelete(otaLock);
+        otaLock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    pOtaProgressCb = pCb;
+#if !CONFIG_SECURE_SIGNED_ON_UPDATE
+    ESP_LOGW(TAG, "Image signatures are not checked, any client of the broker can update the mesh");
+#endif
+    const esp_partition_t* pRunning = esp_ota_get_running_partition();
+    if (esp_ota_get_state_partition(pRunning, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        esp_timer_create_args_t timerArgs = { .callback = otaValidateTimeout, .name = "ota validate" };
+        ESP_LOGW(TAG, "Image in %s waits for verification", pRunning->label);
+        if (esp_timer_create(&timerArgs, &otaValidateTimer) == ESP_OK)
+        {
+            esp_timer_start_once(otaValidateTimer, CONFIG_MESH_OTA_VALIDATE_S * 1000000ULL);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t meshOtaStart(const char* pUrl)
+{
+    if (otaLock == NULL || !esp_mesh_is_root())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (strlen(pUrl) >= sizeof(otaUrl))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (__atomic_exchange_n(&otaRunning, true, __ATOMIC_ACQ_REL))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    strcpy(otaUrl, pUrl);
+    xTaskNotify(otaTask, OTA_EVENT_START, eSetBits);
+    return ESP_OK;
+}
+
+void meshOtaConfirm(void)
+{
+    esp_ota_img_states_t state;
+
+    if (otaValidateTimer == NULL
+            || esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK
+            || state != ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        return;
+    }
+    esp_timer_stop(otaValidateTimer);
+    esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    ESP_LOGI(TAG, "Image confirmed with err code %d %s", err, esp_err_to_name(err));
+}
+
+esp_err_t meshOtaReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    static const uint8_t lengths[] = { OTA_OFFER_MSG_LEN, OTA_DATA_HDR_LEN + 1, OTA_QUERY_MSG_LEN,
+            OTA_STATUS_HDR_LEN, OTA_END_MSG_LEN };
+    const uint8_t* pMsg = pData->data;
+    uint32_t event = 0;
+
+    if (otaLock == NULL || !MESH_OTA_IS_CMD(pMsg[0]) || pData->size < lengths[pMsg[0] - CMD_OTA_OFFER])
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (pMsg[0] == CMD_OTA_STATUS)
+    {
+        otaRootStatus(pFrom, pMsg, pData->size);
+        return ESP_OK;
+    }
+    if (esp_mesh_is_root())
+    {
+        return ESP_OK;
+    }
+    if (pMsg[0] == CMD_OTA_DATA)
+    {
+        otaNodeData(pMsg, pData->size);
+        return ESP_OK;
+    }
+    xSemaphoreTake(otaLock, portMAX_DELAY);
+    if (pMsg[0] == CMD_OTA_OFFER)
+    {
+        uint16_t chunkSize = getBE16(pMsg + 9);
+        uint32_t size = getBE32(pMsg + 5);
+        if (chunkSize && size && (size + chunkSize - 1) / chunkSize <= OTA_MAX_CHUNKS)
+        {
+            otaRoot = *pFrom;
+            otaOfferSession = getBE32(pMsg + 1);
+            otaOfferSize = size;
+            otaOfferChunkSize = chunkSize;
+            event = OTA_EVENT_OFFER;
+        }
+    }
+    else if (getBE32(pMsg + 1) == otaSession && otaState != MESH_OTA_IDLE)
+    {
+        if (pMsg[0] == CMD_OTA_QUERY && pMsg[7] <= OTA_WINDOW)
+        {
+            otaQueryFirst = getBE16(pMsg + 5);
+            otaQueryCount = pMsg[7];
+            event = OTA_EVENT_QUERY;
+        }
+        else if (pMsg[0] == CMD_OTA_END)
+        {
+            otaCommit = pMsg[5];
+            event = OTA_EVENT_END;
+        }
+    }
+    xSemaphoreGive(otaLock);
+    if (event)
+    {
+        xTaskNotify(otaTask, event, eSetBits);
+    }
+    return ESP_OK;
+}
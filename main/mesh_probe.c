@@ -0,0 +1,260 @@
+#include "mesh_probe.h"
+#include "mesh_netif.h"
+#include "mesh_sched.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include <string.h> // for memcpy,memset
+
+#define PROBE_REQUEST_LEN   (1 + 4 + 4 + 1)
+#define PROBE_REPLY_LEN     (PROBE_REQUEST_LEN + 1)
+
+typedef struct
+{
+    bool valid;      // address known
+    bool pending;    // a probe is out, it is lost if the next one is sent before its reply arrives
+    uint32_t seq;
+    mesh_addr_t addr;
+} probeTarget_t;
+
+static const char* TAG = "mesh_probe";
+static SemaphoreHandle_t probeLock = NULL;
+static probeTarget_t probeTargets[MESH_PROBE_DESTINATIONS] = { 0 };
+static meshProbeStats_t probeStats = { 0 };
+static uint32_t probeSeq = 0;
+static int probeNodeIndex = 0; // root: next routing table entry to probe
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void putBE32(uint8_t* p, uint32_t value)
+{
+    putBE16(p, value >> 16);
+    putBE16(p + 2, value & 0xFFFF);
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t)getBE16(p) << 16) | getBE16(p + 2);
+}
+
+static void probeHistogramClear(meshProbeHistogram_t* pHistogram)
+{
+    memset(pHistogram, 0, sizeof(*pHistogram));
+    pHistogram->minUs = UINT32_MAX;
+}
+
+static void probeHistogramAdd(meshProbeHistogram_t* pHistogram, uint32_t rttUs)
+{
+    uint32_t ms = rttUs / 1000;
+    int bucket = ms ? 32 - __builtin_clz(ms) : 0;
+
+    pHistogram->received++;
+    pHistogram->sumUs += rttUs;
+    pHistogram->minUs = rttUs < pHistogram->minUs ? rttUs : pHistogram->minUs;
+    pHistogram->maxUs = rttUs > pHistogram->maxUs ? rttUs : pHistogram->maxUs;
+    pHistogram->buckets[bucket < MESH_PROBE_BUCKETS ? bucket : MESH_PROBE_BUCKETS - 1]++;
+}
+
+static void probeSend(meshProbeDestination_t destination)
+{
+    uint8_t msg[PROBE_REQUEST_LEN] = { CMD_PROBE_REQUEST };
+    probeTarget_t* pTarget = &probeTargets[destination];
+    mesh_addr_t to;
+
+    xSemaphoreTake(probeLock, portMAX_DELAY);
+    if (!pTarget->valid)
+    {
+        xSemaphoreGive(probeLock);
+        return;
+    }
+    to = pTarget->addr;
+    pTarget->seq = ++probeSeq;
+    pTarget->pending = true;
+    probeStats.addresses[destination] = to;
+    probeStats.destinations[destination].sent++;
+    putBE32(msg + 1, pTarget->seq);
+    xSemaphoreGive(probeLock);
+
+    putBE32(msg + 5, (uint32_t)esp_timer_get_time());
+    msg[9] = esp_mesh_get_layer();
+    mesh_data_t data = { .data = msg, .size = sizeof(msg), .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+    // probes take the queue of keypresses, so they see the latency users see; a probe not sent counts as lost
+    esp_err_t err = meshNetifSendRaw(&to, &data, MESH_TRAFFIC_INTERACTIVE);
+    if (err != ESP_OK)
+    {
+        ESP_LOGD(TAG, "Probe not sent, err code %d %s", err, esp_err_to_name(err));
+    }
+}
+
+// Root: aim the node probe at the next entry of the routing table other than the root itself
+static void probeNextNode(void)
+{
+    const mesh_addr_t* pTable;
+    int size;
+    uint8_t self[MAC_ADDR_LEN];
+
+    esp_wifi_get_mac(WIFI_IF_STA, self);
+    meshNetifGetRoutingTable(&pTable, &size);
+    for (int i = 0; i < size; i++)
+    {
+        probeNodeIndex = (probeNodeIndex + 1) % size;
+        if (!MAC_ADDR_EQUAL(pTable[probeNodeIndex].addr, self))
+        {
+            xSemaphoreTake(probeLock, portMAX_DELAY);
+            probeTargets[MESH_PROBE_NODES].addr = pTable[probeNodeIndex];
+            probeTargets[MESH_PROBE_NODES].valid = true;
+            xSemaphoreGive(probeLock);
+            break;
+        }
+    }
+    meshNetifReleaseRoutingTable(pTable);
+}
+
+// Scheduler job, devices powered on together do not probe in step
+static void probeRun(void* arg)
+{
+    if (esp_mesh_is_root())
+    {
+        probeNextNode();
+        probeSend(MESH_PROBE_NODES);
+    }
+    else
+    {
+        probeSend(MESH_PROBE_PARENT);
+        probeSend(MESH_PROBE_ROOT);
+    }
+}
+
+static void probeReply(const mesh_addr_t* pFrom, const uint8_t* pRequest)
+{
+    uint8_t msg[PROBE_REPLY_LEN];
+
+    memcpy(msg, pRequest, PROBE_REQUEST_LEN);
+    msg[0] = CMD_PROBE_REPLY;
+    msg[PROBE_REQUEST_LEN] = esp_mesh_get_layer();
+    mesh_data_t data = { .data = msg, .size = sizeof(msg), .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+    esp_err_t err = meshNetifSendRaw(pFrom, &data, MESH_TRAFFIC_INTERACTIVE);
+    if (err != ESP_OK)
+    {
+        ESP_LOGD(TAG, "Probe reply not sent, err code %d %s", err, esp_err_to_name(err));
+    }
+}
+
+static void probeReplyInput(const uint8_t* pReply)
+{
+    uint32_t seq = getBE32(pReply + 1);
+    uint32_t rttUs = (uint32_t)esp_timer_get_time() - getBE32(pReply + 5);
+    uint8_t layer = pReply[PROBE_REQUEST_LEN];
+
+    xSemaphoreTake(probeLock, portMAX_DELAY);
+    for (int i = 0; i < MESH_PROBE_DESTINATIONS; i++)
+    {
+        probeTarget_t* pTarget = &probeTargets[i];
+        if (pTarget->pending && pTarget->seq == seq)
+        {
+            pTarget->pending = false;
+            probeHistogramAdd(&probeStats.destinations[i], rttUs);
+            // the layer of a node is only known from its reply, so layers count no losses
+            if (i == MESH_PROBE_NODES && layer >= 1 && layer <= CONFIG_MESH_MAX_LAYER)
+            {
+                probeStats.layers[layer - 1].sent++;
+                probeHistogramAdd(&probeStats.layers[layer - 1], rttUs);
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(probeLock);
+}
+
+esp_err_t meshProbeInit(void)
+{
+    meshSchedJob_t job;
+
+    if (probeLock != NULL)
+    {
+        return ESP_OK;
+    }
+    probeLock = xSemaphoreCreateMutex();
+    if (probeLock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < MESH_PROBE_DESTINATIONS; i++)
+    {
+        probeHistogramClear(&probeStats.destinations[i]);
+    }
+    for (int i = 0; i < CONFIG_MESH_MAX_LAYER; i++)
+    {
+        probeHistogramClear(&probeStats.layers[i]);
+    }
+    return meshSchedAdd("probe", CONFIG_MESH_PROBE_INTERVAL_MS, probeRun, NULL, &job);
+}
+
+void meshProbeSetParent(const mesh_addr_t* pBssid)
+{
+    xSemaphoreTake(probeLock, portMAX_DELAY);
+    probeTargets[MESH_PROBE_PARENT].valid = pBssid != NULL;
+    probeTargets[MESH_PROBE_PARENT].pending = false;
+    if (pBssid)
+    {
+        // nodes associate with the softAP of their parent, its mesh address is the station MAC one below
+        probeTargets[MESH_PROBE_PARENT].addr = *pBssid;
+        probeTargets[MESH_PROBE_PARENT].addr.addr[5]--;
+    }
+    xSemaphoreGive(probeLock);
+}
+
+void meshProbeSetRoot(const mesh_addr_t* pRoot)
+{
+    xSemaphoreTake(probeLock, portMAX_DELAY);
+    probeTargets[MESH_PROBE_ROOT].valid = true;
+    probeTargets[MESH_PROBE_ROOT].pending = false;
+    probeTargets[MESH_PROBE_ROOT].addr = *pRoot;
+    xSemaphoreGive(probeLock);
+}
+
+esp_err_t meshProbeReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    if (probeLock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (pData->data[0] == CMD_PROBE_REQUEST && pData->size == PROBE_REQUEST_LEN)
+    {
+        probeReply(pFrom, pData->data);
+        return ESP_OK;
+    }
+    if (pData->data[0] == CMD_PROBE_REPLY && pData->size == PROBE_REPLY_LEN)
+    {
+        probeReplyInput(pData->data);
+        return ESP_OK;
+    }
+    return ESP_ERR_INVALID_SIZE;
+}
+
+void meshProbeTakeStats(meshProbeStats_t* pStats)
+{
+    xSemaphoreTake(probeLock, portMAX_DELAY);
+    *pStats = probeStats;
+    for (int i = 0; i < MESH_PROBE_DESTINATIONS; i++)
+    {
+        probeHistogramClear(&probeStats.destinations[i]);
+    }
+    for (int i = 0; i < CONFIG_MESH_MAX_LAYER; i++)
+    {
+        probeHistogramClear(&probeStats.layers[i]);
+    }
+    xSemaphoreGive(probeLock);
+}
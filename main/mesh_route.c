@@ -0,0 +1,422 @@
+#include "mesh_route.h"
+#include "mesh_netif.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include <stdlib.h> // for qsort
+#include <string.h> // for memcpy,memcmp,memset
+
+#define ROUTE_ENTRY_SIZE      (6)
+#define ROUTE_FULL_HDR_LEN    (1 + 4)
+#define ROUTE_DELTA_HDR_LEN   (1 + 4 + 4 + 2 + 2)
+#define ROUTE_VERSION_MSG_LEN (1 + 4)
+#define ROUTE_PART_HDR_LEN    (1 + 4 + 2 + 2)
+#define ROUTE_TABLE_LEN       (ROUTE_DELTA_HDR_LEN + CONFIG_MESH_ROUTE_TABLE_SIZE * ROUTE_ENTRY_SIZE)
+// messages stay within the largest raw message, full tables beyond it go out in parts
+#define ROUTE_MSG_MAX_LEN \
+    (ROUTE_TABLE_LEN < CONFIG_MESH_RAW_MAX_SIZE ? ROUTE_TABLE_LEN : CONFIG_MESH_RAW_MAX_SIZE)
+#define ROUTE_DELTA_MAX_ENTRIES ((ROUTE_MSG_MAX_LEN - ROUTE_DELTA_HDR_LEN) / ROUTE_ENTRY_SIZE) // larger deltas resync
+#define ROUTE_PART_MAX_ENTRIES  ((ROUTE_MSG_MAX_LEN - ROUTE_PART_HDR_LEN) / ROUTE_ENTRY_SIZE)
+#define ROUTE_RESYNC_HOLDOFF_us (1000 * 1000)
+
+typedef struct
+{
+    uint32_t version;
+    int size;
+    mesh_addr_t entries[CONFIG_MESH_ROUTE_TABLE_SIZE]; // sorted by address so tables can be diffed in one pass
+} routeTable_t;
+
+static const char* TAG = "mesh_route";
+static SemaphoreHandle_t routeLock = NULL;
+static routeTable_t routeTable = { 0 };        // table held, distributed by the root or received by a node
+static routeTable_t routeStage = { 0 };        // node: table received in parts, held once all arrived
+static int routeStageTotal = 0;                // node: entries of the table in routeStage, 0 without one
+static uint32_t routeNetifVersion = 0;         // root: netif routing table version the held table was built from
+static int64_t routeLastResyncUs = 0;
+static meshRouteStats_t routeStats = { 0 };
+static uint8_t routeTxBuffer[ROUTE_MSG_MAX_LEN]; // messages larger than MESH_MPS are fragmented by mesh_netif
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void putBE32(uint8_t* p, uint32_t value)
+{
+    putBE16(p, value >> 16);
+    putBE16(p + 2, value & 0xFFFF);
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t)getBE16(p) << 16) | getBE16(p + 2);
+}
+
+static int routeEntryCompare(const void* a, const void* b)
+{
+    return memcmp(a, b, ROUTE_ENTRY_SIZE);
+}
+
+static void routeSend(const mesh_addr_t* pTo, size_t len)
+{
+    mesh_data_t data = { .data = routeTxBuffer, .size = len, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+    esp_err_t err = meshNetifSendRaw(pTo, &data, MESH_TRAFFIC_CONTROL);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Routing command 0x%02x not sent, err code %d %s", routeTxBuffer[0], err, esp_err_to_name(err));
+        return;
+    }
+    routeStats.bytesSent += len;
+}
+
+static void routeSendVersion(const mesh_addr_t* pTo, uint8_t cmd, uint32_t version)
+{
+    routeTxBuffer[0] = cmd;
+    putBE32(routeTxBuffer + 1, version);
+    routeSend(pTo, ROUTE_VERSION_MSG_LEN);
+}
+
+// Send the whole held table, in parts if it is larger than one message, call with routeLock taken
+static void routeSendFull(const mesh_addr_t* pTo)
+{
+    if (ROUTE_FULL_HDR_LEN + routeTable.size * ROUTE_ENTRY_SIZE <= ROUTE_MSG_MAX_LEN)
+    {
+        routeTxBuffer[0] = CMD_ROUTE_TABLE;
+        putBE32(routeTxBuffer + 1, routeTable.version);
+        memcpy(routeTxBuffer + ROUTE_FULL_HDR_LEN, routeTable.entries, routeTable.size * ROUTE_ENTRY_SIZE);
+        routeSend(pTo, ROUTE_FULL_HDR_LEN + routeTable.size * ROUTE_ENTRY_SIZE);
+    }
+    else
+    {
+        for (int offset = 0; offset < routeTable.size; offset += ROUTE_PART_MAX_ENTRIES)
+        {
+            int count = routeTable.size - offset < ROUTE_PART_MAX_ENTRIES ? routeTable.size - offset
+                    : ROUTE_PART_MAX_ENTRIES;
+            routeTxBuffer[0] = CMD_ROUTE_PART;
+            putBE32(routeTxBuffer + 1, routeTable.version);
+            putBE16(routeTxBuffer + 5, offset);
+            putBE16(routeTxBuffer + 7, routeTable.size);
+            memcpy(routeTxBuffer + ROUTE_PART_HDR_LEN, &routeTable.entries[offset], count * ROUTE_ENTRY_SIZE);
+            routeSend(pTo, ROUTE_PART_HDR_LEN + count * ROUTE_ENTRY_SIZE);
+        }
+    }
+    routeStats.fullSent++;
+}
+
+/**
+ * @brief Write the differences of two sorted tables as a delta message into routeTxBuffer
+ *
+ * @return message length, 0 if the delta is larger than ROUTE_DELTA_MAX_ENTRIES
+ */
+static size_t routeDeltaBuild(const routeTable_t* pOld, const routeTable_t* pNew)
+{
+    uint8_t* pEntry = routeTxBuffer + ROUTE_DELTA_HDR_LEN;
+    int added = 0;
+    int removed = 0;
+
+    // added entries first, removed ones behind them
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const routeTable_t* pFrom = pass ? pOld : pNew;
+        const routeTable_t* pOther = pass ? pNew : pOld;
+        int j = 0;
+        for (int i = 0; i < pFrom->size; i++)
+        {
+            while (j < pOther->size && routeEntryCompare(&pOther->entries[j], &pFrom->entries[i]) < 0)
+            {
+                j++;
+            }
+            if (j < pOther->size && routeEntryCompare(&pOther->entries[j], &pFrom->entries[i]) == 0)
+            {
+                continue;
+            }
+            if (added + removed >= ROUTE_DELTA_MAX_ENTRIES)
+            {
+                return 0;
+            }
+            memcpy(pEntry, &pFrom->entries[i], ROUTE_ENTRY_SIZE);
+            pEntry += ROUTE_ENTRY_SIZE;
+            if (pass)
+            {
+                removed++;
+            }
+            else
+            {
+                added++;
+            }
+        }
+    }
+    routeTxBuffer[0] = CMD_ROUTE_DELTA;
+    putBE32(routeTxBuffer + 1, pOld->version);
+    putBE32(routeTxBuffer + 5, pNew->version);
+    putBE16(routeTxBuffer + 9, added);
+    putBE16(routeTxBuffer + 11, removed);
+    return pEntry - routeTxBuffer;
+}
+
+// Apply a delta to the held table, a delta that does not fit leaves the table unchanged, call with routeLock taken
+static esp_err_t routeDeltaApply(const uint8_t* pEntries, int added, int removed, uint32_t version)
+{
+    const uint8_t* pRemoved = pEntries + added * ROUTE_ENTRY_SIZE;
+    int size = 0;
+
+    for (int i = 0; i < routeTable.size; i++)
+    {
+        if (bsearch(&routeTable.entries[i], pRemoved, removed, ROUTE_ENTRY_SIZE, routeEntryCompare) == NULL)
+        {
+            size++;
+        }
+    }
+    if (size + added > CONFIG_MESH_ROUTE_TABLE_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size = 0;
+    for (int i = 0; i < routeTable.size; i++)
+    {
+        if (bsearch(&routeTable.entries[i], pRemoved, removed, ROUTE_ENTRY_SIZE, routeEntryCompare) == NULL)
+        {
+            routeTable.entries[size++] = routeTable.entries[i];
+        }
+    }
+    memcpy(&routeTable.entries[size], pEntries, added * ROUTE_ENTRY_SIZE);
+    routeTable.size = size + added;
+    qsort(routeTable.entries, routeTable.size, ROUTE_ENTRY_SIZE, routeEntryCompare);
+    routeTable.version = version;
+    return ESP_OK;
+}
+
+static void routeTableApply(void)
+{
+    ESP_LOGI(TAG, "Routing table version %u, %d entries", routeTable.version, routeTable.size);
+    meshNetifRoutingTableSet(routeTable.entries, routeTable.size);
+}
+
+// Ask the root for the full table, at most once per holdoff period
+static void routeRequestResync(const mesh_addr_t* pRoot)
+{
+    int64_t now = esp_timer_get_time();
+    if (routeLastResyncUs && now - routeLastResyncUs < ROUTE_RESYNC_HOLDOFF_us)
+    {
+        return;
+    }
+    routeLastResyncUs = now;
+    routeStats.resyncs++;
+    routeSendVersion(pRoot, CMD_ROUTE_RESYNC, routeTable.version);
+}
+
+static void routeReceiveFull(uint32_t version, const uint8_t* pEntries, int count)
+{
+    if (count > CONFIG_MESH_ROUTE_TABLE_SIZE)
+    {
+        ESP_LOGE(TAG, "Routing table of %d entries does not fit", count);
+        return;
+    }
+    memcpy(routeTable.entries, pEntries, count * ROUTE_ENTRY_SIZE);
+    routeTable.size = count;
+    routeTable.version = version;
+    routeTableApply();
+}
+
+// Collect the parts of a full table, a missing part leaves the held table at its version, so the next heartbeat
+// asks for the table again, call with routeLock taken
+static esp_err_t routeReceivePart(uint32_t version, int offset, int total, const uint8_t* pEntries, int count)
+{
+    if (total > CONFIG_MESH_ROUTE_TABLE_SIZE || offset + count > total)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (offset == 0)
+    {
+        routeStage.version = version;
+        routeStage.size = 0;
+        routeStageTotal = total;
+    }
+    if (routeStageTotal == 0 || version != routeStage.version || total != routeStageTotal
+            || offset != routeStage.size)
+    {
+        routeStageTotal = 0;
+        return ESP_OK;
+    }
+    memcpy(&routeStage.entries[offset], pEntries, count * ROUTE_ENTRY_SIZE);
+    routeStage.size += count;
+    if (routeStage.size == total)
+    {
+        routeStageTotal = 0;
+        routeReceiveFull(version, (const uint8_t*)routeStage.entries, total);
+    }
+    return ESP_OK;
+}
+
+esp_err_t meshRouteInit(void)
+{
+    if (routeLock == NULL)
+    {
+        routeLock = xSemaphoreCreateMutex();
+        if (routeLock == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        // a new root must not continue the version sequence of an old one by chance
+        routeTable.version = esp_random();
+    }
+    return ESP_OK;
+}
+
+void meshRouteRootUpdate(void)
+{
+    static routeTable_t next;
+    const mesh_addr_t* pTable;
+    int size;
+
+    if (!esp_mesh_is_root() || routeLock == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(routeLock, portMAX_DELAY);
+    uint32_t netifVersion = meshNetifGetRoutingTable(&pTable, &size);
+    if (netifVersion == routeNetifVersion)
+    {
+        meshNetifReleaseRoutingTable(pTable);
+        xSemaphoreGive(routeLock);
+        return;
+    }
+    routeNetifVersion = netifVersion;
+    memcpy(next.entries, pTable, size * sizeof(mesh_addr_t));
+    meshNetifReleaseRoutingTable(pTable);
+    next.size = size;
+    qsort(next.entries, next.size, ROUTE_ENTRY_SIZE, routeEntryCompare);
+    if (next.size != routeTable.size || memcmp(next.entries, routeTable.entries, size * sizeof(mesh_addr_t)) != 0)
+    {
+        next.version = routeTable.version + 1;
+        size_t len = routeDeltaBuild(&routeTable, &next);
+        routeTable = next;
+        if (len)
+        {
+            routeSend(NULL, len);
+            routeStats.deltasSent++;
+        }
+        else
+        {
+            // too many changes for one delta, nodes resync on the version
+            routeSendVersion(NULL, CMD_ROUTE_HEARTBEAT, routeTable.version);
+            routeStats.heartbeats++;
+        }
+        ESP_LOGI(TAG, "Routing table version %u, %d entries", routeTable.version, routeTable.size);
+    }
+    xSemaphoreGive(routeLock);
+}
+
+void meshRouteHeartbeat(void)
+{
+    if (!esp_mesh_is_root() || routeLock == NULL)
+    {
+        return;
+    }
+    meshRouteRootUpdate();
+    xSemaphoreTake(routeLock, portMAX_DELAY);
+    routeSendVersion(NULL, CMD_ROUTE_HEARTBEAT, routeTable.version);
+    routeStats.heartbeats++;
+    xSemaphoreGive(routeLock);
+}
+
+esp_err_t meshRouteReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    const uint8_t* pMsg = pData->data;
+    esp_err_t err = ESP_OK;
+
+    if (pData->size < ROUTE_VERSION_MSG_LEN || routeLock == NULL)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint32_t version = getBE32(pMsg + 1);
+    bool isRoot = esp_mesh_is_root();
+
+    xSemaphoreTake(routeLock, portMAX_DELAY);
+    if (pMsg[0] == CMD_ROUTE_RESYNC && isRoot)
+    {
+        ESP_LOGD(TAG, "Resync of " MACSTR " from version %u", MAC2STR(pFrom->addr), version);
+        routeStats.resyncs++;
+        routeSendFull(pFrom);
+    }
+    else if (pMsg[0] == CMD_ROUTE_HEARTBEAT && !isRoot)
+    {
+        if (version != routeTable.version)
+        {
+            routeRequestResync(pFrom);
+        }
+    }
+    else if (pMsg[0] == CMD_ROUTE_DELTA && !isRoot)
+    {
+        int added = pData->size >= ROUTE_DELTA_HDR_LEN ? getBE16(pMsg + 9) : 0;
+        int removed = pData->size >= ROUTE_DELTA_HDR_LEN ? getBE16(pMsg + 11) : 0;
+        if (pData->size < ROUTE_DELTA_HDR_LEN || pData->size != ROUTE_DELTA_HDR_LEN + (added + removed) * ROUTE_ENTRY_SIZE)
+        {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+        else if (version == routeTable.version)
+        {
+            uint32_t newVersion = getBE32(pMsg + 5);
+            if (routeDeltaApply(pMsg + ROUTE_DELTA_HDR_LEN, added, removed, newVersion) == ESP_OK)
+            {
+                routeTableApply();
+            }
+            else
+            {
+                routeRequestResync(pFrom);
+            }
+        }
+        else if (getBE32(pMsg + 5) != routeTable.version)
+        {
+            routeRequestResync(pFrom);
+        }
+    }
+    else if (pMsg[0] == CMD_ROUTE_TABLE && !isRoot)
+    {
+        int count = pData->size >= ROUTE_FULL_HDR_LEN ? (pData->size - ROUTE_FULL_HDR_LEN) / ROUTE_ENTRY_SIZE : 0;
+        if (pData->size < ROUTE_FULL_HDR_LEN || pData->size != ROUTE_FULL_HDR_LEN + count * ROUTE_ENTRY_SIZE)
+        {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+        else
+        {
+            routeReceiveFull(version, pMsg + ROUTE_FULL_HDR_LEN, count);
+        }
+    }
+    else if (pMsg[0] == CMD_ROUTE_PART && !isRoot)
+    {
+        int count = pData->size >= ROUTE_PART_HDR_LEN ? (pData->size - ROUTE_PART_HDR_LEN) / ROUTE_ENTRY_SIZE : 0;
+        if (pData->size < ROUTE_PART_HDR_LEN || pData->size != ROUTE_PART_HDR_LEN + count * ROUTE_ENTRY_SIZE)
+        {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+        else
+        {
+            err = routeReceivePart(version, getBE16(pMsg + 5), getBE16(pMsg + 7), pMsg + ROUTE_PART_HDR_LEN, count);
+        }
+    }
+    xSemaphoreGive(routeLock);
+    return err;
+}
+
+void meshRouteGetStats(meshRouteStats_t* pStats)
+{
+    if (routeLock == NULL)
+    {
+        memset(pStats, 0, sizeof(*pStats));
+        return;
+    }
+    xSemaphoreTake(routeLock, portMAX_DELAY);
+    *pStats = routeStats;
+    pStats->version = routeTable.version;
+    pStats->size = routeTable.size;
+    xSemaphoreGive(routeLock);
+}
@@ -0,0 +1,222 @@
+#include "mesh_sched.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define SCHED_TASK_STACK (3072) // the jobs run on it, publishing metrics and traces is the deepest
+
+_Static_assert(MESH_SCHED_JOBS_MAX <= 32, "triggers are a bit per job");
+
+// a task per lane, interactive jobs run at a higher priority than the periodic ones
+typedef enum
+{
+    SCHED_LANE_PERIODIC,
+    SCHED_LANE_INTERACTIVE,
+    SCHED_LANE_MAX
+} schedLane_t;
+
+typedef struct
+{
+    const char* pName;
+    meshSchedJobCb_t* pCb;
+    void* pArg;
+    int64_t periodUs; // 0 for jobs run only when triggered
+    int64_t baseUs;   // run time without jitter, advanced by whole periods so jitter does not add up
+    int64_t nextUs;
+    schedLane_t lane;
+} schedJob_t;
+
+static const char* TAG = "mesh_sched";
+
+static SemaphoreHandle_t schedLock = NULL;
+static TaskHandle_t schedTasks[SCHED_LANE_MAX];
+static schedJob_t schedJobs[MESH_SCHED_JOBS_MAX];
+static int schedJobCount = 0;
+// bit per job for each lane, set from tasks and interrupts without the lock
+static uint32_t schedTriggered[SCHED_LANE_MAX];
+
+// Random offset of up to CONFIG_MESH_SCHED_JITTER_PERCENT of the period in both directions
+static int64_t schedJitterUs(int64_t periodUs)
+{
+    int64_t jitterUs = periodUs * CONFIG_MESH_SCHED_JITTER_PERCENT / 100;
+
+    return jitterUs ? (int64_t)(esp_random() % (2 * jitterUs + 1)) - jitterUs : 0;
+}
+
+// Plan the first run at a random phase within the period, call with schedLock taken
+static void schedStart(schedJob_t* pJob, int64_t nowUs)
+{
+    pJob->baseUs = pJob->periodUs ? nowUs + esp_random() % pJob->periodUs : 0;
+    pJob->nextUs = pJob->baseUs;
+}
+
+// Plan the run after a periodic one, call with schedLock taken
+static void schedAdvance(schedJob_t* pJob, int64_t nowUs)
+{
+    pJob->baseUs += pJob->periodUs;
+    if (pJob->baseUs <= nowUs)
+    {
+        // runs missed while a job took long are skipped, not caught up back to back
+        pJob->baseUs = nowUs + pJob->periodUs;
+    }
+    pJob->nextUs = pJob->baseUs + schedJitterUs(pJob->periodUs);
+}
+
+// Run the jobs of the lane arg
+static void schedTaskRun(void* arg)
+{
+    schedLane_t lane = (schedLane_t)(intptr_t)arg;
+
+    while (1)
+    {
+        uint32_t triggered = __atomic_exchange_n(&schedTriggered[lane], 0, __ATOMIC_ACQUIRE);
+        int64_t nextUs = INT64_MAX;
+
+        xSemaphoreTake(schedLock, portMAX_DELAY);
+        int count = schedJobCount;
+        xSemaphoreGive(schedLock);
+        for (int i = 0; i < count; i++)
+        {
+            schedJob_t* pJob = &schedJobs[i];
+            if (pJob->lane != lane)
+            {
+                continue;
+            }
+            int64_t nowUs = esp_timer_get_time();
+            xSemaphoreTake(schedLock, portMAX_DELAY);
+            bool due = pJob->periodUs && pJob->nextUs <= nowUs;
+            if (due)
+            {
+                schedAdvance(pJob, nowUs);
+            }
+            xSemaphoreGive(schedLock);
+            if (due || (triggered & (1u << i)))
+            {
+                pJob->pCb(pJob->pArg);
+            }
+        }
+        xSemaphoreTake(schedLock, portMAX_DELAY);
+        for (int i = 0; i < schedJobCount; i++)
+        {
+            if (schedJobs[i].lane == lane && schedJobs[i].periodUs && schedJobs[i].nextUs < nextUs)
+            {
+                nextUs = schedJobs[i].nextUs;
+            }
+        }
+        xSemaphoreGive(schedLock);
+        int64_t waitUs = nextUs - esp_timer_get_time();
+        if (waitUs > 0)
+        {
+            // one tick more, so a wait shorter than a tick does not return before the job is due
+            ulTaskNotifyTake(pdTRUE, nextUs == INT64_MAX ? portMAX_DELAY : pdMS_TO_TICKS(waitUs / 1000) + 1);
+        }
+    }
+}
+
+esp_err_t meshSchedInit(void)
+{
+    if (schedLock)
+    {
+        return ESP_OK;
+    }
+    schedLock = xSemaphoreCreateMutex();
+    if (schedLock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    static const char* names[SCHED_LANE_MAX] = { "sched task", "sched ui task" };
+    static const UBaseType_t priorities[SCHED_LANE_MAX] = { 5, 6 };
+    for (int i = 0; i < SCHED_LANE_MAX; i++)
+    {
+        if (xTaskCreate(schedTaskRun, names[i], SCHED_TASK_STACK, (void*)(intptr_t)i, priorities[i], &schedTasks[i])
+                != pdPASS)
+        {
+            while (--i >= 0)
+            {
+                vTaskDelete(schedTasks[i]);
+            }
+            vSemaphoreDelete(schedLock);
+            schedLock = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t schedAdd(schedLane_t lane, const char* pName, uint32_t periodMs, meshSchedJobCb_t* pCb,
+        void* pArg, meshSchedJob_t* pJob)
+{
+    esp_err_t err = ESP_OK;
+
+    if (schedLock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(schedLock, portMAX_DELAY);
+    if (schedJobCount == MESH_SCHED_JOBS_MAX)
+    {
+        ESP_LOGE(TAG, "No room for job %s, raise CONFIG_MESH_SCHED_JOBS_MAX", pName);
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        schedJob_t* pNew = &schedJobs[schedJobCount];
+        pNew->pName = pName;
+        pNew->pCb = pCb;
+        pNew->pArg = pArg;
+        pNew->periodUs = periodMs * 1000LL;
+        pNew->lane = lane;
+        schedStart(pNew, esp_timer_get_time());
+        *pJob = schedJobCount++;
+        ESP_LOGI(TAG, "Job %s every %u ms, first in %lld ms", pName, periodMs,
+                pNew->periodUs ? (pNew->nextUs - esp_timer_get_time()) / 1000 : -1LL);
+    }
+    xSemaphoreGive(schedLock);
+    xTaskNotifyGive(schedTasks[lane]);
+    return err;
+}
+
+esp_err_t meshSchedAdd(const char* pName, uint32_t periodMs, meshSchedJobCb_t* pCb, void* pArg,
+        meshSchedJob_t* pJob)
+{
+    return schedAdd(SCHED_LANE_PERIODIC, pName, periodMs, pCb, pArg, pJob);
+}
+
+esp_err_t meshSchedAddInteractive(const char* pName, uint32_t periodMs, meshSchedJobCb_t* pCb, void* pArg,
+        meshSchedJob_t* pJob)
+{
+    return schedAdd(SCHED_LANE_INTERACTIVE, pName, periodMs, pCb, pArg, pJob);
+}
+
+void meshSchedTrigger(meshSchedJob_t job)
+{
+    if (job < 0 || job >= MESH_SCHED_JOBS_MAX)
+    {
+        return;
+    }
+    schedLane_t lane = schedJobs[job].lane;
+    __atomic_fetch_or(&schedTriggered[lane], 1u << job, __ATOMIC_RELEASE);
+    xTaskNotifyGive(schedTasks[lane]);
+}
+
+void IRAM_ATTR meshSchedTriggerFromISR(meshSchedJob_t job)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (job < 0 || job >= MESH_SCHED_JOBS_MAX)
+    {
+        return;
+    }
+    schedLane_t lane = schedJobs[job].lane;
+    __atomic_fetch_or(&schedTriggered[lane], 1u << job, __ATOMIC_RELEASE);
+    vTaskNotifyGiveFromISR(schedTasks[lane], &woken);
+    if (woken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
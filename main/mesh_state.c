@@ -0,0 +1,211 @@
+#include "mesh_state.h"
+#if CONFIG_MESH_LEASES
+#include "mesh_lease.h"
+#endif
+#include "mesh_netif.h"
+#include "mesh_route.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define STATE_TASK_PRIORITY (6)    // below the event loop, above the scheduler
+#define STATE_TASK_STACK    (3072) // creating the root's AP and its driver is the deepest
+#define STATE_DEBOUNCE_us   (CONFIG_MESH_STATE_DEBOUNCE_MS * 1000LL)
+
+// Events posted since the task last ran, later events overwrite earlier ones
+typedef struct
+{
+    uint32_t events;
+    bool linkChanged;      // the parent was lost or connected
+    bool connected;        // state of the parent link after the last of those events
+    bool lost;             // one of those events was a parent loss
+    bool isRoot;
+    int64_t lostUs;        // time of the last parent loss
+    bool rootChanged;
+    mesh_addr_t root;
+    bool routesChanged;
+    bool gotIp;
+    bool gotIpIsRoot;
+    uint32_t dnsAddr;
+} stateWork_t;
+
+static const char* TAG = "mesh_state";
+
+static SemaphoreHandle_t stateLock = NULL;
+static TaskHandle_t stateTask = NULL;
+static stateWork_t statePending;
+static bool stateConnected = false; // link state the netifs were last told
+static bool stateIsRoot = false;
+static meshStateStats_t stateStats;
+
+// Tell the netifs about the parent link, runs on the state task
+static const char* stateLinkApply(const stateWork_t* pWork)
+{
+    if (pWork->connected)
+    {
+        if (stateConnected && pWork->lost && stateIsRoot == pWork->isRoot)
+        {
+            // lost and back within the debounce time, the netifs never saw the loss
+            stateStats.debounced++;
+        }
+        stateConnected = true;
+        stateIsRoot = pWork->isRoot;
+        meshNetifsStart(pWork->isRoot);
+        return pWork->isRoot ? "root" : "node";
+    }
+    if (!stateConnected)
+    {
+        return NULL;
+    }
+    stateConnected = false;
+    meshNetifsStop();
+    return "lost";
+}
+
+static void stateTaskRun(void* arg)
+{
+    TickType_t wait = portMAX_DELAY;
+    stateWork_t work;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = portMAX_DELAY;
+        xSemaphoreTake(stateLock, portMAX_DELAY);
+        work = statePending;
+        statePending.events = 0;
+        statePending.rootChanged = false;
+        statePending.routesChanged = false;
+        statePending.gotIp = false;
+        if (work.linkChanged && !work.connected && work.lostUs + STATE_DEBOUNCE_us > esp_timer_get_time())
+        {
+            // the parent may come back before the loss is worth acting on, the rest is handled now
+            wait = pdMS_TO_TICKS((work.lostUs + STATE_DEBOUNCE_us - esp_timer_get_time()) / 1000) + 1;
+            work.linkChanged = false;
+        }
+        statePending.linkChanged = statePending.linkChanged && !work.linkChanged;
+        statePending.lost = statePending.lost && !work.linkChanged;
+        xSemaphoreGive(stateLock);
+        if (!work.linkChanged && !work.rootChanged && !work.routesChanged && !work.gotIp)
+        {
+            continue;
+        }
+
+        int64_t startUs = esp_timer_get_time();
+        const char* pLink = work.linkChanged ? stateLinkApply(&work) : NULL;
+        if (work.rootChanged)
+        {
+#if CONFIG_MESH_LEASES
+            // a station leasing its address again asks the new root
+            meshLeaseSetRoot(&work.root);
+#endif
+            meshNetifSetRoot(&work.root);
+        }
+        if (work.routesChanged)
+        {
+            meshNetifRoutingTableUpdate();
+            meshRouteRootUpdate();
+#if CONFIG_MESH_LEASES
+            meshLeaseRootUpdate();
+#endif
+        }
+        if (work.gotIp)
+        {
+            meshNetifStartRootAP(work.gotIpIsRoot, work.dnsAddr);
+#if CONFIG_MESH_LEASES
+            if (work.gotIpIsRoot)
+            {
+                meshLeaseSetDns(work.dnsAddr);
+            }
+#endif
+        }
+        uint32_t tookUs = esp_timer_get_time() - startUs;
+        stateStats.runs++;
+        stateStats.lastUs = tookUs;
+        stateStats.maxUs = tookUs > stateStats.maxUs ? tookUs : stateStats.maxUs;
+        if (pLink)
+        {
+            ESP_LOGI(TAG, "Parent %s in %u us, %u events", pLink, tookUs, work.events);
+        }
+    }
+}
+
+// Merge an event into the pending work and wake the task, call with stateLock taken
+static void stateWake(void)
+{
+    statePending.events++;
+    stateStats.events++;
+    xSemaphoreGive(stateLock);
+    xTaskNotifyGive(stateTask);
+}
+
+esp_err_t meshStateInit(void)
+{
+    if (stateLock)
+    {
+        return ESP_OK;
+    }
+    stateLock = xSemaphoreCreateMutex();
+    if (stateLock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(stateTaskRun, "state task", STATE_TASK_STACK, NULL, STATE_TASK_PRIORITY, &stateTask) != pdPASS)
+    {
+        vSemaphoreDelete(stateLock);
+        stateLock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void meshStateParentConnected(bool isRoot)
+{
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    statePending.linkChanged = true;
+    statePending.connected = true;
+    statePending.isRoot = isRoot;
+    stateWake();
+}
+
+void meshStateParentDisconnected(void)
+{
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    statePending.linkChanged = true;
+    statePending.connected = false;
+    statePending.lost = true;
+    statePending.lostUs = esp_timer_get_time();
+    stateWake();
+}
+
+void meshStateRootAddress(const mesh_addr_t* pRoot)
+{
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    statePending.rootChanged = true;
+    statePending.root = *pRoot;
+    stateWake();
+}
+
+void meshStateRoutingTableChanged(void)
+{
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    statePending.routesChanged = true;
+    stateWake();
+}
+
+void meshStateGotIp(bool isRoot, uint32_t dnsAddr)
+{
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    statePending.gotIp = true;
+    statePending.gotIpIsRoot = isRoot;
+    statePending.dnsAddr = dnsAddr;
+    stateWake();
+}
+
+void meshStateGetStats(meshStateStats_t* pStats)
+{
+    *pStats = stateStats;
+}
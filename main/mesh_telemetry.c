@@ -0,0 +1,53 @@
+#include "mesh_telemetry.h"
+
+#include <stdio.h>  // for snprintf
+#include <string.h> // for memcpy
+
+static inline void telemetryHeader(uint8_t* pBuffer, meshTelemetryType_t type)
+{
+    pBuffer[0] = MESH_TELEMETRY_VERSION;
+    pBuffer[1] = type;
+}
+
+size_t meshTelemetryStatus(uint8_t* pBuffer, int layer, uint32_t ipAddr)
+{
+    telemetryHeader(pBuffer, MESH_TELEMETRY_STATUS);
+    pBuffer[MESH_TELEMETRY_HDR_LEN] = layer;
+    // the address is kept in network order, its bytes go out as they are
+    memcpy(pBuffer + MESH_TELEMETRY_HDR_LEN + 1, &ipAddr, 4);
+    return MESH_TELEMETRY_STATUS_LEN;
+}
+
+size_t meshTelemetryKeypress(uint8_t* pBuffer, const uint8_t* pMac)
+{
+    telemetryHeader(pBuffer, MESH_TELEMETRY_KEYPRESS);
+    memcpy(pBuffer + MESH_TELEMETRY_HDR_LEN, pMac, 6);
+    return MESH_TELEMETRY_KEYPRESS_LEN;
+}
+
+int meshTelemetryFormat(const uint8_t* pRecord, size_t len, char* pText, size_t size)
+{
+    const uint8_t* p = pRecord + MESH_TELEMETRY_HDR_LEN;
+
+    if (len < MESH_TELEMETRY_HDR_LEN || pRecord[0] != MESH_TELEMETRY_VERSION)
+    {
+        return -1;
+    }
+    switch (pRecord[1])
+    {
+        case MESH_TELEMETRY_STATUS:
+            if (len != MESH_TELEMETRY_STATUS_LEN)
+            {
+                return -1;
+            }
+            return snprintf(pText, size, "layer:%d IP:%u.%u.%u.%u", p[0], p[1], p[2], p[3], p[4]);
+        case MESH_TELEMETRY_KEYPRESS:
+            if (len != MESH_TELEMETRY_KEYPRESS_LEN)
+            {
+                return -1;
+            }
+            return snprintf(pText, size, "%02x:%02x:%02x:%02x:%02x:%02x", p[0], p[1], p[2], p[3], p[4], p[5]);
+        default:
+            return -1;
+    }
+}
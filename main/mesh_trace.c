@@ -0,0 +1,155 @@
+#include "mesh_trace.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdio.h>  // for snprintf
+#include <stdlib.h> // for malloc,free
+#include <string.h> // for memcpy,memset
+
+#define TRACE_RING_SIZE (CONFIG_MESH_TRACE_EVENTS) // events per core, a power of two
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "CONFIG_MESH_TRACE_EVENTS must be a power of two");
+
+typedef struct
+{
+    uint32_t head; // seq of the last event claimed
+    meshTraceEvent_t events[TRACE_RING_SIZE];
+} traceRing_t;
+
+// one ring per core keeps the writers of different cores off each other's cache lines, tasks of the
+// same core that preempt each other claim their slots with one atomic add
+static traceRing_t traceRings[portNUM_PROCESSORS];
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void putBE32(uint8_t* p, uint32_t value)
+{
+    putBE16(p, value >> 16);
+    putBE16(p + 2, value & 0xFFFF);
+}
+
+void meshTraceRecord(meshTraceId_t id, uint8_t arg, size_t size, int32_t err, const uint8_t* pAddr1,
+        const uint8_t* pAddr2)
+{
+    traceRing_t* pRing = &traceRings[xPortGetCoreID()];
+    uint32_t seq = __atomic_add_fetch(&pRing->head, 1, __ATOMIC_RELAXED);
+    meshTraceEvent_t* pEvent = &pRing->events[seq & (TRACE_RING_SIZE - 1)];
+
+    // readers skip the slot until its seq is published again
+    __atomic_store_n(&pEvent->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    pEvent->timeUs = (uint32_t)esp_timer_get_time();
+    pEvent->id = id;
+    pEvent->arg = arg;
+    pEvent->size = size > UINT16_MAX ? UINT16_MAX : size;
+    pEvent->err = err;
+    if (pAddr1)
+    {
+        memcpy(pEvent->addr1, pAddr1, sizeof(pEvent->addr1));
+    }
+    else
+    {
+        memset(pEvent->addr1, 0, sizeof(pEvent->addr1));
+    }
+    if (pAddr2)
+    {
+        memcpy(pEvent->addr2, pAddr2, sizeof(pEvent->addr2));
+    }
+    else
+    {
+        memset(pEvent->addr2, 0, sizeof(pEvent->addr2));
+    }
+    __atomic_store_n(&pEvent->seq, seq, __ATOMIC_RELEASE);
+}
+
+// Copy an event that is not rewritten while it is copied, returns false if it was
+static bool traceEventRead(const meshTraceEvent_t* pEvent, uint32_t seq, meshTraceEvent_t* pCopy)
+{
+    if (__atomic_load_n(&pEvent->seq, __ATOMIC_ACQUIRE) != seq)
+    {
+        return false;
+    }
+    memcpy(pCopy, pEvent, sizeof(*pCopy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&pEvent->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static void traceEventEncode(const meshTraceEvent_t* pEvent, uint8_t* p)
+{
+    putBE32(p, pEvent->seq);
+    putBE32(p + 4, pEvent->timeUs);
+    p[8] = pEvent->id;
+    p[9] = pEvent->arg;
+    putBE16(p + 10, pEvent->size);
+    putBE32(p + 12, (uint32_t)pEvent->err);
+    memcpy(p + 16, pEvent->addr1, 6);
+    memcpy(p + 22, pEvent->addr2, 6);
+}
+
+// Copy the events of a ring still in it, oldest first, returns their number
+static int traceRingCopy(traceRing_t* pRing, meshTraceEvent_t* pEvents)
+{
+    uint32_t head = __atomic_load_n(&pRing->head, __ATOMIC_ACQUIRE);
+    uint32_t seq = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE + 1 : 1;
+    int count = 0;
+
+    for (; seq != head + 1; seq++)
+    {
+        if (traceEventRead(&pRing->events[seq & (TRACE_RING_SIZE - 1)], seq, &pEvents[count]))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+int meshTraceDump(meshTraceLineCb_t* pCb, void* pContext)
+{
+    char line[MESH_TRACE_LINE_MAX];
+    uint8_t encoded[MESH_TRACE_EVENT_LEN];
+    int counts[portNUM_PROCESSORS];
+    int dumped = 0;
+    // the callback may be slow, a copy keeps the rings from overwriting the events not yet dumped
+    meshTraceEvent_t* pEvents = malloc(portNUM_PROCESSORS * TRACE_RING_SIZE * sizeof(meshTraceEvent_t));
+
+    if (pEvents == NULL)
+    {
+        return -1;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        counts[core] = traceRingCopy(&traceRings[core], &pEvents[core * TRACE_RING_SIZE]);
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        const meshTraceEvent_t* pCoreEvents = &pEvents[core * TRACE_RING_SIZE];
+        int count = counts[core];
+        int len = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (i % MESH_TRACE_LINE_EVENTS == 0)
+            {
+                len = snprintf(line, sizeof(line), MESH_TRACE_LINE_TAG " %d ", core);
+            }
+            traceEventEncode(&pCoreEvents[i], encoded);
+            for (int j = 0; j < MESH_TRACE_EVENT_LEN; j++)
+            {
+                len += snprintf(line + len, sizeof(line) - len, "%02x", encoded[j]);
+            }
+            if (i % MESH_TRACE_LINE_EVENTS == MESH_TRACE_LINE_EVENTS - 1 || i == count - 1)
+            {
+                pCb(line, pContext);
+            }
+        }
+        dumped += count;
+    }
+    free(pEvents);
+    return dumped;
+}
@@ -0,0 +1,410 @@
+#include "mesh_tx.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+#include <stdlib.h> // for malloc
+#include <string.h> // for memcpy
+
+#define TX_SIZE           (1560)
+#define TX_QUEUE_LEN      (CONFIG_MESH_TX_QUEUE_LEN)
+#define TX_RESERVED       ((TX_QUEUE_LEN + 3) / 4) // slots bulk frames may not take
+#define TX_POOL_LEN       (CONFIG_MESH_TX_POOL_LEN)
+#define TX_POOL_RESERVED  ((TX_POOL_LEN + 3) / 4)  // frames of the pool bulk frames may not take
+#define TX_SEND_RETRIES   (10)
+#define TX_TASK_STACK     (3072)
+#define TX_TASK_PRIORITY  (6)
+#define TX_AGGREGATE_HDR_LEN   (14u) // ethernet header of the aggregate
+#define TX_AGGREGATE_LEN_SIZE  (2u)  // big endian length in front of each packed frame
+
+typedef struct
+{
+    meshTxInfo_t info;
+    int64_t queuedUs;
+    uint16_t len;
+    uint8_t trafficClass;
+    uint8_t data[TX_SIZE];
+} meshTxFrame_t;
+
+// Frames shared by all queues, each queue holds at most TX_QUEUE_LEN of them
+typedef struct
+{
+    QueueHandle_t freeQueue;
+    meshTxFrame_t frames[TX_POOL_LEN];
+} meshTxPool_t;
+
+// Frames of all classes share the slots of the queue, each class has its own queue drained in priority order
+struct meshTxQueue
+{
+    meshTxSendFn_t* pSendFn;
+    QueueHandle_t classQueues[MESH_TRAFFIC_CLASS_MAX];
+    SemaphoreHandle_t slots;     // frames the queue may still take from the pool
+    TaskHandle_t task;
+    meshTxStats_t stats[MESH_TRAFFIC_CLASS_MAX];
+    uint32_t aggregateFrameMax;  // largest frame packed into an aggregate, 0 disables aggregation
+    uint32_t aggregateDeadlineUs;
+    meshTxFrame_t* pPending;     // frame taken while aggregating that did not fit, sent next
+    meshTxFrame_t* pAggregated[TX_QUEUE_LEN];
+    uint8_t* pAggregate;         // MESH_MPS bytes, allocated once aggregation is enabled
+};
+
+static const char* TAG = "mesh_tx";
+static meshTxPool_t txPool = { 0 };
+
+static esp_err_t txPoolInit(void)
+{
+    if (txPool.freeQueue)
+    {
+        return ESP_OK;
+    }
+    txPool.freeQueue = xQueueCreate(TX_POOL_LEN, sizeof(meshTxFrame_t*));
+    if (txPool.freeQueue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < TX_POOL_LEN; i++)
+    {
+        meshTxFrame_t* pFrame = &txPool.frames[i];
+        xQueueSend(txPool.freeQueue, &pFrame, 0);
+    }
+    return ESP_OK;
+}
+
+// Return the frame to the pool and its slot to the queue
+static void txFrameFree(meshTxQueue_t* pQueue, meshTxFrame_t* pFrame)
+{
+    xQueueSend(txPool.freeQueue, &pFrame, 0);
+    xSemaphoreGive(pQueue->slots);
+}
+
+static inline bool txErrorIsTransient(esp_err_t err)
+{
+    return err == ESP_ERR_MESH_QUEUE_FULL || err == ESP_ERR_MESH_XON_NO_WINDOW || err == ESP_ERR_MESH_NO_MEMORY;
+}
+
+static esp_err_t txSend(meshTxQueue_t* pQueue, const meshTxInfo_t* pInfo, const mesh_data_t* pData)
+{
+    meshTxInfo_t info = *pInfo;
+    esp_err_t err;
+
+    info.flag |= MESH_DATA_NONBLOCK;
+    for (int attempt = 0;; attempt++)
+    {
+        err = pQueue->pSendFn(&info, pData);
+        if (!txErrorIsTransient(err) || attempt >= TX_SEND_RETRIES)
+        {
+            break;
+        }
+        // mesh stack queue is full, give it a tick to drain instead of blocking inside it
+        vTaskDelay(1);
+    }
+    return err;
+}
+
+static void txFrameDone(meshTxQueue_t* pQueue, meshTxFrame_t* pFrame, esp_err_t err)
+{
+    meshTxStats_t* pStats = &pQueue->stats[pFrame->trafficClass];
+
+    if (err != ESP_OK)
+    {
+        pStats->errors++;
+        ESP_LOGD(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
+        return;
+    }
+    uint32_t latencyUs = (uint32_t)(esp_timer_get_time() - pFrame->queuedUs);
+    pStats->sent++;
+    pStats->latencyAvgUs += ((int32_t)latencyUs - (int32_t)pStats->latencyAvgUs) / 8;
+    if (latencyUs > pStats->latencyMaxUs)
+    {
+        pStats->latencyMaxUs = latencyUs;
+    }
+}
+
+static void txFrameSend(meshTxQueue_t* pQueue, meshTxFrame_t* pFrame)
+{
+    mesh_data_t data = { .data = pFrame->data, .size = pFrame->len, .proto = pFrame->info.proto,
+            .tos = pFrame->info.tos };
+
+    txFrameDone(pQueue, pFrame, txSend(pQueue, &pFrame->info, &data));
+}
+
+// Takes the next frame of the highest priority class that has one
+static bool txFrameNext(meshTxQueue_t* pQueue, meshTxFrame_t** ppFrame)
+{
+    if (pQueue->pPending)
+    {
+        *ppFrame = pQueue->pPending;
+        pQueue->pPending = NULL;
+        return true;
+    }
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        if (xQueueReceive(pQueue->classQueues[i], ppFrame, 0) == pdTRUE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Small frames to the root can share one mesh payload
+static inline bool txFrameCanAggregate(const meshTxQueue_t* pQueue, const meshTxFrame_t* pFrame,
+        const meshTxFrame_t* pFirst)
+{
+    return (pFrame->info.flag & MESH_DATA_TODS) && pFrame->len >= TX_AGGREGATE_HDR_LEN
+            && pFrame->len <= pQueue->aggregateFrameMax
+            && (pFirst == NULL || (pFrame->info.proto == pFirst->info.proto && pFrame->info.tos == pFirst->info.tos));
+}
+
+/**
+ * @brief Pack the frame and the ones queued after it into one mesh payload
+ *
+ * Frames are collected until the payload is full, a frame that cannot be packed arrives
+ * or the deadline counted from queueing of the first frame passes
+ */
+static void txAggregateSend(meshTxQueue_t* pQueue, meshTxFrame_t* pFirst)
+{
+    int64_t deadlineUs = pFirst->queuedUs + pQueue->aggregateDeadlineUs;
+    size_t len = TX_AGGREGATE_HDR_LEN;
+    int count = 0;
+    meshTxFrame_t* pFrame = pFirst;
+
+    // ethernet header of the first frame with our own type, the root recognizes aggregates by it
+    memcpy(pQueue->pAggregate, pFirst->data, TX_AGGREGATE_HDR_LEN - 2);
+    pQueue->pAggregate[TX_AGGREGATE_HDR_LEN - 2] = MESH_TX_AGGREGATE_ETH_TYPE >> 8;
+    pQueue->pAggregate[TX_AGGREGATE_HDR_LEN - 1] = MESH_TX_AGGREGATE_ETH_TYPE & 0xFF;
+    while (1)
+    {
+        pQueue->pAggregate[len] = pFrame->len >> 8;
+        pQueue->pAggregate[len + 1] = pFrame->len & 0xFF;
+        memcpy(pQueue->pAggregate + len + TX_AGGREGATE_LEN_SIZE, pFrame->data, pFrame->len);
+        len += TX_AGGREGATE_LEN_SIZE + pFrame->len;
+        pQueue->pAggregated[count++] = pFrame;
+
+        pFrame = NULL;
+        while (count < TX_QUEUE_LEN && !txFrameNext(pQueue, &pFrame))
+        {
+            int64_t remainingUs = deadlineUs - esp_timer_get_time();
+            if (remainingUs <= 0)
+            {
+                break;
+            }
+            // woken early by every queued frame
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((remainingUs + 999) / 1000) + 1);
+        }
+        if (pFrame == NULL)
+        {
+            break;
+        }
+        if (!txFrameCanAggregate(pQueue, pFrame, pFirst)
+                || len + TX_AGGREGATE_LEN_SIZE + pFrame->len > MESH_MPS)
+        {
+            pQueue->pPending = pFrame;
+            break;
+        }
+    }
+
+    esp_err_t err;
+    if (count == 1)
+    {
+        // nothing to pack with, send as is
+        mesh_data_t data = { .data = pFirst->data, .size = pFirst->len, .proto = pFirst->info.proto,
+                .tos = pFirst->info.tos };
+        err = txSend(pQueue, &pFirst->info, &data);
+    }
+    else
+    {
+        mesh_data_t data = { .data = pQueue->pAggregate, .size = len, .proto = pFirst->info.proto,
+                .tos = pFirst->info.tos };
+        err = txSend(pQueue, &pFirst->info, &data);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        txFrameDone(pQueue, pQueue->pAggregated[i], err);
+        if (count > 1 && err == ESP_OK)
+        {
+            pQueue->stats[pQueue->pAggregated[i]->trafficClass].aggregated++;
+        }
+        txFrameFree(pQueue, pQueue->pAggregated[i]);
+    }
+}
+
+static void txQueueFree(meshTxQueue_t* pQueue)
+{
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        if (pQueue->classQueues[i])
+        {
+            vQueueDelete(pQueue->classQueues[i]);
+        }
+    }
+    if (pQueue->slots)
+    {
+        vSemaphoreDelete(pQueue->slots);
+    }
+    free(pQueue);
+}
+
+static void txTask(void* arg)
+{
+    meshTxQueue_t* pQueue = arg;
+    meshTxFrame_t* pFrame;
+
+    while (1)
+    {
+        if (!txFrameNext(pQueue, &pFrame))
+        {
+            ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+            continue;
+        }
+        if (pQueue->aggregateFrameMax && txFrameCanAggregate(pQueue, pFrame, NULL))
+        {
+            txAggregateSend(pQueue, pFrame);
+            continue;
+        }
+        txFrameSend(pQueue, pFrame);
+        txFrameFree(pQueue, pFrame);
+    }
+}
+
+meshTxQueue_t* meshTxQueueCreate(const char* pName, meshTxSendFn_t* pSendFn)
+{
+    meshTxQueue_t* pQueue = txPoolInit() == ESP_OK ? calloc(1, sizeof(meshTxQueue_t)) : NULL;
+    if (pQueue == NULL)
+    {
+        ESP_LOGE(TAG, "No memory to create a tx queue");
+        return NULL;
+    }
+    pQueue->pSendFn = pSendFn;
+    pQueue->slots = xSemaphoreCreateCounting(TX_QUEUE_LEN, TX_QUEUE_LEN);
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        pQueue->classQueues[i] = xQueueCreate(TX_QUEUE_LEN, sizeof(meshTxFrame_t*));
+        if (pQueue->classQueues[i] == NULL)
+        {
+            break;
+        }
+    }
+    if (pQueue->slots == NULL || pQueue->classQueues[MESH_TRAFFIC_CLASS_MAX - 1] == NULL)
+    {
+        ESP_LOGE(TAG, "No memory to create a tx queue");
+        txQueueFree(pQueue);
+        return NULL;
+    }
+    if (xTaskCreate(txTask, pName, TX_TASK_STACK, pQueue, TX_TASK_PRIORITY, &pQueue->task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create tx task");
+        txQueueFree(pQueue);
+        return NULL;
+    }
+    return pQueue;
+}
+
+void meshTxQueueSetAggregation(meshTxQueue_t* pQueue, uint32_t frameMax, uint32_t deadlineUs)
+{
+    if (frameMax && pQueue->pAggregate == NULL && (pQueue->pAggregate = malloc(MESH_MPS)) == NULL)
+    {
+        ESP_LOGE(TAG, "No memory to aggregate frames, sending them one by one");
+        return;
+    }
+    pQueue->aggregateDeadlineUs = deadlineUs;
+    pQueue->aggregateFrameMax = frameMax;
+}
+
+bool meshTxAggregateNext(const uint8_t* pData, size_t len, size_t* pOffset, const uint8_t** ppFrame,
+        size_t* pFrameLen)
+{
+    if (*pOffset == 0)
+    {
+        if (len < TX_AGGREGATE_HDR_LEN
+                || ((pData[TX_AGGREGATE_HDR_LEN - 2] << 8) | pData[TX_AGGREGATE_HDR_LEN - 1]) != MESH_TX_AGGREGATE_ETH_TYPE)
+        {
+            return false;
+        }
+        *pOffset = TX_AGGREGATE_HDR_LEN;
+    }
+    if (*pOffset + TX_AGGREGATE_LEN_SIZE > len)
+    {
+        return false;
+    }
+    size_t frameLen = (pData[*pOffset] << 8) | pData[*pOffset + 1];
+    if (frameLen == 0 || *pOffset + TX_AGGREGATE_LEN_SIZE + frameLen > len)
+    {
+        return false;
+    }
+    *ppFrame = pData + *pOffset + TX_AGGREGATE_LEN_SIZE;
+    *pFrameLen = frameLen;
+    *pOffset += TX_AGGREGATE_LEN_SIZE + frameLen;
+    return true;
+}
+
+esp_err_t meshTxQueuePush(meshTxQueue_t* pQueue, const meshTxInfo_t* pInfo, const void* pBuffer, size_t len,
+        meshTrafficClass_t trafficClass, TickType_t wait)
+{
+    return meshTxQueuePushWithHeader(pQueue, pInfo, NULL, 0, pBuffer, len, trafficClass, wait);
+}
+
+esp_err_t meshTxQueuePushWithHeader(meshTxQueue_t* pQueue, const meshTxInfo_t* pInfo, const void* pHeader,
+        size_t headerLen, const void* pBuffer, size_t len, meshTrafficClass_t trafficClass, TickType_t wait)
+{
+    meshTxStats_t* pStats = &pQueue->stats[trafficClass];
+    QueueHandle_t classQueue = pQueue->classQueues[trafficClass];
+    meshTxFrame_t* pFrame;
+
+    if (headerLen + len > TX_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+#if CONFIG_MESH_TX_DROP_PRIORITY
+    // keep the last slots of the queue and frames of the pool for control and interactive frames so bulk traffic
+    // cannot starve them
+    if (trafficClass == MESH_TRAFFIC_BULK && (uxSemaphoreGetCount(pQueue->slots) <= TX_RESERVED
+            || uxQueueMessagesWaiting(txPool.freeQueue) <= TX_POOL_RESERVED))
+    {
+        __atomic_fetch_add(&pStats->dropped, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+#else
+    // one queue in arrival order, classes are only counted
+    classQueue = pQueue->classQueues[MESH_TRAFFIC_BULK];
+#endif
+    if (xSemaphoreTake(pQueue->slots, wait) != pdTRUE)
+    {
+        __atomic_fetch_add(&pStats->dropped, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+    if (xQueueReceive(txPool.freeQueue, &pFrame, wait) != pdTRUE)
+    {
+        xSemaphoreGive(pQueue->slots);
+        __atomic_fetch_add(&pStats->dropped, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+    pFrame->info = *pInfo;
+    pFrame->len = headerLen + len;
+    pFrame->trafficClass = trafficClass;
+    pFrame->queuedUs = esp_timer_get_time();
+    if (headerLen)
+    {
+        memcpy(pFrame->data, pHeader, headerLen);
+    }
+    memcpy(pFrame->data + headerLen, pBuffer, len);
+    xQueueSend(classQueue, &pFrame, 0);
+    __atomic_fetch_add(&pStats->queued, 1, __ATOMIC_RELAXED);
+    uint32_t depth = uxQueueMessagesWaiting(classQueue);
+    if (depth > pStats->peakDepth)
+    {
+        pStats->peakDepth = depth;
+    }
+    xTaskNotifyGive(pQueue->task);
+    return ESP_OK;
+}
+
+void meshTxQueueGetStats(const meshTxQueue_t* pQueue, meshTxStats_t pStats[MESH_TRAFFIC_CLASS_MAX])
+{
+    for (int i = 0; i < MESH_TRAFFIC_CLASS_MAX; i++)
+    {
+        pStats[i] = pQueue->stats[i];
+        pStats[i].depth = pStats[i].queued - pStats[i].sent - pStats[i].errors;
+    }
+}
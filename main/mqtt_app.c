@@ -1,12 +1,678 @@
 #include "mqtt_app.h"
+#include "mesh_netif.h"
+#include "mqtt_store.h"
+#include "mqtt_topic.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "mqtt_client.h"
 
 #include <stddef.h> //for NULL
+#include <stdint.h> //for intptr_t
+#include <stdio.h>  //for snprintf,sscanf
+#include <stdlib.h> //for malloc,calloc,free
+#include <string.h> //for strlen,strncmp,memcpy
+
+#define MQTT_APP_SUBSCRIPTIONS_MAX 4
+#define MQTT_CMD_TOPIC_MAC_LEN     (6 * 3 - 1) // "xx:xx:xx:xx:xx:xx"
+#define MQTT_CMD_TOPIC_MAX_LEN     (sizeof(MQTT_CMD_TOPIC_PREFIX) - 1 + MQTT_CMD_TOPIC_MAC_LEN \
+                                    + sizeof(MQTT_CMD_TOPIC_SUFFIX))
+
+#if CONFIG_MESH_MQTT_GATEWAY
+#define GATEWAY_QUEUE_LEN       (32)       // publishes waiting for the gateway task
+#define GATEWAY_SLOT_SIZE       (128)      // pool slot of a record, larger publishes take the heap
+#define GATEWAY_TOPICS_MAX      (16)       // distinct topics the root subscribes to for its nodes
+#define GATEWAY_TOPIC_MAX_LEN   (64)
+#define GATEWAY_RECORD_HDR_LEN  (1 + 2)    // <topic len:1> <data len:2> in front of every record
+#define GATEWAY_BATCH_MAX       (MESH_MPS) // a batch fits one mesh packet, larger publishes are sent alone
+#define GATEWAY_BATCH_RECORDS   (32)
+#define GATEWAY_POLL_ms         (1000)
+#define GATEWAY_TASK_PRIORITY   (5)
+#define GATEWAY_REFRESH_us      (CONFIG_MESH_MQTT_GATEWAY_REFRESH_S * 1000000LL)
+#define GATEWAY_NODE_EXPIRY_us  (3 * GATEWAY_REFRESH_us) // nodes that stopped refreshing left the mesh
+#endif
+
+#if CONFIG_MESH_MQTT_STORE
+#define STORE_POLL_ms           (1000)     // replay check without a notification, e.g. after a reconnect
+#define STORE_TASK_PRIORITY     (4)
+#endif
+
+typedef struct
+{
+    const char* pTopic;
+    MQTT_AppDataCb_t* pCb;
+} MQTT_AppSubscription_t;
+
+#if CONFIG_MESH_MQTT_GATEWAY
+typedef struct
+{
+    uint8_t topicLen;
+    uint16_t dataLen;
+    char payload[]; // topic, its terminating zero, data
+} MQTT_GatewayRecord_t;
+
+typedef struct
+{
+    char topic[GATEWAY_TOPIC_MAX_LEN];
+    bool subscribed; // subscribed at the broker since the last connect
+} MQTT_GatewayTopic_t;
+
+typedef struct
+{
+    mesh_addr_t addr;
+    uint32_t topics; // bit i set if subscribed to MQTT_GatewayTopics[i]
+    int64_t seenUs;  // last subscription list received
+} MQTT_GatewayNode_t;
+#endif
 
 static const char* TAG = "mesh_mqtt";
 static esp_mqtt_client_handle_t MQTT_ClientHandle = NULL;
+// held while the handle is used or changed, a client is destroyed only once no publish holds it
+static SemaphoreHandle_t MQTT_ClientLock = NULL;
+static MQTT_AppSubscription_t MQTT_Subscriptions[MQTT_APP_SUBSCRIPTIONS_MAX] = { 0 };
+static int MQTT_SubscriptionCount = 0;
+static MQTT_AppStats_t MQTT_Stats = { 0 };
+static MQTT_AppDataCb_t* pMQTT_CommandCb = NULL;
+static char MQTT_CommandTopic[MQTT_CMD_TOPIC_MAX_LEN]; // command topic of this device
+static bool MQTT_Connected = false;
+#if CONFIG_MESH_MQTT_STORE
+static bool MQTT_ToDsReachable = true; // until the root says otherwise
+static TaskHandle_t MQTT_StoreTaskHandle = NULL;
+#endif
+#if CONFIG_MESH_MQTT_GATEWAY
+static QueueHandle_t MQTT_GatewayQueue = NULL;
+static SemaphoreHandle_t MQTT_GatewayLock = NULL;
+// records of the status and keypress publishes fit a slot, so the queue does not allocate for them
+static uint32_t MQTT_GatewaySlots[GATEWAY_QUEUE_LEN][GATEWAY_SLOT_SIZE / sizeof(uint32_t)];
+static QueueHandle_t MQTT_GatewayFreeSlots = NULL;
+// root: topics and nodes subscribed to them, nodes are allocated once the device acts as root
+static MQTT_GatewayTopic_t MQTT_GatewayTopics[GATEWAY_TOPICS_MAX];
+static int MQTT_GatewayTopicCount = 0;
+static MQTT_GatewayNode_t* pMQTT_GatewayNodes = NULL;
+static int MQTT_GatewayNodeCount = 0;
+// node: where publishes and subscriptions go
+static mesh_addr_t MQTT_GatewayRoot;
+static bool MQTT_GatewayRootKnown = false;
+static bool MQTT_GatewayRefresh = false;
+#endif
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Hand a received message to the handlers of the filters matching its topic, pContext is passed to them:
+// with the gateway it points to the mask of gateway topics matched when the root received the message from
+// the broker, NULL when a node received it from the root
+static void MQTT_AppDispatch(const char* pTopic, int topicLen, const char* pData, int dataLen, void* pContext)
+{
+    __atomic_fetch_add(&MQTT_Stats.received, 1, __ATOMIC_RELAXED);
+    MQTT_TopicDispatch(pTopic, topicLen, pData, dataLen, pContext);
+}
+
+static void MQTT_AppSubscriptionHandler(const MQTT_TopicMessage_t* pMessage, void* pArg)
+{
+    ((MQTT_AppSubscription_t*)pArg)->pCb(pMessage->pData, pMessage->dataLen);
+}
+
+static void MQTT_AppCommandHandler(const MQTT_TopicMessage_t* pMessage, void* pArg)
+{
+    pMQTT_CommandCb(pMessage->pData, pMessage->dataLen);
+}
+
+#if CONFIG_MESH_MQTT_STORE
+// Returns whether publishes can leave this device now, otherwise they wait in the store
+static bool MQTT_AppUpstream(void)
+{
+#if CONFIG_MESH_MQTT_GATEWAY
+    if (!esp_mesh_is_root())
+    {
+        return __atomic_load_n(&MQTT_GatewayRootKnown, __ATOMIC_ACQUIRE)
+                && __atomic_load_n(&MQTT_ToDsReachable, __ATOMIC_RELAXED);
+    }
+#endif
+    return __atomic_load_n(&MQTT_Connected, __ATOMIC_RELAXED);
+}
+#endif
+
+// Keep a publish for the replay once the broker is reachable, counts it as failed without a store
+static void MQTT_AppStore(const char* pTopic, size_t topicLen, const char* pData, size_t dataLen)
+{
+#if CONFIG_MESH_MQTT_STORE
+    if (MQTT_StorePut(pTopic, topicLen, pData, dataLen) == ESP_OK)
+    {
+        return;
+    }
+#endif
+    __atomic_fetch_add(&MQTT_Stats.publishErrors, 1, __ATOMIC_RELAXED);
+}
+
+static void MQTT_AppConnectedSet(bool connected)
+{
+    __atomic_store_n(&MQTT_Connected, connected, __ATOMIC_RELAXED);
+#if CONFIG_MESH_MQTT_STORE
+#if CONFIG_MESH_MQTT_GATEWAY
+    // the broker connection of the root is the upstream of all nodes, they keep their publishes while it is down
+    if (esp_mesh_is_root())
+    {
+        esp_mesh_post_toDS_state(connected);
+    }
+#endif
+    if (connected && MQTT_StoreTaskHandle)
+    {
+        xTaskNotifyGive(MQTT_StoreTaskHandle);
+    }
+#endif
+}
+
+#if CONFIG_MESH_MQTT_GATEWAY
+static MQTT_GatewayRecord_t* MQTT_GatewayRecordNew(const char* pTopic, size_t topicLen, const char* pData,
+        size_t dataLen)
+{
+    if (topicLen > UINT8_MAX || dataLen > UINT16_MAX)
+    {
+        return NULL;
+    }
+    size_t size = sizeof(MQTT_GatewayRecord_t) + topicLen + 1 + dataLen;
+    MQTT_GatewayRecord_t* pRecord = NULL;
+    if (size > GATEWAY_SLOT_SIZE || xQueueReceive(MQTT_GatewayFreeSlots, &pRecord, 0) != pdTRUE)
+    {
+        pRecord = malloc(size);
+    }
+    if (pRecord)
+    {
+        pRecord->topicLen = topicLen;
+        pRecord->dataLen = dataLen;
+        memcpy(pRecord->payload, pTopic, topicLen);
+        pRecord->payload[topicLen] = '\0';
+        memcpy(pRecord->payload + topicLen + 1, pData, dataLen);
+    }
+    return pRecord;
+}
+
+static void MQTT_GatewayRecordFree(MQTT_GatewayRecord_t* pRecord)
+{
+    const uint8_t* p = (const uint8_t*)pRecord;
+
+    if (p >= (const uint8_t*)MQTT_GatewaySlots && p < (const uint8_t*)MQTT_GatewaySlots + sizeof(MQTT_GatewaySlots))
+    {
+        xQueueSend(MQTT_GatewayFreeSlots, &pRecord, 0);
+    }
+    else
+    {
+        free(pRecord);
+    }
+}
+
+static inline size_t MQTT_GatewayRecordLen(const MQTT_GatewayRecord_t* pRecord)
+{
+    return GATEWAY_RECORD_HDR_LEN + pRecord->topicLen + pRecord->dataLen;
+}
+
+// Write <topic len:1> <data len:2> <topic> <data>, returns the length written
+static size_t MQTT_GatewayRecordEncode(const MQTT_GatewayRecord_t* pRecord, uint8_t* p)
+{
+    p[0] = pRecord->topicLen;
+    putBE16(p + 1, pRecord->dataLen);
+    memcpy(p + GATEWAY_RECORD_HDR_LEN, pRecord->payload, pRecord->topicLen);
+    memcpy(p + GATEWAY_RECORD_HDR_LEN + pRecord->topicLen, pRecord->payload + pRecord->topicLen + 1,
+            pRecord->dataLen);
+    return MQTT_GatewayRecordLen(pRecord);
+}
+
+// Find the record at *pOffset of a message, returns false at its end or on a malformed record
+static bool MQTT_GatewayRecordNext(const mesh_data_t* pData, size_t* pOffset, const char** ppTopic,
+        size_t* pTopicLen, const char** ppData, size_t* pDataLen)
+{
+    const uint8_t* p = pData->data + *pOffset;
+    size_t left = pData->size - *pOffset;
+
+    if (left < GATEWAY_RECORD_HDR_LEN)
+    {
+        return false;
+    }
+    *pTopicLen = p[0];
+    *pDataLen = getBE16(p + 1);
+    if (left < GATEWAY_RECORD_HDR_LEN + *pTopicLen + *pDataLen)
+    {
+        return false;
+    }
+    *ppTopic = (const char*)p + GATEWAY_RECORD_HDR_LEN;
+    *ppData = *ppTopic + *pTopicLen;
+    *pOffset += GATEWAY_RECORD_HDR_LEN + *pTopicLen + *pDataLen;
+    return true;
+}
+
+static esp_err_t MQTT_GatewaySend(const mesh_addr_t* pTo, uint8_t* pMsg, size_t len, meshTrafficClass_t trafficClass)
+{
+    mesh_data_t data = { .data = pMsg, .size = len, .proto = MESH_PROTO_BIN, .tos = MESH_TOS_P2P };
+    return meshNetifSendRaw(pTo, &data, trafficClass);
+}
+
+// Node: send the topics of MQTT_AppSubscribe() and the keypress topic to the root
+static void MQTT_GatewaySubscriptionsSend(void)
+{
+    uint8_t msg[2 + (MQTT_APP_SUBSCRIPTIONS_MAX + 1) * (1 + GATEWAY_TOPIC_MAX_LEN)] = { CMD_MQTT_SUBSCRIBE };
+    size_t len = 2;
+
+    for (int i = -1; i < MQTT_SubscriptionCount; i++)
+    {
+        const char* pTopic = i < 0 ? MQTT_BUTTON_TOPIC : MQTT_Subscriptions[i].pTopic;
+        size_t topicLen = strlen(pTopic);
+        if (topicLen >= GATEWAY_TOPIC_MAX_LEN)
+        {
+            continue;
+        }
+        msg[len++] = topicLen;
+        memcpy(msg + len, pTopic, topicLen);
+        len += topicLen;
+        msg[1]++;
+    }
+    esp_err_t err = MQTT_GatewaySend(&MQTT_GatewayRoot, msg, len, MESH_TRAFFIC_CONTROL);
+    if (err != ESP_OK)
+    {
+        // try again with the next batch or poll
+        __atomic_store_n(&MQTT_GatewayRefresh, true, __ATOMIC_RELAXED);
+    }
+}
+
+// Node: send publishes to the root, packed into one mesh packet as long as they fit
+static void MQTT_GatewayBatchSend(MQTT_GatewayRecord_t** ppRecords, int count)
+{
+    static uint8_t batch[GATEWAY_BATCH_MAX];
+    uint8_t* pMsg = batch;
+    size_t len = 1;
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if (count == 1 && 1 + MQTT_GatewayRecordLen(ppRecords[0]) > sizeof(batch))
+    {
+        // too large to share a packet, sent alone in fragments
+        pMsg = malloc(1 + MQTT_GatewayRecordLen(ppRecords[0]));
+    }
+    if (pMsg && MQTT_GatewayRootKnown)
+    {
+        pMsg[0] = CMD_MQTT_PUBLISH;
+        for (int i = 0; i < count; i++)
+        {
+            len += MQTT_GatewayRecordEncode(ppRecords[i], pMsg + len);
+        }
+        err = MQTT_GatewaySend(&MQTT_GatewayRoot, pMsg, len, MESH_TRAFFIC_BULK);
+    }
+    if (err == ESP_OK)
+    {
+        __atomic_fetch_add(&MQTT_Stats.published, count, __ATOMIC_RELAXED);
+    }
+    if (pMsg != batch)
+    {
+        free(pMsg);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (err != ESP_OK)
+        {
+            MQTT_AppStore(ppRecords[i]->payload, ppRecords[i]->topicLen,
+                    ppRecords[i]->payload + ppRecords[i]->topicLen + 1, ppRecords[i]->dataLen);
+        }
+        MQTT_GatewayRecordFree(ppRecords[i]);
+    }
+}
+
+// Node: collect the publishes of CONFIG_MESH_MQTT_GATEWAY_BATCH_MS after the first into one batch
+static void MQTT_GatewayNodeRun(MQTT_GatewayRecord_t* pFirst, MQTT_GatewayRecord_t** ppNext)
+{
+    MQTT_GatewayRecord_t* pRecords[GATEWAY_BATCH_RECORDS];
+    TickType_t start = xTaskGetTickCount();
+    TickType_t window = pdMS_TO_TICKS(CONFIG_MESH_MQTT_GATEWAY_BATCH_MS);
+    size_t len = 1 + MQTT_GatewayRecordLen(pFirst);
+    int count = 0;
+
+    pRecords[count++] = pFirst;
+    *ppNext = NULL;
+    while (len < GATEWAY_BATCH_MAX && count < GATEWAY_BATCH_RECORDS)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        MQTT_GatewayRecord_t* pRecord;
+        if (elapsed >= window || xQueueReceive(MQTT_GatewayQueue, &pRecord, window - elapsed) != pdTRUE)
+        {
+            break;
+        }
+        if (len + MQTT_GatewayRecordLen(pRecord) > GATEWAY_BATCH_MAX)
+        {
+            // starts the next batch
+            *ppNext = pRecord;
+            break;
+        }
+        len += MQTT_GatewayRecordLen(pRecord);
+        pRecords[count++] = pRecord;
+    }
+    MQTT_GatewayBatchSend(pRecords, count);
+}
+
+// Root: subscribe to the topics of the nodes not subscribed since the last connect
+static void MQTT_GatewaySubscribePending(void)
+{
+    char topic[GATEWAY_TOPIC_MAX_LEN];
+
+    for (int i = 0; i < GATEWAY_TOPICS_MAX; i++)
+    {
+        xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+        bool pending = i < MQTT_GatewayTopicCount && !MQTT_GatewayTopics[i].subscribed;
+        memcpy(topic, MQTT_GatewayTopics[i].topic, sizeof(topic));
+        xSemaphoreGive(MQTT_GatewayLock);
+        if (pending && __atomic_load_n(&MQTT_Connected, __ATOMIC_RELAXED)
+                && esp_mqtt_client_subscribe(MQTT_ClientHandle, topic, 0) >= 0)
+        {
+            xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+            MQTT_GatewayTopics[i].subscribed = true;
+            xSemaphoreGive(MQTT_GatewayLock);
+        }
+    }
+}
+
+// Root: forget nodes that stopped refreshing their subscriptions
+static void MQTT_GatewayNodesExpire(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_GatewayNodeCount; i++)
+    {
+        if (now - pMQTT_GatewayNodes[i].seenUs > GATEWAY_NODE_EXPIRY_us)
+        {
+            pMQTT_GatewayNodes[i--] = pMQTT_GatewayNodes[--MQTT_GatewayNodeCount];
+        }
+    }
+    xSemaphoreGive(MQTT_GatewayLock);
+}
+
+static void MQTT_ClientStart(void);
+static void MQTT_ClientStop(void);
+static void MQTT_AppPublishOrStore(const char* pTopic, size_t topicLen, const char* pData, size_t dataLen,
+        uint32_t* pCount);
+static MQTT_TopicHandler_t MQTT_GatewayTopicHandler;
+
+static void MQTT_GatewayTask(void* arg)
+{
+    MQTT_GatewayRecord_t* pRecord = NULL;
+    int64_t refreshUs = 0;
+
+    while (1)
+    {
+        if (pRecord == NULL && xQueueReceive(MQTT_GatewayQueue, &pRecord, pdMS_TO_TICKS(GATEWAY_POLL_ms)) != pdTRUE)
+        {
+            pRecord = NULL;
+        }
+        if (esp_mesh_is_root())
+        {
+            if (MQTT_ClientHandle == NULL)
+            {
+                // this node became root after the start
+                MQTT_ClientStart();
+            }
+            // publishes of the nodes go out back to back through the one broker connection
+            while (pRecord)
+            {
+                MQTT_AppPublishOrStore(pRecord->payload, pRecord->topicLen, pRecord->payload + pRecord->topicLen + 1,
+                        pRecord->dataLen, &MQTT_Stats.forwarded);
+                MQTT_GatewayRecordFree(pRecord);
+                if (xQueueReceive(MQTT_GatewayQueue, &pRecord, 0) != pdTRUE)
+                {
+                    pRecord = NULL;
+                }
+            }
+            MQTT_GatewaySubscribePending();
+            MQTT_GatewayNodesExpire();
+            continue;
+        }
+        if (MQTT_ClientHandle)
+        {
+            // no longer root, the new root takes the broker session and the subscriptions of the nodes
+            MQTT_ClientStop();
+        }
+        if (__atomic_exchange_n(&MQTT_GatewayRefresh, false, __ATOMIC_RELAXED)
+                || esp_timer_get_time() >= refreshUs)
+        {
+            if (MQTT_GatewayRootKnown)
+            {
+                MQTT_GatewaySubscriptionsSend();
+            }
+            refreshUs = esp_timer_get_time() + GATEWAY_REFRESH_us;
+        }
+        if (pRecord)
+        {
+            MQTT_GatewayNodeRun(pRecord, &pRecord);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+// Root: a node's complete list of topics, replaces the one it sent before
+static esp_err_t MQTT_GatewaySubscriptionsInput(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    uint32_t topics = 0;
+    size_t offset = 2;
+    MQTT_GatewayNode_t* pNode = NULL;
+
+    if (pData->size < 2)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+    for (int n = 0; n < pData->data[1]; n++)
+    {
+        size_t topicLen = offset < pData->size ? pData->data[offset] : GATEWAY_TOPIC_MAX_LEN;
+        const char* pTopic = (const char*)pData->data + offset + 1;
+        int i;
+
+        if (topicLen >= GATEWAY_TOPIC_MAX_LEN || offset + 1 + topicLen > pData->size)
+        {
+            xSemaphoreGive(MQTT_GatewayLock);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        offset += 1 + topicLen;
+        for (i = 0; i < MQTT_GatewayTopicCount; i++)
+        {
+            if (strlen(MQTT_GatewayTopics[i].topic) == topicLen
+                    && strncmp(MQTT_GatewayTopics[i].topic, pTopic, topicLen) == 0)
+            {
+                break;
+            }
+        }
+        if (i == MQTT_GatewayTopicCount)
+        {
+            if (i == GATEWAY_TOPICS_MAX)
+            {
+                ESP_LOGW(TAG, "No room for gateway topic %.*s", (int)topicLen, pTopic);
+                continue;
+            }
+            memcpy(MQTT_GatewayTopics[i].topic, pTopic, topicLen);
+            MQTT_GatewayTopics[i].topic[topicLen] = '\0';
+            // messages of the broker matching the filter mark topic i for MQTT_GatewayFanout()
+            if (MQTT_TopicAdd(MQTT_GatewayTopics[i].topic, MQTT_GatewayTopicHandler, (void*)(intptr_t)i) != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Invalid gateway topic %.*s", (int)topicLen, pTopic);
+                continue;
+            }
+            MQTT_GatewayTopics[i].subscribed = false;
+            MQTT_GatewayTopicCount++;
+        }
+        topics |= 1u << i;
+    }
+    if (pMQTT_GatewayNodes == NULL)
+    {
+        pMQTT_GatewayNodes = calloc(CONFIG_MESH_ROUTE_TABLE_SIZE, sizeof(MQTT_GatewayNode_t));
+    }
+    for (int i = 0; pMQTT_GatewayNodes && i < MQTT_GatewayNodeCount; i++)
+    {
+        if (MAC_ADDR_EQUAL(pMQTT_GatewayNodes[i].addr.addr, pFrom->addr))
+        {
+            pNode = &pMQTT_GatewayNodes[i];
+            break;
+        }
+    }
+    if (pNode == NULL && pMQTT_GatewayNodes && MQTT_GatewayNodeCount < CONFIG_MESH_ROUTE_TABLE_SIZE)
+    {
+        pNode = &pMQTT_GatewayNodes[MQTT_GatewayNodeCount++];
+        pNode->addr = *pFrom;
+    }
+    if (pNode)
+    {
+        pNode->topics = topics;
+        pNode->seenUs = esp_timer_get_time();
+    }
+    xSemaphoreGive(MQTT_GatewayLock);
+    return pNode ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Root: queue the publishes of a node for the gateway task
+static esp_err_t MQTT_GatewayPublishInput(const mesh_data_t* pData)
+{
+    size_t offset = 1;
+    const char* pTopic;
+    const char* pValue;
+    size_t topicLen;
+    size_t valueLen;
+
+    while (MQTT_GatewayRecordNext(pData, &offset, &pTopic, &topicLen, &pValue, &valueLen))
+    {
+        MQTT_GatewayRecord_t* pRecord = MQTT_GatewayRecordNew(pTopic, topicLen, pValue, valueLen);
+        if (pRecord == NULL || xQueueSend(MQTT_GatewayQueue, &pRecord, 0) != pdTRUE)
+        {
+            __atomic_fetch_add(&MQTT_Stats.publishErrors, 1, __ATOMIC_RELAXED);
+            MQTT_GatewayRecordFree(pRecord);
+        }
+    }
+    return offset == pData->size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+// Node: a message of a subscribed topic relayed by the root
+static esp_err_t MQTT_GatewayDataInput(const mesh_data_t* pData)
+{
+    size_t offset = 1;
+    const char* pTopic;
+    const char* pValue;
+    size_t topicLen;
+    size_t valueLen;
+
+    if (!MQTT_GatewayRecordNext(pData, &offset, &pTopic, &topicLen, &pValue, &valueLen) || offset != pData->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    MQTT_AppDispatch(pTopic, topicLen, pValue, valueLen, NULL);
+    return ESP_OK;
+}
+
+// Root: send a message from the broker to nodes, with one broadcast when most nodes want it
+static int MQTT_GatewayDataSend(const mesh_addr_t* pTargets, int count, const char* pTopic, int topicLen,
+        const char* pData, int dataLen)
+{
+    const mesh_addr_t* pTable;
+    int tableSize;
+    int sent = 0;
+    MQTT_GatewayRecord_t* pRecord = MQTT_GatewayRecordNew(pTopic, topicLen, pData, dataLen);
+    uint8_t* pMsg = pRecord ? malloc(1 + MQTT_GatewayRecordLen(pRecord)) : NULL;
+
+    if (pMsg)
+    {
+        pMsg[0] = CMD_MQTT_DATA;
+        size_t len = 1 + MQTT_GatewayRecordEncode(pRecord, pMsg + 1);
+        meshNetifGetRoutingTable(&pTable, &tableSize);
+        meshNetifReleaseRoutingTable(pTable);
+        if (count > 1 && count * 2 > tableSize)
+        {
+            // one broadcast is cheaper than a send per node
+            sent = MQTT_GatewaySend(NULL, pMsg, len, MESH_TRAFFIC_INTERACTIVE) == ESP_OK;
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                sent += MQTT_GatewaySend(&pTargets[i], pMsg, len, MESH_TRAFFIC_INTERACTIVE) == ESP_OK;
+            }
+        }
+        __atomic_fetch_add(&MQTT_Stats.delivered, sent, __ATOMIC_RELAXED);
+    }
+    free(pMsg);
+    MQTT_GatewayRecordFree(pRecord);
+    return sent;
+}
+
+// Root: relay a message from the broker to the nodes subscribed to one of the matched gateway topics
+static void MQTT_GatewayFanout(const char* pTopic, int topicLen, const char* pData, int dataLen, uint32_t topics)
+{
+    int count = 0;
+    mesh_addr_t* pTargets = NULL;
+
+    xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+    if (MQTT_GatewayNodeCount)
+    {
+        pTargets = malloc(MQTT_GatewayNodeCount * sizeof(mesh_addr_t));
+        for (int i = 0; pTargets && i < MQTT_GatewayNodeCount; i++)
+        {
+            if (pMQTT_GatewayNodes[i].topics & topics)
+            {
+                pTargets[count++] = pMQTT_GatewayNodes[i].addr;
+            }
+        }
+    }
+    xSemaphoreGive(MQTT_GatewayLock);
+    if (count)
+    {
+        MQTT_GatewayDataSend(pTargets, count, pTopic, topicLen, pData, dataLen);
+    }
+    free(pTargets);
+}
+
+// Root: a message of the broker matched the filter of gateway topic pArg
+static void MQTT_GatewayTopicHandler(const MQTT_TopicMessage_t* pMessage, void* pArg)
+{
+    if (pMessage->pContext)
+    {
+        *(uint32_t*)pMessage->pContext |= 1u << (intptr_t)pArg;
+    }
+}
+
+// Root: relay a command of the broker to the node named in its topic, its own is handled by
+// MQTT_AppCommandHandler()
+static void MQTT_GatewayCommandRelay(const MQTT_TopicMessage_t* pMessage, void* pArg)
+{
+    const int prefixLen = sizeof(MQTT_CMD_TOPIC_PREFIX) - 1;
+    char mac[MQTT_CMD_TOPIC_MAC_LEN + 1];
+    mesh_addr_t to;
+    int parsed = 0;
+
+    if (pMessage->pContext == NULL
+            || pMessage->topicLen != prefixLen + MQTT_CMD_TOPIC_MAC_LEN + (int)sizeof(MQTT_CMD_TOPIC_SUFFIX) - 1
+            || (pMessage->topicLen == (int)strlen(MQTT_CommandTopic)
+                    && strncmp(pMessage->pTopic, MQTT_CommandTopic, pMessage->topicLen) == 0))
+    {
+        return;
+    }
+    memcpy(mac, pMessage->pTopic + prefixLen, MQTT_CMD_TOPIC_MAC_LEN);
+    mac[MQTT_CMD_TOPIC_MAC_LEN] = '\0';
+    if (sscanf(mac, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n", &to.addr[0], &to.addr[1], &to.addr[2], &to.addr[3],
+            &to.addr[4], &to.addr[5], &parsed) != 6 || parsed != MQTT_CMD_TOPIC_MAC_LEN)
+    {
+        ESP_LOGW(TAG, "No node address in %.*s", pMessage->topicLen, pMessage->pTopic);
+        return;
+    }
+    if (MQTT_GatewayDataSend(&to, 1, pMessage->pTopic, pMessage->topicLen, pMessage->pData, pMessage->dataLen) == 0)
+    {
+        ESP_LOGW(TAG, "Failed to relay command to " MACSTR, MAC2STR(to.addr));
+    }
+}
+#endif
 
 static esp_err_t MQTT_EventProcess(esp_mqtt_event_handle_t event)
 {
@@ -14,14 +680,49 @@ static esp_err_t MQTT_EventProcess(esp_mqtt_event_handle_t event)
     {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-            if (esp_mqtt_client_subscribe(MQTT_ClientHandle, MQTT_BUTTON_TOPIC, 0) < 0)
+            __atomic_fetch_add(&MQTT_Stats.connects, 1, __ATOMIC_RELAXED);
+#if CONFIG_MESH_MQTT_GATEWAY
+            // the gateway task subscribes to the topics of the nodes again
+            xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+            for (int i = 0; i < MQTT_GatewayTopicCount; i++)
+            {
+                MQTT_GatewayTopics[i].subscribed = false;
+            }
+            xSemaphoreGive(MQTT_GatewayLock);
+#endif
+            MQTT_AppConnectedSet(true);
+            if (esp_mqtt_client_subscribe(event->client, MQTT_BUTTON_TOPIC, 0) < 0)
             {
                 // Disconnect to retry the subscribe after auto-reconnect timeout
-                esp_mqtt_client_disconnect(MQTT_ClientHandle);
+                esp_mqtt_client_disconnect(event->client);
+                break;
+            }
+            for (int i = 0; i < MQTT_SubscriptionCount; i++)
+            {
+                if (esp_mqtt_client_subscribe(event->client, MQTT_Subscriptions[i].pTopic, 0) < 0)
+                {
+                    esp_mqtt_client_disconnect(event->client);
+                    break;
+                }
+            }
+            if (pMQTT_CommandCb)
+            {
+#if CONFIG_MESH_MQTT_GATEWAY
+                // the root takes the commands of all nodes and relays them
+                const char* pCommandFilter = MQTT_CMD_TOPIC_ALL;
+#else
+                const char* pCommandFilter = MQTT_CommandTopic;
+#endif
+                if (esp_mqtt_client_subscribe(event->client, pCommandFilter, 0) < 0)
+                {
+                    esp_mqtt_client_disconnect(event->client);
+                }
             }
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            __atomic_fetch_add(&MQTT_Stats.disconnects, 1, __ATOMIC_RELAXED);
+            MQTT_AppConnectedSet(false);
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
@@ -34,12 +735,24 @@ static esp_err_t MQTT_EventProcess(esp_mqtt_event_handle_t event)
             ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
             break;
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-            ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
-            ESP_LOGI(TAG, "DATA=%.*s", event->data_len, event->data);
+        {
+            // payloads are binary telemetry as often as text
+            ESP_LOGI(TAG, "MQTT_EVENT_DATA, topic %d bytes, data %d bytes", event->topic_len, event->data_len);
+#if CONFIG_MESH_MQTT_GATEWAY
+            uint32_t topics = 0;
+            MQTT_AppDispatch(event->topic, event->topic_len, event->data, event->data_len, &topics);
+            if (topics)
+            {
+                MQTT_GatewayFanout(event->topic, event->topic_len, event->data, event->data_len, topics);
+            }
+#else
+            MQTT_AppDispatch(event->topic, event->topic_len, event->data, event->data_len, NULL);
+#endif
             break;
+        }
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+            __atomic_fetch_add(&MQTT_Stats.errors, 1, __ATOMIC_RELAXED);
             break;
         default:
             ESP_LOGI(TAG, "Other event id:%d", event->event_id);
@@ -54,17 +767,190 @@ static void MQTT_EventCb(void* handlerArgs, esp_event_base_t base, int32_t event
     MQTT_EventProcess(pEventData);
 }
 
-void MQTT_AppPublish(const char* pTopic, const char* pPublishString)
+// Hand a publish to the gateway queue of a node or to the client, counted in *pCount once the client has it,
+// returns false if it has to wait
+static bool MQTT_AppPublishNow(const char* pTopic, const char* pData, size_t dataLen, uint32_t* pCount)
 {
-    if (MQTT_ClientHandle)
+#if CONFIG_MESH_MQTT_GATEWAY
+    if (MQTT_GatewayQueue && !esp_mesh_is_root())
+    {
+        MQTT_GatewayRecord_t* pRecord = MQTT_GatewayRecordNew(pTopic, strlen(pTopic), pData, dataLen);
+        if (pRecord == NULL || xQueueSend(MQTT_GatewayQueue, &pRecord, 0) != pdTRUE)
+        {
+            MQTT_GatewayRecordFree(pRecord);
+            return false;
+        }
+        return true;
+    }
+#endif
+    if (MQTT_ClientLock == NULL)
+    {
+        return false;
+    }
+    int msg_id = -1;
+    xSemaphoreTake(MQTT_ClientLock, portMAX_DELAY);
+    if (MQTT_ClientHandle && __atomic_load_n(&MQTT_Connected, __ATOMIC_RELAXED))
     {
-        int msg_id = esp_mqtt_client_publish(MQTT_ClientHandle, pTopic, pPublishString, 0, 1, 0);
+        msg_id = esp_mqtt_client_publish(MQTT_ClientHandle, pTopic, pData, dataLen, 1, 0);
         ESP_LOGI(TAG, "sent publish returned msg_id=%d", msg_id);
     }
+    xSemaphoreGive(MQTT_ClientLock);
+    if (msg_id < 0)
+    {
+        return false;
+    }
+    __atomic_fetch_add(pCount, 1, __ATOMIC_RELAXED);
+    return true;
 }
 
-void MQTT_AppStart(void)
+static void MQTT_AppPublishOrStore(const char* pTopic, size_t topicLen, const char* pData, size_t dataLen,
+        uint32_t* pCount)
+{
+    bool ready = true;
+#if CONFIG_MESH_MQTT_STORE
+    // while stored publishes wait or one of them is replayed, new ones queue behind them to keep the order
+    ready = MQTT_AppUpstream() && MQTT_StoreIsEmpty();
+#endif
+    if (!ready || !MQTT_AppPublishNow(pTopic, pData, dataLen, pCount))
+    {
+        MQTT_AppStore(pTopic, topicLen, pData, dataLen);
+    }
+}
+
+void MQTT_AppPublish(const char* pTopic, const char* pPublishString)
+{
+    MQTT_AppPublishOrStore(pTopic, strlen(pTopic), pPublishString, strlen(pPublishString), &MQTT_Stats.published);
+}
+
+void MQTT_AppPublishData(const char* pTopic, const void* pData, size_t len)
+{
+    MQTT_AppPublishOrStore(pTopic, strlen(pTopic), pData, len, &MQTT_Stats.published);
+}
+
+#if CONFIG_MESH_MQTT_STORE
+// Replay stored publishes in batches while the broker is reachable
+static void MQTT_StoreTask(void* arg)
+{
+    while (1)
+    {
+        if (!MQTT_AppUpstream() || MQTT_StoreIsEmpty())
+        {
+            // woken by a change of the upstream, the timeout covers changes without a notification
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STORE_POLL_ms));
+            continue;
+        }
+        for (int i = 0; i < CONFIG_MESH_MQTT_STORE_REPLAY_BATCH; i++)
+        {
+            MQTT_StoreRecord_t* pRecord = MQTT_StoreTake();
+            if (pRecord == NULL)
+            {
+                break;
+            }
+            if (!MQTT_AppPublishNow(MQTT_STORE_TOPIC(pRecord), MQTT_STORE_DATA(pRecord), pRecord->dataLen,
+                    &MQTT_Stats.published))
+            {
+                MQTT_StoreReturn(pRecord);
+                break;
+            }
+            MQTT_StoreDone(pRecord);
+        }
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_MESH_MQTT_STORE_REPLAY_MS));
+    }
+    vTaskDelete(NULL);
+}
+#endif
+
+void MQTT_AppSetToDS(bool reachable)
+{
+#if CONFIG_MESH_MQTT_STORE
+    __atomic_store_n(&MQTT_ToDsReachable, reachable, __ATOMIC_RELAXED);
+    if (reachable && MQTT_StoreTaskHandle)
+    {
+        xTaskNotifyGive(MQTT_StoreTaskHandle);
+    }
+#endif
+}
+
+esp_err_t MQTT_AppSubscribe(const char* pTopic, MQTT_AppDataCb_t* pCb)
+{
+    MQTT_AppSubscription_t* pSubscription = &MQTT_Subscriptions[MQTT_SubscriptionCount];
+    esp_err_t err = MQTT_TopicInit();
+
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (MQTT_SubscriptionCount == MQTT_APP_SUBSCRIPTIONS_MAX)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    pSubscription->pTopic = pTopic;
+    pSubscription->pCb = pCb;
+    err = MQTT_TopicAdd(pTopic, MQTT_AppSubscriptionHandler, pSubscription);
+    if (err == ESP_OK)
+    {
+        MQTT_SubscriptionCount++;
+    }
+    return err;
+}
+
+void MQTT_AppSetCommandCb(MQTT_AppDataCb_t* pCb)
 {
+    pMQTT_CommandCb = pCb;
+}
+
+void MQTT_AppGetStats(MQTT_AppStats_t* pStats)
+{
+    pStats->published = __atomic_load_n(&MQTT_Stats.published, __ATOMIC_RELAXED);
+    pStats->publishErrors = __atomic_load_n(&MQTT_Stats.publishErrors, __ATOMIC_RELAXED);
+    pStats->received = __atomic_load_n(&MQTT_Stats.received, __ATOMIC_RELAXED);
+    pStats->connects = __atomic_load_n(&MQTT_Stats.connects, __ATOMIC_RELAXED);
+    pStats->disconnects = __atomic_load_n(&MQTT_Stats.disconnects, __ATOMIC_RELAXED);
+    pStats->errors = __atomic_load_n(&MQTT_Stats.errors, __ATOMIC_RELAXED);
+    pStats->forwarded = __atomic_load_n(&MQTT_Stats.forwarded, __ATOMIC_RELAXED);
+    pStats->delivered = __atomic_load_n(&MQTT_Stats.delivered, __ATOMIC_RELAXED);
+#if CONFIG_MESH_MQTT_GATEWAY
+    pStats->gatewayNodes = __atomic_load_n(&MQTT_GatewayNodeCount, __ATOMIC_RELAXED);
+#else
+    pStats->gatewayNodes = 0;
+#endif
+}
+
+#if CONFIG_MESH_MQTT_GATEWAY
+void MQTT_AppSetRoot(const mesh_addr_t* pRoot)
+{
+    MQTT_GatewayRoot = *pRoot;
+    __atomic_store_n(&MQTT_GatewayRootKnown, true, __ATOMIC_RELEASE);
+    // a new root knows nothing of this node's subscriptions
+    __atomic_store_n(&MQTT_GatewayRefresh, true, __ATOMIC_RELAXED);
+}
+
+esp_err_t MQTT_AppMeshReceive(const mesh_addr_t* pFrom, const mesh_data_t* pData)
+{
+    if (MQTT_GatewayQueue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    switch (pData->data[0])
+    {
+        case CMD_MQTT_PUBLISH:
+            return esp_mesh_is_root() ? MQTT_GatewayPublishInput(pData) : ESP_ERR_INVALID_STATE;
+        case CMD_MQTT_SUBSCRIBE:
+            return esp_mesh_is_root() ? MQTT_GatewaySubscriptionsInput(pFrom, pData) : ESP_ERR_INVALID_STATE;
+        case CMD_MQTT_DATA:
+            return MQTT_GatewayDataInput(pData);
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+}
+#endif
+
+static void MQTT_ClientStart(void)
+{
+    if (MQTT_ClientHandle)
+    {
+        return;
+    }
     #if 1
         esp_mqtt_client_config_t MQTT_config = {
              .uri = "mqtt://mqtt.eclipseprojects.io",
@@ -76,8 +962,118 @@ void MQTT_AppStart(void)
         };
     #endif
 
-    MQTT_ClientHandle = esp_mqtt_client_init(&MQTT_config);
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&MQTT_config);
+
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, MQTT_EventCb, client);
+    esp_mqtt_client_start(client);
+    xSemaphoreTake(MQTT_ClientLock, portMAX_DELAY);
+    MQTT_ClientHandle = client;
+    xSemaphoreGive(MQTT_ClientLock);
+}
+
+#if CONFIG_MESH_MQTT_GATEWAY
+// End the broker session of a former root and forget the nodes that subscribed through it
+static void MQTT_ClientStop(void)
+{
+    esp_mqtt_client_handle_t client = MQTT_ClientHandle;
+
+    // waits for a publish of another task, stopping the client outside the lock as its event handler may publish
+    xSemaphoreTake(MQTT_ClientLock, portMAX_DELAY);
+    __atomic_store_n(&MQTT_Connected, false, __ATOMIC_RELAXED);
+    MQTT_ClientHandle = NULL;
+    xSemaphoreGive(MQTT_ClientLock);
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    xSemaphoreTake(MQTT_GatewayLock, portMAX_DELAY);
+    MQTT_GatewayNodeCount = 0;
+    for (int i = 0; i < MQTT_GatewayTopicCount; i++)
+    {
+        MQTT_GatewayTopics[i].subscribed = false;
+    }
+    xSemaphoreGive(MQTT_GatewayLock);
+    ESP_LOGI(TAG, "Broker session ended, no longer root");
+}
+#endif
+
+// Register the command topic of this device and, for the root of the gateway, the relay to the other nodes
+static void MQTT_CommandStart(void)
+{
+    uint8_t mac[6];
+
+    if (pMQTT_CommandCb == NULL || MQTT_CommandTopic[0])
+    {
+        return;
+    }
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    snprintf(MQTT_CommandTopic, sizeof(MQTT_CommandTopic), MQTT_CMD_TOPIC_PREFIX MACSTR MQTT_CMD_TOPIC_SUFFIX,
+            MAC2STR(mac));
+    if (MQTT_TopicAdd(MQTT_CommandTopic, MQTT_AppCommandHandler, NULL) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to register %s", MQTT_CommandTopic);
+    }
+#if CONFIG_MESH_MQTT_GATEWAY
+    if (MQTT_TopicAdd(MQTT_CMD_TOPIC_ALL, MQTT_GatewayCommandRelay, NULL) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to register %s", MQTT_CMD_TOPIC_ALL);
+    }
+#endif
+}
 
-    esp_mqtt_client_register_event(MQTT_ClientHandle, ESP_EVENT_ANY_ID, MQTT_EventCb, MQTT_ClientHandle);
-    esp_mqtt_client_start(MQTT_ClientHandle);
+void MQTT_AppStart(void)
+{
+    if (MQTT_ClientLock == NULL && (MQTT_ClientLock = xSemaphoreCreateMutex()) == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create the MQTT client lock");
+        return;
+    }
+    if (MQTT_TopicInit() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start the MQTT topic registry");
+        return;
+    }
+    MQTT_CommandStart();
+#if CONFIG_MESH_MQTT_STORE
+    if (MQTT_StoreTaskHandle == NULL && (MQTT_StoreInit() != ESP_OK
+            || xTaskCreate(MQTT_StoreTask, "mqtt store task", 3072, NULL, STORE_TASK_PRIORITY,
+                    &MQTT_StoreTaskHandle) != pdPASS))
+    {
+        ESP_LOGE(TAG, "Failed to start the MQTT store");
+    }
+#endif
+#if CONFIG_MESH_MQTT_GATEWAY
+    if (MQTT_GatewayQueue != NULL)
+    {
+        return;
+    }
+    MQTT_GatewayLock = xSemaphoreCreateMutex();
+    MQTT_GatewayFreeSlots = xQueueCreate(GATEWAY_QUEUE_LEN, sizeof(MQTT_GatewayRecord_t*));
+    if (MQTT_GatewayLock == NULL || MQTT_GatewayFreeSlots == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to start the MQTT gateway");
+        return;
+    }
+    for (int i = 0; i < GATEWAY_QUEUE_LEN; i++)
+    {
+        MQTT_GatewayRecord_t* pSlot = (MQTT_GatewayRecord_t*)MQTT_GatewaySlots[i];
+        xQueueSend(MQTT_GatewayFreeSlots, &pSlot, 0);
+    }
+    // publishes go to the queue once it exists
+    MQTT_GatewayQueue = xQueueCreate(GATEWAY_QUEUE_LEN, sizeof(MQTT_GatewayRecord_t*));
+    if (MQTT_GatewayQueue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to start the MQTT gateway");
+        return;
+    }
+    // only the root connects to the broker, nodes go through it
+    if (esp_mesh_is_root())
+    {
+        MQTT_ClientStart();
+    }
+    if (xTaskCreate(MQTT_GatewayTask, "mqtt gw task", 3072, NULL, GATEWAY_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to start the MQTT gateway");
+    }
+#else
+    MQTT_ClientStart();
+#endif
 }
@@ -0,0 +1,362 @@
+#include "mqtt_store.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if CONFIG_MESH_MQTT_STORE_NVS
+#include "nvs.h"
+#endif
+
+#include <stdio.h>  // for snprintf
+#include <stdlib.h> // for malloc,free
+#include <string.h> // for memcpy
+
+#define STORE_RECORD_HDR_LEN (1 + 2)  // <topic len:1> <data len:2> in front of every record of a blob
+#define STORE_BLOB_MAX       (512)    // NVS blob of spilled records: <count:1> followed by the records
+#define STORE_KEY_LEN        (12)
+
+static SemaphoreHandle_t storeLock = NULL;
+// records of MQTT_StoreReturn(), older than all others
+static MQTT_StoreRecord_t* pStoreFront = NULL;
+// records in RAM, oldest first
+static MQTT_StoreRecord_t* pStoreHead = NULL;
+static MQTT_StoreRecord_t* pStoreTail = NULL;
+// records of MQTT_StoreTake() not yet done or returned
+static uint32_t storeTaken = 0;
+static MQTT_StoreStats_t storeStats = { 0 };
+#if CONFIG_MESH_MQTT_STORE_NVS
+static const char* TAG = "mqtt_store";
+static bool storeNvsOpen = false;
+static nvs_handle_t storeNvs;
+// blobs storeNvsHead to storeNvsTail - 1 wait in NVS, the head blob is replayed from storeBlob
+static uint32_t storeNvsHead = 0;
+static uint32_t storeNvsTail = 0;
+static uint8_t storeBlob[STORE_BLOB_MAX];
+static size_t storeBlobLen = 0; // 0 while no blob is loaded
+static size_t storeBlobOffset = 0;
+#endif
+
+static inline void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline uint16_t getBE16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline size_t storeRecordSize(const MQTT_StoreRecord_t* pRecord)
+{
+    return sizeof(MQTT_StoreRecord_t) + pRecord->topicLen + 1 + pRecord->dataLen + 1;
+}
+
+static MQTT_StoreRecord_t* storeRecordNew(const char* pTopic, size_t topicLen, const char* pData, size_t dataLen)
+{
+    MQTT_StoreRecord_t* pRecord = malloc(sizeof(MQTT_StoreRecord_t) + topicLen + 1 + dataLen + 1);
+
+    if (pRecord)
+    {
+        pRecord->pNext = NULL;
+        pRecord->topicLen = topicLen;
+        pRecord->dataLen = dataLen;
+        memcpy(pRecord->payload, pTopic, topicLen);
+        pRecord->payload[topicLen] = '\0';
+        memcpy(pRecord->payload + topicLen + 1, pData, dataLen);
+        pRecord->payload[topicLen + 1 + dataLen] = '\0';
+    }
+    return pRecord;
+}
+
+// Unlink the oldest record in RAM, call with storeLock taken
+static MQTT_StoreRecord_t* storeRamPop(void)
+{
+    MQTT_StoreRecord_t* pRecord = pStoreHead;
+
+    if (pRecord)
+    {
+        pStoreHead = pRecord->pNext;
+        pStoreTail = pStoreHead ? pStoreTail : NULL;
+        storeStats.records--;
+        storeStats.bytes -= storeRecordSize(pRecord);
+        pRecord->pNext = NULL;
+    }
+    return pRecord;
+}
+
+#if CONFIG_MESH_MQTT_STORE_NVS
+static inline void storeKey(char* pKey, uint32_t seq)
+{
+    snprintf(pKey, STORE_KEY_LEN, "mqs%08x", seq);
+}
+
+// Move the oldest records in RAM to a new NVS blob, call with storeLock taken
+static esp_err_t storeSpill(void)
+{
+    static uint8_t blob[STORE_BLOB_MAX];
+    char key[STORE_KEY_LEN];
+    size_t len = 1;
+    int count = 0;
+
+    if (!storeNvsOpen || storeNvsTail - storeNvsHead >= CONFIG_MESH_MQTT_STORE_NVS_BLOBS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for (MQTT_StoreRecord_t* pRecord = pStoreHead; pRecord && count < UINT8_MAX; pRecord = pRecord->pNext)
+    {
+        if (len + STORE_RECORD_HDR_LEN + pRecord->topicLen + pRecord->dataLen > sizeof(blob))
+        {
+            break;
+        }
+        blob[len] = pRecord->topicLen;
+        putBE16(blob + len + 1, pRecord->dataLen);
+        memcpy(blob + len + STORE_RECORD_HDR_LEN, MQTT_STORE_TOPIC(pRecord), pRecord->topicLen);
+        memcpy(blob + len + STORE_RECORD_HDR_LEN + pRecord->topicLen, MQTT_STORE_DATA(pRecord), pRecord->dataLen);
+        len += STORE_RECORD_HDR_LEN + pRecord->topicLen + pRecord->dataLen;
+        count++;
+    }
+    if (count == 0)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    blob[0] = count;
+    storeKey(key, storeNvsTail);
+    esp_err_t err = nvs_set_blob(storeNvs, key, blob, len);
+    err = err == ESP_OK ? nvs_set_u32(storeNvs, "mqs_tail", storeNvsTail + 1) : err;
+    err = err == ESP_OK ? nvs_commit(storeNvs) : err;
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to spill to NVS: %s", esp_err_to_name(err));
+        nvs_erase_key(storeNvs, key);
+        return err;
+    }
+    storeNvsTail++;
+    storeStats.blobs++;
+    storeStats.spilled += count;
+    for (int i = 0; i < count; i++)
+    {
+        free(storeRamPop());
+    }
+    return ESP_OK;
+}
+
+// Forget the head blob once all its records are taken, call with storeLock taken
+static void storeBlobRelease(void)
+{
+    char key[STORE_KEY_LEN];
+
+    storeKey(key, storeNvsHead);
+    nvs_erase_key(storeNvs, key);
+    storeNvsHead++;
+    nvs_set_u32(storeNvs, "mqs_head", storeNvsHead);
+    nvs_commit(storeNvs);
+    storeStats.blobs--;
+    storeBlobLen = 0;
+}
+
+// Decode the next record of the blobs, call with storeLock taken
+static MQTT_StoreRecord_t* storeBlobNext(void)
+{
+    MQTT_StoreRecord_t* pRecord = NULL;
+
+    while (pRecord == NULL && (storeBlobLen || storeNvsHead != storeNvsTail))
+    {
+        if (storeBlobLen == 0)
+        {
+            char key[STORE_KEY_LEN];
+            size_t len = sizeof(storeBlob);
+            storeKey(key, storeNvsHead);
+            if (nvs_get_blob(storeNvs, key, storeBlob, &len) != ESP_OK || len < 1)
+            {
+                storeBlobRelease();
+                continue;
+            }
+            storeBlobLen = len;
+            storeBlobOffset = 1;
+        }
+        const uint8_t* p = storeBlob + storeBlobOffset;
+        size_t left = storeBlobLen - storeBlobOffset;
+        if (left < STORE_RECORD_HDR_LEN || left < STORE_RECORD_HDR_LEN + p[0] + getBE16(p + 1))
+        {
+            // end of the blob
+            storeBlobRelease();
+            continue;
+        }
+        pRecord = storeRecordNew((const char*)p + STORE_RECORD_HDR_LEN, p[0],
+                (const char*)p + STORE_RECORD_HDR_LEN + p[0], getBE16(p + 1));
+        if (pRecord == NULL)
+        {
+            break;
+        }
+        storeBlobOffset += STORE_RECORD_HDR_LEN + p[0] + getBE16(p + 1);
+    }
+    return pRecord;
+}
+#endif
+
+esp_err_t MQTT_StoreInit(void)
+{
+    if (storeLock)
+    {
+        return ESP_OK;
+    }
+    storeLock = xSemaphoreCreateMutex();
+    if (storeLock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+#if CONFIG_MESH_MQTT_STORE_NVS
+    // without NVS the store keeps publishes in RAM only
+    storeNvsOpen = nvs_open("mqtt_store", NVS_READWRITE, &storeNvs) == ESP_OK;
+    if (storeNvsOpen)
+    {
+        // a missing key was never written and stays 0
+        nvs_get_u32(storeNvs, "mqs_head", &storeNvsHead);
+        nvs_get_u32(storeNvs, "mqs_tail", &storeNvsTail);
+        if (storeNvsTail - storeNvsHead > CONFIG_MESH_MQTT_STORE_NVS_BLOBS)
+        {
+            ESP_LOGW(TAG, "Inconsistent NVS index %u..%u, dropped", storeNvsHead, storeNvsTail);
+            storeNvsHead = storeNvsTail;
+            nvs_set_u32(storeNvs, "mqs_head", storeNvsHead);
+            nvs_commit(storeNvs);
+        }
+        storeStats.blobs = storeNvsTail - storeNvsHead;
+        if (storeStats.blobs)
+        {
+            ESP_LOGI(TAG, "%u blobs of publishes left in NVS", storeStats.blobs);
+        }
+    }
+#endif
+    return ESP_OK;
+}
+
+esp_err_t MQTT_StorePut(const char* pTopic, size_t topicLen, const char* pData, size_t dataLen)
+{
+    MQTT_StoreRecord_t* pRecord = NULL;
+    size_t size = sizeof(MQTT_StoreRecord_t) + topicLen + 1 + dataLen + 1;
+
+    if (storeLock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (topicLen <= UINT8_MAX && dataLen <= UINT16_MAX && size <= CONFIG_MESH_MQTT_STORE_SIZE)
+    {
+        pRecord = storeRecordNew(pTopic, topicLen, pData, dataLen);
+    }
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    if (pRecord == NULL)
+    {
+        storeStats.dropped++;
+        xSemaphoreGive(storeLock);
+        return size > CONFIG_MESH_MQTT_STORE_SIZE ? ESP_ERR_INVALID_SIZE : ESP_ERR_NO_MEM;
+    }
+    while (storeStats.bytes + size > CONFIG_MESH_MQTT_STORE_SIZE)
+    {
+#if CONFIG_MESH_MQTT_STORE_NVS
+        if (storeSpill() == ESP_OK)
+        {
+            continue;
+        }
+#endif
+        free(storeRamPop());
+        storeStats.dropped++;
+    }
+    if (pStoreTail)
+    {
+        pStoreTail->pNext = pRecord;
+    }
+    else
+    {
+        pStoreHead = pRecord;
+    }
+    pStoreTail = pRecord;
+    storeStats.records++;
+    storeStats.bytes += size;
+    storeStats.stored++;
+    xSemaphoreGive(storeLock);
+    return ESP_OK;
+}
+
+MQTT_StoreRecord_t* MQTT_StoreTake(void)
+{
+    MQTT_StoreRecord_t* pRecord = NULL;
+    bool olderInNvs = false;
+
+    if (storeLock == NULL)
+    {
+        return NULL;
+    }
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    if (pStoreFront)
+    {
+        pRecord = pStoreFront;
+        pStoreFront = pRecord->pNext;
+        pRecord->pNext = NULL;
+    }
+#if CONFIG_MESH_MQTT_STORE_NVS
+    else if (storeNvsOpen && (storeBlobLen || storeNvsHead != storeNvsTail))
+    {
+        pRecord = storeBlobNext();
+        // without memory for the next record of a blob the newer ones in RAM wait for it
+        olderInNvs = pRecord == NULL && storeBlobLen != 0;
+    }
+#endif
+    if (pRecord == NULL && !olderInNvs)
+    {
+        pRecord = storeRamPop();
+    }
+    if (pRecord)
+    {
+        storeTaken++;
+    }
+    xSemaphoreGive(storeLock);
+    return pRecord;
+}
+
+void MQTT_StoreReturn(MQTT_StoreRecord_t* pRecord)
+{
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    pRecord->pNext = pStoreFront;
+    pStoreFront = pRecord;
+    storeTaken--;
+    xSemaphoreGive(storeLock);
+}
+
+void MQTT_StoreDone(MQTT_StoreRecord_t* pRecord)
+{
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    storeTaken--;
+    xSemaphoreGive(storeLock);
+    __atomic_fetch_add(&storeStats.replayed, 1, __ATOMIC_RELAXED);
+    free(pRecord);
+}
+
+bool MQTT_StoreIsEmpty(void)
+{
+    bool empty = true;
+
+    if (storeLock)
+    {
+        xSemaphoreTake(storeLock, portMAX_DELAY);
+        // a record being replayed counts, publishes after it must not overtake it
+        empty = storeTaken == 0 && pStoreFront == NULL && pStoreHead == NULL;
+#if CONFIG_MESH_MQTT_STORE_NVS
+        empty = empty && storeBlobLen == 0 && storeNvsHead == storeNvsTail;
+#endif
+        xSemaphoreGive(storeLock);
+    }
+    return empty;
+}
+
+void MQTT_StoreGetStats(MQTT_StoreStats_t* pStats)
+{
+    if (storeLock == NULL)
+    {
+        *pStats = storeStats;
+        return;
+    }
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    *pStats = storeStats;
+    xSemaphoreGive(storeLock);
+}
@@ -0,0 +1,241 @@
+#include "mqtt_topic.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <stdint.h>
+#include <string.h> // for memcpy,memcmp,strlen
+
+#define TOPIC_NONE (-1) // end of a sibling or handler list
+
+typedef struct
+{
+    char level[MQTT_TOPIC_LEVEL_MAX];
+    int16_t firstChild;
+    int16_t nextSibling;
+    int16_t firstHandler;
+} topicNode_t;
+
+typedef struct
+{
+    MQTT_TopicHandler_t* pHandler;
+    void* pArg;
+    int16_t next;
+} topicHandler_t;
+
+typedef struct
+{
+    MQTT_TopicHandler_t* pHandler;
+    void* pArg;
+} topicMatch_t;
+
+typedef struct
+{
+    topicMatch_t matches[MQTT_TOPIC_MATCH_MAX];
+    int count;
+} topicMatches_t;
+
+static SemaphoreHandle_t topicLock = NULL;
+// node 0 is the root of the trie, its children are the first levels of the filters
+static topicNode_t topicNodes[MQTT_TOPIC_NODES_MAX];
+static int topicNodeCount = 0;
+static topicHandler_t topicHandlers[MQTT_TOPIC_HANDLERS_MAX];
+static int topicHandlerCount = 0;
+
+// Length of the level starting at pLevel, ends at '/' or pEnd
+static inline int topicLevelLen(const char* pLevel, const char* pEnd)
+{
+    const char* p = pLevel;
+    while (p < pEnd && *p != '/')
+    {
+        p++;
+    }
+    return p - pLevel;
+}
+
+static inline bool topicLevelEqual(const topicNode_t* pNode, const char* pLevel, int len)
+{
+    return len < MQTT_TOPIC_LEVEL_MAX && pNode->level[len] == '\0' && memcmp(pNode->level, pLevel, len) == 0;
+}
+
+esp_err_t MQTT_TopicInit(void)
+{
+    if (topicLock == NULL)
+    {
+        topicLock = xSemaphoreCreateMutex();
+        if (topicLock == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        topicNodes[0].firstChild = TOPIC_NONE;
+        topicNodes[0].nextSibling = TOPIC_NONE;
+        topicNodes[0].firstHandler = TOPIC_NONE;
+        topicNodeCount = 1;
+    }
+    return ESP_OK;
+}
+
+bool MQTT_TopicFilterValid(const char* pFilter)
+{
+    const char* pEnd = pFilter + strlen(pFilter);
+
+    for (const char* pLevel = pFilter; pLevel <= pEnd;)
+    {
+        int len = topicLevelLen(pLevel, pEnd);
+        if (len >= MQTT_TOPIC_LEVEL_MAX)
+        {
+            return false;
+        }
+        for (int i = 0; i < len; i++)
+        {
+            if ((pLevel[i] == '+' || pLevel[i] == '#') && len != 1)
+            {
+                return false;
+            }
+        }
+        if (len == 1 && pLevel[0] == '#' && pLevel + 1 != pEnd)
+        {
+            return false;
+        }
+        pLevel += len + 1;
+    }
+    return true;
+}
+
+// Returns the child of a node with the given level, adds it if asked to
+static int16_t topicChild(int16_t parent, const char* pLevel, int len, bool add)
+{
+    for (int16_t child = topicNodes[parent].firstChild; child != TOPIC_NONE; child = topicNodes[child].nextSibling)
+    {
+        if (topicLevelEqual(&topicNodes[child], pLevel, len))
+        {
+            return child;
+        }
+    }
+    if (!add || topicNodeCount == MQTT_TOPIC_NODES_MAX)
+    {
+        return TOPIC_NONE;
+    }
+    int16_t child = topicNodeCount++;
+    memcpy(topicNodes[child].level, pLevel, len);
+    topicNodes[child].level[len] = '\0';
+    topicNodes[child].firstChild = TOPIC_NONE;
+    topicNodes[child].firstHandler = TOPIC_NONE;
+    topicNodes[child].nextSibling = topicNodes[parent].firstChild;
+    topicNodes[parent].firstChild = child;
+    return child;
+}
+
+esp_err_t MQTT_TopicAdd(const char* pFilter, MQTT_TopicHandler_t* pHandler, void* pArg)
+{
+    const char* pEnd = pFilter + strlen(pFilter);
+    int16_t node = 0;
+    esp_err_t err = ESP_OK;
+
+    if (!MQTT_TopicFilterValid(pFilter) || pHandler == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (topicLock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(topicLock, portMAX_DELAY);
+    for (const char* pLevel = pFilter; pLevel <= pEnd && node != TOPIC_NONE;)
+    {
+        int len = topicLevelLen(pLevel, pEnd);
+        node = topicChild(node, pLevel, len, true);
+        pLevel += len + 1;
+    }
+    if (node == TOPIC_NONE)
+    {
+        // levels added so far stay as empty branches, they match nothing
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        int16_t handler;
+        for (handler = topicNodes[node].firstHandler; handler != TOPIC_NONE; handler = topicHandlers[handler].next)
+        {
+            if (topicHandlers[handler].pHandler == pHandler && topicHandlers[handler].pArg == pArg)
+            {
+                break;
+            }
+        }
+        if (handler == TOPIC_NONE && topicHandlerCount == MQTT_TOPIC_HANDLERS_MAX)
+        {
+            err = ESP_ERR_NO_MEM;
+        }
+        else if (handler == TOPIC_NONE)
+        {
+            handler = topicHandlerCount++;
+            topicHandlers[handler].pHandler = pHandler;
+            topicHandlers[handler].pArg = pArg;
+            topicHandlers[handler].next = topicNodes[node].firstHandler;
+            topicNodes[node].firstHandler = handler;
+        }
+    }
+    xSemaphoreGive(topicLock);
+    return err;
+}
+
+static void topicCollect(int16_t node, topicMatches_t* pMatches)
+{
+    for (int16_t handler = topicNodes[node].firstHandler; handler != TOPIC_NONE; handler = topicHandlers[handler].next)
+    {
+        if (pMatches->count < MQTT_TOPIC_MATCH_MAX)
+        {
+            pMatches->matches[pMatches->count].pHandler = topicHandlers[handler].pHandler;
+            pMatches->matches[pMatches->count].pArg = topicHandlers[handler].pArg;
+            pMatches->count++;
+        }
+    }
+}
+
+// Match the rest of a topic from pLevel below a node, pLevel is NULL once all levels matched
+static void topicMatch(int16_t node, const char* pLevel, const char* pEnd, bool first, topicMatches_t* pMatches)
+{
+    if (pLevel == NULL)
+    {
+        topicCollect(node, pMatches);
+    }
+    int len = pLevel ? topicLevelLen(pLevel, pEnd) : 0;
+    const char* pNext = pLevel && pLevel + len < pEnd ? pLevel + len + 1 : NULL;
+    // wildcards do not match the first level of topics starting with '$'
+    bool wildcards = !(first && len && pLevel[0] == '$');
+
+    for (int16_t child = topicNodes[node].firstChild; child != TOPIC_NONE; child = topicNodes[child].nextSibling)
+    {
+        const topicNode_t* pChild = &topicNodes[child];
+        if (wildcards && pChild->level[0] == '#' && pChild->level[1] == '\0')
+        {
+            // "a/#" matches "a" as well as everything below it
+            topicCollect(child, pMatches);
+        }
+        else if (pLevel && ((wildcards && pChild->level[0] == '+' && pChild->level[1] == '\0')
+                || topicLevelEqual(pChild, pLevel, len)))
+        {
+            topicMatch(child, pNext, pEnd, false, pMatches);
+        }
+    }
+}
+
+int MQTT_TopicDispatch(const char* pTopic, int topicLen, const char* pData, int dataLen, void* pContext)
+{
+    topicMatches_t matches = { .count = 0 };
+    MQTT_TopicMessage_t message = { .pTopic = pTopic, .topicLen = topicLen, .pData = pData, .dataLen = dataLen,
+            .pContext = pContext };
+
+    if (topicLock == NULL)
+    {
+        return 0;
+    }
+    xSemaphoreTake(topicLock, portMAX_DELAY);
+    topicMatch(0, pTopic, pTopic + topicLen, true, &matches);
+    xSemaphoreGive(topicLock);
+    for (int i = 0; i < matches.count; i++)
+    {
+        matches.matches[i].pHandler(&message, matches.matches[i].pArg);
+    }
+    return matches.count;
+}